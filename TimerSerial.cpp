@@ -0,0 +1,326 @@
+#include "TimerSerial.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "WProgram.h"
+#include "pins_arduino.h"
+
+// start, 8 data bits, stop
+#define FRAME_BITS 10
+#define STOP_BIT   (FRAME_BITS - 1)
+
+#define RX_MASK (TIMER_SERIAL_RX_BUFF - 1)
+#define TX_MASK (TIMER_SERIAL_TX_BUFF - 1)
+
+// how far ahead of TCNT1 the first bit of a byte is started; the match
+// mustn't have gone by before OCR1B's written
+#define TX_START_TICKS 4
+
+volatile TimerSerialStats timer_serial_stats;
+
+// timer1 ticks per bit, whole and in 1/256ths
+static uint16_t bit_ticks;
+static uint8_t bit_frac;
+
+// rx_threshold[k] is halfway through bit k, counting from the start bit's
+// falling edge; an edge later than that starts bit k + 1 or later
+static uint16_t rx_threshold[FRAME_BITS];
+
+// {{{ receiver state
+static uint8_t rx_buf[TIMER_SERIAL_RX_BUFF];
+static volatile uint8_t rx_head;
+static volatile uint8_t rx_tail;
+
+static bool rx_busy;      // between a start bit and its stop bit
+static uint16_t rx_start; // ICR1 at the start bit
+static uint8_t rx_bit;    // first bit whose level isn't known yet
+static bool rx_high;      // level since the last edge
+static uint8_t rx_byte;   // shifted in LSB first
+// }}}
+
+// {{{ transmitter state
+static volatile uint8_t *tx_port;
+static uint8_t tx_mask;
+
+static uint8_t tx_buf[TIMER_SERIAL_TX_BUFF];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+
+static volatile bool tx_busy;
+static uint16_t tx_frame;   // bits still to go out, LSB first
+static uint8_t tx_bits_left;
+static uint8_t tx_frac;     // fraction of a tick OCR1B is behind
+// }}}
+
+// {{{ TimerSerial::TimerSerial
+TimerSerial::TimerSerial(uint8_t _transmitPin) :
+    transmitPin(_transmitPin)
+{
+}
+// }}}
+
+// {{{ TimerSerial::begin
+void TimerSerial::begin(long speed) {
+    // ticks per bit in 8.8 fixed point
+    uint32_t bit_fp = (((F_CPU / 8) << 8) + (speed / 2)) / speed;
+
+    bit_ticks = bit_fp >> 8;
+    bit_frac = bit_fp & 0xFF;
+
+    for (uint8_t k = 0; k < FRAME_BITS; k++) {
+        rx_threshold[k] = (((2 * k + 1) * bit_fp / 2) + 0x80) >> 8;
+    }
+
+    // the iPodWrapper relies on the 47k pull-down on the RX pin
+    pinMode(TIMER_SERIAL_RX_PIN, INPUT);
+    digitalWrite(TIMER_SERIAL_RX_PIN, LOW);
+
+    tx_port = portOutputRegister(digitalPinToPort(transmitPin));
+    tx_mask = digitalPinToBitMask(transmitPin);
+
+    digitalWrite(transmitPin, HIGH);
+    pinMode(transmitPin, OUTPUT);
+
+    uint8_t sreg = SREG;
+    cli();
+
+    rx_head = rx_tail = 0;
+    rx_busy = false;
+
+    tx_head = tx_tail = 0;
+    tx_busy = false;
+
+    // normal mode, Fcpu/8, as probe_init() has it; capture on the falling
+    // edge of a start bit.  The noise canceler holds captures back by four
+    // clocks, next to 26us a bit, and a spike shorter than that never gets
+    // as far as the ISR.
+    TCCR1A = 0;
+    TCCR1B = _BV(ICNC1) | _BV(CS11);
+
+    TIFR1 = _BV(ICF1) | _BV(OCF1A) | _BV(OCF1B);
+    TIMSK1 = _BV(ICIE1);
+
+    SREG = sreg;
+}
+// }}}
+
+// {{{ TimerSerial::end
+// the timer keeps running for the probes
+void TimerSerial::end() {
+    uint8_t sreg = SREG;
+    cli();
+
+    TIMSK1 = 0;
+
+    rx_busy = false;
+    tx_busy = false;
+    tx_head = tx_tail = 0;
+
+    if (tx_port != NULL) {
+        *tx_port |= tx_mask;
+    }
+
+    SREG = sreg;
+}
+// }}}
+
+// {{{ rx_fill
+// bits from rx_bit up to, but not including, end were all at rx_high
+static inline void rx_fill(uint8_t end) {
+    for (; rx_bit < end; rx_bit++) {
+        if ((rx_bit > 0) && (rx_bit < STOP_BIT)) {
+            rx_byte >>= 1;
+
+            if (rx_high) {
+                rx_byte |= 0x80;
+            }
+        }
+        else if (rx_bit == STOP_BIT) {
+            rx_busy = false;
+            TIMSK1 &= ~_BV(OCIE1A);
+
+            if (! rx_high) {
+                timer_serial_stats.framing_errors += 1;
+            } else {
+                uint8_t next = (rx_tail + 1) & RX_MASK;
+
+                if (next == rx_head) {
+                    timer_serial_stats.overruns += 1;
+                } else {
+                    rx_buf[rx_tail] = rx_byte;
+                    rx_tail = next;
+                }
+            }
+        }
+    }
+}
+// }}}
+
+// {{{ rx_begin
+static inline void rx_begin(uint16_t t) {
+    rx_busy = true;
+    rx_start = t;
+    rx_bit = 0;
+    rx_high = false;
+
+    // the middle of the stop bit
+    OCR1A = t + rx_threshold[STOP_BIT];
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+}
+// }}}
+
+// {{{ ISR(TIMER1_CAPT_vect)
+ISR(TIMER1_CAPT_vect) {
+    uint16_t t = ICR1;
+
+    // the level on ICP1 rather than the edge ICES1 asked for: if a glitch
+    // came and went before we got here, a capture was lost, and going by
+    // ICES1 every edge after it would be read the wrong way round
+    bool rising = (PINB & _BV(PINB0));
+
+    // the next edge goes the other way; changing ICES1 can set ICF1
+    if (rising) {
+        TCCR1B &= ~_BV(ICES1);
+    } else {
+        TCCR1B |= _BV(ICES1);
+    }
+
+    TIFR1 = _BV(ICF1);
+
+    if (rx_busy) {
+        uint16_t elapsed = t - rx_start;
+        uint8_t end = rx_bit;
+
+        while ((end < FRAME_BITS) && (elapsed > rx_threshold[end])) {
+            end += 1;
+        }
+
+        rx_fill(end);
+
+        if (rx_busy) {
+            rx_high = rising;
+            return;
+        }
+
+        // compare A hadn't got round to the stop bit yet, and this is the
+        // next byte's start bit
+    }
+
+    // a rising edge here is the line going idle after a framing error
+    if (! rising) {
+        rx_begin(t);
+    }
+}
+// }}}
+
+// {{{ ISR(TIMER1_COMPA_vect)
+// the middle of the stop bit; nothing's changed since the last edge
+ISR(TIMER1_COMPA_vect) {
+    if (rx_busy) {
+        rx_fill(FRAME_BITS);
+    }
+
+    TIMSK1 &= ~_BV(OCIE1A);
+}
+// }}}
+
+// {{{ ISR(TIMER1_COMPB_vect)
+ISR(TIMER1_COMPB_vect) {
+    if (tx_bits_left == 0) {
+        // the last stop bit's done
+        if (tx_head == tx_tail) {
+            TIMSK1 &= ~_BV(OCIE1B);
+            tx_busy = false;
+            return;
+        }
+
+        // start bit low, stop bit high
+        tx_frame = (tx_buf[tx_tail] << 1) | _BV(STOP_BIT);
+        tx_tail = (tx_tail + 1) & TX_MASK;
+        tx_bits_left = FRAME_BITS;
+    }
+
+    if (tx_frame & 1) {
+        *tx_port |= tx_mask;
+    } else {
+        *tx_port &= ~tx_mask;
+    }
+
+    tx_frame >>= 1;
+    tx_bits_left -= 1;
+
+    // carry the fraction, so a byte's no more than a tick out at the end
+    uint8_t frac = tx_frac + bit_frac;
+    uint16_t next = OCR1B + bit_ticks + ((frac < tx_frac) ? 1 : 0);
+    tx_frac = frac;
+
+    // held off for more than a bit; this byte's spoilt, but the next
+    // shouldn't have to wait for the timer to wrap
+    if ((int16_t) (next - TCNT1) <= 0) {
+        next = TCNT1 + TX_START_TICKS;
+    }
+
+    OCR1B = next;
+}
+// }}}
+
+// {{{ TimerSerial::write
+void TimerSerial::write(uint8_t b) {
+    uint8_t next = (tx_head + 1) & TX_MASK;
+
+    // compare B frees a slot every character time
+    while (next == tx_tail) {
+        delayMicroseconds(10);
+    }
+
+    tx_buf[tx_head] = b;
+
+    uint8_t sreg = SREG;
+    cli();
+
+    tx_head = next;
+
+    if (! tx_busy) {
+        tx_busy = true;
+        tx_bits_left = 0;
+        tx_frac = 0;
+
+        OCR1B = TCNT1 + TX_START_TICKS;
+        TIFR1 = _BV(OCF1B);
+        TIMSK1 |= _BV(OCIE1B);
+    }
+
+    SREG = sreg;
+}
+// }}}
+
+// {{{ TimerSerial::available / read / peek / flush
+int TimerSerial::available() {
+    return (rx_tail - rx_head) & RX_MASK;
+}
+
+int TimerSerial::read() {
+    if (rx_head == rx_tail) {
+        return -1;
+    }
+
+    uint8_t b = rx_buf[rx_head];
+    rx_head = (rx_head + 1) & RX_MASK;
+
+    return b;
+}
+
+int TimerSerial::peek() {
+    if (rx_head == rx_tail) {
+        return -1;
+    }
+
+    return rx_buf[rx_head];
+}
+
+void TimerSerial::flush() {
+    rx_head = rx_tail;
+}
+// }}}
@@ -0,0 +1,75 @@
+#ifndef TIMER_SERIAL_H
+#define TIMER_SERIAL_H
+
+#include <stdint.h>
+
+#include "Stream.h"
+
+/*
+ * Interrupt-driven async serial (8,N,1) on timer1, for the iPod link.
+ *
+ * Receiving uses the input capture unit, so the RX pin has to be ICP1
+ * (digital pin 8).  The hardware timestamps every edge, and the capture
+ * interrupt only has to work out from the time since the start bit how
+ * many bits went by at the old level and flip the edge select; it has a
+ * bit time to get round to it, where NewSoftSerial's pin change handler
+ * has to sample in the middle of every bit with interrupts off for the
+ * whole byte.  Compare A fires in the middle of the stop bit to finish the
+ * byte off, since trailing ones have no edge.
+ *
+ * Sending uses compare B, which drives the TX pin (any pin) for the bit
+ * that's due and sets the next match a bit time on, so write() only waits
+ * if the transmit buffer's full.
+ *
+ * No ISR takes more than a few µs, so the IBus USART isn't held off for a
+ * character time at a stretch any more.  What this needs in return is that
+ * nothing else holds interrupts off for much more than a bit time at the
+ * baud rate it's run at (26µs at 38400), or bits are missed; the DEBUG
+ * console's bit-banged writes don't manage that.
+ *
+ * Timer1 free-runs at Fcpu/8, as the probes (probe.h) already have it, and
+ * the two share it.  There's only one timer1, so only one of these.
+ */
+
+// ICP1
+#define TIMER_SERIAL_RX_PIN 8
+
+// powers of two
+#define TIMER_SERIAL_RX_BUFF 64
+#define TIMER_SERIAL_TX_BUFF 16
+
+typedef struct __timer_serial_stats {
+    uint16_t overruns;       // received bytes dropped; the buffer was full
+    uint16_t framing_errors; // stop bit wasn't high
+} TimerSerialStats;
+
+extern volatile TimerSerialStats timer_serial_stats;
+
+class TimerSerial : public Stream {
+private:
+    uint8_t transmitPin;
+
+public:
+    TimerSerial(uint8_t transmitPin);
+
+    /*
+     * Takes timer1 over and starts listening.  Anything from 4800 to 57600
+     * works with a 16MHz clock.
+     */
+    void begin(long speed);
+
+    // stops both directions, dropping anything not yet sent
+    void end();
+
+    virtual void write(uint8_t b);
+    using Print::write;
+
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+
+    // discards whatever's been received, as NewSoftSerial does
+    virtual void flush();
+};
+
+#endif /* end of include guard: TIMER_SERIAL_H */
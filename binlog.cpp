@@ -0,0 +1,152 @@
+#include "binlog.h"
+
+#include <string.h>
+
+// records waiting to be sent; empty when head == tail
+static uint8_t ring[BINLOG_RING_LEN];
+static uint8_t ring_head;
+static uint8_t ring_tail;
+
+// records that didn't fit since the last one that did
+static uint8_t dropped;
+
+#define RING_MASK (BINLOG_RING_LEN - 1)
+
+// {{{ ring_free
+static uint8_t ring_free() {
+    // one slot's always left empty, so full and empty can be told apart
+    return RING_MASK - ((ring_head - ring_tail) & RING_MASK);
+}
+// }}}
+
+// {{{ put
+static void put(uint8_t b) {
+    ring[ring_head] = b;
+    ring_head = (ring_head + 1) & RING_MASK;
+}
+// }}}
+
+// {{{ begin_record
+/*
+ * Makes room for a record of len bytes, tag included, and writes the sync
+ * byte.  A dropped count that's owed goes in first.  Returns false if the
+ * record has to be dropped.
+ */
+static bool begin_record(uint8_t len) {
+    uint8_t needed = len + 1;
+
+    if (dropped != 0) {
+        needed += 3;
+    }
+
+    if (ring_free() < needed) {
+        if (dropped < 0xFF) {
+            dropped += 1;
+        }
+
+        return false;
+    }
+
+    if (dropped != 0) {
+        put(BINLOG_SYNC);
+        put(BINLOG_DROPPED);
+        put(dropped);
+
+        dropped = 0;
+    }
+
+    put(BINLOG_SYNC);
+    return true;
+}
+// }}}
+
+// {{{ base_code
+static uint8_t base_code(int base) {
+    switch (base) {
+        case DEC: return BINLOG_BASE_DEC;
+        case HEX: return BINLOG_BASE_HEX;
+        case OCT: return BINLOG_BASE_OCT;
+        case BIN: return BINLOG_BASE_BIN;
+        default:  return BINLOG_BASE_BYTE;
+    }
+}
+// }}}
+
+// {{{ binlog_message
+void binlog_message(PGM_P msg, bool newline) {
+    if (! begin_record(3)) {
+        return;
+    }
+
+    // flash is well under 64K
+    uint16_t addr = (uint16_t) (uintptr_t) msg;
+
+    put(BINLOG_MESSAGE | (newline ? BINLOG_NEWLINE : 0));
+    put((uint8_t) addr);
+    put((uint8_t) (addr >> 8));
+}
+// }}}
+
+// {{{ binlog_value
+void binlog_value(uint8_t type, int base, bool newline, uint32_t value) {
+    uint8_t len;
+
+    switch (type) {
+        case BINLOG_U8:  len = 1; break;
+        case BINLOG_S16:
+        case BINLOG_U16: len = 2; break;
+        case BINLOG_S32:
+        case BINLOG_U32: len = 4; break;
+        default:         len = 0; break;
+    }
+
+    if (! begin_record(len + 1)) {
+        return;
+    }
+
+    put(type | base_code(base) | (newline ? BINLOG_NEWLINE : 0));
+
+    for (uint8_t i = 0; i < len; i++) {
+        put((uint8_t) value);
+        value >>= 8;
+    }
+}
+// }}}
+
+// {{{ binlog_string
+void binlog_string(const char *str, bool newline) {
+    size_t len = strlen(str);
+
+    if (len > BINLOG_MAX_STRING) {
+        len = BINLOG_MAX_STRING;
+    }
+
+    if (! begin_record(len + 2)) {
+        return;
+    }
+
+    put(BINLOG_STRING | (newline ? BINLOG_NEWLINE : 0));
+    put((uint8_t) len);
+
+    for (uint8_t i = 0; i < len; i++) {
+        put(str[i]);
+    }
+}
+// }}}
+
+// {{{ binlog_drain
+void binlog_drain(Print *out) {
+    for (uint8_t i = 0; (i < BINLOG_DRAIN_BYTES) && (ring_tail != ring_head); i++) {
+        out->write(ring[ring_tail]);
+        ring_tail = (ring_tail + 1) & RING_MASK;
+    }
+}
+// }}}
+
+// {{{ binlog_flush
+void binlog_flush(Print *out) {
+    while (ring_tail != ring_head) {
+        binlog_drain(out);
+    }
+}
+// }}}
@@ -0,0 +1,100 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "Print.h"
+
+/*
+ * Deferred binary logging, behind the DEBUG_* macros in pgm_util.h.
+ *
+ * Printing to the console means bit-banging every character through
+ * SoftwareSerial with interrupts off, which changes the timing enough to
+ * hide bugs.  Instead, each DEBUG_* call appends a compact record to a RAM
+ * ring: a message is just the flash address of its PSTR() string, a number
+ * is its raw bytes.  binlog_drain() sends a few bytes at a time from
+ * loop() when nothing else is waiting, and util/binlog_expand.py turns the
+ * stream back into text using the strings in the firmware's .hex file.
+ *
+ * On the wire every record starts with BINLOG_SYNC (which never turns up in
+ * text, so anything printed straight to the console still comes through)
+ * and a tag:
+ *
+ *   bits 0-3  type; what follows the tag
+ *   bits 4-6  base for numbers; BINLOG_BASE_*
+ *   bit 7     newline after this one
+ *
+ * Records that don't fit in the ring are dropped and counted, and the count
+ * is sent as a record of its own once there's room.  Not for use from
+ * interrupt handlers.
+ */
+
+// must be a power of 2
+#define BINLOG_RING_LEN 64
+
+// bytes sent per binlog_drain(); each one has interrupts off for a
+// character time at the console's baud rate
+#define BINLOG_DRAIN_BYTES 4
+
+#define BINLOG_SYNC 0x00
+
+// record types
+#define BINLOG_NONE    0x00 // nothing; just the newline
+#define BINLOG_MESSAGE 0x01 // 16-bit flash address of a string, LSB first
+#define BINLOG_U8      0x02 // values, LSB first
+#define BINLOG_S16     0x03
+#define BINLOG_U16     0x04
+#define BINLOG_S32     0x05
+#define BINLOG_U32     0x06
+#define BINLOG_STRING  0x07 // length, then that many chars (truncated)
+#define BINLOG_DROPPED 0x08 // records dropped since the last one that fit
+
+#define BINLOG_TYPE_MASK 0x0F
+#define BINLOG_NEWLINE   0x80
+
+// bases, as Print's BYTE, DEC, HEX, OCT and BIN
+#define BINLOG_BASE_BYTE 0x00
+#define BINLOG_BASE_DEC  0x10
+#define BINLOG_BASE_HEX  0x20
+#define BINLOG_BASE_OCT  0x30
+#define BINLOG_BASE_BIN  0x40
+#define BINLOG_BASE_MASK 0x70
+
+// longest string argument kept
+#define BINLOG_MAX_STRING 24
+
+void binlog_message(PGM_P msg, bool newline);
+void binlog_value(uint8_t type, int base, bool newline, uint32_t value);
+void binlog_string(const char *str, bool newline);
+
+/*
+ * Sends up to BINLOG_DRAIN_BYTES bytes of queued records.
+ */
+void binlog_drain(Print *out);
+
+/*
+ * Sends everything that's queued; blocks.
+ */
+void binlog_flush(Print *out);
+
+// {{{ binlog_print / binlog_println
+// the same overloads and default bases as Print
+inline void binlog_print(const char *s) { binlog_string(s, false); }
+inline void binlog_print(char c, int base = BYTE) { binlog_value(BINLOG_U8, base, false, (uint8_t) c); }
+inline void binlog_print(unsigned char b, int base = BYTE) { binlog_value(BINLOG_U8, base, false, b); }
+inline void binlog_print(int n, int base = DEC) { binlog_value(BINLOG_S16, base, false, (uint32_t) (int32_t) n); }
+inline void binlog_print(unsigned int n, int base = DEC) { binlog_value(BINLOG_U16, base, false, n); }
+inline void binlog_print(long n, int base = DEC) { binlog_value(BINLOG_S32, base, false, (uint32_t) n); }
+inline void binlog_print(unsigned long n, int base = DEC) { binlog_value(BINLOG_U32, base, false, n); }
+
+inline void binlog_println() { binlog_value(BINLOG_NONE, BYTE, true, 0); }
+inline void binlog_println(const char *s) { binlog_string(s, true); }
+inline void binlog_println(char c, int base = BYTE) { binlog_value(BINLOG_U8, base, true, (uint8_t) c); }
+inline void binlog_println(unsigned char b, int base = BYTE) { binlog_value(BINLOG_U8, base, true, b); }
+inline void binlog_println(int n, int base = DEC) { binlog_value(BINLOG_S16, base, true, (uint32_t) (int32_t) n); }
+inline void binlog_println(unsigned int n, int base = DEC) { binlog_value(BINLOG_U16, base, true, n); }
+inline void binlog_println(long n, int base = DEC) { binlog_value(BINLOG_S32, base, true, (uint32_t) n); }
+inline void binlog_println(unsigned long n, int base = DEC) { binlog_value(BINLOG_U32, base, true, n); }
+// }}}
+
+#endif /* end of include guard: BINLOG_H */
@@ -0,0 +1,98 @@
+#include "display_cache.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "ibus_serial.h"
+
+typedef struct __display_slot {
+    uint16_t crc;
+    uint8_t len;    // 0 if nothing's known to be showing
+} DisplaySlot;
+
+static DisplaySlot slots[DISPLAY_SLOT_COUNT];
+
+// ibus_tx_stats.dropped + failed when the slots were last known good
+static uint16_t tx_losses;
+
+// {{{ current_tx_losses
+static uint16_t current_tx_losses() {
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t losses = ibus_tx_stats.dropped + ibus_tx_stats.failed;
+
+    SREG = sreg;
+    return losses;
+}
+// }}}
+
+// {{{ frame_crc
+// CRC-16-CCITT; a plain XOR would miss characters that swap places
+static uint16_t frame_crc(const uint8_t *frame, uint8_t len) {
+    uint16_t crc = 0xFFFF;
+
+    for (uint8_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) frame[i] << 8;
+
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+// }}}
+
+// {{{ display_cache_slot
+uint8_t display_cache_slot(const uint8_t *frame) {
+    if (frame[PKT_CMD] != 0x3E) {
+        return DISPLAY_SLOT_NONE;
+    }
+
+    // the high nibble's the scanning flag
+    uint8_t kind = frame[PKT_CMD + 1] & 0x0F;
+
+    if (kind == 0x02) {
+        return DISPLAY_SLOT_STATUS;
+    }
+
+    if ((kind == 0x01) && (frame[PKT_CMD + 2] == 0x00)) {
+        return DISPLAY_SLOT_CHANNEL_TEXT;
+    }
+
+    return DISPLAY_SLOT_NONE;
+}
+// }}}
+
+// {{{ display_cache_matches
+bool display_cache_matches(uint8_t slot, const uint8_t *frame, uint8_t len) {
+    if (current_tx_losses() != tx_losses) {
+        display_cache_invalidate();
+        return false;
+    }
+
+    return (slots[slot].len == len) && (slots[slot].crc == frame_crc(frame, len));
+}
+// }}}
+
+// {{{ display_cache_store
+void display_cache_store(uint8_t slot, const uint8_t *frame, uint8_t len) {
+    if (current_tx_losses() != tx_losses) {
+        display_cache_invalidate();
+    }
+
+    slots[slot].crc = frame_crc(frame, len);
+    slots[slot].len = len;
+}
+// }}}
+
+// {{{ display_cache_invalidate
+void display_cache_invalidate() {
+    for (uint8_t i = 0; i < DISPLAY_SLOT_COUNT; i++) {
+        slots[i].len = 0;
+    }
+
+    tx_losses = current_tx_losses();
+}
+// }}}
@@ -0,0 +1,45 @@
+#ifndef DISPLAY_CACHE_H
+#define DISPLAY_CACHE_H
+
+#include <stdint.h>
+
+/*
+ * What the radio's showing in each of its display slots, so a refresh that
+ * would send exactly the same frame again can be skipped.
+ *
+ * A slot holds a CRC of the last frame sent to it (src through checksum),
+ * not the frame itself, which would cost up to 32 bytes of RAM apiece.  A
+ * frame only counts once it's been queued, and the whole cache is thrown
+ * away if any outgoing frame has been dropped or given up on since then,
+ * since it might have been the one the radio needed.  Throw it away too
+ * whenever the radio might have redrawn the display on its own.
+ */
+
+/*
+ * The artist and album (3E 01 06 and 07) aren't cached: they're only sent
+ * when the radio asks for them, and then it's waiting for an answer.
+ */
+#define DISPLAY_SLOT_STATUS       0 // 3E 02
+#define DISPLAY_SLOT_CHANNEL_TEXT 1 // 3E 01 00
+#define DISPLAY_SLOT_COUNT        2
+
+#define DISPLAY_SLOT_NONE 0xFF
+
+/*
+ * Returns the slot a frame from the SDRS updates, or DISPLAY_SLOT_NONE.
+ */
+uint8_t display_cache_slot(const uint8_t *frame);
+
+/*
+ * Returns true if the frame's the same as the last one sent to its slot.
+ */
+bool display_cache_matches(uint8_t slot, const uint8_t *frame, uint8_t len);
+
+/*
+ * Records the frame as the one the slot's showing, once it's been queued.
+ */
+void display_cache_store(uint8_t slot, const uint8_t *frame, uint8_t len);
+
+void display_cache_invalidate();
+
+#endif /* end of include guard: DISPLAY_CACHE_H */
@@ -0,0 +1,311 @@
+/*
+    How long the iPodWrapper takes from the iPod being plugged in to having
+    the current track's title, attaching the usual way (simple mode first,
+    then advanced mode on a later update) and directly (advanced mode
+    straight away, as after a reset when the iPod was in advanced mode), on
+    the TimerSerial link against the simulated iPod in hal/.
+
+        attach_bench [-v] [-r runs] [-l loop_us]
+
+    Each iPod is plugged in runs times (default 10) per way of attaching,
+    at a different point in the wrapper's IPOD_UPDATE_INTERVAL each time,
+    and unplugged again once the title's in.  The iPods:
+
+      • awake: answers in 20ms
+      • slow: answers in 150ms, later than the first direct probe times out
+      • waking: misses everything in the first 250ms
+      • asleep: misses everything in the first 1.5s
+      • stuck: answers in 20ms, but only goes into advanced mode once it's
+        been told to switch to simple mode, so attaching directly has to
+        give up on the probes and go through simple mode
+      • busy: stuck, with loop() held up for 40ms once, at a different
+        point in the first second each time, as when the rest of the
+        sketch is busy; that can bring the switch back to simple mode right
+        up against the next update
+
+    Reported for each: the mean and worst time to the title, and the mode
+    switches the iPod saw and the packets it missed per attach.
+
+    Exits non-zero if any attach never got the title, if attaching directly
+    was slower on average than the usual way by more than the probes can
+    take, or if it wasn't faster for the iPods that are awake.  -v prints
+    every attach.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WProgram.h"
+#include "sim.h"
+#include "sim_ipod.h"
+
+#include "../iPodWrapper.h"
+#include "../TimerSerial.h"
+
+// from the sketch
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+#define IPOD_BAUD   38400
+
+// an attach that's taken this long isn't going to work
+#define ATTACH_TIMEOUT_MS 10000UL
+
+// left for the wrapper to notice the iPod's gone before the next attach
+#define UNPLUG_TIMEOUT_MS 5000UL
+
+// the most attaching directly can lose when the probes go unanswered
+#define PROBE_BUDGET_MS \
+    (IPOD_ATTACH_PROBE_TIMEOUT * ((1UL << IPOD_ATTACH_PROBES) - 1))
+
+#define CYCLES_TO_MS(_c) ((double) (_c) / SIM_CYCLES_PER_MS)
+
+typedef struct __scenario {
+    const char *name;
+    unsigned long response_ms;
+    unsigned long wake_ms;
+    bool needs_simple;
+    unsigned long busy_ms;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    { "awake",  20,  0,    false, 0  },
+    { "slow",   150, 0,    false, 0  },
+    { "waking", 20,  250,  false, 0  },
+    { "asleep", 20,  1500, false, 0  },
+    { "stuck",  20,  0,    true,  0  },
+    { "busy",   20,  0,    true,  40 },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct __attach_result {
+    double mean_ms;
+    double worst_ms;
+    double mode_switches;
+    double slept_through;
+    unsigned long failures;
+} AttachResult;
+
+static bool verbose = false;
+static uint64_t loop_cycles;
+
+TimerSerial iPodSerialPort(IPOD_TX_PIN);
+IPodWrapper iPodWrapper;
+
+// {{{ run_for
+// update() over and over, as loop() does, until done() or timeout_ms;
+// returns false on the timeout
+static bool run_for(unsigned long timeout_ms, bool (*done)()) {
+    uint64_t until = sim_now() + ((uint64_t) timeout_ms * SIM_CYCLES_PER_MS);
+
+    while (sim_now() < until) {
+        sim_ipod_update();
+        scheduler_run();
+        iPodWrapper.update();
+
+        if (done()) {
+            return true;
+        }
+
+        sim_advance(loop_cycles);
+    }
+
+    return false;
+}
+// }}}
+
+// {{{ have_title / gone
+static bool have_title() {
+    return (iPodWrapper.getTitle()[0] != '\0');
+}
+
+static bool gone() {
+    return ! iPodWrapper.isPresent();
+}
+// }}}
+
+// {{{ attach
+// plugs the iPod in, offset_ms into a wait, and times how long it takes to
+// get the title, with loop() held up for busy_ms at busy_at_ms after
+// plugging in; returns -1 if it never does
+static double attach(
+    bool direct,
+    unsigned long offset_ms,
+    unsigned long busy_at_ms,
+    unsigned long busy_ms
+) {
+    // the usual way's only taken until advanced mode's been used
+    iPodWrapper.setSimple();
+    iPodWrapper.setAdvanced(direct);
+
+    sim_advance((uint64_t) offset_ms * SIM_CYCLES_PER_MS);
+
+    uint64_t plugged_at = sim_now();
+    sim_ipod_connect(IPOD_RX_PIN, IPOD_TX_PIN);
+
+    bool ok = run_for(busy_at_ms, have_title);
+
+    if (! ok) {
+        sim_advance((uint64_t) busy_ms * SIM_CYCLES_PER_MS);
+        ok = run_for(ATTACH_TIMEOUT_MS - busy_at_ms - busy_ms, have_title);
+    }
+
+    double ms = CYCLES_TO_MS(sim_now() - plugged_at);
+
+    sim_ipod_disconnect();
+
+    if (! run_for(UNPLUG_TIMEOUT_MS, gone)) {
+        fprintf(stderr, "the wrapper never noticed the iPod had gone\n");
+        exit(1);
+    }
+
+    return ok ? ms : -1.0;
+}
+// }}}
+
+// {{{ run_scenario
+static AttachResult run_scenario(const Scenario *scenario, bool direct, int runs) {
+    AttachResult r;
+    memset(&r, 0, sizeof(r));
+
+    sim_ipod_set_response_delay((uint64_t) scenario->response_ms * SIM_CYCLES_PER_MS);
+    sim_ipod_set_wake_delay((uint64_t) scenario->wake_ms * SIM_CYCLES_PER_MS);
+    sim_ipod_set_needs_simple(scenario->needs_simple);
+
+    int good = 0;
+
+    for (int run = 0; run < runs; run++) {
+        unsigned long offset_ms = (run * IPOD_UPDATE_INTERVAL) / runs;
+        unsigned long busy_at_ms = (run * 1000UL) / runs;
+        double ms = attach(direct, offset_ms, busy_at_ms, scenario->busy_ms);
+        const SimIPodStats *s = sim_ipod_stats();
+
+        if (verbose) {
+            printf("  %-7s %-10s +%3lums  %s%8.1f ms, %lu mode switches, %lu missed\n",
+                   scenario->name, direct ? "direct" : "via simple", offset_ms,
+                   (ms < 0) ? "never" : "", (ms < 0) ? 0.0 : ms,
+                   s->mode_switches, s->slept_through);
+        }
+
+        r.mode_switches += s->mode_switches;
+        r.slept_through += s->slept_through;
+
+        if (ms < 0) {
+            r.failures += 1;
+            continue;
+        }
+
+        good += 1;
+        r.mean_ms += ms;
+
+        if (ms > r.worst_ms) {
+            r.worst_ms = ms;
+        }
+    }
+
+    if (good > 0) {
+        r.mean_ms /= good;
+    }
+
+    r.mode_switches /= runs;
+    r.slept_through /= runs;
+
+    return r;
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    int runs = 10;
+    unsigned long loop_us = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vr:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'r':
+                runs = atoi(optarg);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-r runs] [-l loop_us]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    init();
+
+    // unplugged; the 47k pull-down holds the pin low
+    sim_pin_set(IPOD_RX_PIN, LOW);
+
+    iPodSerialPort.begin(IPOD_BAUD);
+    sim_ipod_set_baud(IPOD_BAUD);
+
+    iPodWrapper.init(&iPodSerialPort, IPOD_RX_PIN);
+
+    printf("%-8s %-8s %-10s %9s %9s %9s %9s\n",
+           "iPod", "answers", "attach", "mean ms", "worst ms", "switches", "missed");
+
+    bool ok = true;
+
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        const Scenario *scenario = &scenarios[i];
+        AttachResult result[2];
+
+        for (int direct = 0; direct < 2; direct++) {
+            AttachResult *r = &result[direct];
+            *r = run_scenario(scenario, direct, runs);
+
+            char answers[16];
+            snprintf(answers, sizeof(answers), "%lums", scenario->response_ms);
+
+            printf("%-8s %-8s %-10s %9.1f %9.1f %9.1f %9.1f",
+                   direct ? "" : scenario->name,
+                   direct ? "" : answers,
+                   direct ? "direct" : "via simple",
+                   r->mean_ms, r->worst_ms, r->mode_switches, r->slept_through);
+
+            if (r->failures != 0) {
+                printf("  %lu never got the title", r->failures);
+                ok = false;
+            }
+
+            printf("\n");
+        }
+
+        if (result[1].mean_ms > (result[0].mean_ms + PROBE_BUDGET_MS)) {
+            printf("FAIL: attaching directly to the %s iPod took longer than the probes can\n", scenario->name);
+            ok = false;
+        }
+
+        if (
+            (scenario->wake_ms == 0) && (! scenario->needs_simple) &&
+            (result[1].mean_ms >= result[0].mean_ms)
+        ) {
+            printf("FAIL: attaching directly to the %s iPod wasn't any faster\n", scenario->name);
+            ok = false;
+        }
+    }
+
+    printf("(%d attaches each; direct attach gives up after %d probes, %lu ms)\n",
+           runs, IPOD_ATTACH_PROBES, PROBE_BUDGET_MS);
+
+    return ok ? 0 : 1;
+}
+// }}}
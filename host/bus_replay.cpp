@@ -0,0 +1,707 @@
+/*
+    Replays real bus captures through the firmware, running on the host
+    against the simulated peripherals in hal/, and measures how quickly it
+    answers the radio.
+
+        bus_replay [-v] [-n] [-l loop_us] [-i ipod_ms] [-s max_idle_s]
+                   [-r parsed_log.txt] capture.ibc...
+
+    Captures are made from NavCoder logs by util/navcoder_capture.py.  Every
+    frame in them is put on the simulated IBus at 9600,8,E,1, timed to end
+    when NavCoder logged it, except the ones the real SDRS sent: the
+    firmware's standing in for it.  Since the radio's side is replayed as it
+    was, a slow answer doesn't make it poll again, but the polls it did
+    repeat in the car are there.
+
+    For each command from the radio to the SDRS, the time from the end of
+    the command on the wire to the end of the first reply that can answer
+    it (02 for 01, 3E for 3D) is recorded, per command.  A command that's
+    repeated before it's answered, or isn't answered within a second, has
+    no reply.  With -r, the same is worked out from the car's own SDRS in
+    the parsed log from doc/logs and shown alongside; NavCoder's timestamps
+    come from the Windows tick, so those are only good to about 16ms.
+
+    Also reported: frames garbled on the wire (collisions and line errors,
+    ours and the radio's), and frames the driver had to drop.
+
+    -v prints every frame on the wire, -n leaves the iPod unplugged, -l
+    sets the virtual time taken by one loop() pass (default 100µs), -i the
+    simulated iPod's response time (default 20ms), and -s shortens stretches
+    of silence longer than max_idle_s (the bus was asleep) to that.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WProgram.h"
+#include "sim.h"
+#include "sim_ipod.h"
+
+#include "../ibus_serial.h"
+
+// from the sketch
+#define INH_PIN     2
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+#define IPOD_BAUD   38400
+
+#define CAPTURE_MAGIC "IBC1"
+
+#define BYTE_CYCLES (11 * SIM_IBUS_BIT_CYCLES)
+
+// a pause this long on the wire ends one of our frames
+#define SENT_FRAME_GAP_CYCLES (2 * BYTE_CYCLES)
+
+// a command that's gone this long without a reply never got one
+#define REPLY_TIMEOUT_MS 1000.0
+
+// left running this long after the last frame, for replies
+#define DRAIN_MS 2000
+
+// latency histogram buckets: under 2ms, under 4ms, ... and the rest
+#define HISTOGRAM_BUCKETS 8
+
+static bool verbose = false;
+
+// {{{ CaptureRecord
+struct CaptureRecord {
+    unsigned long ms;         // since the start of the capture
+    bool garbage;
+    std::vector<uint8_t> bytes;
+};
+// }}}
+
+// {{{ load_capture
+static bool load_capture(const char *path, std::vector<CaptureRecord> &records) {
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char magic[4];
+
+    if ((fread(magic, 1, sizeof(magic), f) != sizeof(magic)) ||
+        (memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0))
+    {
+        fprintf(stderr, "%s: not a capture\n", path);
+        fclose(f);
+        return false;
+    }
+
+    unsigned long ms = 0;
+
+    for (;;) {
+        unsigned long v = 0;
+        int shift = 0;
+        int c;
+
+        while (((c = fgetc(f)) != EOF) && (c & 0x80)) {
+            v |= (unsigned long) (c & 0x7F) << shift;
+            shift += 7;
+        }
+
+        if (c == EOF) {
+            break;
+        }
+
+        v |= (unsigned long) c << shift;
+
+        int len = fgetc(f);
+
+        if (len == EOF) {
+            break;
+        }
+
+        CaptureRecord rec;
+
+        ms += (v >> 1);
+        rec.ms = ms;
+        rec.garbage = (v & 1);
+        rec.bytes.resize(len);
+
+        if (fread(&rec.bytes[0], 1, len, f) != (size_t) len) {
+            break;
+        }
+
+        records.push_back(rec);
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ Latencies
+struct Latencies {
+    std::vector<double> ms;
+    unsigned long no_reply;
+
+    Latencies() : no_reply(0) {}
+
+    double percentile(double p) {
+        if (ms.empty()) {
+            return 0.0;
+        }
+
+        std::sort(ms.begin(), ms.end());
+
+        size_t i = (size_t) (p * (ms.size() - 1) + 0.5);
+        return ms[i];
+    }
+
+    unsigned long bucket(int b) const {
+        unsigned long n = 0;
+
+        for (size_t i = 0; i < ms.size(); i++) {
+            int bk = 0;
+
+            while ((bk < (HISTOGRAM_BUCKETS - 1)) && (ms[i] >= (double) (2 << bk))) {
+                bk += 1;
+            }
+
+            if (bk == b) {
+                n += 1;
+            }
+        }
+
+        return n;
+    }
+};
+// }}}
+
+// {{{ LatencyTracker
+/*
+ * Pairs commands from the radio with the SDRS's replies.
+ */
+class LatencyTracker {
+private:
+    struct Pending {
+        std::string key;
+        uint8_t reply_cmd;
+        double ms;
+    };
+
+    std::deque<Pending> pending;
+
+    void expire(double now_ms) {
+        while ((! pending.empty()) && ((now_ms - pending.front().ms) > REPLY_TIMEOUT_MS)) {
+            commands[pending.front().key].no_reply += 1;
+            pending.pop_front();
+        }
+    }
+
+public:
+    std::map<std::string, Latencies> commands;
+    unsigned long unsolicited;
+
+    LatencyTracker() : unsolicited(0) {}
+
+    // cmd points at the command byte; len is what's left before the checksum
+    void command(double now_ms, const uint8_t *cmd, size_t len) {
+        char key[8];
+
+        expire(now_ms);
+
+        if ((cmd[0] == 0x3D) && (len > 1)) {
+            snprintf(key, sizeof(key), "3D %02X", cmd[1]);
+        } else {
+            snprintf(key, sizeof(key), "%02X", cmd[0]);
+        }
+
+        // asked again before it was answered
+        for (std::deque<Pending>::iterator it = pending.begin(); it != pending.end(); ++it) {
+            if (it->key == key) {
+                commands[it->key].no_reply += 1;
+                pending.erase(it);
+                break;
+            }
+        }
+
+        Pending p;
+        p.key = key;
+        p.reply_cmd = (cmd[0] == 0x01) ? 0x02 : ((cmd[0] == 0x3D) ? 0x3E : 0);
+        p.ms = now_ms;
+
+        pending.push_back(p);
+        commands[p.key];
+    }
+
+    void reply(double now_ms, uint8_t cmd) {
+        expire(now_ms);
+
+        for (std::deque<Pending>::iterator it = pending.begin(); it != pending.end(); ++it) {
+            if ((it->reply_cmd == 0) || (it->reply_cmd == cmd)) {
+                commands[it->key].ms.push_back(now_ms - it->ms);
+                pending.erase(it);
+                return;
+            }
+        }
+
+        unsolicited += 1;
+    }
+
+    void finish() {
+        expire(1e30);
+    }
+};
+// }}}
+
+// {{{ load_parsed_log
+/*
+ * Lines look like
+ *    16ms:  SDRS --> RAD : <02 00    > [??] Device status ready
+ * with the time since the previous line.
+ */
+static bool load_parsed_log(const char *path, LatencyTracker &tracker) {
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[1024];
+    double now_ms = 0.0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *end;
+        unsigned long delta = strtoul(line, &end, 10);
+
+        if ((end == line) || (strncmp(end, "ms:", 3) != 0)) {
+            continue;
+        }
+
+        now_ms += delta;
+
+        char src[8];
+        char dest[8];
+        char *payload = strchr(line, '<');
+
+        if ((payload == NULL) || (sscanf(end + 3, " %7s --> %7[^ :]", src, dest) != 2)) {
+            continue;
+        }
+
+        uint8_t data[64];
+        size_t len = 0;
+        char *p = payload + 1;
+
+        for (;;) {
+            long v = strtol(p, &end, 16);
+
+            if ((end == p) || (len == sizeof(data))) {
+                break;
+            }
+
+            data[len++] = (uint8_t) v;
+            p = end;
+        }
+
+        if (len == 0) {
+            continue;
+        }
+
+        if ((strcmp(src, "RAD") == 0) && (strcmp(dest, "SDRS") == 0)) {
+            tracker.command(now_ms, data, len);
+        } else if ((strcmp(src, "SDRS") == 0) && (strcmp(dest, "RAD") == 0)) {
+            tracker.reply(now_ms, data[0]);
+        }
+    }
+
+    fclose(f);
+    tracker.finish();
+
+    return true;
+}
+// }}}
+
+// {{{ wire
+/*
+ * Frames are put back together from the bytes on the wire: the radio's by
+ * counting them off against what was replayed, ours by their length byte
+ * (or a gap, if a collision cut one short).
+ */
+struct ReplayedFrame {
+    std::vector<uint8_t> bytes;
+    size_t seen;
+    bool garbled;
+};
+
+static std::deque<ReplayedFrame> replayed;
+
+static std::vector<uint8_t> sent_frame;
+static bool sent_garbled;
+static uint64_t sent_frame_last;
+
+static LatencyTracker replay_latency;
+
+static unsigned long radio_frames;
+static unsigned long radio_garbled;
+static unsigned long sent_frames;
+static unsigned long sent_garbled_frames;
+
+static double cycles_to_ms(uint64_t cycles) {
+    return (double) cycles / SIM_CYCLES_PER_MS;
+}
+
+static void print_frame(uint64_t when, const char *who, const std::vector<uint8_t> &bytes, bool garbled) {
+    printf("%12.3f ms  %s", cycles_to_ms(when), who);
+
+    for (size_t i = 0; i < bytes.size(); i++) {
+        printf(" %02X", bytes[i]);
+    }
+
+    printf("%s\n", garbled ? "  (garbled)" : "");
+}
+
+static void flush_sent_frame() {
+    if (sent_frame.empty()) {
+        return;
+    }
+
+    bool complete = (sent_frame.size() >= 2) && (sent_frame.size() == (size_t) (sent_frame[PKT_LEN] + 2));
+
+    if (sent_garbled || ! complete) {
+        sent_garbled_frames += 1;
+    } else {
+        sent_frames += 1;
+
+        if ((sent_frame[PKT_DEST] == RAD_ADDR) && (sent_frame.size() > PKT_CMD)) {
+            replay_latency.reply(cycles_to_ms(sent_frame_last), sent_frame[PKT_CMD]);
+        }
+    }
+
+    if (verbose) {
+        print_frame(sent_frame_last, "TX", sent_frame, sent_garbled || ! complete);
+    }
+
+    sent_frame.clear();
+    sent_garbled = false;
+}
+
+static void radio_byte(uint64_t when, bool garbled) {
+    if (replayed.empty()) {
+        return;
+    }
+
+    ReplayedFrame &rf = replayed.front();
+
+    rf.seen += 1;
+    rf.garbled |= garbled;
+
+    if (rf.seen < rf.bytes.size()) {
+        return;
+    }
+
+    radio_frames += 1;
+
+    if (rf.garbled) {
+        radio_garbled += 1;
+    } else if ((rf.bytes[PKT_SRC] == RAD_ADDR) && (rf.bytes[PKT_DEST] == SDRS_ADDR)) {
+        replay_latency.command(cycles_to_ms(when), &rf.bytes[PKT_CMD], rf.bytes.size() - PKT_CMD - 1);
+    }
+
+    if (verbose) {
+        print_frame(when, "RX", rf.bytes, rf.garbled);
+    }
+
+    replayed.pop_front();
+}
+
+static void ibus_observer(uint64_t when, uint8_t b, uint8_t sources, uint8_t status) {
+    bool garbled = (sources == (SIM_IBUS_US | SIM_IBUS_OTHER)) || (status != 0);
+
+    if (sources & SIM_IBUS_OTHER) {
+        radio_byte(when, garbled);
+    }
+
+    if (sources & SIM_IBUS_US) {
+        if ((! sent_frame.empty()) && ((when - sent_frame_last) > SENT_FRAME_GAP_CYCLES)) {
+            flush_sent_frame();
+        }
+
+        sent_frame.push_back(b);
+        sent_frame_last = when;
+        sent_garbled |= garbled;
+
+        if ((sent_frame.size() >= 2) && (sent_frame.size() == (size_t) (sent_frame[PKT_LEN] + 2))) {
+            flush_sent_frame();
+        }
+    }
+}
+// }}}
+
+// {{{ run_loop
+static void run_loop(uint64_t loop_cycles) {
+    loop();
+    sim_ipod_update();
+    sim_advance(loop_cycles);
+
+    // our last frame stopped short
+    if ((! sent_frame.empty()) && ((sim_now() - sent_frame_last) > SENT_FRAME_GAP_CYCLES)) {
+        flush_sent_frame();
+    }
+}
+// }}}
+
+// {{{ print_report
+static const char *command_name(const std::string &key) {
+    static const char *const names[][2] = {
+        { "01",    "device status request" },
+        { "3D 01", "power/mode" },
+        { "3D 02", "status update ('now')" },
+        { "3D 03", "channel up" },
+        { "3D 04", "channel down" },
+        { "3D 05", "hold channel up" },
+        { "3D 06", "hold channel down" },
+        { "3D 07", "hold M" },
+        { "3D 08", "recall preset" },
+        { "3D 09", "set preset" },
+        { "3D 0E", "inf, 1st press" },
+        { "3D 0F", "inf, 2nd press" },
+        { "3D 14", "hold SAT (ESN)" },
+        { "3D 15", "SAT" },
+    };
+
+    for (size_t i = 0; i < (sizeof(names) / sizeof(names[0])); i++) {
+        if (key == names[i][0]) {
+            return names[i][1];
+        }
+    }
+
+    return "";
+}
+
+static void print_latency_row(const char *label, Latencies &l) {
+    printf("  %-8s %6lu %7.1f %7.1f %7.1f %7.1f %8lu  |",
+           label, (unsigned long) l.ms.size(),
+           l.percentile(0.0), l.percentile(0.5), l.percentile(0.9), l.percentile(1.0),
+           l.no_reply);
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        printf(" %5lu", l.bucket(b));
+    }
+
+    printf("\n");
+}
+
+static void print_report(LatencyTracker *car) {
+    printf("reply latency in ms, end of command to end of reply\n\n");
+    printf("  %-8s %6s %7s %7s %7s %7s %8s  |", "", "n", "min", "median", "p90", "max", "no reply");
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        char bucket[8];
+
+        if (b < (HISTOGRAM_BUCKETS - 1)) {
+            snprintf(bucket, sizeof(bucket), "<%d", 2 << b);
+        } else {
+            snprintf(bucket, sizeof(bucket), ">=%d", 1 << b);
+        }
+
+        printf(" %5s", bucket);
+    }
+
+    printf("\n");
+
+    // every command either side saw
+    std::map<std::string, Latencies> &mine = replay_latency.commands;
+    std::vector<std::string> keys;
+
+    for (std::map<std::string, Latencies>::iterator it = mine.begin(); it != mine.end(); ++it) {
+        keys.push_back(it->first);
+    }
+
+    if (car != NULL) {
+        for (std::map<std::string, Latencies>::iterator it = car->commands.begin(); it != car->commands.end(); ++it) {
+            if (mine.find(it->first) == mine.end()) {
+                keys.push_back(it->first);
+            }
+        }
+
+        std::sort(keys.begin(), keys.end());
+    }
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        printf("%-5s %s\n", keys[i].c_str(), command_name(keys[i]));
+        print_latency_row("replay", mine[keys[i]]);
+
+        if (car != NULL) {
+            print_latency_row("car", car->commands[keys[i]]);
+        }
+    }
+
+    printf("\nunsolicited frames to the radio: %lu replay", replay_latency.unsolicited);
+
+    if (car != NULL) {
+        printf(", %lu car", car->unsolicited);
+    }
+
+    printf("\n");
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    unsigned long loop_us = 100;
+    unsigned long ipod_ms = 20;
+    unsigned long max_idle_s = 0;
+    const char *parsed_log = NULL;
+    bool ipod = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vnl:i:s:r:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'n':
+                ipod = false;
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'i':
+                ipod_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 's':
+                max_idle_s = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'r':
+                parsed_log = optarg;
+                break;
+
+            default:
+                fprintf(stderr,
+                        "usage: %s [-v] [-n] [-l loop_us] [-i ipod_ms] [-s max_idle_s] "
+                        "[-r parsed_log.txt] capture.ibc...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    LatencyTracker car;
+
+    if ((parsed_log != NULL) && ! load_parsed_log(parsed_log, car)) {
+        return 2;
+    }
+
+    uint64_t loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    sim_set_ibus_observer(ibus_observer);
+
+    // bus awake
+    sim_pin_set(INH_PIN, HIGH);
+    sim_pin_set(IPOD_RX_PIN, LOW);
+
+    if (ipod) {
+        sim_ipod_set_response_delay((uint64_t) ipod_ms * SIM_CYCLES_PER_MS);
+        sim_ipod_set_baud(IPOD_BAUD);
+        sim_ipod_connect(IPOD_RX_PIN, IPOD_TX_PIN);
+    }
+
+    init();
+    setup();
+
+    unsigned long skipped = 0;
+    unsigned long played = 0;
+    unsigned long garbage = 0;
+
+    for (int i = optind; i < argc; i++) {
+        std::vector<CaptureRecord> records;
+
+        if (! load_capture(argv[i], records)) {
+            return 2;
+        }
+
+        // each capture starts a second after the previous one's done
+        uint64_t origin = sim_now() + (1000 * SIM_CYCLES_PER_MS);
+        unsigned long cut_ms = 0;
+
+        for (size_t r = 0; r < records.size(); r++) {
+            const CaptureRecord &rec = records[r];
+
+            if ((max_idle_s != 0) && (r > 0) && ((rec.ms - records[r - 1].ms) > (max_idle_s * 1000))) {
+                cut_ms += (rec.ms - records[r - 1].ms) - (max_idle_s * 1000);
+            }
+
+            if ((! rec.garbage) && (rec.bytes[PKT_SRC] == SDRS_ADDR)) {
+                // the firmware answers for itself
+                skipped += 1;
+                continue;
+            }
+
+            // timed to be done when NavCoder saw it
+            uint64_t end = origin + ((uint64_t) (rec.ms - cut_ms) * SIM_CYCLES_PER_MS);
+            uint64_t duration = rec.bytes.size() * BYTE_CYCLES;
+            uint64_t start = (end > duration) ? (end - duration) : 0;
+
+            while (sim_now() < start) {
+                run_loop(loop_cycles);
+            }
+
+            sim_ibus_send(&rec.bytes[0], rec.bytes.size());
+
+            ReplayedFrame rf;
+            rf.bytes = rec.bytes;
+            rf.seen = 0;
+            rf.garbled = rec.garbage;
+            replayed.push_back(rf);
+
+            if (rec.garbage) {
+                garbage += 1;
+            } else {
+                played += 1;
+            }
+        }
+    }
+
+    uint64_t drain_until = sim_ibus_other_idle_at() + ((uint64_t) DRAIN_MS * SIM_CYCLES_PER_MS);
+
+    while (sim_now() < drain_until) {
+        run_loop(loop_cycles);
+    }
+
+    flush_sent_frame();
+    replay_latency.finish();
+
+    printf("replayed %lu frames and %lu bursts of garbage in %.1f s of virtual time; "
+           "%lu frames from the SDRS left out\n\n",
+           played, garbage, (double) sim_now() / (1000.0 * SIM_CYCLES_PER_MS), skipped);
+
+    print_report((parsed_log != NULL) ? &car : NULL);
+
+    printf("\nradio frames: %lu, %lu garbled on the wire (including the garbage)\n",
+           radio_frames, radio_garbled);
+    printf("our frames:   %lu, %lu garbled on the wire\n", sent_frames, sent_garbled_frames);
+    printf("rx: %u line errors, %u valid frames dropped\n",
+           ibus_rx_stats.line_errors, ibus_rx_stats.queue_overruns);
+    printf("tx: %u frames, %u coalesced, %u dropped, %u collisions, %u retries, %u failed\n",
+           ibus_tx_stats.frames, ibus_tx_stats.coalesced, ibus_tx_stats.dropped,
+           ibus_tx_stats.collisions, ibus_tx_stats.retries, ibus_tx_stats.failed);
+
+    if (ipod) {
+        const SimIPodStats *s = sim_ipod_stats();
+
+        printf("ipod: %lu packets (%lu bad, %lu ignored), %lu responses, %lu polls, "
+               "%lu mode switches, %lu buttons\n",
+               s->packets, s->bad_packets, s->ignored, s->responses, s->polls,
+               s->mode_switches, s->buttons);
+    }
+
+    return 0;
+}
+// }}}
@@ -0,0 +1,284 @@
+/*
+    Runs the firmware (ibus_satellite_radio.pde and everything it uses) on
+    the host, against the simulated peripherals in hal/.
+
+    The corpus files given on the command line are played onto the
+    simulated IBus one frame per line, with an idle gap between frames, while
+    loop() is called over and over.  Reported afterwards:
+
+      • host time spent in each interrupt handler, per call and per frame
+        played, i.e. the real cost of the RX ISR, the framer and the gap
+        timer for the traffic in the corpus
+      • host time for loop() passes that found a frame waiting (dispatch)
+        and for passes that didn't (idle)
+      • what the firmware sent back, and the driver's RX/TX statistics
+
+        firmware_sim [-v] [-g gap_ms] [-l loop_us] corpus.hex...
+
+    -v prints every frame the firmware sends, -g sets the idle time after
+    each frame (default 10ms), -l the virtual time taken by one loop() pass
+    (default 100µs).
+
+    The iPod's left unplugged, so the iPodWrapper sits in MODE_UNKNOWN.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "WProgram.h"
+#include "sim.h"
+
+#include "../ibus_serial.h"
+
+// from the sketch
+#define INH_PIN     2
+#define IPOD_RX_PIN 8
+
+// a pause this long on the wire ends one of our frames
+#define SENT_FRAME_GAP_CYCLES (2 * 11 * SIM_IBUS_BIT_CYCLES)
+
+struct CostStats {
+    unsigned long count;
+    uint64_t total;
+    uint64_t worst;
+
+    CostStats() : count(0), total(0), worst(0) {}
+
+    void add(uint64_t cost) {
+        count += 1;
+        total += cost;
+
+        if (cost > worst) {
+            worst = cost;
+        }
+    }
+
+    double mean() const {
+        return count ? ((double) total / count) : 0.0;
+    }
+};
+
+static bool verbose = false;
+
+// what we've put on the wire, split into frames
+static std::vector<uint8_t> sent_frame;
+static uint64_t sent_frame_last;
+static unsigned long sent_frames;
+static unsigned long sent_bytes;
+
+// {{{ flush_sent_frame
+static void flush_sent_frame() {
+    if (sent_frame.empty()) {
+        return;
+    }
+
+    sent_frames += 1;
+
+    if (verbose) {
+        printf("%10.3f ms  TX", (double) sent_frame_last / SIM_CYCLES_PER_MS);
+
+        for (size_t i = 0; i < sent_frame.size(); i++) {
+            printf(" %02X", sent_frame[i]);
+        }
+
+        printf("\n");
+    }
+
+    sent_frame.clear();
+}
+// }}}
+
+// {{{ ibus_observer
+static void ibus_observer(uint64_t when, uint8_t b, uint8_t sources, uint8_t status) {
+    if (! (sources & SIM_IBUS_US)) {
+        return;
+    }
+
+    if ((! sent_frame.empty()) && ((when - sent_frame_last) > SENT_FRAME_GAP_CYCLES)) {
+        flush_sent_frame();
+    }
+
+    sent_frame.push_back(b);
+    sent_frame_last = when;
+    sent_bytes += 1;
+}
+// }}}
+
+// {{{ load_corpus
+// one frame per line; '#' starts a comment
+static bool load_corpus(const char *path, std::vector<std::vector<uint8_t> > &frames) {
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+
+        std::vector<uint8_t> frame;
+        char *p = line;
+        char *end;
+
+        for (;;) {
+            long v = strtol(p, &end, 16);
+
+            if (end == p) {
+                break;
+            }
+
+            frame.push_back((uint8_t) v);
+            p = end;
+        }
+
+        if (! frame.empty()) {
+            frames.push_back(frame);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ run_loop
+// one pass through loop(), costed
+static void run_loop(uint64_t loop_cycles, CostStats &dispatch, CostStats &idle) {
+    bool frame_waiting = (ibus_serial_peek_frame() != NULL);
+
+    uint64_t start = sim_host_cycles();
+    loop();
+    uint64_t cost = sim_host_cycles() - start;
+
+    if (frame_waiting) {
+        dispatch.add(cost);
+    } else {
+        idle.add(cost);
+    }
+
+    sim_advance(loop_cycles);
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    unsigned long gap_ms = 10;
+    unsigned long loop_us = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vg:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'g':
+                gap_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-g gap_ms] [-l loop_us] corpus.hex...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    std::vector<std::vector<uint8_t> > frames;
+
+    for (int i = optind; i < argc; i++) {
+        if (! load_corpus(argv[i], frames)) {
+            return 2;
+        }
+    }
+
+    uint64_t loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    sim_set_ibus_observer(ibus_observer);
+
+    // bus awake, no iPod
+    sim_pin_set(INH_PIN, HIGH);
+    sim_pin_set(IPOD_RX_PIN, LOW);
+
+    init();
+    setup();
+
+    CostStats dispatch;
+    CostStats idle;
+
+    // setup() is out of the way; only the traffic counts
+    sim_reset_isr_stats();
+    uint64_t played_from = sim_now();
+    unsigned long played_bytes = 0;
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        sim_ibus_send(&frames[i][0], frames[i].size());
+        played_bytes += frames[i].size();
+
+        uint64_t until = sim_ibus_other_idle_at() + ((uint64_t) gap_ms * SIM_CYCLES_PER_MS);
+
+        while (sim_now() < until) {
+            run_loop(loop_cycles, dispatch, idle);
+        }
+    }
+
+    // let anything still queued go out
+    for (int i = 0; i < 1000; i++) {
+        run_loop(loop_cycles, dispatch, idle);
+    }
+
+    flush_sent_frame();
+
+    printf("played %lu frames (%lu bytes) in %.1f ms of virtual time\n",
+           (unsigned long) frames.size(), played_bytes,
+           (double) (sim_now() - played_from) / SIM_CYCLES_PER_MS);
+
+    printf("sent %lu frames (%lu bytes)\n\n", sent_frames, sent_bytes);
+
+    printf("%-14s %8s %12s %10s %12s\n",
+           "handler", "calls", "per call", "worst", "per frame");
+
+    uint64_t isr_total = 0;
+
+    for (int v = 0; v < SIM_VECT_COUNT; v++) {
+        const SimIsrStats *s = sim_isr_stats((SimVector) v);
+
+        isr_total += s->host_cycles;
+
+        printf("%-14s %8lu %12.1f %10llu %12.1f\n",
+               s->name, s->calls,
+               s->calls ? ((double) s->host_cycles / s->calls) : 0.0,
+               (unsigned long long) s->worst_host_cycles,
+               frames.empty() ? 0.0 : ((double) s->host_cycles / frames.size()));
+    }
+
+    printf("%-14s %8s %12s %10s %12.1f\n", "all handlers", "", "", "",
+           frames.empty() ? 0.0 : ((double) isr_total / frames.size()));
+
+    printf("\n%-14s %8lu %12.1f %10llu\n", "loop, dispatch",
+           dispatch.count, dispatch.mean(), (unsigned long long) dispatch.worst);
+    printf("%-14s %8lu %12.1f %10llu\n", "loop, idle",
+           idle.count, idle.mean(), (unsigned long long) idle.worst);
+    printf("(host time in %s)\n\n", SIM_HOST_CYCLE_UNIT);
+
+    printf("rx: %u line errors, %u queue overruns\n",
+           ibus_rx_stats.line_errors, ibus_rx_stats.queue_overruns);
+    printf("tx: %u frames, %u coalesced, %u dropped, %u collisions, %u retries, %u failed\n",
+           ibus_tx_stats.frames, ibus_tx_stats.coalesced, ibus_tx_stats.dropped,
+           ibus_tx_stats.collisions, ibus_tx_stats.retries, ibus_tx_stats.failed);
+
+    return 0;
+}
+// }}}
@@ -0,0 +1,480 @@
+/*
+    Host-side benchmark and fuzz driver for IBusFramer.
+
+    Feeds the corpus files given on the command line, plus a set of
+    generated adversarial streams, through the framer one byte at a time
+    and reports:
+
+      • valid frames found, and whether every frame known to be in the
+        stream was found; frames the firmware's accept filter would skip
+        are counted separately
+      • candidate probes per byte, amortized and worst-case for a single
+        byte; this is the number that would go quadratic if resync ever
+        went back to re-scanning the buffer for every dropped byte
+      • cycles per byte (TSC on x86, nanoseconds elsewhere), amortized and
+        worst-case
+
+    For comparison, the same streams are run through a model of the old
+    process_incoming_data() (peek, remove(1) and re-XOR on every failure),
+    counting buffer reads per byte.
+
+    Exits non-zero if any stream needs more probes than the linear bound
+    (two per byte plus one per gap), or if a known frame is missed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define CYCLE_UNIT "cycles"
+    static inline uint64_t cycle_count() { return __rdtsc(); }
+#else
+    #define CYCLE_UNIT "ns"
+    static inline uint64_t cycle_count() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    }
+#endif
+
+#include "../ibus_framer.h"
+
+// every byte can be a candidate start once, plus one probe for each time a
+// candidate has to wait for more data; gaps can add one more each
+#define MAX_PROBES_PER_BYTE 2
+#define MAX_PROBES_PER_GAP  1
+
+// a single event in a stream: a byte, or an idle gap
+struct StreamEvent {
+    bool gap;
+    uint8_t b;
+};
+
+struct Stream_t {
+    std::string name;
+    std::vector<StreamEvent> events;
+
+    // number of valid frames known to be in the stream, or -1 if
+    // unknown
+    long expected_frames;
+};
+
+struct Result {
+    unsigned long bytes;
+    unsigned long gaps;
+    unsigned long frames;
+    unsigned long accepted;
+    uint64_t probes;
+    uint64_t worst_probes;
+    uint64_t cycles;
+    uint64_t worst_cycles;
+    uint64_t naive_reads;
+};
+
+// {{{ xorshift
+static uint32_t rng_state = 0x1B05A7E1;
+
+static uint32_t xorshift() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+// }}}
+
+// {{{ add_byte / add_gap / add_frame
+static void add_byte(Stream_t &s, uint8_t b) {
+    StreamEvent e = { false, b };
+    s.events.push_back(e);
+}
+
+static void add_gap(Stream_t &s) {
+    StreamEvent e = { true, 0 };
+    s.events.push_back(e);
+}
+
+// appends a valid frame; data is dest, command and payload
+static void add_frame(Stream_t &s, uint8_t src, const uint8_t *data, uint8_t data_len, bool corrupt) {
+    uint8_t chksum = src ^ (data_len + 1);
+
+    add_byte(s, src);
+    add_byte(s, data_len + 1);
+
+    for (uint8_t i = 0; i < data_len; i++) {
+        add_byte(s, data[i]);
+        chksum ^= data[i];
+    }
+
+    add_byte(s, corrupt ? (chksum ^ 0x01) : chksum);
+}
+// }}}
+
+// {{{ load_corpus
+static bool load_corpus(const char *path, Stream_t &s) {
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    s.name = path;
+    s.expected_frames = -1;
+
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+
+        char *p = line;
+        char *end;
+        bool any = false;
+
+        for (;;) {
+            long v = strtol(p, &end, 16);
+
+            if (end == p) {
+                break;
+            }
+
+            add_byte(s, (uint8_t) v);
+            any = true;
+            p = end;
+        }
+
+        if (any) {
+            add_gap(s);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ strip_gaps
+// the same traffic as one continuous burst
+static Stream_t strip_gaps(const Stream_t &in) {
+    Stream_t out;
+
+    out.name = in.name + " (no gaps)";
+    out.expected_frames = -1;
+
+    for (size_t i = 0; i < in.events.size(); i++) {
+        if (! in.events[i].gap) {
+            out.events.push_back(in.events[i]);
+        }
+    }
+
+    return out;
+}
+// }}}
+
+// {{{ generated streams
+static const uint8_t POLL[] = { SDRS_ADDR, 0x01 };
+static const uint8_t NOW[] = { SDRS_ADDR, 0x3D, 0x02, 0x00 };
+static const uint8_t TEXT[] = { RAD_ADDR, 0x3E, 0x01, 0x00, 0x18, 0x12, 0x04, 'L', 'i', 't', 'h', 'i', 'u', 'm', ' ' };
+
+// random bytes, no gaps
+static Stream_t gen_noise() {
+    Stream_t s;
+    s.name = "generated: random noise";
+    s.expected_frames = -1;
+
+    for (int i = 0; i < 65536; i++) {
+        add_byte(s, xorshift());
+    }
+
+    return s;
+}
+
+// radio headers claiming the longest allowed frame at every offset
+static Stream_t gen_long_headers() {
+    Stream_t s;
+    s.name = "generated: max-length radio headers";
+    s.expected_frames = -1;
+
+    for (int i = 0; i < 32768; i++) {
+        add_byte(s, RAD_ADDR);
+        add_byte(s, MAX_EXPECTED_LEN - 1);
+    }
+
+    return s;
+}
+
+// valid frames separated by junk that can never start a frame, no gaps
+static Stream_t gen_junk_between() {
+    Stream_t s;
+    s.name = "generated: frames separated by junk";
+    s.expected_frames = 0;
+
+    for (int i = 0; i < 4096; i++) {
+        int junk = xorshift() % 70;
+
+        for (int j = 0; j < junk; j++) {
+            uint8_t b;
+
+            do {
+                b = xorshift();
+            } while ((b == RAD_ADDR) || (b == SDRS_ADDR));
+
+            add_byte(s, b);
+        }
+
+        switch (xorshift() % 3) {
+            case 0: add_frame(s, RAD_ADDR, POLL, sizeof(POLL), false); break;
+            case 1: add_frame(s, RAD_ADDR, NOW, sizeof(NOW), false); break;
+            case 2: add_frame(s, SDRS_ADDR, TEXT, sizeof(TEXT), false); break;
+        }
+
+        s.expected_frames += 1;
+    }
+
+    return s;
+}
+
+// every frame but the last in a burst has a bad checksum
+static Stream_t gen_near_misses() {
+    Stream_t s;
+    s.name = "generated: near-miss checksums";
+    s.expected_frames = 0;
+
+    for (int i = 0; i < 2048; i++) {
+        int misses = xorshift() % 6;
+
+        for (int j = 0; j < misses; j++) {
+            add_frame(s, SDRS_ADDR, TEXT, sizeof(TEXT), true);
+        }
+
+        add_frame(s, RAD_ADDR, NOW, sizeof(NOW), false);
+        s.expected_frames += 1;
+
+        add_gap(s);
+    }
+
+    return s;
+}
+
+// radio traffic where every burst starts part-way into a frame, as when
+// booting in the middle of a transmission
+static Stream_t gen_mid_frame() {
+    Stream_t s;
+    s.name = "generated: bursts starting mid-frame";
+    s.expected_frames = 0;
+
+    for (int i = 0; i < 4096; i++) {
+        Stream_t tmp;
+        add_frame(tmp, SDRS_ADDR, TEXT, sizeof(TEXT), false);
+
+        size_t skip = 1 + (xorshift() % (tmp.events.size() - 1));
+        s.events.insert(s.events.end(), tmp.events.begin() + skip, tmp.events.end());
+
+        add_frame(s, RAD_ADDR, POLL, sizeof(POLL), false);
+        s.expected_frames += 1;
+
+        add_gap(s);
+    }
+
+    return s;
+}
+// }}}
+
+// {{{ naive_reads
+/*
+ * Model of the old process_incoming_data(): peek at the source and length,
+ * XOR the whole candidate to check it, and drop a single byte on any
+ * failure.  Returns the number of buffer reads; at an idle gap, the read
+ * timeout drops a byte at a time until nothing's waiting.
+ */
+static uint64_t naive_reads(const Stream_t &s) {
+    std::deque<uint8_t> buf;
+    uint64_t reads = 0;
+
+    for (size_t i = 0; i <= s.events.size(); i++) {
+        bool gap = (i == s.events.size()) || s.events[i].gap;
+
+        if (! gap) {
+            buf.push_back(s.events[i].b);
+
+            // HardwareSerial drops bytes when its buffer's full
+            if (buf.size() > 128) {
+                buf.pop_back();
+            }
+        }
+
+        for (;;) {
+            if (buf.empty()) {
+                break;
+            }
+
+            reads += 1;
+            uint8_t src = buf[0];
+
+            if ((src != RAD_ADDR) && (src != SDRS_ADDR)) {
+                buf.pop_front();
+                continue;
+            }
+
+            if (buf.size() < 3) {
+                if (gap) { buf.pop_front(); continue; }
+                break;
+            }
+
+            reads += 1;
+            uint8_t data_len = buf[1];
+
+            if ((data_len == 0) || (data_len >= MAX_EXPECTED_LEN)) {
+                buf.pop_front();
+                continue;
+            }
+
+            size_t pkt_len = data_len + 2;
+
+            if (buf.size() < pkt_len) {
+                if (gap) { buf.pop_front(); continue; }
+                break;
+            }
+
+            uint8_t chksum = 0;
+            for (size_t j = 0; j < pkt_len; j++) {
+                chksum ^= buf[j];
+                reads += 1;
+            }
+
+            if (chksum == 0) {
+                buf.erase(buf.begin(), buf.begin() + pkt_len);
+            } else {
+                buf.pop_front();
+            }
+        }
+    }
+
+    return reads;
+}
+// }}}
+
+// {{{ run
+static unsigned long frames_accepted;
+
+static void count_frame(IBusFramer *framer, uint8_t start, uint8_t pkt_len) {
+    frames_accepted += 1;
+}
+
+static Result run(const Stream_t &s) {
+    Result r;
+    memset(&r, 0, sizeof(r));
+
+    IBusFramer framer;
+    framer.setFrameHandler(count_frame);
+    frames_accepted = 0;
+
+    // same filter as setup()
+    framer.clearFilter();
+    framer.acceptSource(RAD_ADDR);
+    framer.acceptDestination(SDRS_ADDR);
+    framer.acceptDestination(BCST_ADDR);
+
+    for (size_t i = 0; i < s.events.size(); i++) {
+        uint32_t probes_before = framer.stats.probes;
+        uint64_t start = cycle_count();
+
+        if (s.events[i].gap) {
+            framer.gap();
+        } else {
+            framer.push(s.events[i].b);
+        }
+
+        uint64_t elapsed = cycle_count() - start;
+
+        if (s.events[i].gap) {
+            r.gaps += 1;
+        } else {
+            r.bytes += 1;
+        }
+
+        uint64_t probes = framer.stats.probes - probes_before;
+
+        r.cycles += elapsed;
+        if (elapsed > r.worst_cycles) r.worst_cycles = elapsed;
+        if (probes > r.worst_probes) r.worst_probes = probes;
+    }
+
+    framer.gap();
+    r.gaps += 1;
+
+    r.frames = framer.stats.frames;
+    r.accepted = frames_accepted;
+    r.probes = framer.stats.probes;
+    r.naive_reads = naive_reads(s);
+
+    return r;
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    std::vector<Stream_t> streams;
+
+    for (int i = 1; i < argc; i++) {
+        Stream_t s;
+
+        if (! load_corpus(argv[i], s)) {
+            return 2;
+        }
+
+        streams.push_back(s);
+        streams.push_back(strip_gaps(s));
+    }
+
+    streams.push_back(gen_noise());
+    streams.push_back(gen_long_headers());
+    streams.push_back(gen_junk_between());
+    streams.push_back(gen_near_misses());
+    streams.push_back(gen_mid_frame());
+
+    bool ok = true;
+
+    printf("%-52s %8s %7s %7s %9s %6s %9s %8s %9s\n",
+           "stream", "bytes", "frames", "to us", "probes/B", "worst",
+           CYCLE_UNIT "/B", "worst", "old rd/B");
+
+    for (size_t i = 0; i < streams.size(); i++) {
+        const Stream_t &s = streams[i];
+        Result r = run(s);
+
+        double probes_per_byte = (double) r.probes / r.bytes;
+        bool too_many = r.probes > ((MAX_PROBES_PER_BYTE * (uint64_t) r.bytes) +
+                                    (MAX_PROBES_PER_GAP * (uint64_t) r.gaps));
+        bool missed = (s.expected_frames >= 0) && ((long) r.frames < s.expected_frames);
+
+        std::string name = s.name;
+        if (name.size() > 52) {
+            name = "..." + name.substr(name.size() - 49);
+        }
+
+        printf("%-52s %8lu %7lu %7lu %9.3f %6llu %9.1f %8llu %9.2f%s%s\n",
+               name.c_str(), r.bytes, r.frames, r.accepted,
+               probes_per_byte, (unsigned long long) r.worst_probes,
+               (double) r.cycles / r.bytes, (unsigned long long) r.worst_cycles,
+               (double) r.naive_reads / r.bytes,
+               too_many ? "  TOO MANY PROBES" : "",
+               missed ? "  MISSED FRAMES" : "");
+
+        if (too_many || missed) {
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
+// }}}
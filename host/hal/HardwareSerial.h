@@ -0,0 +1,28 @@
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+/*
+    On the adapter USART0 belongs to IBus (see ibus_serial.cpp), so nothing
+    in the firmware uses Serial.  It's here for libraries that print
+    through it anyway, and goes to stdout.
+*/
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+public:
+    void begin(long speed) {}
+    void end() {}
+
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+
+    virtual void write(uint8_t b);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,159 @@
+#include "Print.h"
+
+// {{{ Print::write
+void Print::write(const char *str) {
+    while (*str) {
+        write((uint8_t) *str++);
+    }
+}
+
+void Print::write(const uint8_t *buffer, size_t size) {
+    while (size--) {
+        write(*buffer++);
+    }
+}
+// }}}
+
+// {{{ Print::print
+void Print::print(const char str[]) {
+    write(str);
+}
+
+void Print::print(char c, int base) {
+    print((long) c, base);
+}
+
+void Print::print(unsigned char b, int base) {
+    print((unsigned long) b, base);
+}
+
+void Print::print(int n, int base) {
+    print((long) n, base);
+}
+
+void Print::print(unsigned int n, int base) {
+    print((unsigned long) n, base);
+}
+
+void Print::print(long n, int base) {
+    if (base == BYTE) {
+        write((uint8_t) n);
+    } else if ((base == DEC) && (n < 0)) {
+        write('-');
+        printNumber(-n, DEC);
+    } else {
+        printNumber(n, base);
+    }
+}
+
+void Print::print(unsigned long n, int base) {
+    if (base == BYTE) {
+        write((uint8_t) n);
+    } else {
+        printNumber(n, base);
+    }
+}
+
+void Print::print(double n, int digits) {
+    printFloat(n, digits);
+}
+// }}}
+
+// {{{ Print::println
+void Print::println(void) {
+    print('\r');
+    print('\n');
+}
+
+void Print::println(const char c[]) {
+    print(c);
+    println();
+}
+
+void Print::println(char c, int base) {
+    print(c, base);
+    println();
+}
+
+void Print::println(unsigned char b, int base) {
+    print(b, base);
+    println();
+}
+
+void Print::println(int n, int base) {
+    print(n, base);
+    println();
+}
+
+void Print::println(unsigned int n, int base) {
+    print(n, base);
+    println();
+}
+
+void Print::println(long n, int base) {
+    print(n, base);
+    println();
+}
+
+void Print::println(unsigned long n, int base) {
+    print(n, base);
+    println();
+}
+
+void Print::println(double n, int digits) {
+    print(n, digits);
+    println();
+}
+// }}}
+
+// {{{ Print::printNumber
+void Print::printNumber(unsigned long n, uint8_t base) {
+    char buf[8 * sizeof(long)];
+    unsigned long i = 0;
+
+    if (n == 0) {
+        print('0');
+        return;
+    }
+
+    while (n > 0) {
+        buf[i++] = n % base;
+        n /= base;
+    }
+
+    for (; i > 0; i--) {
+        print((char) (buf[i - 1] < 10 ? '0' + buf[i - 1] : 'A' + buf[i - 1] - 10));
+    }
+}
+// }}}
+
+// {{{ Print::printFloat
+void Print::printFloat(double number, uint8_t digits) {
+    if (number < 0.0) {
+        print('-');
+        number = -number;
+    }
+
+    double rounding = 0.5;
+    for (uint8_t i = 0; i < digits; ++i) {
+        rounding /= 10.0;
+    }
+
+    number += rounding;
+
+    unsigned long int_part = (unsigned long) number;
+    double remainder = number - (double) int_part;
+    print(int_part);
+
+    if (digits > 0) {
+        print('.');
+    }
+
+    while (digits-- > 0) {
+        remainder *= 10.0;
+        int to_print = int(remainder);
+        print(to_print);
+        remainder -= to_print;
+    }
+}
+// }}}
@@ -0,0 +1,47 @@
+#ifndef Print_h
+#define Print_h
+
+// Arduino 0022's Print, without String
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEC  10
+#define HEX  16
+#define OCT  8
+#define BIN  2
+#define BYTE 0
+
+class Print {
+private:
+    void printNumber(unsigned long n, uint8_t base);
+    void printFloat(double number, uint8_t digits);
+
+public:
+    virtual ~Print() {}
+
+    virtual void write(uint8_t) = 0;
+    virtual void write(const char *str);
+    virtual void write(const uint8_t *buffer, size_t size);
+
+    void print(const char[]);
+    void print(char, int = BYTE);
+    void print(unsigned char, int = BYTE);
+    void print(int, int = DEC);
+    void print(unsigned int, int = DEC);
+    void print(long, int = DEC);
+    void print(unsigned long, int = DEC);
+    void print(double, int = 2);
+
+    void println(const char[]);
+    void println(char, int = BYTE);
+    void println(unsigned char, int = BYTE);
+    void println(int, int = DEC);
+    void println(unsigned int, int = DEC);
+    void println(long, int = DEC);
+    void println(unsigned long, int = DEC);
+    void println(double, int = 2);
+    void println(void);
+};
+
+#endif
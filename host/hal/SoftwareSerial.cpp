@@ -0,0 +1,145 @@
+#include "SoftwareSerial.h"
+#include "sim.h"
+
+#include <avr/interrupt.h>
+
+#include <stddef.h>
+
+SoftwareSerial *SoftwareSerial::instances = NULL;
+
+// {{{ SoftwareSerial::SoftwareSerial
+SoftwareSerial::SoftwareSerial(
+    uint8_t _receivePin,
+    uint8_t _transmitPin,
+    bool inverse_logic,
+    bool disable_rx,
+    bool disable_pullup
+) :
+    receivePin(_receivePin),
+    transmitPin(_transmitPin),
+    bitCycles(0),
+    receiveBufferTail(0),
+    receiveBufferHead(0),
+    bufferOverflow(false)
+{
+    nextInstance = instances;
+    instances = this;
+}
+// }}}
+
+// {{{ SoftwareSerial::~SoftwareSerial
+SoftwareSerial::~SoftwareSerial() {
+    SoftwareSerial **p = &instances;
+
+    while (*p != NULL) {
+        if (*p == this) {
+            *p = nextInstance;
+            break;
+        }
+
+        p = &(*p)->nextInstance;
+    }
+}
+// }}}
+
+// {{{ SoftwareSerial::begin / end
+void SoftwareSerial::begin(long speed) {
+    bitCycles = F_CPU / speed;
+}
+
+void SoftwareSerial::end() {
+    bitCycles = 0;
+}
+// }}}
+
+// {{{ SoftwareSerial::overflow
+bool SoftwareSerial::overflow() {
+    bool ret = bufferOverflow;
+    bufferOverflow = false;
+    return ret;
+}
+// }}}
+
+// {{{ SoftwareSerial::write
+void SoftwareSerial::write(uint8_t b) {
+    if (bitCycles == 0) {
+        return;
+    }
+
+    sim_soft_serial_wrote(transmitPin, b);
+
+    // start, 8 data bits and stop, with interrupts off throughout
+    sim_stall(10 * bitCycles);
+}
+// }}}
+
+// {{{ SoftwareSerial::available / read / peek / flush
+int SoftwareSerial::available() {
+    return (receiveBufferTail + _SS_MAX_RX_BUFF - receiveBufferHead) % _SS_MAX_RX_BUFF;
+}
+
+int SoftwareSerial::read() {
+    if (receiveBufferHead == receiveBufferTail) {
+        return -1;
+    }
+
+    uint8_t b = receiveBuffer[receiveBufferHead];
+    receiveBufferHead = (receiveBufferHead + 1) % _SS_MAX_RX_BUFF;
+
+    return b;
+}
+
+int SoftwareSerial::peek() {
+    if (receiveBufferHead == receiveBufferTail) {
+        return -1;
+    }
+
+    return receiveBuffer[receiveBufferHead];
+}
+
+// discards whatever's been received, as NewSoftSerial does
+void SoftwareSerial::flush() {
+    receiveBufferHead = receiveBufferTail = 0;
+}
+// }}}
+
+// {{{ SoftwareSerial::findByReceivePin
+SoftwareSerial *SoftwareSerial::findByReceivePin(uint8_t pin) {
+    for (SoftwareSerial *ss = instances; ss != NULL; ss = ss->nextInstance) {
+        if (ss->receivePin == pin) {
+            return ss;
+        }
+    }
+
+    return NULL;
+}
+// }}}
+
+// {{{ SoftwareSerial::receive
+// a byte's come in; one slot is always left empty, so 63 bytes fit
+void SoftwareSerial::receive(uint8_t b) {
+    uint8_t next = (receiveBufferTail + 1) % _SS_MAX_RX_BUFF;
+
+    if (next == receiveBufferHead) {
+        bufferOverflow = true;
+        return;
+    }
+
+    receiveBuffer[receiveBufferTail] = b;
+    receiveBufferTail = next;
+}
+// }}}
+
+// {{{ pin change vectors
+// NewSoftSerial defines all three, and its handler receives a byte if the
+// listening instance's pin shows a start bit.  Reception's modelled in
+// sim.cpp instead, so here they only stand in for the library's.
+ISR(PCINT0_vect) {
+}
+
+ISR(PCINT1_vect) {
+}
+
+ISR(PCINT2_vect) {
+}
+// }}}
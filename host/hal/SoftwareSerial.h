@@ -0,0 +1,69 @@
+#ifndef SoftwareSerial_h
+#define SoftwareSerial_h
+
+/*
+    Simulated NewSoftSerial.  Received bytes come from
+    sim_soft_serial_send(); as on the real thing, each byte keeps the CPU
+    busy with interrupts off for a character time, both ways, and bytes that
+    don't fit in the receive buffer are lost.
+*/
+
+#include <stdint.h>
+
+#include "Stream.h"
+
+#define _SS_MAX_RX_BUFF 64
+
+class SoftwareSerial : public Stream {
+private:
+    uint8_t receivePin;
+    uint8_t transmitPin;
+
+    // 0 until begin()
+    uint32_t bitCycles;
+
+    uint8_t receiveBuffer[_SS_MAX_RX_BUFF];
+    volatile uint8_t receiveBufferTail;
+    volatile uint8_t receiveBufferHead;
+    bool bufferOverflow;
+
+    // every instance, so the simulator can find them by pin
+    SoftwareSerial *nextInstance;
+    static SoftwareSerial *instances;
+
+public:
+    SoftwareSerial(
+        uint8_t receivePin,
+        uint8_t transmitPin,
+        bool inverse_logic = false,
+        bool disable_rx = false,
+        bool disable_pullup = false
+    );
+    ~SoftwareSerial();
+
+    void begin(long speed);
+    void end();
+
+    // true (once) if a received byte was dropped
+    bool overflow();
+
+    virtual void write(uint8_t b);
+    using Print::write;
+
+    virtual int available();
+    virtual int read();
+    virtual int peek();
+    virtual void flush();
+
+    // {{{ simulator interface
+    static SoftwareSerial *findByReceivePin(uint8_t pin);
+
+    uint32_t getBitCycles() const {
+        return bitCycles;
+    }
+
+    void receive(uint8_t b);
+    // }}}
+};
+
+#endif
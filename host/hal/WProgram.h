@@ -0,0 +1,53 @@
+#ifndef WProgram_h
+#define WProgram_h
+
+/*
+    Host stand-in for the Arduino 0022 core; see sim.h.  The min()/max()
+    family of macros is left out, since it breaks the C++ standard headers
+    and the firmware doesn't use it.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "sim.h"
+#include "HardwareSerial.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// sets up the core; in practice, turns interrupts on
+void init(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// the sketch
+void setup(void);
+void loop(void);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+/*
+    The EEPROM, backed by memory in the simulator (see sim_eeprom() in
+    sim.h).  Writes take as long as they would on the real thing, ~3.4ms a
+    byte, with interrupts still running: a write starts straight away and
+    carries on in the background, and reading or writing again waits for
+    it, as avr-libc does.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END 0x1FF
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dest, const void *src, size_t n);
+void eeprom_write_block(const void *src, void *dest, size_t n);
+
+// a function here, rather than avr-libc's macro on EECR
+bool eeprom_is_ready();
+
+#endif /* end of include guard: SIM_AVR_EEPROM_H */
@@ -0,0 +1,14 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+#include "sim.h"
+
+// handlers are plain functions named after the vector; the simulator calls
+// them (see sim.cpp)
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#define cli() sim_cli()
+#define sei() sim_sei()
+
+#endif /* end of include guard: SIM_AVR_INTERRUPT_H */
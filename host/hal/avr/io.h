@@ -0,0 +1,350 @@
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+/*
+    ATmega168 registers, as far as the firmware uses them.  Registers whose
+    reads or writes do something are SimReg8 objects handled by the
+    simulator (see sim.h); the rest are plain variables.
+*/
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+// {{{ SimReg8
+// ids of the registers the simulator handles
+enum {
+    SIM_REG_SREG,
+    SIM_REG_MCUSR,
+    SIM_REG_TCNT0,
+    SIM_REG_TCCR1A,
+    SIM_REG_TCCR1B,
+    SIM_REG_TIMSK1,
+    SIM_REG_TIFR1,
+    SIM_REG_TCCR2A,
+    SIM_REG_TCCR2B,
+    SIM_REG_TCNT2,
+    SIM_REG_OCR2A,
+    SIM_REG_TIMSK2,
+    SIM_REG_TIFR2,
+    SIM_REG_UBRR0H,
+    SIM_REG_UBRR0L,
+    SIM_REG_UCSR0A,
+    SIM_REG_UCSR0B,
+    SIM_REG_UCSR0C,
+    SIM_REG_UDR0,
+    SIM_REG_SMCR,
+    SIM_REG_EICRA,
+    SIM_REG_EIMSK,
+    SIM_REG_EIFR,
+    SIM_REG_PCICR,
+    SIM_REG_PCIFR,
+    SIM_REG_PCMSK0,
+    SIM_REG_PCMSK1,
+    SIM_REG_PCMSK2,
+    SIM_REG_ADCSRA,
+    SIM_REG_COUNT
+};
+
+// and the 16-bit ones
+enum {
+    SIM_REG16_TCNT1,
+    SIM_REG16_ICR1,
+    SIM_REG16_OCR1A,
+    SIM_REG16_OCR1B,
+    SIM_REG16_COUNT
+};
+
+uint8_t sim_reg_read(uint8_t id);
+void sim_reg_write(uint8_t id, uint8_t value);
+
+uint16_t sim_reg16_read(uint8_t id);
+void sim_reg16_write(uint8_t id, uint16_t value);
+
+class SimReg8 {
+    uint8_t id;
+
+    // registers aren't values
+    SimReg8(const SimReg8 &);
+
+public:
+    explicit SimReg8(uint8_t _id) : id(_id) {}
+
+    operator uint8_t() const {
+        return sim_reg_read(id);
+    }
+
+    SimReg8 &operator=(uint8_t value) {
+        sim_reg_write(id, value);
+        return *this;
+    }
+
+    SimReg8 &operator=(const SimReg8 &other) {
+        sim_reg_write(id, (uint8_t) other);
+        return *this;
+    }
+
+    // read-modify-write, like sbi/cbi or in/or/out on the real thing.
+    // The operand's an int, as it is after promotion on the AVR, so
+    // REG &= ~_BV(x) doesn't draw a narrowing warning.
+    SimReg8 &operator|=(int value) {
+        sim_reg_write(id, sim_reg_read(id) | value);
+        return *this;
+    }
+
+    SimReg8 &operator&=(int value) {
+        sim_reg_write(id, sim_reg_read(id) & value);
+        return *this;
+    }
+
+    SimReg8 &operator^=(int value) {
+        sim_reg_write(id, sim_reg_read(id) ^ value);
+        return *this;
+    }
+};
+// }}}
+
+// {{{ SimReg16
+// read and written whole; the TEMP register isn't modelled
+class SimReg16 {
+    uint8_t id;
+
+    SimReg16(const SimReg16 &);
+
+public:
+    explicit SimReg16(uint8_t _id) : id(_id) {}
+
+    operator uint16_t() const {
+        return sim_reg16_read(id);
+    }
+
+    SimReg16 &operator=(uint16_t value) {
+        sim_reg16_write(id, value);
+        return *this;
+    }
+};
+// }}}
+
+extern SimReg8 SREG;
+extern SimReg8 MCUSR;
+
+extern SimReg8 TCNT0;
+
+extern SimReg8 TCCR1A;
+extern SimReg8 TCCR1B;
+extern SimReg16 TCNT1;
+extern SimReg16 ICR1;
+extern SimReg16 OCR1A;
+extern SimReg16 OCR1B;
+extern SimReg8 TIMSK1;
+extern SimReg8 TIFR1;
+
+extern SimReg8 TCCR2A;
+extern SimReg8 TCCR2B;
+extern SimReg8 TCNT2;
+extern SimReg8 OCR2A;
+extern SimReg8 TIMSK2;
+extern SimReg8 TIFR2;
+
+extern SimReg8 UBRR0H;
+extern SimReg8 UBRR0L;
+extern SimReg8 UCSR0A;
+extern SimReg8 UCSR0B;
+extern SimReg8 UCSR0C;
+extern SimReg8 UDR0;
+
+extern SimReg8 SMCR;
+
+extern SimReg8 EICRA;
+extern SimReg8 EIMSK;
+extern SimReg8 EIFR;
+extern SimReg8 PCICR;
+extern SimReg8 PCIFR;
+extern SimReg8 PCMSK0;
+extern SimReg8 PCMSK1;
+extern SimReg8 PCMSK2;
+
+extern SimReg8 ADCSRA;
+
+// updated by the simulator as pins change
+extern volatile uint8_t PINB;
+extern volatile uint8_t PINC;
+extern volatile uint8_t PIND;
+
+// PINB
+#define PINB0 0
+
+// outputs follow PORTx, as of the next time the simulator gets control (a
+// register access, the end of an ISR or the clock moving); DDRx isn't
+// connected to anything, pinMode() is what counts
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PORTC;
+extern volatile uint8_t PORTD;
+extern volatile uint8_t DDRB;
+extern volatile uint8_t DDRC;
+extern volatile uint8_t DDRD;
+
+// SREG
+#define SREG_I 7
+
+// MCUSR
+#define WDRF  3
+#define BORF  2
+#define EXTRF 1
+#define PORF  0
+
+// TCCR1A
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11  1
+#define WGM10  0
+
+// TCCR1B
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12  2
+#define CS11  1
+#define CS10  0
+
+// TIMSK1
+#define ICIE1  5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1  0
+
+// TIFR1
+#define ICF1  5
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1  0
+
+// TCCR2A
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21  1
+#define WGM20  0
+
+// TCCR2B
+#define FOC2A 7
+#define FOC2B 6
+#define WGM22 3
+#define CS22  2
+#define CS21  1
+#define CS20  0
+
+// TIMSK2
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2  0
+
+// TIFR2
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2  0
+
+// UCSR0A
+#define RXC0  7
+#define TXC0  6
+#define UDRE0 5
+#define FE0   4
+#define DOR0  3
+#define UPE0  2
+#define U2X0  1
+#define MPCM0 0
+
+// UCSR0B
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ02 2
+#define RXB80  1
+#define TXB80  0
+
+// UCSR0C
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01   5
+#define UPM00   4
+#define USBS0   3
+#define UCSZ01  2
+#define UCSZ00  1
+#define UCPOL0  0
+
+// SMCR
+#define SM2 3
+#define SM1 2
+#define SM0 1
+#define SE  0
+
+// EICRA
+#define ISC11 3
+#define ISC10 2
+#define ISC01 1
+#define ISC00 0
+
+// EIMSK
+#define INT1 1
+#define INT0 0
+
+// EIFR
+#define INTF1 1
+#define INTF0 0
+
+// PCICR
+#define PCIE2 2
+#define PCIE1 1
+#define PCIE0 0
+
+// PCIFR
+#define PCIF2 2
+#define PCIF1 1
+#define PCIF0 0
+
+// PCMSK2
+#define PCINT23 7
+#define PCINT22 6
+#define PCINT21 5
+#define PCINT20 4
+#define PCINT19 3
+#define PCINT18 2
+#define PCINT17 1
+#define PCINT16 0
+
+// PCMSK1
+#define PCINT14 6
+#define PCINT13 5
+#define PCINT12 4
+#define PCINT11 3
+#define PCINT10 2
+#define PCINT9  1
+#define PCINT8  0
+
+// PCMSK0
+#define PCINT7 7
+#define PCINT6 6
+#define PCINT5 5
+#define PCINT4 4
+#define PCINT3 3
+#define PCINT2 2
+#define PCINT1 1
+#define PCINT0 0
+
+// ADCSRA
+#define ADEN  7
+#define ADSC  6
+#define ADATE 5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#endif /* end of include guard: SIM_AVR_IO_H */
@@ -0,0 +1,26 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+// there's only one address space on the host
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+typedef const char *PGM_P;
+typedef const void *PGM_VOID_P;
+
+#define pgm_read_byte(addr)  (*(const uint8_t *) (addr))
+#define pgm_read_word(addr)  (*(const uint16_t *) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t *) (addr))
+
+#define memcpy_P  memcpy
+#define memcmp_P  memcmp
+#define strcpy_P  strcpy
+#define strncpy_P strncpy
+#define strcmp_P  strcmp
+#define strlen_P  strlen
+
+#endif /* end of include guard: SIM_AVR_PGMSPACE_H */
@@ -0,0 +1,26 @@
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+
+#include <stdint.h>
+
+// timeout is 16ms << value, as on the real thing (roughly)
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+#define WDTO_4S    8
+#define WDTO_8S    9
+
+void sim_wdt_enable(uint8_t timeout);
+void sim_wdt_disable();
+void sim_wdt_reset();
+
+#define wdt_enable(timeout) sim_wdt_enable(timeout)
+#define wdt_disable()       sim_wdt_disable()
+#define wdt_reset()         sim_wdt_reset()
+
+#endif /* end of include guard: SIM_AVR_WDT_H */
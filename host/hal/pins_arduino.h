@@ -0,0 +1,32 @@
+#ifndef Pins_Arduino_h
+#define Pins_Arduino_h
+
+// ATmega168 (Arduino Diecimila/Duemilanove) pin mapping
+
+#include <avr/io.h>
+
+#define NOT_A_PIN  0
+#define NOT_A_PORT 0
+
+#define PB 2
+#define PC 3
+#define PD 4
+
+#define SIM_NUM_PINS 20
+
+#define digitalPinToPort(P) \
+    (((P) < 8) ? PD : (((P) < 14) ? PB : PC))
+
+#define digitalPinToBitMask(P) \
+    _BV(((P) < 8) ? (P) : (((P) < 14) ? ((P) - 8) : ((P) - 14)))
+
+#define portInputRegister(P) \
+    (((P) == PB) ? &PINB : (((P) == PC) ? &PINC : &PIND))
+
+#define portOutputRegister(P) \
+    (((P) == PB) ? &PORTB : (((P) == PC) ? &PORTC : &PORTD))
+
+#define portModeRegister(P) \
+    (((P) == PB) ? &DDRB : (((P) == PC) ? &DDRC : &DDRD))
+
+#endif
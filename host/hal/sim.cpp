@@ -0,0 +1,1435 @@
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+#include <map>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#include "SoftwareSerial.h"
+#include "pins_arduino.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    const char *const SIM_HOST_CYCLE_UNIT = "cycles";
+    uint64_t sim_host_cycles() { return __rdtsc(); }
+#else
+    const char *const SIM_HOST_CYCLE_UNIT = "ns";
+    uint64_t sim_host_cycles() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    }
+#endif
+
+#define NEVER (~((uint64_t) 0))
+
+// an ISR that never clears its own condition would hang the real thing
+#define MAX_ISRS_PER_SERVICE 100000UL
+
+// {{{ handlers
+// defined by the firmware with ISR(); missing ones are a bad interrupt
+extern "C" {
+    void INT0_vect(void) __attribute__((weak));
+    void INT1_vect(void) __attribute__((weak));
+    void PCINT0_vect(void) __attribute__((weak));
+    void PCINT1_vect(void) __attribute__((weak));
+    void PCINT2_vect(void) __attribute__((weak));
+    void TIMER2_COMPA_vect(void) __attribute__((weak));
+    void TIMER1_CAPT_vect(void) __attribute__((weak));
+    void TIMER1_COMPA_vect(void) __attribute__((weak));
+    void TIMER1_COMPB_vect(void) __attribute__((weak));
+    void USART_RX_vect(void) __attribute__((weak));
+    void USART_UDRE_vect(void) __attribute__((weak));
+    void USART_TX_vect(void) __attribute__((weak));
+}
+
+static SimIsrStats isr_stats[SIM_VECT_COUNT];
+
+static const char *const vector_names[SIM_VECT_COUNT] = {
+    "INT0",
+    "INT1",
+    "PCINT0",
+    "PCINT1",
+    "PCINT2",
+    "TIMER2_COMPA",
+    "TIMER1_CAPT",
+    "TIMER1_COMPA",
+    "TIMER1_COMPB",
+    "USART_RX",
+    "USART_UDRE",
+    "USART_TX",
+};
+// }}}
+
+// {{{ registers
+SimReg8 SREG(SIM_REG_SREG);
+SimReg8 MCUSR(SIM_REG_MCUSR);
+SimReg8 TCNT0(SIM_REG_TCNT0);
+SimReg8 TCCR1A(SIM_REG_TCCR1A);
+SimReg8 TCCR1B(SIM_REG_TCCR1B);
+SimReg16 TCNT1(SIM_REG16_TCNT1);
+SimReg16 ICR1(SIM_REG16_ICR1);
+SimReg16 OCR1A(SIM_REG16_OCR1A);
+SimReg16 OCR1B(SIM_REG16_OCR1B);
+SimReg8 TIMSK1(SIM_REG_TIMSK1);
+SimReg8 TIFR1(SIM_REG_TIFR1);
+SimReg8 TCCR2A(SIM_REG_TCCR2A);
+SimReg8 TCCR2B(SIM_REG_TCCR2B);
+SimReg8 TCNT2(SIM_REG_TCNT2);
+SimReg8 OCR2A(SIM_REG_OCR2A);
+SimReg8 TIMSK2(SIM_REG_TIMSK2);
+SimReg8 TIFR2(SIM_REG_TIFR2);
+SimReg8 UBRR0H(SIM_REG_UBRR0H);
+SimReg8 UBRR0L(SIM_REG_UBRR0L);
+SimReg8 UCSR0A(SIM_REG_UCSR0A);
+SimReg8 UCSR0B(SIM_REG_UCSR0B);
+SimReg8 UCSR0C(SIM_REG_UCSR0C);
+SimReg8 UDR0(SIM_REG_UDR0);
+SimReg8 SMCR(SIM_REG_SMCR);
+SimReg8 EICRA(SIM_REG_EICRA);
+SimReg8 EIMSK(SIM_REG_EIMSK);
+SimReg8 EIFR(SIM_REG_EIFR);
+SimReg8 PCICR(SIM_REG_PCICR);
+SimReg8 PCIFR(SIM_REG_PCIFR);
+SimReg8 PCMSK0(SIM_REG_PCMSK0);
+SimReg8 PCMSK1(SIM_REG_PCMSK1);
+SimReg8 PCMSK2(SIM_REG_PCMSK2);
+SimReg8 ADCSRA(SIM_REG_ADCSRA);
+
+// backing store for registers that have no state of their own below
+static uint8_t regs[SIM_REG_COUNT];
+// }}}
+
+// {{{ state
+static uint64_t now;
+
+// the CPU's busy with interrupts off until then (SoftwareSerial)
+static uint64_t busy_until;
+
+static bool in_isr;
+
+// in the sleep instruction, and whether the I/O clock's stopped for it
+static bool sleeping;
+static bool powered_down;
+
+// time the I/O clock's been stopped for, in all
+static uint64_t io_stopped;
+
+static SimPowerState power_state;
+static SimPowerStats power_stats;
+
+// timer1, normal mode only: the counter was 0 at t1_origin, counting at
+// the prescaler in TCCR1B; t1_stopped_count holds the count while it's
+// stopped
+static int64_t t1_origin;
+static uint16_t t1_stopped_count;
+static uint16_t icr1;
+static uint16_t ocr1[2];
+static uint64_t t1_next_match[2];
+
+// timer2: the counter was 0 at t2_origin, counting at the prescaler in
+// TCCR2B; t2_stopped_count holds the count while it's stopped
+static int64_t t2_origin;
+static uint8_t t2_stopped_count;
+static uint64_t t2_next_match;
+
+// USART0 transmitter
+static bool udr_full;
+static uint8_t udr_tx;
+static bool shift_busy;
+static uint64_t shift_end;
+static bool txc;
+
+// USART0 receiver
+typedef struct __rx_entry {
+    uint8_t b;
+    uint8_t status;
+    uint64_t received_at;
+} RxEntry;
+
+static RxEntry rx_fifo[2];
+static uint8_t rx_count;
+static uint8_t udr_last;
+
+// the byte currently on the wire, as the receiver sees it
+static bool wire_active;
+static uint64_t wire_idle_since;
+static uint64_t wire_start_time;
+static uint64_t wire_end;
+static uint8_t wire_byte;
+static uint8_t wire_sources;
+static uint8_t wire_status;
+
+// bytes other devices are going to send
+typedef struct __other_byte {
+    uint64_t start;
+    uint8_t b;
+    uint8_t status;
+    bool listen;      // first byte of a frame; wait for the wire to be free
+} OtherByte;
+
+static std::deque<OtherByte> other_tx;
+static uint64_t other_idle_at;
+
+static SimIBusObserver_t *ibus_observer;
+
+// SoftwareSerial bytes on their way in; a byte "starts" when its start bit
+// shows up, and is delivered once the receive routine's done with it
+typedef struct __soft_byte {
+    SoftwareSerial *ss;
+    uint8_t b;
+    bool deliver;
+} SoftByte;
+
+static std::multimap<uint64_t, SoftByte> soft_rx;
+static std::map<SoftwareSerial *, uint64_t> soft_rx_idle_at;
+
+static SimSoftSerialObserver_t *soft_serial_observer;
+
+static uint8_t eeprom[SIM_EEPROM_SIZE];
+static uint64_t eeprom_busy_until;
+
+// pin changes the driver's scheduled
+typedef struct __pin_event {
+    uint8_t pin;
+    uint8_t level;
+} PinEvent;
+
+static std::multimap<uint64_t, PinEvent> pin_events;
+
+// when each pin's other end will be done with what it's been given to send
+static std::map<uint8_t, uint64_t> pin_uart_idle_at;
+
+// the pin being listened to; uart_bit is the bit to be sampled at
+// uart_next_sample, 0 while waiting for a start bit
+static bool uart_listening;
+static uint8_t uart_pin;
+static long uart_baud;
+static SimPinUartObserver_t *uart_observer;
+static uint64_t uart_start;
+static uint64_t uart_next_sample;
+static uint8_t uart_bit;
+static uint8_t uart_byte;
+
+// watchdog
+static bool wdt_on;
+static uint64_t wdt_timeout;
+static uint64_t wdt_last_reset;
+static unsigned long wdt_resets;
+static SimWatchdogHandler_t *wdt_handler;
+// }}}
+
+// {{{ service
+// INT0 is PD2, INT1 PD3
+#define EXT_INT_PIN(_n) (2 + (_n))
+
+// ISCn1:0 of 0 is a low level, which isn't latched
+static bool ext_int_due(uint8_t n) {
+    if (((regs[SIM_REG_EICRA] >> (2 * n)) & 0x03) == 0) {
+        return (sim_pin_get(EXT_INT_PIN(n)) == 0);
+    }
+
+    return (regs[SIM_REG_EIFR] & _BV(INTF0 + n));
+}
+
+static SimVector pending_vector() {
+    for (uint8_t n = 0; n < 2; n++) {
+        if ((regs[SIM_REG_EIMSK] & _BV(INT0 + n)) && ext_int_due(n)) {
+            return (SimVector) (SIM_VECT_INT0 + n);
+        }
+    }
+
+    uint8_t pcint = regs[SIM_REG_PCIFR] & regs[SIM_REG_PCICR];
+
+    for (uint8_t n = 0; n < 3; n++) {
+        if (pcint & _BV(n)) {
+            return (SimVector) (SIM_VECT_PCINT0 + n);
+        }
+    }
+
+    if ((regs[SIM_REG_TIFR2] & _BV(OCF2A)) && (regs[SIM_REG_TIMSK2] & _BV(OCIE2A))) {
+        return SIM_VECT_TIMER2_COMPA;
+    }
+
+    uint8_t t1_flags = regs[SIM_REG_TIFR1] & regs[SIM_REG_TIMSK1];
+
+    if (t1_flags & _BV(ICF1)) {
+        return SIM_VECT_TIMER1_CAPT;
+    }
+
+    if (t1_flags & _BV(OCF1A)) {
+        return SIM_VECT_TIMER1_COMPA;
+    }
+
+    if (t1_flags & _BV(OCF1B)) {
+        return SIM_VECT_TIMER1_COMPB;
+    }
+
+    uint8_t ucsr0b = regs[SIM_REG_UCSR0B];
+
+    if ((rx_count > 0) && (ucsr0b & _BV(RXCIE0))) {
+        return SIM_VECT_USART_RX;
+    }
+
+    if ((! udr_full) && (ucsr0b & _BV(UDRIE0))) {
+        return SIM_VECT_USART_UDRE;
+    }
+
+    if (txc && (ucsr0b & _BV(TXCIE0))) {
+        return SIM_VECT_USART_TX;
+    }
+
+    return SIM_VECT_COUNT;
+}
+
+static void dispatch(SimVector vect) {
+    void (*handler)(void) = NULL;
+
+    switch (vect) {
+        case SIM_VECT_INT0:
+        case SIM_VECT_INT1:
+            regs[SIM_REG_EIFR] &= ~_BV(INTF0 + (vect - SIM_VECT_INT0));
+            handler = (vect == SIM_VECT_INT0) ? INT0_vect : INT1_vect;
+            break;
+
+        case SIM_VECT_PCINT0:
+            regs[SIM_REG_PCIFR] &= ~_BV(PCIF0);
+            handler = PCINT0_vect;
+            break;
+
+        case SIM_VECT_PCINT1:
+            regs[SIM_REG_PCIFR] &= ~_BV(PCIF1);
+            handler = PCINT1_vect;
+            break;
+
+        case SIM_VECT_PCINT2:
+            regs[SIM_REG_PCIFR] &= ~_BV(PCIF2);
+            handler = PCINT2_vect;
+            break;
+
+        case SIM_VECT_TIMER2_COMPA:
+            // cleared by hardware when the handler runs
+            regs[SIM_REG_TIFR2] &= ~_BV(OCF2A);
+            handler = TIMER2_COMPA_vect;
+            break;
+
+        case SIM_VECT_TIMER1_CAPT:
+            regs[SIM_REG_TIFR1] &= ~_BV(ICF1);
+            handler = TIMER1_CAPT_vect;
+            break;
+
+        case SIM_VECT_TIMER1_COMPA:
+            regs[SIM_REG_TIFR1] &= ~_BV(OCF1A);
+            handler = TIMER1_COMPA_vect;
+            break;
+
+        case SIM_VECT_TIMER1_COMPB:
+            regs[SIM_REG_TIFR1] &= ~_BV(OCF1B);
+            handler = TIMER1_COMPB_vect;
+            break;
+
+        case SIM_VECT_USART_RX: {
+            uint64_t waited = now - rx_fifo[0].received_at;
+
+            if (waited > isr_stats[vect].worst_latency_cycles) {
+                isr_stats[vect].worst_latency_cycles = waited;
+            }
+
+            handler = USART_RX_vect;
+            break;
+        }
+
+        case SIM_VECT_USART_UDRE:
+            handler = USART_UDRE_vect;
+            break;
+
+        case SIM_VECT_USART_TX:
+            txc = false;
+            handler = USART_TX_vect;
+            break;
+
+        default:
+            break;
+    }
+
+    if (handler == NULL) {
+        fprintf(stderr, "[sim] bad interrupt: no handler for %s\n", vector_names[vect]);
+        exit(3);
+    }
+
+    in_isr = true;
+    regs[SIM_REG_SREG] &= ~_BV(SREG_I);
+
+    uint64_t start = sim_host_cycles();
+    handler();
+    uint64_t elapsed = sim_host_cycles() - start;
+
+    sim_sync_ports();
+
+    regs[SIM_REG_SREG] |= _BV(SREG_I);
+    in_isr = false;
+
+    SimIsrStats *stats = &isr_stats[vect];
+    stats->calls += 1;
+    stats->host_cycles += elapsed;
+
+    if (elapsed > stats->worst_host_cycles) {
+        stats->worst_host_cycles = elapsed;
+    }
+}
+
+// runs every handler that's due, if the CPU's in a state to take them
+static void service() {
+    sim_sync_ports();
+
+    if (in_isr || sleeping || (! (regs[SIM_REG_SREG] & _BV(SREG_I))) || (now < busy_until)) {
+        return;
+    }
+
+    for (unsigned long n = 0; ; n++) {
+        SimVector vect = pending_vector();
+
+        if (vect == SIM_VECT_COUNT) {
+            return;
+        }
+
+        if (n == MAX_ISRS_PER_SERVICE) {
+            fprintf(stderr, "[sim] interrupt storm: %s never cleared\n", vector_names[vect]);
+            exit(3);
+        }
+
+        dispatch(vect);
+    }
+}
+// }}}
+
+// {{{ timer1
+// external clock sources aren't modelled, and count as stopped
+static const uint16_t t1_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static uint16_t t1_div() {
+    return t1_prescale[regs[SIM_REG_TCCR1B] & 0x07];
+}
+
+static uint16_t t1_count() {
+    uint16_t div = t1_div();
+
+    if (div == 0) {
+        return t1_stopped_count;
+    }
+
+    return (uint16_t) ((((int64_t) now) - t1_origin) / div);
+}
+
+// works out when the counter next becomes OCR1A and OCR1B
+static void t1_schedule() {
+    uint16_t div = t1_div();
+
+    for (uint8_t n = 0; n < 2; n++) {
+        if ((div == 0) || powered_down) {
+            t1_next_match[n] = NEVER;
+            continue;
+        }
+
+        uint64_t ticks = (((int64_t) now) - t1_origin) / div;
+        uint16_t delta = ocr1[n] - (uint16_t) ticks;
+
+        t1_next_match[n] = t1_origin + ((ticks + (delta ? delta : 65536UL)) * div);
+    }
+}
+
+static void t1_set_count(uint16_t count) {
+    uint16_t div = t1_div();
+
+    if (div == 0) {
+        t1_stopped_count = count;
+    } else {
+        t1_origin = ((int64_t) now) - ((int64_t) count * div);
+    }
+
+    t1_schedule();
+}
+
+// ICP1 is PB0; the edge that's captured is the one ICES1 selects
+#define ICP1_PIN 8
+
+static void t1_pin_changed(uint8_t level) {
+    if ((t1_div() == 0) || powered_down) {
+        return;
+    }
+
+    if ((level != 0) == ((regs[SIM_REG_TCCR1B] & _BV(ICES1)) != 0)) {
+        icr1 = t1_count();
+        regs[SIM_REG_TIFR1] |= _BV(ICF1);
+    }
+}
+// }}}
+
+// {{{ timer2
+static const uint16_t t2_prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+static uint16_t t2_div() {
+    return t2_prescale[regs[SIM_REG_TCCR2B] & 0x07];
+}
+
+static uint8_t t2_count() {
+    uint16_t div = t2_div();
+
+    if (div == 0) {
+        return t2_stopped_count;
+    }
+
+    return (uint8_t) ((((int64_t) now) - t2_origin) / div);
+}
+
+// works out when the counter next becomes OCR2A
+static void t2_schedule() {
+    uint16_t div = t2_div();
+
+    if (div == 0) {
+        t2_next_match = NEVER;
+        return;
+    }
+
+    uint64_t ticks = (((int64_t) now) - t2_origin) / div;
+    uint8_t delta = regs[SIM_REG_OCR2A] - (uint8_t) ticks;
+
+    t2_next_match = t2_origin + ((ticks + (delta ? delta : 256)) * div);
+}
+
+static void t2_set_count(uint8_t count) {
+    uint16_t div = t2_div();
+
+    if (div == 0) {
+        t2_stopped_count = count;
+    } else {
+        t2_origin = ((int64_t) now) - ((int64_t) count * div);
+    }
+
+    t2_schedule();
+}
+// }}}
+
+// {{{ wire
+static uint32_t usart_bit_cycles() {
+    uint16_t ubrr = ((regs[SIM_REG_UBRR0H] & 0x0F) << 8) | regs[SIM_REG_UBRR0L];
+
+    return ((regs[SIM_REG_UCSR0A] & _BV(U2X0)) ? 8UL : 16UL) * (ubrr + 1);
+}
+
+static uint32_t usart_frame_cycles() {
+    uint8_t ucsr0c = regs[SIM_REG_UCSR0C];
+
+    // start bit, data bits, parity, stop bit(s)
+    uint8_t bits = 1 +
+        (5 + ((ucsr0c >> UCSZ00) & 0x03)) +
+        ((ucsr0c & _BV(UPM01)) ? 1 : 0) +
+        ((ucsr0c & _BV(USBS0)) ? 2 : 1);
+
+    return bits * usart_bit_cycles();
+}
+
+// a sender's start bit; the receiver locks on to the first one, and
+// anything that overlaps it is mixed in
+static void wire_start(uint8_t b, uint8_t source, uint8_t status, uint32_t frame_cycles, uint32_t bit_cycles) {
+    if (! wire_active) {
+        wire_active = true;
+        wire_start_time = now;
+        wire_end = now + frame_cycles;
+        wire_byte = b;
+        wire_sources = source;
+        wire_status = status;
+        return;
+    }
+
+    wire_byte &= b;
+    wire_sources |= source;
+    wire_status |= status;
+
+    if ((now - wire_start_time) >= bit_cycles) {
+        wire_status |= _BV(FE0);
+    }
+}
+
+static void wire_receive() {
+    wire_active = false;
+    wire_idle_since = now;
+
+    uint8_t status = wire_status;
+
+    // the receiver has no clock in power-down
+    if ((regs[SIM_REG_UCSR0B] & _BV(RXEN0)) && (! powered_down)) {
+        if (rx_count < 2) {
+            rx_fifo[rx_count].b = wire_byte;
+            rx_fifo[rx_count].status = status;
+            rx_fifo[rx_count].received_at = now;
+            rx_count += 1;
+        } else {
+            // no room; the newest byte in the FIFO reports the overrun
+            rx_fifo[1].status |= _BV(DOR0);
+            status |= _BV(DOR0);
+        }
+    }
+
+    if (ibus_observer != NULL) {
+        ibus_observer(now, wire_byte, wire_sources, status);
+    }
+}
+// }}}
+
+// {{{ usart transmitter
+static void shift_start(uint8_t b) {
+    uint32_t frame_cycles = usart_frame_cycles();
+
+    shift_busy = true;
+    shift_end = now + frame_cycles;
+
+    wire_start(b, SIM_IBUS_US, 0, frame_cycles, usart_bit_cycles());
+}
+
+static void shift_done() {
+    shift_busy = false;
+
+    if (udr_full) {
+        udr_full = false;
+        shift_start(udr_tx);
+    } else {
+        txc = true;
+    }
+}
+// }}}
+
+// {{{ sim_reg_read
+uint8_t sim_reg_read(uint8_t id) {
+    switch (id) {
+        case SIM_REG_TCNT0:
+            // timer0 runs at Fcpu/64 for millis()
+            return (uint8_t) (sim_io_clock() / 64);
+
+        case SIM_REG_TCNT2:
+            return t2_count();
+
+        case SIM_REG_UCSR0A: {
+            uint8_t value = regs[SIM_REG_UCSR0A] & (_BV(U2X0) | _BV(MPCM0));
+
+            if (rx_count > 0) {
+                value |= _BV(RXC0) | rx_fifo[0].status;
+            }
+
+            if (txc) {
+                value |= _BV(TXC0);
+            }
+
+            if (! udr_full) {
+                value |= _BV(UDRE0);
+            }
+
+            return value;
+        }
+
+        case SIM_REG_UDR0:
+            if (rx_count > 0) {
+                udr_last = rx_fifo[0].b;
+                rx_fifo[0] = rx_fifo[1];
+                rx_count -= 1;
+            }
+
+            return udr_last;
+
+        default:
+            return regs[id];
+    }
+}
+// }}}
+
+// {{{ sim_reg_write
+void sim_reg_write(uint8_t id, uint8_t value) {
+    switch (id) {
+        case SIM_REG_TCNT0:
+            // read-only here; millis() can't be turned back
+            break;
+
+        case SIM_REG_TCCR1B: {
+            uint16_t count = t1_count();
+            regs[id] = value;
+            t1_set_count(count);
+            break;
+        }
+
+        case SIM_REG_TCCR2B: {
+            uint8_t count = t2_count();
+            regs[id] = value;
+            t2_set_count(count);
+            break;
+        }
+
+        case SIM_REG_TCNT2:
+            t2_set_count(value);
+            break;
+
+        case SIM_REG_OCR2A:
+            regs[id] = value;
+            t2_schedule();
+            break;
+
+        case SIM_REG_TIFR1:
+        case SIM_REG_TIFR2:
+        case SIM_REG_EIFR:
+        case SIM_REG_PCIFR:
+            // flags are cleared by writing a one
+            regs[id] &= ~value;
+            break;
+
+        case SIM_REG_UCSR0A:
+            regs[id] = value & (_BV(U2X0) | _BV(MPCM0));
+
+            if (value & _BV(TXC0)) {
+                txc = false;
+            }
+            break;
+
+        case SIM_REG_UCSR0B:
+            if ((regs[id] & _BV(RXEN0)) && (! (value & _BV(RXEN0)))) {
+                // disabling the receiver flushes it
+                rx_count = 0;
+            }
+
+            regs[id] = value;
+            break;
+
+        case SIM_REG_UDR0:
+            if (! (regs[SIM_REG_UCSR0B] & _BV(TXEN0))) {
+                break;
+            }
+
+            if (! shift_busy) {
+                shift_start(value);
+            } else {
+                // overwrites a byte that's still waiting, as the real
+                // thing would
+                udr_full = true;
+                udr_tx = value;
+            }
+            break;
+
+        default:
+            regs[id] = value;
+            break;
+    }
+
+    // enabling an interrupt, or turning interrupts back on, can make a
+    // handler due right away
+    service();
+}
+// }}}
+
+// {{{ sim_reg16_read / sim_reg16_write
+uint16_t sim_reg16_read(uint8_t id) {
+    switch (id) {
+        case SIM_REG16_TCNT1:
+            return t1_count();
+
+        case SIM_REG16_ICR1:
+            return icr1;
+
+        case SIM_REG16_OCR1A:
+            return ocr1[0];
+
+        case SIM_REG16_OCR1B:
+            return ocr1[1];
+
+        default:
+            return 0;
+    }
+}
+
+void sim_reg16_write(uint8_t id, uint16_t value) {
+    switch (id) {
+        case SIM_REG16_TCNT1:
+            t1_set_count(value);
+            break;
+
+        case SIM_REG16_ICR1:
+            icr1 = value;
+            break;
+
+        case SIM_REG16_OCR1A:
+        case SIM_REG16_OCR1B:
+            ocr1[id - SIM_REG16_OCR1A] = value;
+            t1_schedule();
+            break;
+
+        default:
+            break;
+    }
+
+    service();
+}
+// }}}
+
+// {{{ sim_init
+void sim_init() {
+    now = 0;
+    busy_until = 0;
+    in_isr = false;
+
+    sleeping = false;
+    powered_down = false;
+    io_stopped = 0;
+    power_state = SIM_POWER_ACTIVE;
+
+    memset(regs, 0, sizeof(regs));
+
+    t1_origin = 0;
+    t1_stopped_count = 0;
+    icr1 = 0;
+    ocr1[0] = ocr1[1] = 0;
+    t1_next_match[0] = t1_next_match[1] = NEVER;
+
+    t2_origin = 0;
+    t2_stopped_count = 0;
+    t2_next_match = NEVER;
+
+    udr_full = false;
+    shift_busy = false;
+    txc = false;
+    rx_count = 0;
+    udr_last = 0;
+
+    wire_active = false;
+    wire_idle_since = 0;
+    other_tx.clear();
+    other_idle_at = 0;
+    ibus_observer = NULL;
+
+    soft_rx.clear();
+    soft_rx_idle_at.clear();
+    soft_serial_observer = NULL;
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    eeprom_busy_until = 0;
+    pin_events.clear();
+    pin_uart_idle_at.clear();
+    uart_listening = false;
+
+    wdt_on = false;
+    wdt_resets = 0;
+    wdt_handler = NULL;
+
+    sim_reset_pins();
+    sim_reset_isr_stats();
+    sim_reset_power_stats();
+}
+// }}}
+
+// {{{ sim_now / sim_io_clock
+uint64_t sim_now() {
+    return now;
+}
+
+uint64_t sim_io_clock() {
+    return now - io_stopped;
+}
+// }}}
+
+// {{{ current_ua
+static double current_ua() {
+    static const double state_ua[SIM_POWER_STATE_COUNT] = {
+        SIM_UA_ACTIVE,
+        SIM_UA_IDLE,
+        SIM_UA_POWER_DOWN,
+    };
+
+    double ua = state_ua[power_state] + SIM_UA_BOD + sim_pin_load_ua();
+
+    if (wdt_on) {
+        ua += SIM_UA_WDT;
+    }
+
+    if (regs[SIM_REG_ADCSRA] & _BV(ADEN)) {
+        ua += SIM_UA_ADC;
+    }
+
+    return ua;
+}
+// }}}
+
+// {{{ move_clock
+// the only place the clock moves; the current drawn on the way is added up
+static void move_clock(uint64_t t) {
+    uint64_t elapsed = t - now;
+
+    if (elapsed != 0) {
+        power_stats.cycles[power_state] += elapsed;
+        power_stats.ua_cycles[power_state] += current_ua() * elapsed;
+    }
+
+    now = t;
+}
+// }}}
+
+// {{{ pin uart
+// the middle of bit n of the byte being listened to; the start bit's 0
+static uint64_t uart_bit_time(uint8_t n) {
+    return uart_start + (((2 * n + 1) * (uint64_t) F_CPU) / (2 * uart_baud));
+}
+
+static void uart_sample() {
+    uint8_t level = sim_pin_get(uart_pin);
+
+    if (uart_bit < 9) {
+        // data, LSB first
+        uart_byte >>= 1;
+
+        if (level) {
+            uart_byte |= 0x80;
+        }
+
+        uart_bit += 1;
+        uart_next_sample = uart_bit_time(uart_bit);
+        return;
+    }
+
+    uart_bit = 0;
+
+    if (level && (uart_observer != NULL)) {
+        uart_observer(uart_pin, uart_byte);
+    }
+}
+// }}}
+
+// {{{ next_event
+static uint64_t next_event() {
+    uint64_t t = t2_next_match;
+
+    for (uint8_t n = 0; n < 2; n++) {
+        if (t1_next_match[n] < t) {
+            t = t1_next_match[n];
+        }
+    }
+
+    if (uart_listening && (uart_bit != 0) && (uart_next_sample < t)) {
+        t = uart_next_sample;
+    }
+
+    if (wire_active && (wire_end < t)) {
+        t = wire_end;
+    }
+
+    if (shift_busy && (shift_end < t)) {
+        t = shift_end;
+    }
+
+    if ((! other_tx.empty()) && (other_tx.front().start < t)) {
+        t = other_tx.front().start;
+    }
+
+    if ((! soft_rx.empty()) && (soft_rx.begin()->first < t)) {
+        t = soft_rx.begin()->first;
+    }
+
+    if ((! pin_events.empty()) && (pin_events.begin()->first < t)) {
+        t = pin_events.begin()->first;
+    }
+
+    if (wdt_on && ((wdt_last_reset + wdt_timeout) < t)) {
+        t = wdt_last_reset + wdt_timeout;
+    }
+
+    // interrupts that were held off become due
+    if ((busy_until > now) && (busy_until < t)) {
+        t = busy_until;
+    }
+
+    return t;
+}
+// }}}
+
+// {{{ run_events
+// everything that happens at exactly now, in the order the hardware would
+// see it: the receiver samples the stop bit before the transmitter's done
+// with it, and a new start bit can follow straight on
+static void run_events() {
+    if (wire_active && (wire_end == now)) {
+        wire_receive();
+    }
+
+    if (shift_busy && (shift_end == now)) {
+        shift_done();
+    }
+
+    while ((! other_tx.empty()) && (other_tx.front().start == now)) {
+        OtherByte ob = other_tx.front();
+
+        if (ob.listen) {
+            uint64_t clear = (wire_active ? wire_end : wire_idle_since) + SIM_IBUS_OTHER_GAP;
+
+            if (clear > now) {
+                // somebody's talking; everything still to be sent slips
+                // until the wire's been free for long enough
+                uint64_t delay = clear - now;
+
+                for (size_t i = 0; i < other_tx.size(); i++) {
+                    other_tx[i].start += delay;
+                }
+
+                other_idle_at += delay;
+                break;
+            }
+        }
+
+        other_tx.pop_front();
+
+        wire_start(ob.b, SIM_IBUS_OTHER, ob.status, 11 * SIM_IBUS_BIT_CYCLES, SIM_IBUS_BIT_CYCLES);
+    }
+
+    if (t2_next_match == now) {
+        regs[SIM_REG_TIFR2] |= _BV(OCF2A);
+
+        // 256 ticks from now
+        t2_schedule();
+    }
+
+    if ((t1_next_match[0] == now) || (t1_next_match[1] == now)) {
+        regs[SIM_REG_TIFR1] |= ((t1_next_match[0] == now) ? _BV(OCF1A) : 0) |
+                               ((t1_next_match[1] == now) ? _BV(OCF1B) : 0);
+
+        t1_schedule();
+    }
+
+    if (uart_listening && (uart_bit != 0) && (uart_next_sample == now)) {
+        uart_sample();
+    }
+
+    while ((! soft_rx.empty()) && (soft_rx.begin()->first == now)) {
+        SoftByte sb = soft_rx.begin()->second;
+        soft_rx.erase(soft_rx.begin());
+
+        uint32_t bit_cycles = sb.ss->getBitCycles();
+
+        if (sb.deliver) {
+            sb.ss->receive(sb.b);
+        } else if (bit_cycles != 0) {
+            // NewSoftSerial's pin change handler reads the whole byte
+            // with interrupts off, and leaves halfway into the stop bit
+            uint64_t done = now + (19 * bit_cycles) / 2;
+
+            if (busy_until < done) {
+                busy_until = done;
+            }
+
+            sb.deliver = true;
+            soft_rx.insert(std::make_pair(done, sb));
+        }
+    }
+
+    while ((! pin_events.empty()) && (pin_events.begin()->first == now)) {
+        PinEvent pe = pin_events.begin()->second;
+        pin_events.erase(pin_events.begin());
+
+        sim_pin_set(pe.pin, pe.level);
+    }
+
+    if (wdt_on && ((wdt_last_reset + wdt_timeout) == now)) {
+        wdt_resets += 1;
+        wdt_last_reset = now;
+        regs[SIM_REG_MCUSR] |= _BV(WDRF);
+
+        if (wdt_handler != NULL) {
+            wdt_handler();
+        } else {
+            fprintf(stderr, "[sim] watchdog reset at %.3f ms\n", (double) now / SIM_CYCLES_PER_MS);
+            exit(3);
+        }
+    }
+}
+// }}}
+
+// {{{ sim_run_until / sim_advance / sim_stall
+void sim_run_until(uint64_t when) {
+    service();
+
+    for (;;) {
+        uint64_t t = next_event();
+
+        if (t > when) {
+            break;
+        }
+
+        move_clock(t);
+
+        run_events();
+        service();
+    }
+
+    if (when > now) {
+        move_clock(when);
+        service();
+    }
+}
+
+void sim_advance(uint64_t cycles) {
+    sim_run_until(now + cycles);
+}
+
+void sim_stall(uint64_t cycles) {
+    uint64_t end = now + cycles;
+
+    if (busy_until < end) {
+        busy_until = end;
+    }
+
+    sim_run_until(end);
+}
+// }}}
+
+// {{{ sim_sleep
+void sim_sleep() {
+    uint8_t smcr = regs[SIM_REG_SMCR];
+
+    if (! (smcr & _BV(SE))) {
+        return;
+    }
+
+    bool deep = ((smcr & (_BV(SM0) | _BV(SM1) | _BV(SM2))) != 0);
+    uint64_t slept_at = now;
+
+    sleeping = true;
+    power_stats.sleeps += 1;
+
+    if (deep) {
+        powered_down = true;
+        power_state = SIM_POWER_DOWN;
+        t2_next_match = NEVER;
+        t1_schedule();
+    } else {
+        power_state = SIM_POWER_IDLE;
+    }
+
+    for (;;) {
+        SimVector vect = pending_vector();
+
+        // only external interrupts and pin changes have no clock to wait
+        // for, and they come first
+        if ((vect != SIM_VECT_COUNT) && ((! deep) || (vect <= SIM_VECT_PCINT2))) {
+            break;
+        }
+
+        uint64_t t = next_event();
+
+        if (t == NEVER) {
+            fprintf(stderr, "[sim] asleep at %.3f ms with nothing to wake it\n", (double) now / SIM_CYCLES_PER_MS);
+            exit(3);
+        }
+
+        move_clock(t);
+        run_events();
+    }
+
+    if (deep) {
+        // the oscillator starts up again
+        uint64_t running_at = now + SIM_WAKE_CYCLES;
+
+        for (uint64_t t = next_event(); t <= running_at; t = next_event()) {
+            move_clock(t);
+            run_events();
+        }
+
+        move_clock(running_at);
+
+        // the timers pick up where they stopped
+        uint64_t stopped = now - slept_at;
+
+        io_stopped += stopped;
+        t1_origin += stopped;
+        t2_origin += stopped;
+        t2_schedule();
+
+        powered_down = false;
+        t1_schedule();
+    }
+
+    sleeping = false;
+    power_state = SIM_POWER_ACTIVE;
+
+    service();
+}
+// }}}
+
+// {{{ sim_power_stats / sim_reset_power_stats / sim_power_state
+const SimPowerStats *sim_power_stats() {
+    return &power_stats;
+}
+
+void sim_reset_power_stats() {
+    memset(&power_stats, 0, sizeof(power_stats));
+}
+
+SimPowerState sim_power_state() {
+    return power_state;
+}
+// }}}
+
+// {{{ sim_pin_changed / sim_pin_schedule
+// called by the pins for every change of level, inputs and outputs alike
+void sim_pin_changed(uint8_t pin, uint8_t level) {
+    if (pin == ICP1_PIN) {
+        t1_pin_changed(level);
+    }
+
+    if (uart_listening && (pin == uart_pin) && (uart_bit == 0) && (! level)) {
+        uart_start = now;
+        uart_bit = 1;
+        uart_byte = 0;
+        uart_next_sample = uart_bit_time(1);
+    }
+
+    for (uint8_t n = 0; n < 2; n++) {
+        if (pin != EXT_INT_PIN(n)) {
+            continue;
+        }
+
+        // edges are only seen while the I/O clock's running
+        uint8_t isc = (regs[SIM_REG_EICRA] >> (2 * n)) & 0x03;
+
+        if (
+            (! powered_down) &&
+            ((isc == 1) || ((isc == 2) && (! level)) || ((isc == 3) && level))
+        ) {
+            regs[SIM_REG_EIFR] |= _BV(INTF0 + n);
+        }
+    }
+
+    // port B is PCINT0-7, port C PCINT8-14 and port D PCINT16-23; pin
+    // changes are asynchronous
+    uint8_t group;
+    uint8_t mask_id;
+
+    switch (digitalPinToPort(pin)) {
+        case PB:
+            group = 0;
+            mask_id = SIM_REG_PCMSK0;
+            break;
+
+        case PC:
+            group = 1;
+            mask_id = SIM_REG_PCMSK1;
+            break;
+
+        default:
+            group = 2;
+            mask_id = SIM_REG_PCMSK2;
+            break;
+    }
+
+    if (regs[mask_id] & digitalPinToBitMask(pin)) {
+        regs[SIM_REG_PCIFR] |= _BV(PCIF0 + group);
+    }
+
+    service();
+}
+
+void sim_pin_schedule(uint64_t when, uint8_t pin, uint8_t level) {
+    PinEvent pe = { pin, level };
+
+    pin_events.insert(std::make_pair((when > now) ? when : now, pe));
+}
+// }}}
+
+// {{{ sim_cli / sim_sei
+void sim_cli() {
+    regs[SIM_REG_SREG] &= ~_BV(SREG_I);
+}
+
+void sim_sei() {
+    regs[SIM_REG_SREG] |= _BV(SREG_I);
+    service();
+}
+// }}}
+
+// {{{ sim_isr_stats / sim_reset_isr_stats
+const SimIsrStats *sim_isr_stats(SimVector vect) {
+    return &isr_stats[vect];
+}
+
+void sim_reset_isr_stats() {
+    memset(isr_stats, 0, sizeof(isr_stats));
+
+    for (uint8_t i = 0; i < SIM_VECT_COUNT; i++) {
+        isr_stats[i].name = vector_names[i];
+    }
+}
+// }}}
+
+// {{{ sim_ibus_send / sim_ibus_send_byte
+static void queue_other_byte(uint8_t b, uint8_t status, bool listen) {
+    OtherByte ob;
+
+    ob.start = (other_idle_at > now) ? other_idle_at : now;
+    ob.b = b;
+    ob.status = status;
+    ob.listen = listen;
+
+    other_tx.push_back(ob);
+    other_idle_at = ob.start + (11 * SIM_IBUS_BIT_CYCLES);
+}
+
+void sim_ibus_send_byte(uint8_t b, uint8_t status) {
+    queue_other_byte(b, status, false);
+}
+
+void sim_ibus_send(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        queue_other_byte(data[i], 0, i == 0);
+    }
+}
+
+uint64_t sim_ibus_other_idle_at() {
+    return (other_idle_at > now) ? other_idle_at : now;
+}
+
+void sim_set_ibus_observer(SimIBusObserver_t *observer) {
+    ibus_observer = observer;
+}
+// }}}
+
+// {{{ sim_pin_uart_send / sim_pin_uart_listen
+void sim_pin_uart_send(uint8_t pin, const uint8_t *data, size_t len, long baud) {
+    uint64_t start = pin_uart_idle_at[pin];
+
+    if (start < now) {
+        start = now;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        // start bit low, data LSB first, stop bit high
+        uint16_t frame = (data[i] << 1) | 0x200;
+
+        for (uint8_t n = 0; n < 10; n++) {
+            uint64_t edge = start + ((n * (uint64_t) F_CPU) + (baud / 2)) / baud;
+
+            sim_pin_schedule(edge, pin, (frame >> n) & 1);
+        }
+
+        start += ((10 * (uint64_t) F_CPU) + (baud / 2)) / baud;
+    }
+
+    pin_uart_idle_at[pin] = start;
+}
+
+void sim_pin_uart_listen(uint8_t pin, long baud, SimPinUartObserver_t *observer) {
+    uart_listening = (baud != 0);
+    uart_pin = pin;
+    uart_baud = baud;
+    uart_observer = observer;
+    uart_bit = 0;
+}
+// }}}
+
+// {{{ sim_soft_serial_send
+void sim_soft_serial_send(uint8_t rx_pin, const uint8_t *data, size_t len) {
+    SoftwareSerial *ss = SoftwareSerial::findByReceivePin(rx_pin);
+
+    // nobody's listening
+    if ((ss == NULL) || (ss->getBitCycles() == 0)) {
+        return;
+    }
+
+    uint64_t start = soft_rx_idle_at[ss];
+
+    if (start < now) {
+        start = now;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        SoftByte sb = { ss, data[i], false };
+        soft_rx.insert(std::make_pair(start, sb));
+
+        // start, 8 data bits, stop
+        start += 10 * ss->getBitCycles();
+    }
+
+    soft_rx_idle_at[ss] = start;
+}
+
+void sim_set_soft_serial_observer(SimSoftSerialObserver_t *observer) {
+    soft_serial_observer = observer;
+}
+
+void sim_soft_serial_wrote(uint8_t tx_pin, uint8_t b) {
+    if (soft_serial_observer != NULL) {
+        soft_serial_observer(tx_pin, b);
+    }
+}
+// }}}
+
+// {{{ EEPROM
+uint8_t *sim_eeprom() {
+    return eeprom;
+}
+
+bool eeprom_is_ready() {
+    return (now >= eeprom_busy_until);
+}
+
+// avr-libc spins on EEPE before touching the EEPROM
+static void eeprom_busy_wait() {
+    if (! eeprom_is_ready()) {
+        sim_advance(eeprom_busy_until - now);
+    }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+    eeprom_busy_wait();
+    return eeprom[((uintptr_t) addr) % SIM_EEPROM_SIZE];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value) {
+    eeprom_busy_wait();
+    eeprom[((uintptr_t) addr) % SIM_EEPROM_SIZE] = value;
+    eeprom_busy_until = now + SIM_EEPROM_WRITE_CYCLES;
+}
+
+void eeprom_read_block(void *dest, const void *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        ((uint8_t *) dest)[i] = eeprom_read_byte((const uint8_t *) src + i);
+    }
+}
+
+void eeprom_write_block(const void *src, void *dest, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        eeprom_write_byte((uint8_t *) dest + i, ((const uint8_t *) src)[i]);
+    }
+}
+// }}}
+
+// {{{ watchdog
+void sim_wdt_enable(uint8_t timeout) {
+    wdt_on = true;
+    wdt_timeout = (16ULL << timeout) * SIM_CYCLES_PER_MS;
+    wdt_last_reset = now;
+}
+
+void sim_wdt_disable() {
+    wdt_on = false;
+}
+
+void sim_wdt_reset() {
+    wdt_last_reset = now;
+}
+
+void sim_set_watchdog_handler(SimWatchdogHandler_t *handler) {
+    wdt_handler = handler;
+}
+
+unsigned long sim_watchdog_resets() {
+    return wdt_resets;
+}
+// }}}
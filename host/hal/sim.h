@@ -0,0 +1,311 @@
+#ifndef SIM_H
+#define SIM_H
+
+/*
+    Simulated ATmega168 peripherals for building the firmware on a
+    workstation.
+
+    The headers in this directory stand in for the Arduino core and avr-libc
+    (WProgram.h, avr/io.h, SoftwareSerial.h and friends), so the firmware
+    sources compile unchanged.  Registers with side effects (USART0, timer2,
+    SREG) are objects whose reads and writes are routed here; everything
+    else is plain memory.
+
+    Time is virtual and counted in CPU cycles at F_CPU.  Firmware code takes
+    no virtual time at all; the clock only moves when the driver calls
+    sim_advance() (or the firmware calls delay(), or blocks in
+    SoftwareSerial).  As the clock moves, the peripherals are stepped from
+    one event to the next and interrupt handlers are called whenever their
+    flag and enable bits are set and interrupts are on, highest priority
+    first, just like the real thing.
+
+    Modelled:
+      • the IBus wire, at the bit rate programmed into UBRR0.  Every byte on
+        the wire, ours or another device's, is received by USART0 (2-byte
+        receive FIFO, data overrun).  Bytes from different senders that
+        overlap are received once, wired-AND, with a framing error if they
+        didn't start on the same bit.
+      • USART0 transmit: data register, shift register, UDRE and TXC.
+      • timer0 as set up by the Arduino core (Fcpu/64; millis(), micros()).
+      • timer1 in normal mode at any prescaler: the counter, compare A and
+        B, and input capture on ICP1 (pin 8), as far as the interrupt flags
+        go.  The OC1A/OC1B pins and the noise canceller aren't modelled.
+      • timer2 counter and compare A, at any prescaler.
+      • SoftwareSerial, NewSoftSerial style: a 64-byte receive buffer, and
+        interrupts are off for a whole character while one's being sent or
+        received.
+      • digital pins, with INT0/INT1 and the pin change interrupts, the
+        EEPROM, and the watchdog.  Outputs follow digitalWrite() and writes
+        to PORTx alike.
+      • serial lines on plain pins, 8N1 at a given baud rate, from outside
+        in and the firmware's output back out; see sim_pin_uart_send().
+      • sleep: idle, and power-down (every other mode is taken to be
+        power-down).  In power-down the I/O clock stops, so timers don't
+        count, millis() stands still and INT0/INT1 only see a low level;
+        anything else the firmware leaves running is assumed to be idle.
+      • supply current, from the sleep mode and what's left on; see
+        SIM_UA_ACTIVE.
+
+    Host time spent in each interrupt handler is recorded, so the cost of
+    the real ISR code can be measured per byte or per frame.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef F_CPU
+    #define F_CPU 16000000UL
+#endif
+
+#define SIM_CYCLES_PER_MS (F_CPU / 1000UL)
+#define SIM_CYCLES_PER_US (F_CPU / 1000000UL)
+
+// interrupt vectors that can be simulated, in priority order
+typedef enum __sim_vector {
+    SIM_VECT_INT0,
+    SIM_VECT_INT1,
+    SIM_VECT_PCINT0,
+    SIM_VECT_PCINT1,
+    SIM_VECT_PCINT2,
+    SIM_VECT_TIMER2_COMPA,
+    SIM_VECT_TIMER1_CAPT,
+    SIM_VECT_TIMER1_COMPA,
+    SIM_VECT_TIMER1_COMPB,
+    SIM_VECT_USART_RX,
+    SIM_VECT_USART_UDRE,
+    SIM_VECT_USART_TX,
+    SIM_VECT_COUNT
+} SimVector;
+
+typedef struct __sim_isr_stats {
+    const char *name;
+    unsigned long calls;
+    uint64_t host_cycles;      // host time spent in the handler
+    uint64_t worst_host_cycles;
+
+    // USART_RX only: the longest a received byte waited for its handler,
+    // from the middle of its stop bit
+    uint64_t worst_latency_cycles;
+} SimIsrStats;
+
+// who put a byte on the IBus wire
+#define SIM_IBUS_US    0x01
+#define SIM_IBUS_OTHER 0x02
+
+/*
+ * Called for every byte received off the IBus wire, whether or not USART0's
+ * receiver is enabled.  sources is SIM_IBUS_US and/or SIM_IBUS_OTHER (both
+ * for a collision); status has FE0, DOR0 and UPE0 as USART0 would report
+ * them.
+ */
+typedef void SimIBusObserver_t(uint64_t when, uint8_t b, uint8_t sources, uint8_t status);
+
+/*
+ * Called for every byte the firmware writes to a SoftwareSerial.
+ */
+typedef void SimSoftSerialObserver_t(uint8_t tx_pin, uint8_t b);
+
+/*
+ * Called for every byte seen on a pin that's being listened to; see
+ * sim_pin_uart_listen().
+ */
+typedef void SimPinUartObserver_t(uint8_t pin, uint8_t b);
+
+// {{{ clock
+/*
+ * Resets every peripheral and the clock.  Interrupts start out disabled;
+ * the Arduino core enables them before setup().
+ */
+void sim_init();
+
+uint64_t sim_now();
+
+/*
+ * Moves the clock forward, running peripherals and interrupt handlers on
+ * the way.
+ */
+void sim_advance(uint64_t cycles);
+void sim_run_until(uint64_t when);
+
+/*
+ * The CPU is busy with interrupts off for the given time (bit-banging in
+ * SoftwareSerial, say).  Peripherals keep running; handlers are called
+ * once it's over.
+ */
+void sim_stall(uint64_t cycles);
+
+/*
+ * Cycles the I/O clock has run for: sim_now(), less the time spent in
+ * power-down.  timer0, and so millis(), count from this.
+ */
+uint64_t sim_io_clock();
+// }}}
+
+// {{{ sleep
+/*
+ * The sleep instruction, if SE is set in SMCR: the clock moves on until an
+ * interrupt that can wake the CPU from the mode in SMCR is due, and, once
+ * the CPU's running again, it's taken if interrupts are on.  From
+ * power-down only INT0/INT1 on a low level (or a flag that was already
+ * set), a pin change or the watchdog will do, and the oscillator takes
+ * SIM_WAKE_CYCLES to start up again.  Sleeping with nothing left that could
+ * wake the CPU is reported, and the simulation exits with status 3.
+ */
+void sim_sleep();
+
+// 16K CK crystal start-up, as the Arduino fuses have it
+#define SIM_WAKE_CYCLES 16384UL
+// }}}
+
+// {{{ interrupts
+void sim_cli();
+void sim_sei();
+
+const SimIsrStats *sim_isr_stats(SimVector vect);
+void sim_reset_isr_stats();
+
+// host cycle counter used for the statistics (TSC on x86, ns elsewhere)
+uint64_t sim_host_cycles();
+extern const char *const SIM_HOST_CYCLE_UNIT;
+// }}}
+
+// {{{ IBus
+/*
+ * Another device sends a frame, once its previous bytes are out and the
+ * wire's been idle for SIM_IBUS_OTHER_GAP; the bytes go back to back.  It
+ * only looks before it starts, so the firmware can still collide with it.
+ */
+void sim_ibus_send(const uint8_t *data, size_t len);
+
+/*
+ * Another device sends a single byte, without waiting for the wire, and
+ * it's received with the given USART status bits (FE0, UPE0) forced on.
+ * For noise and collisions.
+ */
+void sim_ibus_send_byte(uint8_t b, uint8_t status);
+
+// time the last byte queued by another device will be off the wire
+uint64_t sim_ibus_other_idle_at();
+
+void sim_set_ibus_observer(SimIBusObserver_t *observer);
+
+// cycles per bit for other devices on the bus
+#define SIM_IBUS_BIT_CYCLES (F_CPU / 9600UL)
+
+// how long other devices want the wire to be quiet before starting a frame
+#define SIM_IBUS_OTHER_GAP (11 * SIM_IBUS_BIT_CYCLES)
+// }}}
+
+// {{{ pins
+/*
+ * Drives an input pin from outside.
+ */
+void sim_pin_set(uint8_t pin, uint8_t level);
+uint8_t sim_pin_get(uint8_t pin);
+
+/*
+ * The pin's driven to level at the given time, whatever the firmware's
+ * doing then; for waking it from sleep.
+ */
+void sim_pin_schedule(uint64_t when, uint8_t pin, uint8_t level);
+
+/*
+ * What an output draws while it's driven high (an LED, say), for the
+ * supply current.
+ */
+void sim_pin_set_load(uint8_t pin, uint16_t ua);
+// }}}
+
+// {{{ pin UART
+/*
+ * Another device sends bytes on pin, 8N1 at baud, back to back and after
+ * anything it's already sending there; the pin idles high.
+ */
+void sim_pin_uart_send(uint8_t pin, const uint8_t *data, size_t len, long baud);
+
+/*
+ * Decodes 8N1 at baud off pin, whoever's driving it, sampling each bit in
+ * the middle; bytes whose stop bit isn't high are dropped.  One pin at a
+ * time; a baud of 0 stops listening.
+ */
+void sim_pin_uart_listen(uint8_t pin, long baud, SimPinUartObserver_t *observer);
+// }}}
+
+// {{{ SoftwareSerial
+/*
+ * Bytes arrive at the SoftwareSerial listening on rx_pin, back to back at
+ * the baud rate it was started with.
+ */
+void sim_soft_serial_send(uint8_t rx_pin, const uint8_t *data, size_t len);
+
+void sim_set_soft_serial_observer(SimSoftSerialObserver_t *observer);
+// }}}
+
+// {{{ EEPROM
+#define SIM_EEPROM_SIZE 512
+
+/*
+ * The EEPROM's contents, for the driver to look at or preload.  It's
+ * erased (all 0xFF) by sim_init().
+ */
+uint8_t *sim_eeprom();
+
+// a byte write, erase included
+#define SIM_EEPROM_WRITE_CYCLES (34 * SIM_CYCLES_PER_MS / 10)
+// }}}
+
+// {{{ watchdog
+typedef void SimWatchdogHandler_t();
+
+/*
+ * Called when the watchdog runs out.  By default the simulation reports
+ * it and exits with status 3.
+ */
+void sim_set_watchdog_handler(SimWatchdogHandler_t *handler);
+
+unsigned long sim_watchdog_resets();
+// }}}
+
+// {{{ supply current
+/*
+    The ATmega168's supply current at 5V and 16MHz, in µA, roughly as the
+    datasheet's typical figures have it; good for comparing one way of
+    running with another rather than for sizing a regulator.  The
+    brown-out detector's on in every state, since the fuses say so, and the
+    ADC and watchdog are added while they're enabled, asleep or not, along
+    with the loads on outputs that are high.
+*/
+#define SIM_UA_ACTIVE     9000
+#define SIM_UA_IDLE       2500
+#define SIM_UA_POWER_DOWN 1
+#define SIM_UA_BOD        20
+#define SIM_UA_WDT        6
+#define SIM_UA_ADC        200
+
+typedef enum __sim_power_state {
+    SIM_POWER_ACTIVE,
+    SIM_POWER_IDLE,
+    SIM_POWER_DOWN,
+    SIM_POWER_STATE_COUNT
+} SimPowerState;
+
+typedef struct __sim_power_stats {
+    uint64_t cycles[SIM_POWER_STATE_COUNT];
+    double ua_cycles[SIM_POWER_STATE_COUNT]; // current times time
+    unsigned long sleeps;
+} SimPowerStats;
+
+const SimPowerStats *sim_power_stats();
+void sim_reset_power_stats();
+SimPowerState sim_power_state();
+// }}}
+
+// {{{ used by the rest of the HAL
+void sim_reset_pins();
+void sim_sync_ports();
+void sim_pin_changed(uint8_t pin, uint8_t level);
+uint32_t sim_pin_load_ua();
+void sim_soft_serial_wrote(uint8_t tx_pin, uint8_t b);
+// }}}
+
+#endif /* end of include guard: SIM_H */
@@ -0,0 +1,592 @@
+#include "sim_ipod.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "sim.h"
+#include "SoftwareSerial.h"
+
+// {{{ protocol
+#define AAP_HEADER1 0xFF
+#define AAP_HEADER2 0x55
+
+#define MODE_GENERAL  0x00
+#define MODE_SIMPLE   0x02
+#define MODE_ADVANCED 0x04
+
+// mode 0
+#define CMD_SWITCH_MODE 0x01
+
+// mode 4; the high byte is always 0
+#define CMD_FEEDBACK              0x01
+#define CMD_GET_IPOD_TYPE         0x12
+#define CMD_IPOD_TYPE             0x13
+#define CMD_GET_IPOD_NAME         0x14
+#define CMD_IPOD_NAME             0x15
+#define CMD_GET_TIME_AND_STATUS   0x1C
+#define CMD_TIME_AND_STATUS       0x1D
+#define CMD_GET_PLAYLIST_POSITION 0x1E
+#define CMD_PLAYLIST_POSITION     0x1F
+#define CMD_GET_TITLE             0x20
+#define CMD_TITLE                 0x21
+#define CMD_GET_ARTIST            0x22
+#define CMD_ARTIST                0x23
+#define CMD_GET_ALBUM             0x24
+#define CMD_ALBUM                 0x25
+#define CMD_SET_POLLING_MODE      0x26
+#define CMD_POLLING               0x27
+#define CMD_PLAYBACK_CONTROL      0x29
+#define CMD_GET_SONG_COUNT        0x35
+#define CMD_SONG_COUNT            0x36
+#define CMD_JUMP_TO_SONG          0x37
+
+#define FEEDBACK_SUCCESS       0x00
+#define FEEDBACK_INVALID_PARAM 0x04
+
+#define STATUS_STOPPED 0x00
+#define STATUS_PLAYING 0x01
+#define STATUS_PAUSED  0x02
+
+#define POLLING_TRACK_CHANGE 0x01
+#define POLLING_ELAPSED_TIME 0x04
+
+#define PLAYBACK_PLAY_PAUSE    0x01
+#define PLAYBACK_STOP          0x02
+#define PLAYBACK_SKIP_FORWARD  0x03
+#define PLAYBACK_SKIP_BACKWARD 0x04
+
+// simple remote buttons: first and fourth button bytes
+#define BUTTON_PLAY_PAUSE    0x01
+#define BUTTON_SKIP_FORWARD  0x08
+#define BUTTON_SKIP_BACKWARD 0x10
+#define BUTTON_JUST_PLAY     0x01
+#define BUTTON_JUST_PAUSE    0x02
+
+#define POLL_INTERVAL_MS 500
+
+// longest packet payload we'll accept
+#define MAX_PAYLOAD 250
+// }}}
+
+// {{{ state
+typedef struct __pending_packet {
+    uint64_t due;
+    std::vector<uint8_t> bytes;
+} PendingPacket;
+
+static bool connected;
+static uint8_t rx_pin;
+static uint8_t tx_pin;
+
+static uint64_t response_delay = 20 * SIM_CYCLES_PER_MS;
+static uint64_t wake_delay = 0;
+static bool needs_simple = false;
+static uint64_t connected_at;
+static long baud = 19200;
+static unsigned long song_count = 250;
+static unsigned long song_length_ms = 200000UL;
+
+static uint8_t mode;
+static bool told_simple;
+static bool polling;
+static uint64_t next_poll;
+
+// playback; elapsed time is elapsed_ms plus however long it's been playing
+// since playing_since
+static unsigned long position;
+static uint8_t status;
+static unsigned long elapsed_ms;
+static uint64_t playing_since;
+
+// simple remote buttons last pressed
+static bool button_down;
+
+// parser
+static uint8_t parse_state;
+static uint8_t packet_len;
+static uint8_t packet_count;
+static uint8_t packet[MAX_PAYLOAD];
+
+static std::deque<PendingPacket> pending;
+
+static SimIPodStats stats;
+
+// title, artist and album requests for each song
+static std::map<unsigned long, unsigned long> song_meta_reqs;
+// }}}
+
+// {{{ playback
+static unsigned long elapsed() {
+    unsigned long ms = elapsed_ms;
+
+    if (status == STATUS_PLAYING) {
+        ms += (unsigned long) ((sim_now() - playing_since) / SIM_CYCLES_PER_MS);
+    }
+
+    return ms;
+}
+
+static void set_status(uint8_t new_status) {
+    elapsed_ms = elapsed();
+    playing_since = sim_now();
+    status = new_status;
+}
+
+static void set_position(unsigned long new_position) {
+    position = new_position % song_count;
+    elapsed_ms = 0;
+    playing_since = sim_now();
+}
+// }}}
+
+// {{{ send
+static void queue_packet(uint64_t due, const uint8_t *payload, size_t len) {
+    PendingPacket p;
+    p.due = due;
+
+    uint8_t sum = (uint8_t) len;
+
+    p.bytes.push_back(AAP_HEADER1);
+    p.bytes.push_back(AAP_HEADER2);
+    p.bytes.push_back((uint8_t) len);
+
+    for (size_t i = 0; i < len; i++) {
+        p.bytes.push_back(payload[i]);
+        sum += payload[i];
+    }
+
+    p.bytes.push_back((uint8_t) (0x100 - sum));
+
+    pending.push_back(p);
+}
+
+// an advanced mode response; params are copied
+static void respond(uint8_t cmd, const uint8_t *params, size_t params_len) {
+    uint8_t payload[3 + MAX_PAYLOAD];
+
+    payload[0] = MODE_ADVANCED;
+    payload[1] = 0x00;
+    payload[2] = cmd;
+    memcpy(payload + 3, params, params_len);
+
+    queue_packet(sim_now() + response_delay, payload, 3 + params_len);
+    stats.responses += 1;
+}
+
+static void put_ulong(uint8_t *p, unsigned long v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static unsigned long get_ulong(const uint8_t *p) {
+    return ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) |
+           ((unsigned long) p[2] << 8) | p[3];
+}
+
+static void respond_ulong(uint8_t cmd, unsigned long v) {
+    uint8_t params[4];
+
+    put_ulong(params, v);
+    respond(cmd, params, sizeof(params));
+}
+
+static void respond_string(uint8_t cmd, const char *s) {
+    // includes the terminating NUL
+    respond(cmd, (const uint8_t *) s, strlen(s) + 1);
+}
+
+static void respond_feedback(uint8_t result, uint8_t cmd) {
+    uint8_t params[3] = { result, 0x00, cmd };
+
+    respond(CMD_FEEDBACK, params, sizeof(params));
+}
+
+static void poll(uint8_t what, unsigned long v) {
+    uint8_t params[5];
+
+    params[0] = what;
+    put_ulong(params + 1, v);
+    respond(CMD_POLLING, params, sizeof(params));
+
+    stats.responses -= 1;
+    stats.polls += 1;
+}
+// }}}
+
+// {{{ handle_simple
+static void handle_simple(const uint8_t *buttons, uint8_t len) {
+    bool down = false;
+
+    for (uint8_t i = 0; i < len; i++) {
+        down |= (buttons[i] != 0);
+    }
+
+    // acted on when pressed; the release and any repeats don't count
+    bool pressed = down && (! button_down);
+    button_down = down;
+
+    if (! pressed) {
+        return;
+    }
+
+    stats.buttons += 1;
+
+    uint8_t b0 = buttons[0];
+    uint8_t b3 = (len > 3) ? buttons[3] : 0;
+
+    if (b0 & BUTTON_PLAY_PAUSE) {
+        set_status((status == STATUS_PLAYING) ? STATUS_PAUSED : STATUS_PLAYING);
+    } else if (b0 & BUTTON_SKIP_FORWARD) {
+        set_position(position + 1);
+    } else if (b0 & BUTTON_SKIP_BACKWARD) {
+        set_position(position + song_count - 1);
+    } else if (b3 & BUTTON_JUST_PLAY) {
+        set_status(STATUS_PLAYING);
+    } else if (b3 & BUTTON_JUST_PAUSE) {
+        set_status(STATUS_PAUSED);
+    }
+}
+// }}}
+
+// {{{ handle_advanced
+static void handle_advanced(uint8_t cmd, const uint8_t *params, uint8_t len) {
+    char text[32];
+
+    switch (cmd) {
+        case CMD_GET_IPOD_TYPE: {
+            uint8_t type[2] = { 0x01, 0x02 };
+            respond(CMD_IPOD_TYPE, type, sizeof(type));
+            break;
+        }
+
+        case CMD_GET_IPOD_NAME:
+            respond_string(CMD_IPOD_NAME, "Simulated iPod");
+            break;
+
+        case CMD_GET_TIME_AND_STATUS: {
+            uint8_t info[9];
+
+            stats.status_reqs += 1;
+
+            put_ulong(info, song_length_ms);
+            put_ulong(info + 4, elapsed());
+            info[8] = status;
+
+            respond(CMD_TIME_AND_STATUS, info, sizeof(info));
+            break;
+        }
+
+        case CMD_GET_PLAYLIST_POSITION:
+            respond_ulong(CMD_PLAYLIST_POSITION, position);
+            break;
+
+        case CMD_GET_SONG_COUNT:
+            respond_ulong(CMD_SONG_COUNT, song_count);
+            break;
+
+        case CMD_GET_TITLE:
+        case CMD_GET_ARTIST:
+        case CMD_GET_ALBUM: {
+            if (len < 4) {
+                respond_feedback(FEEDBACK_INVALID_PARAM, cmd);
+                break;
+            }
+
+            static const char *const names[] = { "Title", "Artist", "Album" };
+            unsigned long song = get_ulong(params);
+
+            stats.meta_reqs += 1;
+            song_meta_reqs[song] += 1;
+
+            snprintf(text, sizeof(text), "%s %lu", names[(cmd - CMD_GET_TITLE) / 2], song);
+            respond_string(cmd + 1, text);
+            break;
+        }
+
+        case CMD_SET_POLLING_MODE:
+            polling = (len > 0) && (params[0] != 0);
+            next_poll = sim_now() + (POLL_INTERVAL_MS * SIM_CYCLES_PER_MS);
+            respond_feedback(FEEDBACK_SUCCESS, cmd);
+            break;
+
+        case CMD_PLAYBACK_CONTROL:
+            if (len < 1) {
+                respond_feedback(FEEDBACK_INVALID_PARAM, cmd);
+                break;
+            }
+
+            if (params[0] == PLAYBACK_PLAY_PAUSE) {
+                set_status((status == STATUS_PLAYING) ? STATUS_PAUSED : STATUS_PLAYING);
+            } else if (params[0] == PLAYBACK_STOP) {
+                set_status(STATUS_STOPPED);
+            } else if (params[0] == PLAYBACK_SKIP_FORWARD) {
+                stats.skips += 1;
+                set_position(position + 1);
+            } else if (params[0] == PLAYBACK_SKIP_BACKWARD) {
+                stats.skips += 1;
+                set_position(position + song_count - 1);
+            }
+
+            respond_feedback(FEEDBACK_SUCCESS, cmd);
+
+            if (polling && ((params[0] == PLAYBACK_SKIP_FORWARD) || (params[0] == PLAYBACK_SKIP_BACKWARD))) {
+                poll(POLLING_TRACK_CHANGE, position);
+            }
+            break;
+
+        case CMD_JUMP_TO_SONG:
+            if ((len < 4) || (get_ulong(params) >= song_count)) {
+                respond_feedback(FEEDBACK_INVALID_PARAM, cmd);
+                break;
+            }
+
+            stats.skips += 1;
+            set_position(get_ulong(params));
+            respond_feedback(FEEDBACK_SUCCESS, cmd);
+
+            if (polling) {
+                poll(POLLING_TRACK_CHANGE, position);
+            }
+            break;
+
+        default:
+            respond_feedback(FEEDBACK_INVALID_PARAM, cmd);
+            break;
+    }
+}
+// }}}
+
+// {{{ handle_packet
+static void handle_packet(const uint8_t *payload, uint8_t len) {
+    stats.packets += 1;
+
+    if (sim_now() < (connected_at + wake_delay)) {
+        stats.slept_through += 1;
+        return;
+    }
+
+    if (len < 2) {
+        return;
+    }
+
+    if (payload[0] == MODE_GENERAL) {
+        if ((payload[1] == CMD_SWITCH_MODE) && (len >= 3)) {
+            if (payload[2] == MODE_SIMPLE) {
+                told_simple = true;
+            }
+
+            if ((payload[2] == MODE_ADVANCED) && needs_simple && (! told_simple)) {
+                stats.ignored += 1;
+            } else if (payload[2] != mode) {
+                mode = payload[2];
+                stats.mode_switches += 1;
+
+                if (mode != MODE_ADVANCED) {
+                    polling = false;
+                }
+            }
+        }
+    } else if (payload[0] == MODE_SIMPLE) {
+        handle_simple(payload + 2, len - 2);
+    } else if (payload[0] == MODE_ADVANCED) {
+        if (mode != MODE_ADVANCED) {
+            stats.ignored += 1;
+        } else if (len >= 3) {
+            handle_advanced(payload[2], payload + 3, len - 3);
+        }
+    }
+}
+// }}}
+
+// {{{ soft_serial_observer
+// bytes from the firmware, through a SoftwareSerial or off the pin
+static void soft_serial_observer(uint8_t pin, uint8_t b) {
+    if ((! connected) || (pin != tx_pin)) {
+        return;
+    }
+
+    switch (parse_state) {
+        case 0:
+            if (b == AAP_HEADER1) {
+                parse_state = 1;
+            }
+            break;
+
+        case 1:
+            parse_state = (b == AAP_HEADER2) ? 2 : ((b == AAP_HEADER1) ? 1 : 0);
+            break;
+
+        case 2:
+            if ((b == 0) || (b > MAX_PAYLOAD)) {
+                stats.bad_packets += 1;
+                parse_state = 0;
+            } else {
+                packet_len = b;
+                packet_count = 0;
+                parse_state = 3;
+            }
+            break;
+
+        case 3:
+            packet[packet_count++] = b;
+
+            if (packet_count == packet_len) {
+                parse_state = 4;
+            }
+            break;
+
+        case 4: {
+            uint8_t sum = packet_len + b;
+
+            for (uint8_t i = 0; i < packet_len; i++) {
+                sum += packet[i];
+            }
+
+            if (sum == 0) {
+                handle_packet(packet, packet_len);
+            } else {
+                stats.bad_packets += 1;
+            }
+
+            parse_state = 0;
+            break;
+        }
+    }
+}
+// }}}
+
+// {{{ sim_ipod_connect / sim_ipod_disconnect
+void sim_ipod_connect(uint8_t ipod_rx_pin, uint8_t ipod_tx_pin) {
+    rx_pin = ipod_rx_pin;
+    tx_pin = ipod_tx_pin;
+    connected = true;
+    connected_at = sim_now();
+
+    mode = MODE_SIMPLE;
+    told_simple = false;
+    polling = false;
+    button_down = false;
+    parse_state = 0;
+    pending.clear();
+
+    position = 0;
+    elapsed_ms = 0;
+    status = STATUS_PLAYING;
+    playing_since = sim_now();
+
+    memset(&stats, 0, sizeof(stats));
+    song_meta_reqs.clear();
+
+    sim_set_soft_serial_observer(soft_serial_observer);
+    sim_pin_uart_listen(tx_pin, baud, soft_serial_observer);
+    sim_pin_set(rx_pin, 1);
+}
+
+void sim_ipod_disconnect() {
+    connected = false;
+    pending.clear();
+
+    sim_pin_uart_listen(tx_pin, 0, NULL);
+
+    sim_pin_set(rx_pin, 0);
+}
+// }}}
+
+// {{{ sim_ipod_drop_out
+void sim_ipod_drop_out() {
+    mode = MODE_SIMPLE;
+    polling = false;
+}
+// }}}
+
+// {{{ sim_ipod_set_response_delay / sim_ipod_set_wake_delay / sim_ipod_set_needs_simple / sim_ipod_set_baud / sim_ipod_set_playlist
+void sim_ipod_set_response_delay(uint64_t cycles) {
+    response_delay = cycles;
+}
+
+void sim_ipod_set_wake_delay(uint64_t cycles) {
+    wake_delay = cycles;
+}
+
+void sim_ipod_set_needs_simple(bool _needs_simple) {
+    needs_simple = _needs_simple;
+}
+
+void sim_ipod_set_baud(long _baud) {
+    baud = _baud;
+
+    if (connected) {
+        sim_pin_uart_listen(tx_pin, baud, soft_serial_observer);
+    }
+}
+
+void sim_ipod_set_playlist(unsigned long songs, unsigned long song_ms) {
+    song_count = songs ? songs : 1;
+    song_length_ms = song_ms;
+}
+// }}}
+
+// {{{ sim_ipod_update
+void sim_ipod_update() {
+    if (! connected) {
+        return;
+    }
+
+    uint64_t now = sim_now();
+
+    if ((status == STATUS_PLAYING) && (elapsed() >= song_length_ms)) {
+        set_position(position + 1);
+
+        if (polling) {
+            poll(POLLING_TRACK_CHANGE, position);
+        }
+    }
+
+    if (polling && (now >= next_poll)) {
+        next_poll = now + (POLL_INTERVAL_MS * SIM_CYCLES_PER_MS);
+
+        if (status == STATUS_PLAYING) {
+            poll(POLLING_ELAPSED_TIME, elapsed());
+        }
+    }
+
+    while ((! pending.empty()) && (pending.front().due <= now)) {
+        const std::vector<uint8_t> &bytes = pending.front().bytes;
+        SoftwareSerial *ss = SoftwareSerial::findByReceivePin(rx_pin);
+
+        if ((ss != NULL) && (ss->getBitCycles() != 0)) {
+            sim_soft_serial_send(rx_pin, &bytes[0], bytes.size());
+        } else {
+            sim_pin_uart_send(rx_pin, &bytes[0], bytes.size(), baud);
+        }
+
+        pending.pop_front();
+    }
+}
+// }}}
+
+// {{{ sim_ipod_stats
+const SimIPodStats *sim_ipod_stats() {
+    return &stats;
+}
+// }}}
+
+// {{{ sim_ipod_meta_reqs
+unsigned long sim_ipod_meta_reqs(unsigned long song) {
+    std::map<unsigned long, unsigned long>::const_iterator it = song_meta_reqs.find(song);
+
+    return (it == song_meta_reqs.end()) ? 0 : it->second;
+}
+// }}}
+
+// {{{ sim_ipod_playing
+bool sim_ipod_playing() {
+    return (status == STATUS_PLAYING);
+}
+// }}}
@@ -0,0 +1,92 @@
+#ifndef SIM_IPOD_H
+#define SIM_IPOD_H
+
+/*
+    A simulated iPod on the far end of the firmware's serial link,
+    speaking enough of the Apple Accessory Protocol for iPodSerial:
+
+      • mode 0: switching between simple and advanced remote modes
+      • mode 2 (simple remote): play/pause, just play, just pause and skips,
+        acted on when the button's pressed
+      • mode 4 (advanced remote): iPod type and name, time and status,
+        playlist position, song count, title/artist/album of a song,
+        playback control, jump to song and polling mode, with elapsed time
+        updates every 500ms and a track change update when a song ends or
+        is skipped
+
+    Advanced commands are ignored unless the iPod has been switched to
+    advanced mode, as a real one does.  The playlist is made up: songs are
+    called "Title n", "Artist n" and "Album n".
+
+    Responses go out once the iPod's response delay has passed, from
+    sim_ipod_update(), which the driver calls at least as often as loop().
+    They go to the SoftwareSerial listening on the firmware's receive pin if
+    there is one, and otherwise onto the pin itself at the iPod's baud rate.
+    Packets from the firmware are seen both ways too: through the
+    SoftwareSerial observer and by listening to the firmware's transmit pin,
+    so sim_ipod_connect() takes both over.
+*/
+
+#include <stdint.h>
+
+typedef struct __sim_ipod_stats {
+    unsigned long packets;        // valid packets from the firmware
+    unsigned long bad_packets;    // checksum or length didn't add up
+    unsigned long ignored;        // advanced commands while in simple mode
+    unsigned long responses;
+    unsigned long polls;          // polling updates sent
+    unsigned long mode_switches;
+    unsigned long buttons;        // simple remote presses acted on
+    unsigned long slept_through;  // packets missed while waking up
+    unsigned long status_reqs;    // time and status asked for
+    unsigned long meta_reqs;      // title, artist or album asked for
+    unsigned long skips;          // skips and jumps in advanced mode
+} SimIPodStats;
+
+/*
+ * Plugs the iPod in: the firmware's receive pin (ipod_rx_pin, what the iPod
+ * transmits on) goes high, and bytes the firmware writes on ipod_tx_pin are
+ * parsed.  The iPod starts out playing song 0 in simple mode.
+ */
+void sim_ipod_connect(uint8_t ipod_rx_pin, uint8_t ipod_tx_pin);
+void sim_ipod_disconnect();
+
+// time from the end of a request to the start of the response
+void sim_ipod_set_response_delay(uint64_t cycles);
+
+/*
+ * Packets that come within this long of the iPod being plugged in are
+ * missed, as they would be by an iPod that's still waking up; 0 (to begin
+ * with) for one that's awake.
+ */
+void sim_ipod_set_wake_delay(uint64_t cycles);
+
+/*
+ * Won't go into advanced mode until it's been told to switch to simple
+ * mode since it was plugged in, as some iPods that have come out of
+ * advanced mode without noticing won't; false to begin with.
+ */
+void sim_ipod_set_needs_simple(bool needs_simple);
+
+/*
+ * Drops back to simple mode without being asked, as real iPods now and
+ * then do; it's still plugged in, but advanced commands are ignored.
+ */
+void sim_ipod_drop_out();
+
+// for the link on the pins (not a SoftwareSerial); 19200 to begin with
+void sim_ipod_set_baud(long baud);
+
+void sim_ipod_set_playlist(unsigned long songs, unsigned long song_ms);
+
+// sends responses and polling updates that are due; cheap when none are
+void sim_ipod_update();
+
+const SimIPodStats *sim_ipod_stats();
+
+// titles, artists and albums asked for of one song since it was plugged in
+unsigned long sim_ipod_meta_reqs(unsigned long song);
+
+bool sim_ipod_playing();
+
+#endif /* end of include guard: SIM_IPOD_H */
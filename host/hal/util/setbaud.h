@@ -0,0 +1,23 @@
+/*
+    Same arithmetic as avr-libc's util/setbaud.h, without the tolerance
+    checks; define F_CPU and BAUD first.  The simulated USART runs at
+    whatever bit rate ends up in UBRR0.
+*/
+
+#ifndef F_CPU
+    #error F_CPU must be defined for util/setbaud.h
+#endif
+
+#ifndef BAUD
+    #error BAUD must be defined for util/setbaud.h
+#endif
+
+#undef UBRR_VALUE
+#undef UBRRL_VALUE
+#undef UBRRH_VALUE
+#undef USE_2X
+
+#define UBRR_VALUE  (((F_CPU) + 8UL * (BAUD)) / (16UL * (BAUD)) - 1UL)
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+#define USE_2X 0
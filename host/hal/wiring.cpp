@@ -0,0 +1,269 @@
+#include "WProgram.h"
+#include "pins_arduino.h"
+
+#include <stdio.h>
+
+/*
+    The Arduino core's timing, digital I/O and external interrupt
+    functions, on top of the simulator.  timer0 isn't simulated as such:
+    millis() and micros() come straight from the virtual I/O clock, and
+    TCNT0 is worked out from it when read (see sim.cpp).
+*/
+
+volatile uint8_t PINB;
+volatile uint8_t PINC;
+volatile uint8_t PIND;
+
+volatile uint8_t PORTB;
+volatile uint8_t PORTC;
+volatile uint8_t PORTD;
+volatile uint8_t DDRB;
+volatile uint8_t DDRC;
+volatile uint8_t DDRD;
+
+static uint8_t pin_mode[SIM_NUM_PINS];
+static uint8_t pin_level[SIM_NUM_PINS];
+static uint16_t pin_load_ua[SIM_NUM_PINS];
+
+// PORTx as of the last sim_sync_ports(), so only what's changed is looked at
+static uint8_t synced_portb;
+static uint8_t synced_portc;
+static uint8_t synced_portd;
+
+// attachInterrupt() handlers for INT0 and INT1
+typedef void (*InterruptHandler_t)(void);
+static volatile InterruptHandler_t int_handlers[2];
+
+HardwareSerial Serial;
+
+// {{{ init
+// the real thing turns the ADC on, too
+void init(void) {
+    ADCSRA |= _BV(ADEN);
+    sei();
+}
+// }}}
+
+// {{{ millis / micros
+unsigned long millis(void) {
+    return (unsigned long) (sim_io_clock() / SIM_CYCLES_PER_MS);
+}
+
+unsigned long micros(void) {
+    return (unsigned long) (sim_io_clock() / SIM_CYCLES_PER_US);
+}
+// }}}
+
+// {{{ delay / delayMicroseconds
+void delay(unsigned long ms) {
+    sim_advance((uint64_t) ms * SIM_CYCLES_PER_MS);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim_advance((uint64_t) us * SIM_CYCLES_PER_US);
+}
+// }}}
+
+// {{{ update_input_registers
+static void update_input_registers() {
+    uint8_t pind = 0;
+    uint8_t pinb = 0;
+    uint8_t pinc = 0;
+
+    for (uint8_t pin = 0; pin < SIM_NUM_PINS; pin++) {
+        if (! pin_level[pin]) {
+            continue;
+        }
+
+        if (digitalPinToPort(pin) == PD) {
+            pind |= digitalPinToBitMask(pin);
+        } else if (digitalPinToPort(pin) == PB) {
+            pinb |= digitalPinToBitMask(pin);
+        } else {
+            pinc |= digitalPinToBitMask(pin);
+        }
+    }
+
+    PIND = pind;
+    PINB = pinb;
+    PINC = pinc;
+}
+// }}}
+
+// {{{ sim_reset_pins
+void sim_reset_pins() {
+    memset(pin_mode, INPUT, sizeof(pin_mode));
+    memset(pin_level, LOW, sizeof(pin_level));
+    memset(pin_load_ua, 0, sizeof(pin_load_ua));
+
+    int_handlers[0] = int_handlers[1] = NULL;
+
+    PORTB = PORTC = PORTD = 0;
+    DDRB = DDRC = DDRD = 0;
+    synced_portb = synced_portc = synced_portd = 0;
+
+    update_input_registers();
+}
+// }}}
+
+// {{{ set_level
+static void set_level(uint8_t pin, uint8_t level) {
+    if (pin_level[pin] == level) {
+        return;
+    }
+
+    pin_level[pin] = level;
+    update_input_registers();
+
+    sim_pin_changed(pin, level);
+}
+// }}}
+
+// {{{ port_bit
+static uint8_t port_bit(uint8_t pin) {
+    return (*portOutputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+// }}}
+
+// {{{ sync_port
+static void sync_port(volatile uint8_t *port, uint8_t *synced, uint8_t first_pin, uint8_t pins) {
+    uint8_t value = *port;
+    uint8_t changed = value ^ *synced;
+
+    *synced = value;
+
+    for (uint8_t bit = 0; changed && (bit < pins); bit++, changed >>= 1) {
+        uint8_t pin = first_pin + bit;
+
+        if ((changed & 1) && (pin_mode[pin] == OUTPUT)) {
+            set_level(pin, (value >> bit) & 1);
+        }
+    }
+}
+// }}}
+
+// {{{ sim_sync_ports
+// outputs written straight to PORTx, as an ISR driving a pin would
+void sim_sync_ports() {
+    sync_port(&PORTD, &synced_portd, 0, 8);
+    sync_port(&PORTB, &synced_portb, 8, 6);
+    sync_port(&PORTC, &synced_portc, 14, 6);
+}
+// }}}
+
+// {{{ pinMode / digitalWrite / digitalRead
+// an output's driven to what's in PORTx straight away
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < SIM_NUM_PINS) {
+        pin_mode[pin] = mode;
+
+        if (mode == OUTPUT) {
+            set_level(pin, port_bit(pin));
+        }
+    }
+}
+
+// writing an input only turns the pull-up on or off, which doesn't matter
+// here
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin >= SIM_NUM_PINS) {
+        return;
+    }
+
+    sim_sync_ports();
+
+    volatile uint8_t *port = portOutputRegister(digitalPinToPort(pin));
+    uint8_t mask = digitalPinToBitMask(pin);
+
+    if (value) {
+        *port |= mask;
+    } else {
+        *port &= ~mask;
+    }
+
+    sim_sync_ports();
+}
+
+int digitalRead(uint8_t pin) {
+    if (pin >= SIM_NUM_PINS) {
+        return LOW;
+    }
+
+    return pin_level[pin];
+}
+// }}}
+
+// {{{ sim_pin_set / sim_pin_get
+void sim_pin_set(uint8_t pin, uint8_t level) {
+    if (pin < SIM_NUM_PINS) {
+        set_level(pin, level ? HIGH : LOW);
+    }
+}
+
+uint8_t sim_pin_get(uint8_t pin) {
+    return digitalRead(pin);
+}
+// }}}
+
+// {{{ sim_pin_set_load / sim_pin_load_ua
+void sim_pin_set_load(uint8_t pin, uint16_t ua) {
+    if (pin < SIM_NUM_PINS) {
+        pin_load_ua[pin] = ua;
+    }
+}
+
+uint32_t sim_pin_load_ua() {
+    uint32_t ua = 0;
+
+    for (uint8_t pin = 0; pin < SIM_NUM_PINS; pin++) {
+        if ((pin_mode[pin] == OUTPUT) && pin_level[pin]) {
+            ua += pin_load_ua[pin];
+        }
+    }
+
+    return ua;
+}
+// }}}
+
+// {{{ attachInterrupt / detachInterrupt
+// mode is LOW, CHANGE, FALLING or RISING, which are the ISCn1:0 values
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode) {
+    if (interruptNum > 1) {
+        return;
+    }
+
+    int_handlers[interruptNum] = userFunc;
+
+    uint8_t shift = 2 * interruptNum;
+
+    EICRA = (EICRA & ~(0x03 << shift)) | ((mode & 0x03) << shift);
+    EIMSK |= _BV(INT0 + interruptNum);
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+    if (interruptNum > 1) {
+        return;
+    }
+
+    EIMSK &= ~_BV(INT0 + interruptNum);
+    int_handlers[interruptNum] = NULL;
+}
+
+ISR(INT0_vect) {
+    if (int_handlers[0] != NULL) {
+        int_handlers[0]();
+    }
+}
+
+ISR(INT1_vect) {
+    if (int_handlers[1] != NULL) {
+        int_handlers[1]();
+    }
+}
+// }}}
+
+// {{{ HardwareSerial::write
+void HardwareSerial::write(uint8_t b) {
+    putchar(b);
+}
+// }}}
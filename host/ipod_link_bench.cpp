@@ -0,0 +1,468 @@
+/*
+    What the iPod link costs, with NewSoftSerial at 19200 (as it was) and
+    with TimerSerial at 38400 and 57600, against the simulated peripherals
+    in hal/.  The IBus driver's the real one; the iPod side is this file,
+    so the iPodSerial library isn't needed.
+
+        ipod_link_bench [-v] [-t tracks] [-l loop_us] corpus.hex...
+
+    For each link, the corpus is played onto the IBus over and over with the
+    usual gap between frames, while every TRACK_PERIOD_MS the metadata for a
+    track is fetched: title, artist and album requests (11 bytes each, as
+    AdvancedRemote builds them) and, as soon as they're on the wire, the
+    answers, each a 32 character string in a 40 byte packet.  A loop() pass
+    reads whatever the link has and releases any IBus frames.  Reported:
+
+      • metadata transfer time, from the first request written to the last
+        byte of the answers read; and how long the writes blocked
+      • IBus frames received, and how many fewer than with no iPod traffic;
+        USART line errors and queue overruns
+      • the longest any IBus byte waited for the RX handler
+
+    Handlers take no virtual time, so with TimerSerial the IBus waits for
+    nothing; the host time its handlers took is shown per byte instead.
+
+    Exits non-zero if TimerSerial lost or garbled any iPod byte, cost any
+    IBus frames, or wasn't faster than NewSoftSerial.  -v prints each
+    track's transfer time.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "WProgram.h"
+#include "SoftwareSerial.h"
+#include "sim.h"
+
+#include "../TimerSerial.h"
+#include "../ibus_serial.h"
+
+// from the sketch
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+
+// how often a track's metadata is fetched
+#define TRACK_PERIOD_MS 250UL
+
+// request and answer sizes
+#define REQUEST_LEN  11
+#define REQUESTS     3
+#define META_LEN     32
+#define ANSWER_LEN   (3 + 3 + META_LEN + 1 + 1)
+
+// played after the last track, so the IBus can catch up
+#define DRAIN_MS 50UL
+
+#define CYCLES_TO_MS(_c) ((double) (_c) / SIM_CYCLES_PER_MS)
+#define CYCLES_TO_US(_c) ((double) (_c) / SIM_CYCLES_PER_US)
+
+typedef struct __link {
+    const char *name;
+    long baud;          // 0 for no iPod traffic at all
+    bool soft;
+} Link;
+
+static const Link links[] = {
+    { "no iPod traffic", 0,     false },
+    { "NewSoftSerial",   19200, true  },
+    { "TimerSerial",     38400, false },
+    { "TimerSerial",     57600, false },
+};
+
+#define LINK_COUNT (sizeof(links) / sizeof(links[0]))
+
+typedef struct __link_result {
+    double transfer_ms;
+    double worst_transfer_ms;
+    double blocked_ms;
+    unsigned long frames;
+    unsigned long line_errors;
+    unsigned long queue_overruns;
+    double worst_rx_wait_us;
+    unsigned long ipod_bytes;
+    unsigned long bad_bytes;
+    double host_cycles_per_byte;
+} LinkResult;
+
+static bool verbose = false;
+
+SoftwareSerial softSerial(IPOD_RX_PIN, IPOD_TX_PIN, false, false, true);
+TimerSerial timerSerial(IPOD_TX_PIN);
+
+// request bytes the iPod's seen this track, and when the last one will be
+// off the wire
+static unsigned long request_bytes;
+static uint64_t requests_done_at;
+static uint64_t byte_cycles;
+static bool soft_link;
+
+// {{{ request_observer
+static void request_observer(uint8_t pin, uint8_t b) {
+    request_bytes += 1;
+
+    if (request_bytes == (REQUESTS * REQUEST_LEN)) {
+        // NewSoftSerial's seen as write() starts the byte, the pin as the
+        // middle of the stop bit goes by
+        requests_done_at = sim_now() + (soft_link ? byte_cycles : (byte_cycles / 20));
+    }
+}
+// }}}
+
+// {{{ aap_packet
+static void aap_packet(std::vector<uint8_t> &out, const uint8_t *payload, uint8_t len) {
+    uint8_t sum = len;
+
+    out.push_back(0xFF);
+    out.push_back(0x55);
+    out.push_back(len);
+
+    for (uint8_t i = 0; i < len; i++) {
+        out.push_back(payload[i]);
+        sum += payload[i];
+    }
+
+    out.push_back((uint8_t) (0x100 - sum));
+}
+// }}}
+
+// {{{ load_corpus
+// one frame per line; '#' starts a comment
+static bool load_corpus(const char *path, std::vector<std::vector<uint8_t> > &frames) {
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[1024];
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+
+        std::vector<uint8_t> frame;
+        char *p = line;
+        char *end;
+
+        for (;;) {
+            long v = strtol(p, &end, 16);
+
+            if (end == p) {
+                break;
+            }
+
+            frame.push_back((uint8_t) v);
+            p = end;
+        }
+
+        if (! frame.empty()) {
+            frames.push_back(frame);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ start_fetch
+// writes a track's requests, and works out the answers they'll get
+static void start_fetch(Stream *stream, unsigned long track, std::vector<uint8_t> &answers) {
+    std::vector<uint8_t> requests;
+
+    answers.clear();
+    request_bytes = 0;
+    requests_done_at = 0;
+
+    for (uint8_t r = 0; r < REQUESTS; r++) {
+        // get title, artist or album of the song at an index
+        uint8_t request[7] = { 0x04, 0x00, (uint8_t) (0x20 + (2 * r)), 0, 0, 0, (uint8_t) track };
+        aap_packet(requests, request, sizeof(request));
+
+        uint8_t answer[3 + META_LEN + 1];
+
+        answer[0] = 0x04;
+        answer[1] = 0x00;
+        answer[2] = request[2] + 1;
+
+        for (uint8_t i = 0; i < META_LEN; i++) {
+            answer[3 + i] = 'A' + ((track + r + i) % 26);
+        }
+
+        answer[3 + META_LEN] = '\0';
+        aap_packet(answers, answer, sizeof(answer));
+    }
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        stream->write(requests[i]);
+    }
+}
+// }}}
+
+// {{{ run_link
+static void run_link(
+    const Link *link,
+    const std::vector<std::vector<uint8_t> > &frames,
+    unsigned long tracks,
+    uint64_t loop_cycles,
+    LinkResult *result
+) {
+    memset(result, 0, sizeof(*result));
+
+    sim_init();
+    init();
+    ibus_serial_init();
+
+    memset((void *) &ibus_rx_stats, 0, sizeof(ibus_rx_stats));
+    memset((void *) &timer_serial_stats, 0, sizeof(timer_serial_stats));
+
+    Stream *stream = NULL;
+
+    soft_link = link->soft;
+    softSerial.end();
+
+    // the iPod's plugged in; its TX idles high
+    sim_pin_set(IPOD_RX_PIN, HIGH);
+
+    if (link->baud != 0) {
+        byte_cycles = (10 * (uint64_t) F_CPU) / link->baud;
+
+        if (link->soft) {
+            softSerial.begin(link->baud);
+            sim_set_soft_serial_observer(request_observer);
+            stream = &softSerial;
+        } else {
+            timerSerial.begin(link->baud);
+            sim_pin_uart_listen(IPOD_TX_PIN, link->baud, request_observer);
+            stream = &timerSerial;
+        }
+    }
+
+    // the whole run's IBus traffic, up front, so it's the same whatever
+    // the link's doing
+    uint64_t start = sim_now();
+    uint64_t run_end = start + (tracks * TRACK_PERIOD_MS * SIM_CYCLES_PER_MS);
+
+    for (size_t i = 0; sim_ibus_other_idle_at() < run_end; i = (i + 1) % frames.size()) {
+        sim_ibus_send(&frames[i][0], frames[i].size());
+    }
+
+    sim_reset_isr_stats();
+
+    std::vector<uint8_t> answers;
+    std::vector<uint8_t> received;
+    uint64_t total_transfer = 0;
+    uint64_t total_blocked = 0;
+
+    unsigned long track = 0;
+    uint64_t next_track = start;
+    uint64_t fetch_start = 0;
+    bool fetching = false;
+    bool answered = false;
+
+    for (;;) {
+        // loop()
+        while (ibus_serial_peek_frame() != NULL) {
+            ibus_serial_release_frame();
+            result->frames += 1;
+        }
+
+        if (stream != NULL) {
+            while (stream->available() > 0) {
+                received.push_back(stream->read());
+            }
+        }
+
+        if (fetching) {
+            if ((! answered) && (requests_done_at != 0) && (sim_now() >= requests_done_at)) {
+                if (link->soft) {
+                    sim_soft_serial_send(IPOD_RX_PIN, &answers[0], answers.size());
+                } else {
+                    sim_pin_uart_send(IPOD_RX_PIN, &answers[0], answers.size(), link->baud);
+                }
+
+                answered = true;
+            }
+
+            if (received.size() >= answers.size()) {
+                uint64_t transfer = sim_now() - fetch_start;
+
+                total_transfer += transfer;
+
+                if (CYCLES_TO_MS(transfer) > result->worst_transfer_ms) {
+                    result->worst_transfer_ms = CYCLES_TO_MS(transfer);
+                }
+
+                for (size_t i = 0; i < answers.size(); i++) {
+                    if (received[i] != answers[i]) {
+                        result->bad_bytes += 1;
+                    }
+                }
+
+                if (verbose) {
+                    printf("  %s %ld, track %lu: %.2f ms\n", link->name, link->baud, track, CYCLES_TO_MS(transfer));
+                }
+
+                fetching = false;
+            }
+        }
+
+        if (sim_now() >= next_track) {
+            if (fetching) {
+                // what never came in
+                result->bad_bytes += answers.size() - received.size();
+                fetching = false;
+            }
+
+            if (track == tracks) {
+                break;
+            }
+
+            track += 1;
+
+            if (track == tracks) {
+                // the last of the IBus traffic
+                next_track = sim_ibus_other_idle_at() + (DRAIN_MS * SIM_CYCLES_PER_MS);
+            } else {
+                next_track += TRACK_PERIOD_MS * SIM_CYCLES_PER_MS;
+            }
+
+            if (stream != NULL) {
+                received.clear();
+                answered = false;
+                fetching = true;
+
+                fetch_start = sim_now();
+                start_fetch(stream, track, answers);
+                total_blocked += sim_now() - fetch_start;
+
+                result->ipod_bytes += answers.size();
+            }
+        }
+
+        sim_advance(loop_cycles);
+    }
+
+    result->transfer_ms = tracks ? (CYCLES_TO_MS(total_transfer) / tracks) : 0;
+    result->blocked_ms = tracks ? (CYCLES_TO_MS(total_blocked) / tracks) : 0;
+    result->line_errors = ibus_rx_stats.line_errors;
+    result->queue_overruns = ibus_rx_stats.queue_overruns;
+    result->worst_rx_wait_us = CYCLES_TO_US(sim_isr_stats(SIM_VECT_USART_RX)->worst_latency_cycles);
+
+    if ((! link->soft) && (link->baud != 0)) {
+        uint64_t host_cycles = 0;
+
+        for (int v = SIM_VECT_TIMER1_CAPT; v <= SIM_VECT_TIMER1_COMPB; v++) {
+            host_cycles += sim_isr_stats((SimVector) v)->host_cycles;
+        }
+
+        unsigned long link_bytes = tracks * REQUESTS * (REQUEST_LEN + ANSWER_LEN);
+
+        result->host_cycles_per_byte = (double) host_cycles / link_bytes;
+        result->bad_bytes += timer_serial_stats.overruns + timer_serial_stats.framing_errors;
+    }
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    unsigned long tracks = 40;
+    unsigned long loop_us = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vt:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't':
+                tracks = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-t tracks] [-l loop_us] corpus.hex...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    std::vector<std::vector<uint8_t> > frames;
+
+    for (int i = optind; i < argc; i++) {
+        if (! load_corpus(argv[i], frames)) {
+            return 2;
+        }
+    }
+
+    if (frames.empty() || (tracks == 0)) {
+        fprintf(stderr, "usage: %s [-v] [-t tracks] [-l loop_us] corpus.hex...\n", argv[0]);
+        return 2;
+    }
+
+    uint64_t loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+    LinkResult results[LINK_COUNT];
+
+    for (size_t i = 0; i < LINK_COUNT; i++) {
+        run_link(&links[i], frames, tracks, loop_cycles, &results[i]);
+    }
+
+    printf("%lu tracks' metadata, one every %lu ms, over the %zu corpus frames played in a loop\n\n",
+           tracks, TRACK_PERIOD_MS, frames.size());
+
+    printf("%-16s %6s  %9s %9s %8s  %7s %5s %6s %5s  %9s  %9s %s\n",
+           "link", "baud",
+           "transfer", "worst", "blocked",
+           "frames", "lost", "errors", "ovr",
+           "rx wait", "bad bytes", "handlers/byte");
+
+    int failures = 0;
+
+    for (size_t i = 0; i < LINK_COUNT; i++) {
+        const Link *link = &links[i];
+        const LinkResult *r = &results[i];
+        long lost = (long) results[0].frames - (long) r->frames;
+
+        printf("%-16s %6ld  %6.2f ms %6.2f ms %5.2f ms  %7lu %5ld %6lu %5lu  %6.1f µs  %4lu/%-4lu",
+               link->name, link->baud,
+               r->transfer_ms, r->worst_transfer_ms, r->blocked_ms,
+               r->frames, lost, r->line_errors, r->queue_overruns,
+               r->worst_rx_wait_us,
+               r->bad_bytes, r->ipod_bytes);
+
+        if (r->host_cycles_per_byte != 0) {
+            printf(" %.0f %s", r->host_cycles_per_byte, SIM_HOST_CYCLE_UNIT);
+        }
+
+        printf("\n");
+
+        if (link->soft || (link->baud == 0)) {
+            continue;
+        }
+
+        if ((r->bad_bytes != 0) || (lost > 0) || (r->queue_overruns > results[0].queue_overruns)) {
+            printf("FAIL: TimerSerial at %ld garbled the link or cost IBus frames\n", link->baud);
+            failures += 1;
+        }
+
+        if (r->transfer_ms >= results[1].transfer_ms) {
+            printf("FAIL: TimerSerial at %ld was no faster than NewSoftSerial\n", link->baud);
+            failures += 1;
+        }
+    }
+
+    printf("\n(transfer: first request written to last answer byte read; rx wait:\n"
+           " longest an IBus byte waited for its handler)\n");
+
+    return failures ? 1 : 0;
+}
+// }}}
@@ -0,0 +1,329 @@
+/*
+    How quickly the iPodWrapper notices the iPod's gone, and how much it
+    asks the iPod to find out, on the TimerSerial link against the
+    simulated iPod in hal/.
+
+        liveness_bench [-v] [-r runs] [-m minutes] [-l loop_us]
+
+    With the iPod in advanced mode, paused and then playing, the time and
+    status requests it's sent over minutes (default 1) of doing nothing
+    else are counted: that's the keep-alive traffic.  Then, runs times
+    (default 10) each, at a different point in the keep-alive interval:
+
+      • unplug: the iPod's unplugged in simple mode, and paused and playing
+        in advanced mode; timed until the wrapper says it's not present
+      • drop out: the iPod drops back to simple mode by itself, paused,
+        with the line still high; timed until the wrapper's out of
+        advanced mode
+
+    Exits non-zero if an unplug took UNPLUG_LIMIT_MS or more to notice, or
+    a drop out DROP_OUT_LIMIT_MS or more, or wasn't noticed at all.  -v
+    prints every run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WProgram.h"
+#include "sim.h"
+#include "sim_ipod.h"
+
+#include "../iPodWrapper.h"
+#include "../TimerSerial.h"
+
+// from the sketch
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+#define IPOD_BAUD   38400
+
+#define UNPLUG_LIMIT_MS 300UL
+
+// the worst it was with a fixed 2s keep-alive window
+#define DROP_OUT_LIMIT_MS 2500UL
+
+// long enough for any of it
+#define ATTACH_TIMEOUT_MS 10000UL
+#define NOTICE_TIMEOUT_MS 30000UL
+
+// after attaching, before anything's measured
+#define SETTLE_MS 3000UL
+
+// spreads the runs over the longest keep-alive interval
+#define RUN_OFFSET_MS 797UL
+
+#define CYCLES_TO_MS(_c) ((double) (_c) / SIM_CYCLES_PER_MS)
+
+typedef struct __notice_result {
+    double mean_ms;
+    double worst_ms;
+    unsigned long missed;
+} NoticeResult;
+
+static bool verbose = false;
+static uint64_t loop_cycles;
+
+TimerSerial iPodSerialPort(IPOD_TX_PIN);
+IPodWrapper iPodWrapper;
+
+// {{{ run_for
+// update() over and over, as loop() does, until done() or timeout_ms;
+// returns false on the timeout
+static bool run_for(unsigned long timeout_ms, bool (*done)()) {
+    uint64_t until = sim_now() + ((uint64_t) timeout_ms * SIM_CYCLES_PER_MS);
+
+    while (sim_now() < until) {
+        sim_ipod_update();
+        scheduler_run();
+        iPodWrapper.update();
+
+        if ((done != NULL) && done()) {
+            return true;
+        }
+
+        sim_advance(loop_cycles);
+    }
+
+    return false;
+}
+// }}}
+
+// {{{ conditions
+static bool have_title() {
+    return (iPodWrapper.getTitle()[0] != '\0');
+}
+
+static bool in_simple_mode() {
+    return iPodWrapper.isPresent() && ! iPodWrapper.isAdvancedModeActive();
+}
+
+static bool gone() {
+    return ! iPodWrapper.isPresent();
+}
+
+static bool not_advanced() {
+    return ! iPodWrapper.isAdvancedModeActive();
+}
+// }}}
+
+// {{{ plug_in
+// plugs the iPod in and waits for it to settle in the mode asked for
+static void plug_in(bool advanced, bool playing) {
+    if (advanced) {
+        iPodWrapper.setAdvanced();
+    } else {
+        iPodWrapper.setSimple();
+    }
+
+    if (playing) {
+        iPodWrapper.play();
+    } else {
+        iPodWrapper.pause();
+    }
+
+    sim_ipod_connect(IPOD_RX_PIN, IPOD_TX_PIN);
+
+    if (! run_for(ATTACH_TIMEOUT_MS, advanced ? have_title : in_simple_mode)) {
+        fprintf(stderr, "the iPod never attached\n");
+        exit(1);
+    }
+
+    run_for(SETTLE_MS, NULL);
+}
+// }}}
+
+// {{{ unplug
+static void unplug() {
+    sim_ipod_disconnect();
+
+    if (! run_for(NOTICE_TIMEOUT_MS, gone)) {
+        fprintf(stderr, "the wrapper never noticed the iPod had gone\n");
+        exit(1);
+    }
+}
+// }}}
+
+// {{{ keep_alive_traffic
+// time and status requests per minute with nothing else going on
+static double keep_alive_traffic(bool playing, unsigned long minutes) {
+    plug_in(true, playing);
+
+    unsigned long before = sim_ipod_stats()->status_reqs;
+    run_for(minutes * 60000UL, NULL);
+    unsigned long reqs = sim_ipod_stats()->status_reqs - before;
+
+    unplug();
+
+    return (double) reqs / minutes;
+}
+// }}}
+
+// {{{ time_to_notice
+// does what's asked to the iPod in the given mode, runs times, and times
+// how long the wrapper takes to notice
+static NoticeResult time_to_notice(
+    const char *name,
+    bool advanced,
+    bool playing,
+    bool drop_out,
+    int runs
+) {
+    NoticeResult r;
+    memset(&r, 0, sizeof(r));
+
+    int noticed = 0;
+
+    for (int run = 0; run < runs; run++) {
+        plug_in(advanced, playing);
+        run_for(run * RUN_OFFSET_MS, NULL);
+
+        uint64_t at = sim_now();
+
+        if (drop_out) {
+            sim_ipod_drop_out();
+        } else {
+            sim_ipod_disconnect();
+        }
+
+        bool ok = run_for(NOTICE_TIMEOUT_MS, drop_out ? not_advanced : gone);
+        double ms = CYCLES_TO_MS(sim_now() - at);
+
+        if (drop_out) {
+            unplug();
+        }
+
+        if (verbose) {
+            printf("  %-16s +%5lums  %s%8.1f ms\n",
+                   name, run * RUN_OFFSET_MS,
+                   ok ? "" : "never", ok ? ms : 0.0);
+        }
+
+        if (! ok) {
+            r.missed += 1;
+            continue;
+        }
+
+        noticed += 1;
+        r.mean_ms += ms;
+
+        if (ms > r.worst_ms) {
+            r.worst_ms = ms;
+        }
+    }
+
+    if (noticed > 0) {
+        r.mean_ms /= noticed;
+    }
+
+    return r;
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    int runs = 10;
+    unsigned long minutes = 1;
+    unsigned long loop_us = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vr:m:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'r':
+                runs = atoi(optarg);
+                break;
+
+            case 'm':
+                minutes = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-r runs] [-m minutes] [-l loop_us]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    if (minutes < 1) {
+        minutes = 1;
+    }
+
+    loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    init();
+
+    // unplugged; the 47k pull-down holds the pin low
+    sim_pin_set(IPOD_RX_PIN, LOW);
+
+    iPodSerialPort.begin(IPOD_BAUD);
+    sim_ipod_set_baud(IPOD_BAUD);
+    sim_ipod_set_response_delay(20 * SIM_CYCLES_PER_MS);
+
+    iPodWrapper.init(&iPodSerialPort, IPOD_RX_PIN);
+
+    bool ok = true;
+
+    printf("keep-alive: %.1f time and status requests a minute paused, %.1f playing\n",
+           keep_alive_traffic(false, minutes), keep_alive_traffic(true, minutes));
+
+    printf("%-18s %9s %9s\n", "noticing", "mean ms", "worst ms");
+
+    static const struct {
+        const char *name;
+        bool advanced;
+        bool playing;
+        bool drop_out;
+    } cases[] = {
+        { "unplug, simple",   false, false, false },
+        { "unplug, paused",   true,  false, false },
+        { "unplug, playing",  true,  true,  false },
+        { "drop out, paused", true,  false, true  },
+    };
+
+    for (size_t i = 0; i < (sizeof(cases) / sizeof(cases[0])); i++) {
+        NoticeResult r = time_to_notice(
+            cases[i].name, cases[i].advanced, cases[i].playing, cases[i].drop_out, runs
+        );
+
+        printf("%-18s %9.1f %9.1f", cases[i].name, r.mean_ms, r.worst_ms);
+
+        if (r.missed != 0) {
+            printf("  %lu never noticed", r.missed);
+            ok = false;
+        }
+
+        printf("\n");
+
+        if (! cases[i].drop_out && (r.worst_ms >= UNPLUG_LIMIT_MS)) {
+            printf("FAIL: an unplug took %lu ms or more to notice\n", UNPLUG_LIMIT_MS);
+            ok = false;
+        }
+
+        if (cases[i].drop_out && (r.worst_ms >= DROP_OUT_LIMIT_MS)) {
+            printf("FAIL: a drop out took %lu ms or more to notice\n", DROP_OUT_LIMIT_MS);
+            ok = false;
+        }
+    }
+
+    const IPodWrapper::LivenessStats *stats = iPodWrapper.getLivenessStats();
+
+    printf("(wrapper: %u keep-alives, %u missed, %u given up on, %u unplugs; "
+           "reply latency %u ms)\n",
+           stats->keepAlives, stats->keepAliveMisses, stats->expiries,
+           stats->unplugs, stats->replyLatency);
+
+    return ok ? 0 : 1;
+}
+// }}}
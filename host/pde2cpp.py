@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+"""
+pde2cpp.py
+
+Turns an Arduino sketch into a C++ file the way the Arduino 0022 IDE does:
+WProgram.h is included first, and a prototype for every function defined in
+the sketch is inserted ahead of the first line that isn't a comment, a blank
+or a preprocessor directive.  #line directives keep compiler messages
+pointing at the .pde.
+
+    pde2cpp.py sketch.pde > sketch.cpp
+"""
+
+import os
+import re
+import sys
+
+FUNC_RE = re.compile(r'([A-Za-z_][\w:<>]*[\s\*&]+)+([A-Za-z_]\w*)\s*\(([^;{}()]*)\)\s*$', re.S)
+PREPROC_RE = re.compile(r'(?m)^[ \t]*#(?:[^\n]*\\\n)*[^\n]*')
+KEYWORDS = set(['if', 'while', 'for', 'switch', 'return', 'sizeof', 'ISR', 'SIGNAL'])
+
+
+def strip_comments_and_strings(src):
+    """Blanks out comments and literals, keeping newlines so offsets match."""
+    out = []
+    i = 0
+    n = len(src)
+
+    while i < n:
+        c = src[i]
+
+        if src.startswith('//', i):
+            j = src.find('\n', i)
+            j = n if j < 0 else j
+            out.append(' ' * (j - i))
+            i = j
+        elif src.startswith('/*', i):
+            j = src.find('*/', i + 2)
+            j = n if j < 0 else j + 2
+            out.append(re.sub(r'[^\n]', ' ', src[i:j]))
+            i = j
+        elif c in '"\'':
+            j = i + 1
+
+            while j < n and src[j] != c:
+                j += 2 if src[j] == '\\' else 1
+
+            j = min(j + 1, n)
+            out.append(c + re.sub(r'[^\n]', ' ', src[i + 1:j - 1]) + c)
+            i = j
+        else:
+            out.append(c)
+            i += 1
+
+    return ''.join(out)
+
+
+def strip_preprocessor(clean):
+    """Blanks out directives, including continuation lines."""
+    return PREPROC_RE.sub(lambda m: re.sub(r'[^\n]', ' ', m.group(0)), clean)
+
+
+def find_prototypes(src):
+    clean = strip_preprocessor(strip_comments_and_strings(src))
+
+    prototypes = []
+    depth = 0
+    stmt_start = 0
+
+    for i, c in enumerate(clean):
+        if c == '{':
+            if depth == 0:
+                head = clean[stmt_start:i].strip()
+                m = FUNC_RE.search(head)
+
+                if m and (m.group(2) not in KEYWORDS) and ('=' not in head):
+                    # only the declaration itself, from the original source
+                    proto = ' '.join(head.split())
+                    proto = re.sub(r'\s*__attribute__\s*\(\(.*\)\)', '', proto)
+                    prototypes.append(proto + ';')
+
+            depth += 1
+        elif c == '}':
+            depth -= 1
+
+            if depth == 0:
+                stmt_start = i + 1
+        elif (c == ';') and (depth == 0):
+            stmt_start = i + 1
+
+    return prototypes
+
+
+def first_code_line(src):
+    clean = strip_preprocessor(strip_comments_and_strings(src))
+
+    for lineno, line in enumerate(clean.split('\n')):
+        if line.strip():
+            return lineno
+
+    return 0
+
+
+def main():
+    path = sys.argv[1]
+    src = open(path).read()
+    name = os.path.basename(path)
+
+    lines = src.split('\n')
+    insert_at = first_code_line(src)
+
+    out = []
+    out.append('#include "WProgram.h"')
+    out.append('#line 1 "%s"' % name)
+    out.extend(lines[:insert_at])
+    out.extend(find_prototypes(src))
+    out.append('#line %d "%s"' % (insert_at + 1, name))
+    out.extend(lines[insert_at:])
+
+    sys.stdout.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
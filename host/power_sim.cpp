@@ -0,0 +1,379 @@
+/*
+    Parks the car with the firmware running on the host, against the
+    simulated peripherals in hal/, and measures what it draws while the
+    bus is asleep and how quickly it's back when the bus wakes up.
+
+        power_sim [-v] [-n] [-p park_s] [-w poll_ms] [-l loop_us] [-e eeprom.bin]
+
+    The radio polls every RADIO_POLL_MS while the bus is awake.  After
+    AWAKE_MS, INH goes low (the radio stops) for park_s seconds (default
+    60), with one short glitch on INH halfway through, and then high again;
+    the radio's first poll after that comes poll_ms later (default 500).
+    Reported:
+
+      • the average supply current while awake, and while parked: how long
+        the firmware stayed up after INH went low, and the quiescent current
+        once it was powered down
+      • from INH going high to the end of the first frame we sent (the
+        announcement), and from the end of the radio's first poll to the
+        end of our answer
+      • from the reset to the end of the first channel text (3E 01) we
+        sent, and what it said
+
+    Exits non-zero if the firmware never powered down, or if either the
+    announcement or the answer took longer than the radio's poll period.
+    A watchdog reset while asleep ends the simulation with status 3.
+
+    -v prints every frame on the wire, -n leaves the iPod unplugged, and -l
+    sets the virtual time taken by one loop() pass (default 100µs).  The
+    LEDs are assumed to draw LED_LOAD_UA each when lit.
+
+    With -e, the EEPROM's loaded from eeprom.bin (if it's there) before the
+    firmware starts, and written back to it at the end; a second run with
+    the same file starts the way the firmware does after a reset, with the
+    state the first one saved (see state_snapshot.h).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "WProgram.h"
+#include "sim.h"
+#include "sim_ipod.h"
+
+// from the sketch
+#define INH_PIN     2
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+#define IPOD_BAUD   38400
+#define LED_ERR     19
+#define LED_IBUS_RX 18
+#define LED_IBUS_TX 17
+
+// 5V through 1k and a red LED
+#define LED_LOAD_UA 3000
+
+#define RADIO_POLL_MS 10000UL
+
+// the bus is awake this long before it's parked
+#define AWAKE_MS 30000UL
+
+// how long INH blips high halfway through the park
+#define GLITCH_US 20
+
+// left running this long after the radio's first poll, for the answer
+#define DRAIN_MS 2000UL
+
+static bool verbose = false;
+
+static const uint8_t radio_poll[] = { 0x68, 0x03, 0x73, 0x01, 0x19 };
+
+// the end of the first frame we sent since, and the first answer to a poll
+// since; 0 until there's been one
+static uint64_t watch_from;
+static uint64_t first_frame_at;
+static uint64_t first_reply_at;
+
+// the end of the first channel text sent since the reset, and its text
+static uint64_t first_text_at;
+static std::string first_text;
+
+// what we've put on the wire, split up by length
+static std::vector<uint8_t> sent_frame;
+
+#define CYCLES_TO_MS(_c) ((double) (_c) / SIM_CYCLES_PER_MS)
+
+// {{{ ibus_observer
+static void ibus_observer(uint64_t when, uint8_t b, uint8_t sources, uint8_t status) {
+    if (verbose) {
+        printf("%12.3f ms  %s %02X%s\n",
+               CYCLES_TO_MS(when),
+               (sources == SIM_IBUS_US) ? "us   " : ((sources == SIM_IBUS_OTHER) ? "radio" : "both "),
+               b,
+               status ? " (garbled)" : "");
+    }
+
+    if (sources != SIM_IBUS_US) {
+        sent_frame.clear();
+        return;
+    }
+
+    sent_frame.push_back(b);
+
+    if ((sent_frame.size() < 2) || (sent_frame.size() < (size_t) (sent_frame[1] + 2))) {
+        return;
+    }
+
+    // 73 .. 68 3E 01 00 channel preset 04 text...; the high nibble of the
+    // 01's the scanning flag
+    if ((first_text_at == 0) && (sent_frame.size() > 9) && (sent_frame[3] == 0x3E) &&
+        ((sent_frame[4] & 0x0F) == 0x01) && (sent_frame[5] == 0x00)) {
+        first_text_at = when;
+        first_text.assign(sent_frame.begin() + 9, sent_frame.end() - 1);
+    }
+
+    if ((watch_from != 0) && (when > watch_from)) {
+        if (first_frame_at == 0) {
+            first_frame_at = when;
+        }
+
+        // 73 04 68 02 00: device ready, the answer to a poll
+        if ((first_reply_at == 0) && (sent_frame[3] == 0x02) && (sent_frame[4] == 0x00)) {
+            first_reply_at = when;
+        }
+    }
+
+    sent_frame.clear();
+}
+// }}}
+
+// {{{ mean_ua
+static double mean_ua(const SimPowerStats *s) {
+    uint64_t cycles = 0;
+    double ua_cycles = 0;
+
+    for (int i = 0; i < SIM_POWER_STATE_COUNT; i++) {
+        cycles += s->cycles[i];
+        ua_cycles += s->ua_cycles[i];
+    }
+
+    return cycles ? (ua_cycles / cycles) : 0.0;
+}
+// }}}
+
+// {{{ load_eeprom / save_eeprom
+static void load_eeprom(const char *path) {
+    FILE *f = fopen(path, "rb");
+
+    if (f != NULL) {
+        size_t n = fread(sim_eeprom(), 1, SIM_EEPROM_SIZE, f);
+        fclose(f);
+
+        if (verbose) {
+            printf("EEPROM: %zu bytes from %s\n", n, path);
+        }
+    }
+}
+
+static bool save_eeprom(const char *path) {
+    FILE *f = fopen(path, "wb");
+
+    if ((f == NULL) || (fwrite(sim_eeprom(), 1, SIM_EEPROM_SIZE, f) != SIM_EEPROM_SIZE)) {
+        perror(path);
+
+        if (f != NULL) {
+            fclose(f);
+        }
+
+        return false;
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ run_until
+// loop() over and over, with the radio polling from next_poll on (if it's
+// not 0); returns the power stats as they were when the firmware woke up
+// from its first sleep, if it did
+static void run_until(uint64_t until, uint64_t loop_cycles, uint64_t *next_poll, SimPowerStats *at_wake) {
+    while (sim_now() < until) {
+        if ((*next_poll != 0) && (sim_now() >= *next_poll)) {
+            sim_ibus_send(radio_poll, sizeof(radio_poll));
+            *next_poll += RADIO_POLL_MS * SIM_CYCLES_PER_MS;
+        }
+
+        sim_ipod_update();
+
+        unsigned long sleeps = sim_power_stats()->sleeps;
+
+        loop();
+
+        if ((at_wake != NULL) && (sleeps == 0) && (sim_power_stats()->sleeps != 0)) {
+            *at_wake = *sim_power_stats();
+        }
+
+        sim_advance(loop_cycles);
+    }
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    bool ipod = true;
+    unsigned long park_s = 60;
+    unsigned long poll_ms = 500;
+    unsigned long loop_us = 100;
+    const char *eeprom_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vnp:w:l:e:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'n':
+                ipod = false;
+                break;
+
+            case 'p':
+                park_s = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'w':
+                poll_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'e':
+                eeprom_path = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-n] [-p park_s] [-w poll_ms] [-l loop_us] [-e eeprom.bin]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    uint64_t loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    sim_set_ibus_observer(ibus_observer);
+
+    if (eeprom_path != NULL) {
+        load_eeprom(eeprom_path);
+    }
+
+    sim_pin_set_load(LED_ERR, LED_LOAD_UA);
+    sim_pin_set_load(LED_IBUS_RX, LED_LOAD_UA);
+    sim_pin_set_load(LED_IBUS_TX, LED_LOAD_UA);
+
+    // bus awake
+    sim_pin_set(INH_PIN, HIGH);
+
+    if (ipod) {
+        sim_ipod_set_baud(IPOD_BAUD);
+        sim_ipod_connect(IPOD_RX_PIN, IPOD_TX_PIN);
+    } else {
+        sim_pin_set(IPOD_RX_PIN, LOW);
+    }
+
+    uint64_t reset_at = sim_now();
+
+    init();
+    setup();
+
+    uint64_t next_poll = sim_now() + (RADIO_POLL_MS * SIM_CYCLES_PER_MS);
+
+    // setup()'s LED flashing and the iPod's attach are out of the way by
+    // now; the last poll period's what counts
+    run_until(AWAKE_MS * SIM_CYCLES_PER_MS, loop_cycles, &next_poll, NULL);
+    sim_reset_power_stats();
+    run_until(sim_now() + (RADIO_POLL_MS * SIM_CYCLES_PER_MS), loop_cycles, &next_poll, NULL);
+
+    SimPowerStats awake = *sim_power_stats();
+    bool ipod_playing = sim_ipod_playing();
+
+    // park; the radio goes quiet, and the bus wakes up later with a blip
+    // in between
+    uint64_t parked_at = sim_now();
+    uint64_t park_cycles = (uint64_t) park_s * 1000UL * SIM_CYCLES_PER_MS;
+    uint64_t wake_at = parked_at + park_cycles;
+    uint64_t glitch_at = parked_at + (park_cycles / 2);
+
+    next_poll = 0;
+    sim_pin_set(INH_PIN, LOW);
+    sim_pin_schedule(glitch_at, INH_PIN, HIGH);
+    sim_pin_schedule(glitch_at + (GLITCH_US * SIM_CYCLES_PER_US), INH_PIN, LOW);
+    sim_pin_schedule(wake_at, INH_PIN, HIGH);
+
+    sim_reset_power_stats();
+
+    SimPowerStats parked;
+    memset(&parked, 0, sizeof(parked));
+
+    watch_from = wake_at;
+
+    uint64_t radio_wakes_at = wake_at + ((uint64_t) poll_ms * SIM_CYCLES_PER_MS);
+
+    run_until(radio_wakes_at, loop_cycles, &next_poll, &parked);
+
+    bool ipod_paused = ! sim_ipod_playing();
+
+    // the radio's first poll, and what it takes to answer it
+    next_poll = sim_now();
+    run_until(radio_wakes_at + (DRAIN_MS * SIM_CYCLES_PER_MS), loop_cycles, &next_poll, NULL);
+
+    uint64_t poll_end = radio_wakes_at + (sizeof(radio_poll) * 11 * SIM_IBUS_BIT_CYCLES);
+    unsigned long wdt_resets = sim_watchdog_resets();
+
+    printf("awake: %.2f mA average over %.1f s%s\n",
+           mean_ua(&awake) / 1000.0,
+           CYCLES_TO_MS(RADIO_POLL_MS * SIM_CYCLES_PER_MS) / 1000.0,
+           ipod ? (ipod_playing ? ", iPod playing" : ", iPod paused") : "");
+
+    if (parked.sleeps == 0) {
+        printf("parked: never powered down in %lu s\n", park_s);
+        return 1;
+    }
+
+    printf("parked: up for %.1f ms after INH fell, then powered down for %.3f s at %.1f µA",
+           CYCLES_TO_MS(parked.cycles[SIM_POWER_ACTIVE]),
+           CYCLES_TO_MS(parked.cycles[SIM_POWER_DOWN]) / 1000.0,
+           parked.ua_cycles[SIM_POWER_DOWN] / parked.cycles[SIM_POWER_DOWN]);
+
+    printf("; %.1f µA average, %lu sleeps%s\n",
+           mean_ua(&parked),
+           parked.sleeps,
+           ipod ? (ipod_paused ? ", iPod paused" : ", iPod still playing") : "");
+
+    bool ok = true;
+    double window_ms = (double) RADIO_POLL_MS;
+
+    if (first_frame_at == 0) {
+        printf("wake: nothing sent within %lu ms of INH rising\n", poll_ms + DRAIN_MS);
+        ok = false;
+    } else {
+        double ms = CYCLES_TO_MS(first_frame_at - wake_at);
+
+        printf("wake: first frame %.2f ms after INH rose\n", ms);
+        ok = ok && (ms < window_ms);
+    }
+
+    if ((first_reply_at == 0) || (first_reply_at < poll_end)) {
+        printf("poll: no answer within %lu ms\n", DRAIN_MS);
+        ok = false;
+    } else {
+        double ms = CYCLES_TO_MS(first_reply_at - poll_end);
+
+        printf("poll: answered %.2f ms after the radio's first poll, %lu ms after INH rose\n",
+               ms, poll_ms);
+        ok = ok && (ms < window_ms);
+    }
+
+    if (first_text_at == 0) {
+        printf("boot: no channel text sent\n");
+    } else {
+        printf("boot: channel text \"%s\" %.2f ms after the reset\n",
+               first_text.c_str(), CYCLES_TO_MS(first_text_at - reset_at));
+    }
+
+    printf("(radio polls every %lu ms; %lu watchdog resets)\n", RADIO_POLL_MS, wdt_resets);
+
+    if ((eeprom_path != NULL) && ! save_eeprom(eeprom_path)) {
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
+// }}}
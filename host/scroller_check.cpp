@@ -0,0 +1,321 @@
+/*
+    Checks the windows text_scroller shows the channel text in.
+
+        scroller_check [-v] [names.txt...]
+
+    A few texts with known windows are run through first: words that fit
+    exactly, long words, runs of spaces and UTF-8.  Then every line of the
+    files given (track titles, artists and albums, as UTF-8), checking that
+    each window:
+
+      • is at most SCROLL_WIDTH bytes and doesn't end in a partial UTF-8
+        character
+      • starts after the one before
+      • doesn't start with a word that was shown whole in the one before,
+        except for the last window of a field that ran out of windows
+
+    And that a title that fits isn't scrolled because of a long artist or
+    album, unless SCROLL_ALL_FIELDS says they're shown too.
+
+    Exits non-zero if any of it fails.  -v prints every line's windows.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../text_scroller.h"
+
+// the title's last window is held for the pause at its end
+#if SCROLL_PAUSE_MS == 0
+    #error "scroller_check needs SCROLL_PAUSE_MS to find the end of the title"
+#endif
+
+typedef struct __known_windows {
+    const char *text;
+    const char *windows[SCROLL_MAX_WINDOWS + 1];
+} KnownWindows;
+
+static const KnownWindows known[] = {
+    { "Hello World",             { "Hello Wo", "World", NULL } },
+    { "Hello ab World",          { "Hello ab", "World", NULL } },
+    { "Abcdefgh  Xyz",           { "Abcdefgh", "Xyz", NULL } },
+    { "Smells Like Teen Spirit", { "Smells L", "Like Tee", "Teen Spi", "Spirit", NULL } },
+    { "Supercalifragilistic",    { "Supercal", "ifragili", "stic", NULL } },
+    { "Björk Guðmundsdóttir",    { "Björk G", "Guðmund", "sdóttir", NULL } },
+    { "Nirvana",                 { "Nirvana", NULL } },
+};
+
+#define KNOWN_COUNT (sizeof(known) / sizeof(known[0]))
+
+static const char *title = "";
+static const char *artist = "";
+
+// {{{ text_source
+static const char *text_source(uint8_t field) {
+    switch (field) {
+        case SCROLL_FIELD_TITLE:
+            return title;
+
+        case SCROLL_FIELD_ARTIST:
+            return artist;
+
+        default:
+            return "";
+    }
+}
+// }}}
+
+// {{{ title_windows
+// the windows the title's shown in, as the radio would get them
+static std::vector<std::string> title_windows(const char *text) {
+    std::vector<std::string> windows;
+    char window[SCROLL_WIDTH + 1];
+
+    title = text;
+    scroller_load(SCROLL_FIELD_TITLE);
+    scroller_restart();
+
+    for (int i = 0; i < SCROLL_MAX_WINDOWS; i++) {
+        if (! scroller_window(window)) {
+            break;
+        }
+
+        windows.push_back(window);
+
+        // held longer than the windows before the end
+        unsigned long hold = SCROLL_STEP_MS + ((i == 0) ? SCROLL_PAUSE_MS : 0);
+
+        if (scroller_hold_time() > ((hold > SCROLL_MIN_INTERVAL) ? hold : SCROLL_MIN_INTERVAL)) {
+            break;
+        }
+
+        scroller_advance();
+    }
+
+    return windows;
+}
+// }}}
+
+// {{{ print_windows
+static void print_windows(const char *text, const std::vector<std::string> &windows) {
+    printf("  %-32s", text);
+
+    for (size_t i = 0; i < windows.size(); i++) {
+        printf(" [%s]", windows[i].c_str());
+    }
+
+    printf("\n");
+}
+// }}}
+
+// {{{ check_known
+static int check_known(bool verbose) {
+    int failures = 0;
+
+    for (size_t n = 0; n < KNOWN_COUNT; n++) {
+        std::vector<std::string> windows = title_windows(known[n].text);
+        bool ok = true;
+        size_t i;
+
+        for (i = 0; known[n].windows[i] != NULL; i++) {
+            if ((i >= windows.size()) || (windows[i] != known[n].windows[i])) {
+                ok = false;
+            }
+        }
+
+        if (i != windows.size()) {
+            ok = false;
+        }
+
+        if (verbose || ! ok) {
+            print_windows(known[n].text, windows);
+        }
+
+        if (! ok) {
+            printf("FAIL: \"%s\" should be", known[n].text);
+
+            for (i = 0; known[n].windows[i] != NULL; i++) {
+                printf(" [%s]", known[n].windows[i]);
+            }
+
+            printf("\n");
+            failures += 1;
+        }
+    }
+
+    return failures;
+}
+// }}}
+
+// {{{ check_scrolling
+// whether a title scrolls, with and without a long artist
+static int check_scrolling() {
+    static const struct {
+        const char *title;
+        const char *artist;
+        bool scrolling;
+    } cases[] = {
+        { "Nirvana",                 "",                        false },
+        { "Nirvana",                 "Smells Like Teen Spirit", SCROLL_ALL_FIELDS },
+        { "Smells Like Teen Spirit", "",                        true  },
+        { "Smells Like Teen Spirit", "Nirvana",                 true  },
+    };
+
+    int failures = 0;
+
+    for (size_t i = 0; i < (sizeof(cases) / sizeof(cases[0])); i++) {
+        title = cases[i].title;
+        artist = cases[i].artist;
+        scroller_load(SCROLL_FIELD_TITLE);
+        scroller_load(SCROLL_FIELD_ARTIST);
+        scroller_restart();
+
+        if (scroller_is_scrolling() != cases[i].scrolling) {
+            printf("FAIL: \"%s\" by \"%s\" should%s scroll\n",
+                   cases[i].title, cases[i].artist, cases[i].scrolling ? "" : "n't");
+            failures += 1;
+        }
+    }
+
+    artist = "";
+    scroller_load(SCROLL_FIELD_ARTIST);
+
+    return failures;
+}
+// }}}
+
+// {{{ check_line
+// returns what's wrong with text's windows, or NULL
+static const char *check_line(const char *text, const std::vector<std::string> &windows) {
+    size_t len = strlen(text);
+
+    if ((len > 0) && windows.empty()) {
+        return "no windows";
+    }
+
+    size_t prev_start = 0;
+    size_t prev_end = 0;
+
+    for (size_t i = 0; i < windows.size(); i++) {
+        const char *window = windows[i].c_str();
+        size_t window_len = strlen(window);
+
+        if (window_len > SCROLL_WIDTH) {
+            return "window too long";
+        }
+
+        if ((window_len > 0) && ((window[window_len - 1] & 0xC0) == 0xC0)) {
+            return "window ends in a partial character";
+        }
+
+        // where it starts; the windows only go forwards
+        const char *found = strstr(text + ((i == 0) ? 0 : (prev_start + 1)), window);
+
+        if ((found == NULL) || ((i == 0) && (found != text))) {
+            return "window out of order";
+        }
+
+        size_t start = found - text;
+
+        if (start > 0xFF) {
+            break;
+        }
+
+        // the first word in this one, if it was all in the one before
+        if ((i > 0) && (i < (SCROLL_MAX_WINDOWS - 1)) && (start < prev_end)) {
+            const char *space = strchr(text + start, ' ');
+            size_t word_end = (space == NULL) ? len : (size_t) (space - text);
+
+            if (word_end <= prev_end) {
+                return "word shown whole twice";
+            }
+        }
+
+        prev_start = start;
+        prev_end = start + window_len;
+    }
+
+    return NULL;
+}
+// }}}
+
+// {{{ load_lines
+static bool load_lines(const char *path, std::vector<std::string> &lines) {
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char buf[1024];
+
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+        if (buf[0] != '\0') {
+            lines.push_back(buf);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-v] [names.txt...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<std::string> lines;
+
+    for (int i = optind; i < argc; i++) {
+        if (! load_lines(argv[i], lines)) {
+            return 1;
+        }
+    }
+
+    scroller_init(text_source);
+
+    int failures = check_known(verbose) + check_scrolling();
+    size_t window_total = 0;
+
+    for (size_t n = 0; n < lines.size(); n++) {
+        const char *text = lines[n].c_str();
+        std::vector<std::string> windows = title_windows(text);
+        const char *problem = check_line(text, windows);
+
+        window_total += windows.size();
+
+        if (verbose || (problem != NULL)) {
+            print_windows(text, windows);
+        }
+
+        if (problem != NULL) {
+            printf("FAIL: \"%s\": %s\n", text, problem);
+            failures += 1;
+        }
+    }
+
+    printf("%lu known texts, %lu lines in %lu windows; %d failed\n",
+           (unsigned long) KNOWN_COUNT, (unsigned long) lines.size(),
+           (unsigned long) window_total, failures);
+
+    return (failures == 0) ? 0 : 1;
+}
+// }}}
@@ -0,0 +1,286 @@
+/*
+    What a burst of channel up presses costs on the iPod link: the
+    iPodWrapper skipping tracks in advanced mode, on the TimerSerial link
+    against the simulated iPod in hal/.
+
+        skip_bench [-v] [-r runs] [-g gap_ms] [-l loop_us]
+
+    With the iPod playing in advanced mode, nextTrack() is called 1, 2, 5
+    and 10 times in a row, gap_ms apart (default 120ms, a quick tap), runs
+    times each (default 10).  Reported for each burst size: the skip and
+    jump commands the iPod got, the titles, artists and albums it was asked
+    for, and the time from the last press until the wrapper has the title
+    of the track the presses add up to.
+
+    Exits non-zero if the wrapper ever ends up with the wrong track's title,
+    or if a burst isn't one jump with one fetch of the final track's title,
+    artist and album and none of the tracks skipped over; the track after
+    the one it starts on has been prefetched, so a single press fetches
+    nothing.  -v prints every burst.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WProgram.h"
+#include "sim.h"
+#include "sim_ipod.h"
+
+#include "../iPodWrapper.h"
+#include "../TimerSerial.h"
+
+// from the sketch
+#define IPOD_RX_PIN 8
+#define IPOD_TX_PIN 7
+#define IPOD_BAUD   38400
+
+// long enough that no song ends by itself during a run
+#define SONGS   100
+#define SONG_MS (60UL * 60UL * 1000UL)
+
+#define ATTACH_TIMEOUT_MS 10000UL
+#define TITLE_TIMEOUT_MS  5000UL
+
+// between bursts, for anything still on its way
+#define SETTLE_MS 1000UL
+
+// title, artist and album
+#define FETCH_REQS 3
+
+#define CYCLES_TO_MS(_c) ((double) (_c) / SIM_CYCLES_PER_MS)
+
+typedef struct __burst_result {
+    double skips;
+    double meta_reqs;
+    double mean_ms;
+    double worst_ms;
+    unsigned long wrong;
+    unsigned long wasted;
+} BurstResult;
+
+static bool verbose = false;
+static uint64_t loop_cycles;
+
+// what the title should end up as
+static char expected_title[32];
+
+TimerSerial iPodSerialPort(IPOD_TX_PIN);
+IPodWrapper iPodWrapper;
+
+// {{{ run_for
+// update() over and over, as loop() does, until done() or timeout_ms;
+// returns false on the timeout
+static bool run_for(unsigned long timeout_ms, bool (*done)()) {
+    uint64_t until = sim_now() + ((uint64_t) timeout_ms * SIM_CYCLES_PER_MS);
+
+    while (sim_now() < until) {
+        sim_ipod_update();
+        scheduler_run();
+        iPodWrapper.update();
+
+        if ((done != NULL) && done()) {
+            return true;
+        }
+
+        sim_advance(loop_cycles);
+    }
+
+    return false;
+}
+// }}}
+
+// {{{ have_title / have_expected_title
+static bool have_title() {
+    return (iPodWrapper.getTitle()[0] != '\0');
+}
+
+static bool have_expected_title() {
+    return (strcmp(iPodWrapper.getTitle(), expected_title) == 0);
+}
+// }}}
+
+// {{{ skipped_over_reqs
+// metadata asked for so far of the tracks between from and the one presses
+// tracks on
+static unsigned long skipped_over_reqs(unsigned long from, int presses) {
+    unsigned long reqs = 0;
+
+    for (int i = 1; i < presses; i++) {
+        reqs += sim_ipod_meta_reqs((from + i) % SONGS);
+    }
+
+    return reqs;
+}
+// }}}
+
+// {{{ run_burst
+static BurstResult run_burst(int presses, unsigned long gap_ms, int runs) {
+    BurstResult r;
+    memset(&r, 0, sizeof(r));
+
+    int good = 0;
+
+    for (int run = 0; run < runs; run++) {
+        run_for(SETTLE_MS, NULL);
+
+        unsigned long from = iPodWrapper.getPlaylistPosition();
+        snprintf(expected_title, sizeof(expected_title), "Title %lu", (from + presses) % SONGS);
+
+        SimIPodStats before = *sim_ipod_stats();
+        unsigned long final_reqs = sim_ipod_meta_reqs((from + presses) % SONGS);
+        unsigned long between_reqs = skipped_over_reqs(from, presses);
+
+        for (int i = 0; i < presses; i++) {
+            if (i > 0) {
+                run_for(gap_ms, NULL);
+            }
+
+            iPodWrapper.nextTrack();
+        }
+
+        uint64_t last_press = sim_now();
+        bool ok = run_for(TITLE_TIMEOUT_MS, have_expected_title);
+        double ms = CYCLES_TO_MS(sim_now() - last_press);
+
+        // whatever else is coming for it has to be counted too
+        run_for(SETTLE_MS, NULL);
+
+        const SimIPodStats *after = sim_ipod_stats();
+        unsigned long skips = after->skips - before.skips;
+        unsigned long meta_reqs = after->meta_reqs - before.meta_reqs;
+
+        final_reqs = sim_ipod_meta_reqs((from + presses) % SONGS) - final_reqs;
+        between_reqs = skipped_over_reqs(from, presses) - between_reqs;
+
+        // one jump, and one fetch for the track it ends up on unless it was
+        // prefetched
+        bool one_fetch = (skips == 1) && (between_reqs == 0) &&
+                         (final_reqs == ((presses == 1) ? 0 : FETCH_REQS));
+
+        if (verbose) {
+            printf("  %2d presses from %3lu: %lu skips, %lu metadata requests (%lu for the final track), %s%.1f ms\n",
+                   presses, from, skips, meta_reqs, final_reqs,
+                   ok ? "" : "never got the title, ", ok ? ms : 0.0);
+        }
+
+        r.skips += skips;
+        r.meta_reqs += meta_reqs;
+
+        if (! one_fetch) {
+            r.wasted += 1;
+        }
+
+        if (! ok) {
+            r.wrong += 1;
+            continue;
+        }
+
+        good += 1;
+        r.mean_ms += ms;
+
+        if (ms > r.worst_ms) {
+            r.worst_ms = ms;
+        }
+    }
+
+    if (good > 0) {
+        r.mean_ms /= good;
+    }
+
+    r.skips /= runs;
+    r.meta_reqs /= runs;
+
+    return r;
+}
+// }}}
+
+// {{{ main
+int main(int argc, char **argv) {
+    int runs = 10;
+    unsigned long gap_ms = 120;
+    unsigned long loop_us = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vr:g:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'r':
+                runs = atoi(optarg);
+                break;
+
+            case 'g':
+                gap_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                loop_us = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-v] [-r runs] [-g gap_ms] [-l loop_us]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    loop_cycles = (uint64_t) loop_us * SIM_CYCLES_PER_US;
+
+    sim_init();
+    init();
+
+    // unplugged; the 47k pull-down holds the pin low
+    sim_pin_set(IPOD_RX_PIN, LOW);
+
+    iPodSerialPort.begin(IPOD_BAUD);
+    sim_ipod_set_baud(IPOD_BAUD);
+    sim_ipod_set_response_delay(20 * SIM_CYCLES_PER_MS);
+    sim_ipod_set_playlist(SONGS, SONG_MS);
+
+    iPodWrapper.init(&iPodSerialPort, IPOD_RX_PIN);
+    iPodWrapper.setAdvanced();
+    iPodWrapper.play();
+
+    sim_ipod_connect(IPOD_RX_PIN, IPOD_TX_PIN);
+
+    if (! run_for(ATTACH_TIMEOUT_MS, have_title)) {
+        fprintf(stderr, "the iPod never attached\n");
+        return 1;
+    }
+
+    printf("%-8s %9s %9s %9s %9s\n", "presses", "skips", "meta reqs", "mean ms", "worst ms");
+
+    static const int bursts[] = { 1, 2, 5, 10 };
+    bool ok = true;
+
+    for (size_t i = 0; i < (sizeof(bursts) / sizeof(bursts[0])); i++) {
+        BurstResult r = run_burst(bursts[i], gap_ms, runs);
+
+        printf("%-8d %9.1f %9.1f %9.1f %9.1f", bursts[i], r.skips, r.meta_reqs, r.mean_ms, r.worst_ms);
+
+        if (r.wrong != 0) {
+            printf("  %lu never got the right title", r.wrong);
+            ok = false;
+        }
+
+        if (r.wasted != 0) {
+            printf("  %lu not one jump and one fetch", r.wasted);
+            ok = false;
+        }
+
+        printf("\n");
+    }
+
+    printf("(%d bursts each, presses %lu ms apart; mean and worst from the last press to the title)\n",
+           runs, gap_ms);
+
+    return ok ? 0 : 1;
+}
+// }}}
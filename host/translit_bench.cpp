@@ -0,0 +1,204 @@
+/*
+    Host-side benchmark for translit_utf8().
+
+    Runs every line of the files given on the command line (track titles,
+    artists and albums, as UTF-8) through the transliteration the firmware
+    does as metadata arrives, and reports:
+
+      • cycles per string and per input byte (TSC on x86, nanoseconds
+        elsewhere), amortized and for the worst string
+      • how many of the 8 characters the radio shows were garbage before
+        (bytes of multi-byte sequences, copied as-is) and after
+      • how many characters came out as TRANSLIT_UNKNOWN
+
+    With -v, every string that changed is shown with what it became.
+
+    Exits non-zero if any output has a byte outside printable ASCII, or is
+    longer than the buffer allows.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define CYCLE_UNIT "cycles"
+    static inline uint64_t cycle_count() { return __rdtsc(); }
+#else
+    #define CYCLE_UNIT "ns"
+    static inline uint64_t cycle_count() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    }
+#endif
+
+#include "../translit.h"
+
+// what IPodWrapper converts into; IPOD_META_TITLE_LEN + 1
+#define META_BUF_LEN 33
+
+// what the radio shows of the channel text
+#define DISPLAY_LEN 8
+
+// runs of each string; the fastest is kept, to leave out interrupts and
+// cache misses that have nothing to do with the code
+#define RUNS 200
+
+// {{{ load_lines
+static bool load_lines(const char *path, std::vector<std::string> &lines) {
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char buf[1024];
+
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+        if (buf[0] != '\0') {
+            lines.push_back(buf);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+// }}}
+
+// {{{ garbage_on_display
+// bytes of the first DISPLAY_LEN that aren't a printable ASCII character
+static int garbage_on_display(const char *s) {
+    int garbage = 0;
+
+    for (int i = 0; (i < DISPLAY_LEN) && (s[i] != '\0'); i++) {
+        uint8_t c = s[i];
+
+        if ((c < 0x20) || (c > 0x7E)) {
+            garbage += 1;
+        }
+    }
+
+    return garbage;
+}
+// }}}
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-v] names.txt...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<std::string> lines;
+
+    for (int i = optind; i < argc; i++) {
+        if (! load_lines(argv[i], lines)) {
+            return 1;
+        }
+    }
+
+    if (lines.empty()) {
+        fprintf(stderr, "usage: %s [-v] names.txt...\n", argv[0]);
+        return 2;
+    }
+
+    uint64_t total_cycles = 0;
+    uint64_t worst_cycles = 0;
+    size_t total_bytes = 0;
+    size_t worst_line = 0;
+    int changed = 0;
+    int garbage_before = 0;
+    int garbage_after = 0;
+    int unknown = 0;
+    int failures = 0;
+
+    for (size_t n = 0; n < lines.size(); n++) {
+        const char *src = lines[n].c_str();
+        char dest[META_BUF_LEN];
+        size_t len = 0;
+        uint64_t best = UINT64_MAX;
+
+        for (int run = 0; run < RUNS; run++) {
+            uint64_t start = cycle_count();
+            len = translit_utf8(dest, src, sizeof(dest));
+            uint64_t elapsed = cycle_count() - start;
+
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        total_cycles += best;
+        total_bytes += strlen(src);
+
+        if (best > worst_cycles) {
+            worst_cycles = best;
+            worst_line = n;
+        }
+
+        if ((len != strlen(dest)) || (len >= sizeof(dest))) {
+            printf("FAIL: bad length %zu for \"%s\"\n", len, src);
+            failures += 1;
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            uint8_t c = dest[i];
+
+            if ((c < 0x20) || (c > 0x7E)) {
+                printf("FAIL: byte %02X in output for \"%s\"\n", c, src);
+                failures += 1;
+                break;
+            }
+
+            if (c == TRANSLIT_UNKNOWN) {
+                unknown += 1;
+            }
+        }
+
+        // the old way: the first bytes, copied as they came
+        garbage_before += garbage_on_display(src);
+        garbage_after += garbage_on_display(dest);
+
+        if (strncmp(src, dest, sizeof(dest) - 1) != 0) {
+            changed += 1;
+
+            if (verbose) {
+                printf("%-40s -> %s\n", src, dest);
+            }
+        }
+    }
+
+    printf("%zu strings, %zu bytes; %d changed\n", lines.size(), total_bytes, changed);
+    printf("%.1f %s per string, %.2f per byte; worst %llu, for \"%s\"\n",
+           (double) total_cycles / lines.size(),
+           CYCLE_UNIT,
+           (double) total_cycles / total_bytes,
+           (unsigned long long) worst_cycles,
+           lines[worst_line].c_str());
+    printf("garbage in the first %d characters: %d bytes before, %d after; %d shown as '%c'\n",
+           DISPLAY_LEN, garbage_before, garbage_after, unknown, TRANSLIT_UNKNOWN);
+
+    if (failures != 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -5,23 +5,36 @@
     mode switches:
     MODE_UNKNOWN (initial)
         detect high on RX pin -> MODE_SIMPLE
+        detect high on RX pin, direct attach -> MODE_SWITCHING_TO_ADVANCED
     MODE_SIMPLE
         advancedModeRequested -> MODE_SWITCHING_TO_ADVANCED
-        detect low on RX pin -> MODE_UNKNOWN
     MODE_SWITCHING_TO_ADVANCED
         handleTimeAndStatus() -> MODE_ADVANCED
-        timeout -> MODE_UNKNOWN
+        direct attach probes unanswered -> MODE_SIMPLE
+        timeout, keep-alive unanswered -> MODE_UNKNOWN
     MODE_ADVANCED
-        timeout -> MODE_UNKNOWN
+        keep-alives unanswered -> MODE_UNKNOWN
+    any mode
+        RX pin low for IPOD_UNPLUG_DEBOUNCE -> MODE_UNKNOWN
  **/
 
 #include "pgm_util.h"
+#include "utf8_util.h"
+#include "translit.h"
+#include "scheduler.h"
 #include "pins_arduino.h"
+#include "trace.h"
 
 #if DEBUG
     extern Print *console;
 #endif
 
+// MetaDataRequest.slot for a request whose response is no longer wanted
+#define IPOD_META_NO_SLOT 0xFF
+
+// MetaDataSlot.missing when nothing has been retrieved
+#define IPOD_META_ALL_FIELDS (_BV(META_TITLE) | _BV(META_ARTIST) | _BV(META_ALBUM))
+
 // {{{ IPodWrapper constructor
 IPodWrapper::IPodWrapper() {
     // these are set directly
@@ -31,6 +44,38 @@ IPodWrapper::IPodWrapper() {
     pIPodPlayingStateChangedHandler = NULL;
     
     requestedPlayingState = PLAY_STATE_PAUSED;
+    
+    directAttach = false;
+    attachProbes = 0;
+    
+    memset(&livenessStats, 0, sizeof(livenessStats));
+    
+    // these are all just timers, except for the simple remote
+    scheduler_init_action(&updateInterval, NULL, NULL);
+    scheduler_init_action(&advancedModeExpiration, NULL, NULL);
+    scheduler_init_action(&attachProbeExpiration, NULL, NULL);
+    scheduler_init_action(&metaRequestExpiration, NULL, NULL);
+    scheduler_init_action(&skipWindow, NULL, NULL);
+    scheduler_init_action(&simpleRemoteAction, simpleRemoteCallback, this);
+    
+    simpleButtonCount = 0;
+    simpleButtonHeld = false;
+    simpleSwitchPending = false;
+    
+    memset(metaCache, 0, sizeof(metaCache));
+    
+    for (uint8_t i = 0; i < IPOD_META_CACHE_SLOTS; i++) {
+        metaCache[i].age = i;
+    }
+    
+    currentMeta = &metaCache[0];
+    metaRequestHead = 0;
+    metaRequestCount = 0;
+    metaCacheHit = false;
+    haveSongCount = false;
+    metaDataChanged = false;
+    
+    memset(metaDataGeneration, 0, sizeof(metaDataGeneration));
 }
 // }}}
 
@@ -64,7 +109,6 @@ void IPodWrapper::init(Stream *_stream, uint8_t _rxPin) {
 	rx_port = portInputRegister(digitalPinToPort(_rxPin));
 
     stream = _stream;
-    lastUpdateInvocation = millis();
     
     simpleRemote.setSerial(*stream);
     advancedRemote.setSerial(*stream);
@@ -89,23 +133,39 @@ void IPodWrapper::init(Stream *_stream, uint8_t _rxPin) {
  */
 void IPodWrapper::reset() {
     mode = MODE_UNKNOWN;
-    updateMetaState = UPDATE_META_DONE;
     
     currentPlayingState = PLAY_STATE_UNKNOWN;
     
     havePlaylistPosition = false;
     playlistPosition = 0;
     
-    free(trackName);
-    trackName = NULL;
+    pendingSkip = 0;
+    skipQueued = false;
+    scheduler_cancel(&skipWindow);
     
-    free(artistName);
-    artistName = NULL;
+    // the iPod may have been swapped for another one; nothing cached is
+    // trustworthy any more, and nothing that's been asked for is coming
+    flushMetaCache();
+    emptyMetaSlot(currentMeta);
+    clearMetaData(currentMeta);
     
-    free(albumName);
-    albumName = NULL;
+    metaRequestCount = 0;
     
-    willExpire = false;
+    metaCacheHit = false;
+    haveSongCount = false;
+    metaDataChanged = false;
+    
+    // the next iPod may not be this one
+    scheduler_cancel(&advancedModeExpiration);
+    keepAlivePending = false;
+    keepAliveMisses = 0;
+    keepAliveInterval = IPOD_KEEPALIVE_MIN;
+    replyLatency8 = 0;
+    replyDeviation4 = 0;
+    rxLowSamples = 0;
+    
+    attachProbes = 0;
+    scheduler_cancel(&attachProbeExpiration);
 }
 // }}}
 
@@ -122,20 +182,361 @@ bool IPodWrapper::isAdvancedModeActive() {
 // }}}
 
 // {{{ IPodWrapper::getTitle
-char *IPodWrapper::getTitle() {
-    return trackName;
+const char *IPodWrapper::getTitle() {
+    return currentMeta->trackName;
 }
 // }}}
 
 // {{{ IPodWrapper::getArtist
-char *IPodWrapper::getArtist() {
-    return artistName;
+const char *IPodWrapper::getArtist() {
+    return currentMeta->artistName;
 }
 // }}}
 
 // {{{ IPodWrapper::getAlbum
-char *IPodWrapper::getAlbum() {
-    return albumName;
+const char *IPodWrapper::getAlbum() {
+    return currentMeta->albumName;
+}
+// }}}
+
+// {{{ IPodWrapper::getMetaDataGeneration
+uint8_t IPodWrapper::getMetaDataGeneration(MetaDataField field) {
+    return metaDataGeneration[field];
+}
+// }}}
+
+// {{{ IPodWrapper::metaDataField
+/*
+ * Returns the storage for the given field in a cache slot, and its size.
+ */
+char *IPodWrapper::metaDataField(MetaDataSlot *slot, MetaDataField field, size_t *size) {
+    if (field == META_TITLE) {
+        *size = sizeof(slot->trackName);
+        return slot->trackName;
+    } else if (field == META_ARTIST) {
+        *size = sizeof(slot->artistName);
+        return slot->artistName;
+    } else {
+        *size = sizeof(slot->albumName);
+        return slot->albumName;
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::setMetaData
+/*
+ * Copies value into a slot's storage for the given field, truncating it if
+ * necessary.  If the slot's the current one, the field's generation is
+ * bumped if it actually changed.
+ */
+void IPodWrapper::setMetaData(MetaDataSlot *slot, MetaDataField field, const char *value) {
+    size_t destSize;
+    char *dest = metaDataField(slot, field, &destSize);
+    
+    // compare against what'll actually be stored, not the untruncated value
+    size_t len = utf8_fit_len(value, destSize);
+    
+    if ((strlen(dest) == len) && (memcmp(dest, value, len) == 0)) {
+        return;
+    }
+    
+    memcpy(dest, value, len);
+    dest[len] = '\0';
+    
+    if (slot == currentMeta) {
+        metaDataGeneration[field] += 1;
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::clearMetaData
+void IPodWrapper::clearMetaData(MetaDataSlot *slot) {
+    setMetaData(slot, META_TITLE, "");
+    setMetaData(slot, META_ARTIST, "");
+    setMetaData(slot, META_ALBUM, "");
+}
+// }}}
+
+// {{{ IPodWrapper::flushMetaCache
+/*
+ * Forgets the metadata for every track but the current one.
+ */
+void IPodWrapper::flushMetaCache() {
+    for (uint8_t i = 0; i < IPOD_META_CACHE_SLOTS; i++) {
+        if (&metaCache[i] != currentMeta) {
+            emptyMetaSlot(&metaCache[i]);
+        }
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::emptyMetaSlot
+/*
+ * Marks a slot as unused and discards any responses still to come for it.
+ * The strings are left alone, so that the getters don't change underneath
+ * the caller if it's the current slot.
+ */
+void IPodWrapper::emptyMetaSlot(MetaDataSlot *slot) {
+    slot->valid = false;
+    slot->missing = IPOD_META_ALL_FIELDS;
+    
+    cancelMetaRequests(slot);
+}
+// }}}
+
+// {{{ IPodWrapper::findMetaSlot
+/*
+ * Returns the slot for the given playlist position, whether or not all of
+ * its fields have been retrieved yet, or NULL if there isn't one.
+ */
+IPodWrapper::MetaDataSlot *IPodWrapper::findMetaSlot(unsigned long position) {
+    for (uint8_t i = 0; i < IPOD_META_CACHE_SLOTS; i++) {
+        if (metaCache[i].valid && (metaCache[i].playlistPosition == position)) {
+            return &metaCache[i];
+        }
+    }
+    
+    return NULL;
+}
+// }}}
+
+// {{{ IPodWrapper::allocateMetaSlot
+/*
+ * Empties the least recently used slot other than the current one and
+ * assigns it to the given playlist position.
+ */
+IPodWrapper::MetaDataSlot *IPodWrapper::allocateMetaSlot(unsigned long position) {
+    MetaDataSlot *victim = NULL;
+    
+    for (uint8_t i = 0; i < IPOD_META_CACHE_SLOTS; i++) {
+        MetaDataSlot *slot = &metaCache[i];
+        
+        // prefer empty slots, then the oldest; the current slot is only
+        // reused if it's the only one
+        if (
+            (victim == NULL) ||
+            (victim == currentMeta) ||
+            ((slot != currentMeta) && victim->valid && ((! slot->valid) || (slot->age > victim->age)))
+        ) {
+            victim = slot;
+        }
+    }
+    
+    emptyMetaSlot(victim);
+    
+    victim->valid = true;
+    victim->playlistPosition = position;
+    
+    if (victim != currentMeta) {
+        victim->trackName[0] = '\0';
+        victim->artistName[0] = '\0';
+        victim->albumName[0] = '\0';
+    } else {
+        clearMetaData(victim);
+    }
+    
+    return victim;
+}
+// }}}
+
+// {{{ IPodWrapper::selectMetaSlot
+/*
+ * Makes slot the current one and the most recently used.  Generations are
+ * bumped for every field that reads differently than it did before.
+ */
+void IPodWrapper::selectMetaSlot(MetaDataSlot *slot) {
+    for (uint8_t f = 0; f < META_FIELD_COUNT; f++) {
+        size_t size;
+        
+        if (strcmp(metaDataField(currentMeta, (MetaDataField) f, &size),
+                   metaDataField(slot, (MetaDataField) f, &size)) != 0)
+        {
+            metaDataGeneration[f] += 1;
+        }
+    }
+    
+    for (uint8_t i = 0; i < IPOD_META_CACHE_SLOTS; i++) {
+        if (metaCache[i].age < slot->age) {
+            metaCache[i].age += 1;
+        }
+    }
+    
+    slot->age = 0;
+    currentMeta = slot;
+}
+// }}}
+
+// {{{ IPodWrapper::selectCachedMetaData
+/*
+ * Selects the slot for the given playlist position and returns true.  If
+ * there isn't one, a new one is allocated and selected instead, and false
+ * is returned.
+ */
+bool IPodWrapper::selectCachedMetaData(unsigned long position) {
+    MetaDataSlot *slot = findMetaSlot(position);
+    bool hit = (slot != NULL);
+    
+    if (! hit) {
+        slot = allocateMetaSlot(position);
+    }
+    
+    selectMetaSlot(slot);
+    
+    return hit;
+}
+// }}}
+
+// {{{ IPodWrapper::requestMetaData
+/*
+ * Keeps the request pipeline full: first with whatever's missing for the
+ * current track, then, once that's all arrived and the iPod's playing, with
+ * the next track's metadata so it's already cached when the track changes.
+ */
+void IPodWrapper::requestMetaData() {
+    // wait until it's known which track it's wanted for
+    if ((! currentMeta->valid) || skipQueued) {
+        return;
+    }
+    
+    requestMissingMetaData(currentMeta);
+    
+    #if IPOD_META_PREFETCH && (IPOD_META_CACHE_SLOTS > 1)
+        if (
+            (currentMeta->missing == 0) &&
+            (currentPlayingState == PLAY_STATE_PLAYING) &&
+            haveSongCount &&
+            (! metaCacheHit) &&
+            ((playlistPosition + 1) < playlistSongCount)
+        ) {
+            MetaDataSlot *next = findMetaSlot(playlistPosition + 1);
+            
+            if (next == NULL) {
+                DEBUG_PGM_PRINTLN("[wrap] prefetching metadata for next track");
+                next = allocateMetaSlot(playlistPosition + 1);
+            }
+            
+            requestMissingMetaData(next);
+        }
+    #endif
+}
+// }}}
+
+// {{{ IPodWrapper::requestMissingMetaData
+/*
+ * Requests every field of the slot that's neither been retrieved nor
+ * already asked for, as far as there's room in the pipeline.
+ */
+void IPodWrapper::requestMissingMetaData(MetaDataSlot *slot) {
+    uint8_t slotIndex = slot - metaCache;
+    uint8_t inFlight = 0;
+    
+    for (uint8_t i = 0; i < metaRequestCount; i++) {
+        MetaDataRequest *req = &metaRequests[(metaRequestHead + i) % IPOD_META_PIPELINE_DEPTH];
+        
+        if (req->slot == slotIndex) {
+            inFlight |= _BV(req->field);
+        }
+    }
+    
+    for (uint8_t f = 0; f < META_FIELD_COUNT; f++) {
+        if (metaRequestCount == IPOD_META_PIPELINE_DEPTH) {
+            return;
+        }
+        
+        if ((! (slot->missing & _BV(f))) || (inFlight & _BV(f))) {
+            continue;
+        }
+        
+        if (f == META_TITLE) {
+            advancedRemote.getTitle(slot->playlistPosition);
+        } else if (f == META_ARTIST) {
+            advancedRemote.getArtist(slot->playlistPosition);
+        } else {
+            advancedRemote.getAlbum(slot->playlistPosition);
+        }
+        
+        if (metaRequestCount == 0) {
+            scheduler_schedule(&metaRequestExpiration, IPOD_META_REQUEST_TIMEOUT);
+        }
+        
+        MetaDataRequest *req = &metaRequests[(metaRequestHead + metaRequestCount) % IPOD_META_PIPELINE_DEPTH];
+        req->slot = slotIndex;
+        req->field = f;
+        
+        metaRequestCount += 1;
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::cancelMetaRequests
+/*
+ * Responses to requests already sent will still arrive, so the requests
+ * stay in the pipeline to keep the rest matched up; only the data's thrown
+ * away.
+ */
+void IPodWrapper::cancelMetaRequests(MetaDataSlot *slot) {
+    uint8_t slotIndex = slot - metaCache;
+    
+    for (uint8_t i = 0; i < IPOD_META_PIPELINE_DEPTH; i++) {
+        if (metaRequests[i].slot == slotIndex) {
+            metaRequests[i].slot = IPOD_META_NO_SLOT;
+        }
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::handleMetaData
+/*
+ * Common handling for title, artist and album responses.
+ */
+void IPodWrapper::handleMetaData(MetaDataField field, const char *value) {
+    uint8_t i;
+    
+    updateAdvancedModeExpirationTimestamp();
+    
+    for (i = 0; i < metaRequestCount; i++) {
+        if (metaRequests[(metaRequestHead + i) % IPOD_META_PIPELINE_DEPTH].field == field) {
+            break;
+        }
+    }
+    
+    if (i == metaRequestCount) {
+        DEBUG_PGM_PRINTLN("[wrap] unexpected metadata response");
+        return;
+    }
+    
+    MetaDataRequest req = metaRequests[(metaRequestHead + i) % IPOD_META_PIPELINE_DEPTH];
+    
+    // anything older than this request went unanswered; those fields are
+    // still missing, so they'll be asked for again below
+    metaRequestHead = (metaRequestHead + i + 1) % IPOD_META_PIPELINE_DEPTH;
+    metaRequestCount -= i + 1;
+    
+    // the iPod's still answering; give the rest more time
+    scheduler_schedule(&metaRequestExpiration, IPOD_META_REQUEST_TIMEOUT);
+    
+    if (req.slot != IPOD_META_NO_SLOT) {
+        MetaDataSlot *slot = &metaCache[req.slot];
+        
+        // the radio can only show ASCII; convert it now, once, so what's
+        // stored can be copied straight into frames
+        char text[IPOD_META_TITLE_LEN + 1];
+        translit_utf8(text, value, sizeof(text));
+        
+        setMetaData(slot, field, text);
+        slot->missing &= ~_BV(field);
+        
+        if (slot == currentMeta) {
+            metaDataChanged = true;
+            
+            if ((slot->missing == 0) && (! haveSongCount)) {
+                // need something to validate future cache hits against
+                advancedRemote.getSongCountInCurrentPlaylist();
+            }
+        }
+    }
+    
+    requestMetaData();
 }
 // }}}
 
@@ -151,6 +552,18 @@ IPodWrapper::IPodPlayingState IPodWrapper::getPlayingState() {
 }
 // }}}
 
+// {{{ IPodWrapper::getPendingSkip
+int8_t IPodWrapper::getPendingSkip() {
+    return pendingSkip;
+}
+// }}}
+
+// {{{ IPodWrapper::getLivenessStats
+const IPodWrapper::LivenessStats *IPodWrapper::getLivenessStats() {
+    return &livenessStats;
+}
+// }}}
+
 // {{{ IPodWrapper::switchToSimple
 void IPodWrapper::switchToSimple() {
     DEBUG_PGM_PRINTLN("[wrap] setting MODE_SIMPLE");
@@ -161,11 +574,11 @@ void IPodWrapper::switchToSimple() {
     mode = MODE_SIMPLE;
     
     // the Dension ice>Link: Plus does this; might be a wakeup of some kind?
+    // advanced mode's disabled 21ms later, by simpleRemoteStep()
     stream->write('\xff');
-    delay(21);
     
-    advancedRemote.disable();
-    activeRemote = &simpleRemote;
+    simpleSwitchPending = true;
+    scheduler_schedule(&simpleRemoteAction, 21);
     
     // we're either losing the feedback from the iPod that the mode has changed,
     // or it's not getting sent.  Either way, notify that the mode changed.
@@ -177,6 +590,10 @@ void IPodWrapper::switchToSimple() {
 
 // {{{ IPodWrapper::switchToAdvanced
 void IPodWrapper::switchToAdvanced() {
+    // anything still waiting to be done in simple mode is moot now
+    simpleSwitchPending = false;
+    simpleButtonCount = 0;
+    
     activeRemote = &advancedRemote;
     advancedRemote.enable();
     
@@ -185,118 +602,285 @@ void IPodWrapper::switchToAdvanced() {
     
     advancedRemote.getTimeAndStatusInfo();
     
+    // not a keep-alive; the switch takes longer
+    keepAlivePending = false;
     updateAdvancedModeExpirationTimestamp();
 }
 // }}}
 
+// {{{ IPodWrapper::probeAdvanced
+/*
+ * Asks an iPod that's just been found for advanced mode, without going
+ * through simple mode first; update() sends it again or gives up if it's
+ * not answered in time.  Retries lead with switchToSimple()'s wakeup byte,
+ * in case the iPod was asleep.
+ */
+void IPodWrapper::probeAdvanced() {
+    DEBUG_PGM_PRINTLN("[wrap] probing for advanced mode");
+    
+    if (attachProbes > 0) {
+        stream->write('\xff');
+    }
+    
+    switchToAdvanced();
+    
+    scheduler_schedule(&attachProbeExpiration, IPOD_ATTACH_PROBE_TIMEOUT << attachProbes);
+    attachProbes += 1;
+}
+// }}}
+
 // {{{ IPodWrapper::initiateMetadataUpdate
+/*
+ * Throws away whatever's known about the current track and retrieves it
+ * all again.
+ */
 void IPodWrapper::initiateMetadataUpdate() {
-    // free malloc'd memory for meta data; doing it here should help
-    // avoid heap fragmentation…
-    free(trackName);
-    trackName = NULL;
-
-    free(artistName);
-    artistName = NULL;
+    cancelMetaRequests(currentMeta);
+    clearMetaData(currentMeta);
+    currentMeta->missing = IPOD_META_ALL_FIELDS;
+    metaCacheHit = false;
 
-    free(albumName);
-    albumName = NULL;
-
-    updateMetaState = UPDATE_META_TITLE;
-    advancedRemote.getTitle(playlistPosition);
-    
-    // allow 2s to finish updating all metadata
-    metaUpdateExpirationTimestamp = millis() + 2000L;
+    requestMetaData();
 }
 // }}}
 
 // {{{ IPodWrapper::setSimple
 void IPodWrapper::setSimple() {
     advancedModeRequested = false;
+    directAttach = false;
 }
 // }}}
 
 // {{{ IPodWrapper::setAdvanced
-void IPodWrapper::setAdvanced() {
+void IPodWrapper::setAdvanced(bool direct) {
     advancedModeRequested = true;
+    
+    if (direct) {
+        directAttach = true;
+    }
 }
 // }}}
 
 // {{{ IPodWrapper::updateAdvancedModeExpirationTimestamp
+/*
+ * Something's been heard from the iPod in advanced mode (or it's just been
+ * asked for it), so it doesn't need asking whether it's there for a while.
+ */
 void IPodWrapper::updateAdvancedModeExpirationTimestamp() {
-    // allow enough time to handle call/response when paused/stopped
-    advancedModeExpirationTimestamp = millis() + 2000L;
+    if (keepAlivePending) {
+        keepAlivePending = false;
+        
+        // it's been there the whole time so far; ask less often
+        keepAliveInterval <<= 1;
+        
+        if (keepAliveInterval > IPOD_KEEPALIVE_MAX) {
+            keepAliveInterval = IPOD_KEEPALIVE_MAX;
+        }
+    }
+    
+    keepAliveMisses = 0;
+    
+    scheduler_schedule(
+        &advancedModeExpiration,
+        (mode == MODE_SWITCHING_TO_ADVANCED) ? IPOD_ADVANCED_SWITCH_TIMEOUT : keepAliveInterval
+    );
 }
 // }}}
 
-// {{{ IPodWrapper::update
-void IPodWrapper::update() {
-    unsigned long now = millis();
-    
-    // throttle update calls to 250ms
-    if (now < (lastUpdateInvocation + 250L)) {
+// {{{ IPodWrapper::checkRxLine
+/*
+ * Notices the iPod's gone when the RX line's been low for
+ * IPOD_UNPLUG_DEBOUNCE; see there.
+ */
+void IPodWrapper::checkRxLine() {
+    if (*rx_port & rx_bitmask) {
+        rxLowSamples = 0;
         return;
     }
     
-    lastUpdateInvocation = now;
+    unsigned long now = millis();
     
-    // advanced mode should only be enabled after we've ascertained the 
-    // presence of the iPod
-    IPodMode oldMode = mode;
-    IPodPlayingState oldPlayState = currentPlayingState;
+    if (rxLowSamples == 0) {
+        rxLowSince = now;
+    }
     
-    bool metaUpdateInProgress = (updateMetaState != UPDATE_META_DONE);
+    if (rxLowSamples < IPOD_UNPLUG_SAMPLES) {
+        rxLowSamples += 1;
+    }
     
-    // process incoming data from iPod; will be a no-op for simple remote
-    // iPodSerial::loop() only reads one byte at a time
-    while (stream->available() > 0) {
-        activeRemote->loop();
+    unsigned long lowFor = now - rxLowSince;
+    
+    if ((rxLowSamples >= IPOD_UNPLUG_SAMPLES) && (lowFor >= IPOD_UNPLUG_DEBOUNCE)) {
+        // transition from found to not-found
+        DEBUG_PGM_PRINTLN("[wrap] RX line low; iPod went away, switching to MODE_UNKNOWN");
+        trace(TRACE_IPOD_GONE, (lowFor > 0xFF) ? 0xFF : lowFor);
+        
+        livenessStats.unplugs += 1;
+        livenessStats.unplugLatency = lowFor;
+        
+        reset();
     }
+}
+// }}}
 
-    if (mode == MODE_UNKNOWN) {
-        if (*rx_port & rx_bitmask) {
-            // transition from not-found to found
-            DEBUG_PGM_PRINTLN("[wrap] iPod found");
+// {{{ IPodWrapper::keepAlive
+/*
+ * Called when advancedModeExpiration runs out: asks the iPod for its time
+ * and status, or gives up on it if it's missed answering too many times.
+ * The switch to advanced mode counts as the first question.
+ */
+void IPodWrapper::keepAlive() {
+    if (keepAlivePending || (mode == MODE_SWITCHING_TO_ADVANCED)) {
+        keepAliveMisses += 1;
+        livenessStats.keepAliveMisses += 1;
+        
+        // start over asking often
+        keepAliveInterval = IPOD_KEEPALIVE_MIN;
+        
+        if (keepAliveMisses >= IPOD_KEEPALIVE_MISSES) {
+            // transition from found to not-found
+            DEBUG_PGM_PRINTLN("[wrap] iPod went away in (or never entered into) advanced mode; switching to MODE_UNKNOWN");
+            trace(TRACE_IPOD_EXPIRED, 1);
             
-            stream->flush();
+            livenessStats.expiries += 1;
             
-            switchToSimple();
+            reset();
+            return;
         }
+        
+        DEBUG_PGM_PRINTLN("[wrap] keep-alive missed");
+        trace(TRACE_IPOD_EXPIRED, 0);
     }
-    else if (mode == MODE_SIMPLE) {
-        if (! (*rx_port & rx_bitmask)) {
-            // transition from found to not-found
-            DEBUG_PGM_PRINTLN("[wrap] iPod went away in simple mode; switching to MODE_UNKNOWN");
-            reset();
+    
+    DEBUG_PGM_PRINTLN("[wrap] requesting time and status info for keep-alive");
+    advancedRemote.getTimeAndStatusInfo();
+    
+    keepAlivePending = true;
+    keepAliveSentAt = millis();
+    livenessStats.keepAlives += 1;
+    
+    scheduler_schedule(&advancedModeExpiration, replyTimeout());
+}
+// }}}
+
+// {{{ IPodWrapper::sampleReplyLatency
+/*
+ * Folds a keep-alive's reply latency into the smoothed latency and its
+ * mean deviation, with gains of 1/8 and 1/4 as TCP does for round trip
+ * times; they're kept scaled up by 8 and 4 so the fractions aren't lost.
+ */
+void IPodWrapper::sampleReplyLatency(unsigned long ms) {
+    if (ms > IPOD_REPLY_TIMEOUT_MAX) {
+        ms = IPOD_REPLY_TIMEOUT_MAX;
+    }
+    
+    if (ms == 0) {
+        ms = 1;
+    }
+    
+    if (replyLatency8 == 0) {
+        replyLatency8 = ms << 3;
+        replyDeviation4 = ms << 1;
+    } else {
+        int16_t err = (int16_t) ms - (int16_t) (replyLatency8 >> 3);
+        
+        replyLatency8 += err;
+        
+        if (err < 0) {
+            err = -err;
         }
+        
+        replyDeviation4 += err - (int16_t) (replyDeviation4 >> 2);
+    }
+    
+    livenessStats.replyLatency = replyLatency8 >> 3;
+}
+// }}}
+
+// {{{ IPodWrapper::replyTimeout
+unsigned long IPodWrapper::replyTimeout() {
+    if (replyLatency8 == 0) {
+        return IPOD_REPLY_TIMEOUT_MAX;
+    }
+    
+    unsigned long timeout = (replyLatency8 >> 3) + replyDeviation4;
+    
+    if (timeout < IPOD_REPLY_TIMEOUT_MIN) {
+        timeout = IPOD_REPLY_TIMEOUT_MIN;
+    } else if (timeout > IPOD_REPLY_TIMEOUT_MAX) {
+        timeout = IPOD_REPLY_TIMEOUT_MAX;
+    }
+    
+    return timeout;
+}
+// }}}
+
+// {{{ IPodWrapper::update
+void IPodWrapper::update() {
+    IPodMode oldMode = mode;
+    IPodPlayingState oldPlayState = currentPlayingState;
+    
+    // process incoming data from iPod; will be a no-op for simple remote.
+    // This is done on every call so that the receive buffer doesn't
+    // overflow while a long metadata string is coming in.
+    // iPodSerial::loop() only reads one byte at a time
+    while (stream->available() > 0) {
+        activeRemote->loop();
+    }
+    
+    // checked on every call, so an unplug's noticed just as quickly in
+    // every mode
+    if (mode != MODE_UNKNOWN) {
+        checkRxLine();
+    }
+    
+    if (
+        ((mode == MODE_SWITCHING_TO_ADVANCED) || (mode == MODE_ADVANCED)) &&
+        (! scheduler_is_pending(&advancedModeExpiration))
+    ) {
+        keepAlive();
     }
-    else if ((mode == MODE_ADVANCED) || (mode == MODE_SWITCHING_TO_ADVANCED)) {
-        // MODE_SWITCHING_TO_ADVANCED is the first mode switched to when
-        // switchToAdvanced() is called. switchToAdvanced() calls 
-        // getTimeAndStatusInfo(), then handleTimeAndStatus() calls
-        // getPlaylistPosition() if the iPod's not stopped. Once 
-        // handleTimeAndStatus() is invoked, MODE_ADVANCED is selected.
+    
+    if (! scheduler_is_pending(&updateInterval)) {
+        scheduler_schedule(&updateInterval, IPOD_UPDATE_INTERVAL);
         
-        // depends on a "timer" that gets reset by incoming messages in 
-        // advanced mode
+        updateTimed();
+    }
+    
+    if (skipQueued && (! scheduler_is_pending(&skipWindow))) {
+        int8_t offset = pendingSkip;
         
-        // DEBUG_PGM_PRINT("[wrap] time to expiration: ");
-        // DEBUG_PRINTLN(advancedModeExpirationTimestamp - now, DEC);
+        pendingSkip = 0;
+        skipQueued = false;
         
-        if (now > advancedModeExpirationTimestamp) {
-            if (! willExpire) {
-                willExpire = true;
-                DEBUG_PGM_PRINTLN("[wrap] timestamp update missed; will expire on next update");
-            } else {
-                // transition from found to not-found
-                DEBUG_PGM_PRINTLN("[wrap] iPod went away in (or never entered into) advanced mode; switching to MODE_UNKNOWN");
-                reset();
-            }
+        if (offset != 0) {
+            skipTracks(offset);
+        } else {
+            // they cancelled out; carry on with the track they started on
+            requestMetaData();
+        }
+    }
+    
+    if (
+        (mode == MODE_SWITCHING_TO_ADVANCED) &&
+        (attachProbes > 0) &&
+        (! scheduler_is_pending(&attachProbeExpiration))
+    ) {
+        if (attachProbes < IPOD_ATTACH_PROBES) {
+            probeAdvanced();
         } else {
-            willExpire = false;
+            // maybe it needs the trip through simple mode after all
+            DEBUG_PGM_PRINTLN("[wrap] no answer in advanced mode; attaching through simple mode");
+            trace(TRACE_IPOD_ATTACH, attachProbes);
+            
+            switchToSimple();
         }
     }
     
+    if (oldMode != mode) {
+        trace(TRACE_IPOD_MODE, mode);
+    }
+    
     // notify on changed mode, but not for MODE_SWITCHING_TO_ADVANCED
     if (
         (oldMode != mode)  && 
@@ -310,18 +894,84 @@ void IPodWrapper::update() {
         // successfully switched to advanced mode; start polling
         advancedRemote.setPollingMode(AdvancedRemote::POLLING_START);
         
+        // next time it can come straight here
+        directAttach = true;
+        attachProbes = 0;
+        scheduler_cancel(&attachProbeExpiration);
+        
         // @todo if we need a little more time for the iPod to process the 
         // switch, update the timestamp here, too.
         // updateAdvancedModeExpirationTimestamp();
     }
-    else if (
+    
+    if (isAdvancedModeActive()) {
+        if (metaDataChanged) {
+            metaDataChanged = false;
+            
+            DEBUG_PGM_PRINTLN("[wrap] metadata updated");
+            if (pMetaDataChangedHandler != NULL) {
+                pMetaDataChangedHandler();
+            }
+        }
+        
+        if ((metaRequestCount > 0) && (! scheduler_is_pending(&metaRequestExpiration))) {
+            // the responses aren't coming; only what's still missing
+            // gets asked for again
+            DEBUG_PGM_PRINTLN("[wrap] metadata request timeout");
+            trace(TRACE_META_TIMEOUT, metaRequestCount);
+            metaRequestCount = 0;
+            
+            requestMetaData();
+        }
+    }
+    
+    if ((oldPlayState != currentPlayingState) && (pIPodPlayingStateChangedHandler != NULL)) {
+        pIPodPlayingStateChangedHandler(currentPlayingState);
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::updateTimed
+/*
+ * The part of update() that isn't driven by data from the iPod: detecting
+ * its arrival and departure, switching modes, keeping advanced mode alive
+ * and pushing the requested playing state.
+ */
+void IPodWrapper::updateTimed() {
+    // advanced mode should only be enabled after we've ascertained the 
+    // presence of the iPod
+    IPodMode oldMode = mode;
+    
+    if (mode == MODE_UNKNOWN) {
+        if (*rx_port & rx_bitmask) {
+            // transition from not-found to found
+            DEBUG_PGM_PRINTLN("[wrap] iPod found");
+            
+            stream->flush();
+            
+            if (advancedModeRequested && directAttach) {
+                reset();
+                probeAdvanced();
+            } else {
+                switchToSimple();
+            }
+        }
+    }
+    
+    // the iPod leaving, and advanced mode running out, are caught by
+    // update()
+    
+    if (
         (oldMode != MODE_UNKNOWN) && 
         (mode == MODE_SIMPLE) &&
+        (! simpleSwitchPending) &&
         advancedModeRequested
     ) {
         // if we immediately go from unknown -> simple -> advanced in a single
-        // call to update(), syncPlayingState() will send simple mode commands
-        // after the switch-to-advanced mode command.
+        // call, syncPlayingState() will send simple mode commands after the
+        // switch-to-advanced mode command.  and not before the iPod's been
+        // told to leave advanced mode, either; switchToAdvanced() would
+        // cancel that.
         switchToAdvanced();
     }
     else if (
@@ -339,41 +989,15 @@ void IPodWrapper::update() {
         if (isAdvancedModeActive()) {
             // DEBUG_PGM_PRINTLN("[wrap] advanced mode is active");
             
-            if (metaUpdateInProgress) {
-                if (updateMetaState == UPDATE_META_DONE) {
-                    DEBUG_PGM_PRINTLN("[wrap] metadata update complete");
-                    if (pMetaDataChangedHandler != NULL) {
-                        pMetaDataChangedHandler();
-                    }
-                } else if (millis() > metaUpdateExpirationTimestamp) {
-                    DEBUG_PGM_PRINTLN("[wrap] metadata update timeout");
-                    initiateMetadataUpdate();
-                }
-            }
+            requestMetaData();
             
-            // this expiration timestamp is more difficult to figure out than
-            // I figured it would be. When polling's enabled, we get an 
-            // update every 500ms, but ONLY WHEN PLAYING.  So when we're not playing
-            // we need to request info from the iPod periodically to make 
-            // sure it's still alive.  It can take quite a while to get back 
-            // to this update loop, so invoke the keep-alive when not playing
-            // with enough time to catch the response before timing out.
-            if (
-                ((advancedModeExpirationTimestamp - now) < 750L) &&
-                (currentPlayingState != PLAY_STATE_PLAYING))
-            {
-                // expiration imminent
-                DEBUG_PGM_PRINTLN("[wrap] requesting time and status info for keep-alive");
-                advancedRemote.getTimeAndStatusInfo();
-            }
+            // when polling's enabled, we get an update every 500ms, but
+            // ONLY WHEN PLAYING; otherwise update() has to ask the iPod
+            // periodically to make sure it's still alive
         }    
     } else {
         currentPlayingState = PLAY_STATE_UNKNOWN;
     }
-    
-    if ((oldPlayState != currentPlayingState) && (pIPodPlayingStateChangedHandler != NULL)) {
-        pIPodPlayingStateChangedHandler(currentPlayingState);
-    }
 }
 // }}}
 
@@ -391,24 +1015,82 @@ void IPodWrapper::pause() {
 
 // {{{ IPodWrapper::nextTrack
 void IPodWrapper::nextTrack() {
-    if (isAdvancedModeActive()) {
-        advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_SKIP_FORWARD);
-    } else {
-        simpleRemote.sendSkipForward();
-        delay(50);
-        simpleRemote.sendButtonReleased();
-    }
+    queueSkip(1);
 }
 // }}}
 
 // {{{ IPodWrapper::prevTrack
 void IPodWrapper::prevTrack() {
-    if (isAdvancedModeActive()) {
-        advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_SKIP_BACKWARD);
+    queueSkip(-1);
+}
+// }}}
+
+// {{{ IPodWrapper::queueSkip
+/*
+ * Adds the skip to the ones update() does in one go once they've stopped
+ * coming for IPOD_SKIP_WINDOW.  Whatever was being fetched for the track
+ * that's being left is of no use by then.
+ */
+void IPodWrapper::queueSkip(int8_t offset) {
+    if (! skipQueued) {
+        skipQueued = true;
+        cancelMetaRequests(currentMeta);
+    }
+    
+    if ((offset > 0) ? (pendingSkip < 127) : (pendingSkip > -127)) {
+        pendingSkip += offset;
+    }
+    
+    scheduler_schedule(&skipWindow, IPOD_SKIP_WINDOW);
+}
+// }}}
+
+// {{{ IPodWrapper::skipTracks
+/*
+ * In advanced mode, one jump to the track offset away, which is selected
+ * straight away instead of waiting for the iPod to say it's changed; its
+ * metadata's asked for right after.
+ */
+void IPodWrapper::skipTracks(int8_t offset) {
+    DEBUG_PGM_PRINT("[wrap] skipping ");
+    DEBUG_PRINTLN(offset, DEC);
+    
+    if (isAdvancedModeActive() && havePlaylistPosition) {
+        long target = (long) playlistPosition + offset;
+        
+        // the iPod goes round to the beginning after the last track
+        if (haveSongCount && (playlistSongCount > 0)) {
+            target %= (long) playlistSongCount;
+            
+            if (target < 0) {
+                target += playlistSongCount;
+            }
+        } else if (target < 0) {
+            target = 0;
+        }
+        
+        advancedRemote.jumpToSongInCurrentPlaylist(target);
+        selectPlaylistPosition(target);
     } else {
-        simpleRemote.sendSkipBackward();
-        delay(50);
-        simpleRemote.sendButtonReleased();
+        // no position to jump from; press the button as many times, as
+        // far as the simple remote's queue goes
+        uint8_t presses = (offset > 0) ? offset : -offset;
+        
+        if (presses > IPOD_BUTTON_QUEUE_LEN) {
+            presses = IPOD_BUTTON_QUEUE_LEN;
+        }
+        
+        for (uint8_t i = 0; i < presses; i++) {
+            if (isAdvancedModeActive()) {
+                advancedRemote.controlPlayback(
+                    (offset > 0) ?
+                        AdvancedRemote::PLAYBACK_CONTROL_SKIP_FORWARD :
+                        AdvancedRemote::PLAYBACK_CONTROL_SKIP_BACKWARD
+                );
+            } else {
+                queueSimpleButton((offset > 0) ? SIMPLE_BUTTON_SKIP_FORWARD : SIMPLE_BUTTON_SKIP_BACKWARD);
+            }
+        }
     }
 }
 // }}}
@@ -419,9 +1101,7 @@ void IPodWrapper::nextAlbum() {
         // advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_SKIP_BACKWARD);
         // @todo
     } else {
-        simpleRemote.sendNextAlbum();
-        delay(50);
-        simpleRemote.sendButtonReleased();
+        queueSimpleButton(SIMPLE_BUTTON_NEXT_ALBUM);
     }
 }
 // }}}
@@ -432,9 +1112,7 @@ void IPodWrapper::prevAlbum() {
         // advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_SKIP_BACKWARD);
         // @todo
     } else {
-        simpleRemote.sendPreviousAlbum();
-        delay(50);
-        simpleRemote.sendButtonReleased();
+        queueSimpleButton(SIMPLE_BUTTON_PREVIOUS_ALBUM);
     }
 }
 // }}}
@@ -449,15 +1127,8 @@ void IPodWrapper::syncPlayingState() {
             if (isAdvancedModeActive()) {
                 advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_PLAY_PAUSE);
             } else {
-                simpleRemote.sendiPodOn();
-                delay(50);
-                simpleRemote.sendButtonReleased();
-
-                delay(50);
-
-                simpleRemote.sendJustPlay();
-                delay(50);
-                simpleRemote.sendButtonReleased();
+                queueSimpleButton(SIMPLE_BUTTON_IPOD_ON);
+                queueSimpleButton(SIMPLE_BUTTON_JUST_PLAY);
             }
         } else {
             // paused or stopped; just go with paused
@@ -466,20 +1137,96 @@ void IPodWrapper::syncPlayingState() {
             if (isAdvancedModeActive()) {
                 advancedRemote.controlPlayback(AdvancedRemote::PLAYBACK_CONTROL_PLAY_PAUSE);
             } else {
-                simpleRemote.sendJustPause();
-                delay(50);
-                simpleRemote.sendButtonReleased();
+                queueSimpleButton(SIMPLE_BUTTON_JUST_PAUSE);
             }
         }
-        
-        // just because?
-        updateAdvancedModeExpirationTimestamp();
     }
     
     currentPlayingState = requestedPlayingState;
 }
 // }}}
 
+// {{{ IPodWrapper::queueSimpleButton
+void IPodWrapper::queueSimpleButton(SimpleButton button) {
+    if (simpleButtonCount == IPOD_BUTTON_QUEUE_LEN) {
+        DEBUG_PGM_PRINTLN("[wrap] simple remote button queue full");
+        return;
+    }
+    
+    simpleButtonQueue[simpleButtonCount] = button;
+    simpleButtonCount += 1;
+    
+    // if a step's already scheduled, the button will be picked up from there
+    if (! scheduler_is_pending(&simpleRemoteAction)) {
+        scheduler_schedule(&simpleRemoteAction, 0);
+    }
+}
+// }}}
+
+// {{{ IPodWrapper::simpleRemoteStep
+/*
+ * Does the next thing the simple remote has to do: finish switching out of
+ * advanced mode, release the button that's held, or press the next one.
+ * Buttons are held for IPOD_BUTTON_PRESS_MS, with the same gap between
+ * presses.
+ */
+void IPodWrapper::simpleRemoteStep() {
+    if (simpleSwitchPending) {
+        simpleSwitchPending = false;
+        
+        advancedRemote.disable();
+        activeRemote = &simpleRemote;
+        
+        // button presses can follow right away
+        if (simpleButtonCount > 0) {
+            scheduler_schedule(&simpleRemoteAction, 0);
+        }
+        
+        return;
+    }
+    
+    if (simpleButtonHeld) {
+        simpleRemote.sendButtonReleased();
+        simpleButtonHeld = false;
+    }
+    else if (simpleButtonCount > 0) {
+        SimpleButton button = (SimpleButton) simpleButtonQueue[0];
+        
+        simpleButtonCount -= 1;
+        memmove(simpleButtonQueue, &simpleButtonQueue[1], simpleButtonCount);
+        
+        if (button == SIMPLE_BUTTON_SKIP_FORWARD) {
+            simpleRemote.sendSkipForward();
+        } else if (button == SIMPLE_BUTTON_SKIP_BACKWARD) {
+            simpleRemote.sendSkipBackward();
+        } else if (button == SIMPLE_BUTTON_NEXT_ALBUM) {
+            simpleRemote.sendNextAlbum();
+        } else if (button == SIMPLE_BUTTON_PREVIOUS_ALBUM) {
+            simpleRemote.sendPreviousAlbum();
+        } else if (button == SIMPLE_BUTTON_IPOD_ON) {
+            simpleRemote.sendiPodOn();
+        } else if (button == SIMPLE_BUTTON_JUST_PLAY) {
+            simpleRemote.sendJustPlay();
+        } else {
+            simpleRemote.sendJustPause();
+        }
+        
+        simpleButtonHeld = true;
+    }
+    else {
+        return;
+    }
+    
+    scheduler_schedule(&simpleRemoteAction, IPOD_BUTTON_PRESS_MS);
+}
+// }}}
+
+// {{{ IPodWrapper::simpleRemoteCallback
+void IPodWrapper::simpleRemoteCallback(void *context) {
+    ((IPodWrapper *) context)->simpleRemoteStep();
+}
+// }}}
+
 // ======= iPod handlers
 
 // {{{ IPodWrapper::handleFeedback
@@ -508,6 +1255,8 @@ void IPodWrapper::handleTimeAndStatus(unsigned long trackLengthInMilliseconds,
     if (mode == MODE_SWITCHING_TO_ADVANCED) {
         DEBUG_PGM_PRINTLN("[wrap] setting MODE_ADVANCED");
         mode = MODE_ADVANCED;
+    } else if (keepAlivePending) {
+        sampleReplyLatency(millis() - keepAliveSentAt);
     }
     
     updateAdvancedModeExpirationTimestamp();
@@ -544,15 +1293,37 @@ void IPodWrapper::handlePlaylistPosition(unsigned long _playlistPosition) {
 
     // DEBUG_PGM_PRINTLN("[wrap] servicing playlist position update");
     
-    if ((! havePlaylistPosition) || (playlistPosition != _playlistPosition)) {
+    selectPlaylistPosition(_playlistPosition);
+}
+// }}}
+
+// {{{ IPodWrapper::selectPlaylistPosition
+/*
+ * Makes position the current track, if it isn't already: the handler's
+ * told, and its metadata comes from the cache or is asked for.
+ */
+void IPodWrapper::selectPlaylistPosition(unsigned long position) {
+    if ((! havePlaylistPosition) || (playlistPosition != position)) {
         havePlaylistPosition = true;
-        playlistPosition = _playlistPosition;
+        playlistPosition = position;
         
         if (pTrackChangedHandler != NULL) {
             pTrackChangedHandler(playlistPosition);
         }
         
-        initiateMetadataUpdate();
+        if (selectCachedMetaData(playlistPosition)) {
+            DEBUG_PGM_PRINTLN("[wrap] metadata cache hit");
+            
+            metaCacheHit = true;
+            metaDataChanged = true;
+            
+            // make sure the playlist hasn't changed underneath the cache;
+            // see handleCurrentPlaylistSongCount()
+            advancedRemote.getSongCountInCurrentPlaylist();
+        }
+        
+        // ask for whatever's still missing for the new track
+        requestMetaData();
     }
 }
 // }}}
@@ -562,18 +1333,7 @@ void IPodWrapper::handleTitle(const char *title) {
     DEBUG_PGM_PRINT("[wrap] got track title: ");
     DEBUG_PRINTLN(title);
     
-    size_t titleLen = strlen(title);
-    trackName = (char *) malloc(titleLen);
-    
-    if (trackName != NULL) {
-        memset(trackName, 0, titleLen);
-        strcpy(trackName, title);
-    } else {
-        DEBUG_PGM_PRINTLN("[wrap] unable to malloc for title");
-    }
-
-    updateMetaState = UPDATE_META_ARTIST;
-    advancedRemote.getArtist(playlistPosition);
+    handleMetaData(META_TITLE, title);
 }
 // }}}
 
@@ -582,18 +1342,7 @@ void IPodWrapper::handleArtist(const char *artist) {
     DEBUG_PGM_PRINT("[wrap] got artist title: ");
     DEBUG_PRINTLN(artist);
 
-    size_t artistLen = strlen(artist);
-    artistName = (char *) malloc(artistLen);
-    
-    if (artistName != NULL) {
-        memset(artistName, 0, artistLen);
-        strcpy(artistName, artist);
-    } else {
-        DEBUG_PGM_PRINTLN("[wrap] unable to malloc for artist");
-    }
-
-    updateMetaState = UPDATE_META_ALBUM;
-    advancedRemote.getAlbum(playlistPosition);
+    handleMetaData(META_ARTIST, artist);
 }
 // }}}
 
@@ -602,17 +1351,7 @@ void IPodWrapper::handleAlbum(const char *album) {
     DEBUG_PGM_PRINT("[wrap] got album title: ");
     DEBUG_PRINTLN(album);
     
-    size_t albumLen = strlen(album);
-    albumName = (char *) malloc(albumLen);
-    
-    if (albumName != NULL) {
-        memset(albumName, 0, albumLen);
-        strcpy(albumName, album);
-    } else {
-        DEBUG_PGM_PRINTLN("[wrap] unable to malloc for album");
-    }
-
-    updateMetaState = UPDATE_META_DONE;
+    handleMetaData(META_ALBUM, album);
 }
 // }}}
 
@@ -646,6 +1385,38 @@ void IPodWrapper::handlePolling(AdvancedRemote::PollingCommand command,
 }
 // }}}
 
+// {{{ IPodWrapper::handleCurrentPlaylistSongCount
+/*
+ * Cached metadata is keyed by playlist position, which only means anything
+ * for the playlist it was retrieved from.  If the song count has changed,
+ * so has the playlist, and everything but the current track is thrown away;
+ * if the current track came out of the cache, it's retrieved again, too.
+ */
+void IPodWrapper::handleCurrentPlaylistSongCount(unsigned long count) {
+    updateAdvancedModeExpirationTimestamp();
+    
+    DEBUG_PGM_PRINT("[wrap] song count in current playlist: ");
+    DEBUG_PRINTLN(count, DEC);
+    
+    if (haveSongCount && (count != playlistSongCount)) {
+        DEBUG_PGM_PRINTLN("[wrap] playlist changed; flushing metadata cache");
+        
+        flushMetaCache();
+        
+        if (metaCacheHit) {
+            initiateMetadataUpdate();
+        }
+    }
+    
+    haveSongCount = true;
+    playlistSongCount = count;
+    metaCacheHit = false;
+    
+    // prefetch may be possible now
+    requestMetaData();
+}
+// }}}
+
 // no-ops
 void IPodWrapper::handleIPodName(const char *ipodName) {}
 void IPodWrapper::handleIPodType(const char *ipodName) {}
@@ -653,4 +1424,3 @@ void IPodWrapper::handleItemCount(unsigned long count) {}
 void IPodWrapper::handleItemName(unsigned long offet, const char *itemName) {}
 void IPodWrapper::handleShuffleMode(AdvancedRemote::ShuffleMode mode) {}
 void IPodWrapper::handleRepeatMode(AdvancedRemote::RepeatMode mode) {}
-void IPodWrapper::handleCurrentPlaylistSongCount(unsigned long count) {}
@@ -7,6 +7,82 @@
 #include <AdvancedRemote.h>
 #include <SimpleRemote.h>
 
+#include "scheduler.h"
+
+// capacity of each metadata field, not including the trailing nul; longer
+// strings are truncated on a UTF-8 character boundary
+#define IPOD_META_TITLE_LEN  32
+#define IPOD_META_ARTIST_LEN 20
+#define IPOD_META_ALBUM_LEN  20
+
+// number of tracks whose metadata is kept, including the current one; each
+// slot costs about 80 bytes of RAM
+#define IPOD_META_CACHE_SLOTS 3
+
+// number of metadata requests that may be waiting for a response at once
+#define IPOD_META_PIPELINE_DEPTH 3
+
+// time to wait for the oldest outstanding metadata response before giving
+// up on it; only the fields still missing are requested again
+#define IPOD_META_REQUEST_TIMEOUT 500L
+
+// set to 0 to disable fetching the next track's metadata while playing
+#define IPOD_META_PREFETCH 1
+
+// interval between the checks update() makes on a timer: arrival, mode
+// switches and playing state sync.  Data from the iPod and its departure
+// are handled on every call regardless.
+#define IPOD_UPDATE_INTERVAL 250L
+
+// unplug detection: a plugged-in iPod holds the RX line high when it's not
+// sending, and the 47k pull-down takes it low when it's gone.  No byte
+// holds it low for even a millisecond, so a line that's read low on every
+// update() (at least IPOD_UNPLUG_SAMPLES times) for IPOD_UNPLUG_DEBOUNCE
+// means the iPod's gone, whatever mode it was in.
+#define IPOD_UNPLUG_DEBOUNCE 50L
+#define IPOD_UNPLUG_SAMPLES  4
+
+// advanced mode keep-alive: anything from the iPod shows it's still there.
+// When nothing's come for the keep-alive interval it's asked for its time
+// and status.  Since an unplug's seen on the RX line, the keep-alive's only
+// for an iPod that's dropped out of advanced mode, so the interval starts
+// at IPOD_KEEPALIVE_MIN and doubles with every answer, up to
+// IPOD_KEEPALIVE_MAX; no more than the 2s advanced mode used to be given,
+// so a silent drop out isn't noticed any later.  An answer's waited for as long as the smoothed
+// reply latency plus four times its mean deviation, kept between
+// IPOD_REPLY_TIMEOUT_MIN and IPOD_REPLY_TIMEOUT_MAX; after
+// IPOD_KEEPALIVE_MISSES in a row go unanswered the iPod's given up on.
+#define IPOD_KEEPALIVE_MIN     1000L
+#define IPOD_KEEPALIVE_MAX     2000L
+#define IPOD_REPLY_TIMEOUT_MIN 100L
+#define IPOD_REPLY_TIMEOUT_MAX 1000L
+#define IPOD_KEEPALIVE_MISSES  2
+
+// time the iPod has to answer once it's been asked for advanced mode
+#define IPOD_ADVANCED_SWITCH_TIMEOUT 2000L
+
+// direct attach: an iPod that was in advanced mode last time (see
+// setAdvanced()) is asked for advanced mode as soon as it's found, rather
+// than being put in simple mode first.  A probe that isn't answered in
+// IPOD_ATTACH_PROBE_TIMEOUT is sent again, with twice as long to answer
+// each time, up to IPOD_ATTACH_PROBES in all; after that it's attached the
+// usual way, through simple mode.
+#define IPOD_ATTACH_PROBES        3
+#define IPOD_ATTACH_PROBE_TIMEOUT 100L
+
+// track skips are added up until there's been none for IPOD_SKIP_WINDOW,
+// then done in one go, as a jump straight to the track in advanced mode or
+// the net number of button presses in simple mode; even a single skip waits
+// that long.  No metadata's asked for while they're being added up, so
+// only the track they end up on is fetched.
+#define IPOD_SKIP_WINDOW 200L
+
+// how long a simple remote button is held, and the gap between presses
+#define IPOD_BUTTON_PRESS_MS 50
+
+// simple remote button presses that can be waiting to be sent
+#define IPOD_BUTTON_QUEUE_LEN 4
+
 class IPodWrapper : public AdvancedRemote::AdvancedRemoteListener {
 public:
     enum IPodMode {
@@ -16,13 +92,6 @@ public:
         MODE_ADVANCED
     };
     
-    enum UpdateMetaState {
-        UPDATE_META_TITLE,
-        UPDATE_META_ARTIST,
-        UPDATE_META_ALBUM,
-        UPDATE_META_DONE
-    };
-    
     enum IPodPlayingState {
         PLAY_STATE_UNKNOWN,
         PLAY_STATE_PLAYING,
@@ -30,13 +99,67 @@ public:
         PLAY_STATE_STOPPED
     };
     
+    enum MetaDataField {
+        META_TITLE,
+        META_ARTIST,
+        META_ALBUM,
+        META_FIELD_COUNT
+    };
+    
     // handler definitions
     typedef void TrackChangedHandler_t(unsigned long playlistPosition);
     typedef void MetaDataChangedHandler_t();
     typedef void IPodModeChangedHandler_t(IPodMode mode);
     typedef void IPodPlayingStateChangedHandler_t(IPodPlayingState playingState);
+    
+    // counters for the liveness checks; they wrap
+    struct LivenessStats {
+        uint16_t keepAlives;      // keep-alive requests sent
+        uint16_t keepAliveMisses; // ... and not answered in time
+        uint16_t expiries;        // iPods given up on for not answering
+        uint16_t unplugs;         // iPods found gone from the RX line
+        uint16_t unplugLatency;   // ms the line was low before the last one
+        uint16_t replyLatency;    // smoothed keep-alive reply latency, ms
+    };
 
 private:
+    enum SimpleButton {
+        SIMPLE_BUTTON_SKIP_FORWARD,
+        SIMPLE_BUTTON_SKIP_BACKWARD,
+        SIMPLE_BUTTON_NEXT_ALBUM,
+        SIMPLE_BUTTON_PREVIOUS_ALBUM,
+        SIMPLE_BUTTON_IPOD_ON,
+        SIMPLE_BUTTON_JUST_PLAY,
+        SIMPLE_BUTTON_JUST_PAUSE
+    };
+    
+    // metadata for a single playlist position
+    struct MetaDataSlot {
+        unsigned long playlistPosition;
+        
+        // 0 for the most recently selected slot, IPOD_META_CACHE_SLOTS - 1
+        // for the least
+        uint8_t age;
+        
+        // true if playlistPosition is meaningful
+        bool valid;
+        
+        // one bit per MetaDataField that hasn't been retrieved yet
+        uint8_t missing;
+        
+        char trackName[IPOD_META_TITLE_LEN + 1];
+        char artistName[IPOD_META_ARTIST_LEN + 1];
+        char albumName[IPOD_META_ALBUM_LEN + 1];
+    };
+    
+    // a metadata request that's been sent to the iPod
+    struct MetaDataRequest {
+        // index into metaCache, or IPOD_META_NO_SLOT if the response should
+        // be discarded
+        uint8_t slot;
+        uint8_t field;
+    };
+    
     uint8_t rx_bitmask;
     volatile uint8_t *rx_port;
     
@@ -49,42 +172,141 @@ private:
     IPodMode mode;
     bool advancedModeRequested;
     
-    UpdateMetaState updateMetaState;
+    // set if advanced mode's been used, so the next attach can go straight
+    // there; see IPOD_ATTACH_PROBES
+    bool directAttach;
+    
+    // advanced mode probes sent since the iPod was found, and when the
+    // last one's given up on; 0 when not attaching directly
+    uint8_t attachProbes;
+    ScheduledAction attachProbeExpiration;
+    
     IPodPlayingState currentPlayingState;
     IPodPlayingState requestedPlayingState;
     
     bool havePlaylistPosition;
     unsigned long playlistPosition;
-
-    // used to throttle calls to update()
-    unsigned long lastUpdateInvocation;
     
-    unsigned long advancedModeExpirationTimestamp;
-    bool willExpire;
+    // tracks to skip (backwards if negative) once skipWindow runs out;
+    // skipQueued is set from the first skip on, even if they cancel out
+    int8_t pendingSkip;
+    bool skipQueued;
+    ScheduledAction skipWindow;
 
-    unsigned long metaUpdateExpirationTimestamp;
+    // when updateTimed() is next due
+    ScheduledAction updateInterval;
+    
+    // when the iPod's next asked if it's still there, or, if it's been
+    // asked (keepAlivePending), when it's missed answering; extended by
+    // every message received in advanced mode.  See IPOD_KEEPALIVE_MIN.
+    ScheduledAction advancedModeExpiration;
+    bool keepAlivePending;
+    uint8_t keepAliveMisses;
+    uint16_t keepAliveInterval;
+    unsigned long keepAliveSentAt;
+    
+    // smoothed keep-alive reply latency (x8) and its mean deviation (x4),
+    // in ms; 0 until there's been a reply
+    uint16_t replyLatency8;
+    uint16_t replyDeviation4;
+    
+    // consecutive update()s that found the RX line low, and when the first
+    // of them was; see IPOD_UNPLUG_DEBOUNCE
+    uint8_t rxLowSamples;
+    unsigned long rxLowSince;
+    
+    LivenessStats livenessStats;
+    
+    // simple remote button presses are sent from here, so nothing has to
+    // wait while a button's held down
+    ScheduledAction simpleRemoteAction;
+    uint8_t simpleButtonQueue[IPOD_BUTTON_QUEUE_LEN];
+    uint8_t simpleButtonCount;
+    bool simpleButtonHeld;
+    
+    // set while waiting for the iPod to wake up before leaving advanced
+    // mode; see switchToSimple()
+    bool simpleSwitchPending;
 
-    char *trackName;
-    char *artistName;
-    char *albumName;
+    // fixed storage for metadata of recently-played tracks, keyed by
+    // playlist position; an empty string means unknown
+    MetaDataSlot metaCache[IPOD_META_CACHE_SLOTS];
+    
+    // slot for the current playlist position; never NULL
+    MetaDataSlot *currentMeta;
+    
+    // true if currentMeta came out of the cache and hasn't been checked
+    // against the playlist's song count yet
+    bool metaCacheHit;
+    
+    // the cache is only good as long as the playlist doesn't change; the
+    // song count is a cheap way to notice when it has
+    bool haveSongCount;
+    unsigned long playlistSongCount;
+    
+    // incremented every time the corresponding field changes
+    uint8_t metaDataGeneration[META_FIELD_COUNT];
+    
+    // outstanding metadata requests, oldest first.  The iPod answers in
+    // the order it's asked, so each response belongs to the oldest request
+    // for the same field; anything older than that was lost.
+    MetaDataRequest metaRequests[IPOD_META_PIPELINE_DEPTH];
+    uint8_t metaRequestHead;
+    uint8_t metaRequestCount;
+    ScheduledAction metaRequestExpiration;
     
     // event flag; set to true when a track change is detected
     bool trackChanged;
     
+    // event flag; set when a field of the current track's metadata arrives,
+    // or when the track's metadata is found in the cache
+    bool metaDataChanged;
+    
     TrackChangedHandler_t *pTrackChangedHandler;
     MetaDataChangedHandler_t *pMetaDataChangedHandler;
     IPodModeChangedHandler_t *pIPodModeChangedHandler;
     IPodPlayingStateChangedHandler_t *pIPodPlayingStateChangedHandler;
 
     void reset();
+    void updateTimed();
     void syncPlayingState();
     void updateAdvancedModeExpirationTimestamp();
     
+    void checkRxLine();
+    void keepAlive();
+    void sampleReplyLatency(unsigned long ms);
+    unsigned long replyTimeout();
+    
     void switchToSimple();
     void switchToAdvanced();
+    void probeAdvanced();
+    
+    void queueSkip(int8_t offset);
+    void skipTracks(int8_t offset);
+    void selectPlaylistPosition(unsigned long position);
+    
+    void queueSimpleButton(SimpleButton button);
+    void simpleRemoteStep();
+    static void simpleRemoteCallback(void *context);
     
     void initiateMetadataUpdate();
     
+    char *metaDataField(MetaDataSlot *slot, MetaDataField field, size_t *size);
+    void setMetaData(MetaDataSlot *slot, MetaDataField field, const char *value);
+    void clearMetaData(MetaDataSlot *slot);
+    
+    void flushMetaCache();
+    void emptyMetaSlot(MetaDataSlot *slot);
+    MetaDataSlot *findMetaSlot(unsigned long position);
+    MetaDataSlot *allocateMetaSlot(unsigned long position);
+    void selectMetaSlot(MetaDataSlot *slot);
+    bool selectCachedMetaData(unsigned long position);
+    
+    void requestMetaData();
+    void requestMissingMetaData(MetaDataSlot *slot);
+    void cancelMetaRequests(MetaDataSlot *slot);
+    void handleMetaData(MetaDataField field, const char *value);
+    
 public:
     // CONSTRUCTOR ==========================================================
     IPodWrapper();
@@ -112,17 +334,40 @@ public:
      */
     bool isAdvancedModeActive();
 
-    char *getTitle();
-    char *getArtist();
-    char *getAlbum();
+    /*
+     * Metadata getters.  The returned pointers are always valid and always
+     * point to the same storage; the string is empty when the value isn't
+     * known.
+     */
+    const char *getTitle();
+    const char *getArtist();
+    const char *getAlbum();
+    
+    /*
+     * Returns a counter that changes whenever the given field does; compare
+     * with a previously-saved value to find out if it needs redisplaying.
+     */
+    uint8_t getMetaDataGeneration(MetaDataField field);
+    
     unsigned long getPlaylistPosition();
     IPodPlayingState getPlayingState();
     
+    /*
+     * Tracks skipped that haven't been done yet (see IPOD_SKIP_WINDOW);
+     * add to getPlaylistPosition() for where the iPod's going to be.
+     */
+    int8_t getPendingSkip();
+    
+    const LivenessStats *getLivenessStats();
+    
     // CONTROL ==============================================================
     /*
-     * Attempts to switch to Advanced mode.
+     * Attempts to switch to Advanced mode.  With direct, the iPod was in
+     * advanced mode last time (before a reset, say), so it's asked for
+     * advanced mode as soon as it's found; see IPOD_ATTACH_PROBES.  That's
+     * done anyway once advanced mode's been used, until setSimple().
      */
-    void setAdvanced();
+    void setAdvanced(bool direct = false);
 
     /*
      * Switches to Simple mode.
@@ -130,7 +375,9 @@ public:
     void setSimple();
     
     /*
-     * Call periodically to respond to iPod and update state.
+     * Call on every pass through loop().  Incoming iPod data is handled
+     * (and handlers invoked) as soon as it arrives; everything that runs on
+     * a timer is done every IPOD_UPDATE_INTERVAL ms.
      */
     void update();
     
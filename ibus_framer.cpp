@@ -0,0 +1,148 @@
+#include "ibus_framer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// {{{ IBusFramer constructor
+IBusFramer::IBusFramer() {
+    pFrameHandler = NULL;
+
+    memset(sourceFilter, 0xFF, sizeof(sourceFilter));
+    memset(destinationFilter, 0xFF, sizeof(destinationFilter));
+
+    reset();
+    memset(&stats, 0, sizeof(stats));
+}
+// }}}
+
+// {{{ IBusFramer::setFrameHandler
+void IBusFramer::setFrameHandler(FrameHandler_t *newHandler) {
+    pFrameHandler = newHandler;
+}
+// }}}
+
+// {{{ IBusFramer::clearFilter
+void IBusFramer::clearFilter() {
+    memset(sourceFilter, 0, sizeof(sourceFilter));
+    memset(destinationFilter, 0, sizeof(destinationFilter));
+}
+// }}}
+
+// {{{ IBusFramer::acceptSource
+void IBusFramer::acceptSource(uint8_t addr) {
+    sourceFilter[addr >> 3] |= (1 << (addr & 0x07));
+}
+// }}}
+
+// {{{ IBusFramer::acceptDestination
+void IBusFramer::acceptDestination(uint8_t addr) {
+    destinationFilter[addr >> 3] |= (1 << (addr & 0x07));
+}
+// }}}
+
+// {{{ IBusFramer::reset
+void IBusFramer::reset() {
+    head = 0;
+    cand = 0;
+    prefix[0] = 0;
+}
+// }}}
+
+// {{{ IBusFramer::push
+void IBusFramer::push(uint8_t b) {
+    uint8_t next = head + 1;
+
+    prefix[next & (IBUS_FRAMER_WINDOW - 1)] = prefixAt(head) ^ b;
+    head = next;
+
+    resolve(false);
+}
+// }}}
+
+// {{{ IBusFramer::gap
+void IBusFramer::gap() {
+    resolve(true);
+}
+// }}}
+
+// {{{ IBusFramer::copyFrame
+void IBusFramer::copyFrame(uint8_t start, uint8_t len, uint8_t *dest) const {
+    for (uint8_t i = 0; i < len; i++) {
+        dest[i] = byteAt(start + i);
+    }
+}
+// }}}
+
+// {{{ IBusFramer::resolve
+/*
+ * Works through candidate start offsets, beginning with the earliest, until
+ * one's found that needs more data.  Each pass through the loop either
+ * consumes at least one byte or returns, so the total cost is linear in the
+ * number of bytes pushed.
+ *
+ * When final is true, no more bytes will arrive for the current burst, so
+ * any candidate that needs more data is rejected instead of waited on.
+ */
+void IBusFramer::resolve(bool final) {
+    while (cand != head) {
+        uint8_t avail = head - cand;
+
+        stats.probes += 1;
+
+        // need at least two bytes to a packet, src and length
+        if (avail < 2) {
+            if (final) {
+                stats.truncated += 1;
+                cand += 1;
+                continue;
+            }
+
+            return;
+        }
+
+        uint8_t data_len = byteAt(cand + 1);
+
+        if (
+            (data_len < IBUS_MIN_LEN)     || // too short to hold a command
+            (data_len >= MAX_EXPECTED_LEN)   // we don't handle messages larger than this
+        ) {
+            stats.length_errors += 1;
+            cand += 1;
+            continue;
+        }
+
+        // length of entire packet including source and length
+        uint8_t pkt_len = data_len + 2;
+
+        if (avail < pkt_len) {
+            if (final) {
+                stats.truncated += 1;
+                cand += 1;
+                continue;
+            }
+
+            return;
+        }
+
+        // the checksum byte XORs everything before it back to zero
+        if (prefixAt(cand + pkt_len) != prefixAt(cand)) {
+            stats.checksum_errors += 1;
+            cand += 1;
+            continue;
+        }
+
+        stats.frames += 1;
+
+        // valid frame; filter out packets we don't care about, but skip
+        // the whole thing either way
+        if (! isAccepted(byteAt(cand + PKT_SRC), byteAt(cand + PKT_DEST))) {
+            stats.skipped += 1;
+        }
+        else if (pFrameHandler != NULL) {
+            pFrameHandler(this, cand, pkt_len);
+        }
+
+        cand += pkt_len;
+    }
+}
+// }}}
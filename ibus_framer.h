@@ -0,0 +1,134 @@
+#ifndef IBUS_FRAMER_H
+#define IBUS_FRAMER_H
+
+#include <stdint.h>
+
+#include "ibus_serial.h"
+
+// number of running XOR prefixes kept; must be a power of two and larger
+// than the longest possible frame (MAX_EXPECTED_LEN + 1)
+#define IBUS_FRAMER_WINDOW 128
+
+#if IBUS_FRAMER_WINDOW <= (MAX_EXPECTED_LEN + 1)
+    #error IBUS_FRAMER_WINDOW must be larger than the longest frame
+#endif
+
+// smallest sensible value for a length byte: dest, command and checksum
+#define IBUS_MIN_LEN 3
+
+typedef struct __ibus_framer_stats {
+    uint16_t frames;          // valid frames, whether accepted or not
+    uint16_t skipped;         // valid frames rejected by the accept filter
+    uint16_t length_errors;   // implausible length byte
+    uint16_t checksum_errors; // complete candidate with a bad checksum
+    uint16_t truncated;       // candidate cut short by an idle gap
+    uint32_t probes;          // candidate start offsets examined
+} IBusFramerStats;
+
+/*
+ * Splits a stream of IBus bytes into frames, one byte at a time.
+ *
+ * Instead of keeping the raw bytes, the framer keeps a ring of running XOR
+ * prefixes: prefix[i] is the XOR of every byte before index i.  A frame
+ * occupying [s, e) is valid when prefix[e] == prefix[s], so checking any
+ * candidate start offset costs the same no matter how long the frame is,
+ * and the original bytes can still be recovered as prefix[i + 1] ^ prefix[i].
+ *
+ * Only the earliest unresolved start offset is ever examined.  When it
+ * turns out to be bogus (bad length, bad checksum, cut short by a gap) the
+ * next offset is tried, and because its prefixes are already in the ring,
+ * that check is O(1) too.  Every byte is the candidate start at most once,
+ * so resynchronising after garbage is linear in the number of bytes
+ * received rather than quadratic.
+ *
+ * Frames from every device on the bus are validated the same way, and a
+ * valid frame is always skipped as a unit, so once the framer's in sync the
+ * bytes inside other modules' frames are never mistaken for frame starts.
+ * Only frames that pass the source/destination accept filter are handed to
+ * the frame handler.
+ */
+class IBusFramer {
+public:
+    /*
+     * Invoked for every valid frame.  start is the stream index of the
+     * frame's source byte; use byteAt() or copyFrame() to get at the data.
+     */
+    typedef void FrameHandler_t(IBusFramer *framer, uint8_t start, uint8_t pkt_len);
+
+private:
+    uint8_t prefix[IBUS_FRAMER_WINDOW];
+
+    // stream index of the next byte to be received
+    uint8_t head;
+
+    // stream index of the earliest candidate frame start
+    uint8_t cand;
+
+    FrameHandler_t *pFrameHandler;
+
+    // one bit per address; a frame is accepted when both its source and
+    // destination bits are set
+    uint8_t sourceFilter[32];
+    uint8_t destinationFilter[32];
+
+    void resolve(bool final);
+
+    static inline bool isSet(const uint8_t *filter, uint8_t addr) {
+        return filter[addr >> 3] & (1 << (addr & 0x07));
+    }
+
+    inline uint8_t prefixAt(uint8_t index) const {
+        return prefix[index & (IBUS_FRAMER_WINDOW - 1)];
+    }
+
+public:
+    IBusFramerStats stats;
+
+    IBusFramer();
+
+    void setFrameHandler(FrameHandler_t *newHandler);
+
+    /*
+     * Accept filter configuration.  By default every frame is accepted;
+     * clearFilter() rejects everything until sources and destinations are
+     * added back.
+     */
+    void clearFilter();
+    void acceptSource(uint8_t addr);
+    void acceptDestination(uint8_t addr);
+
+    inline bool isAccepted(uint8_t src, uint8_t dest) const {
+        return isSet(sourceFilter, src) && isSet(destinationFilter, dest);
+    }
+
+    /*
+     * Forgets everything received so far.
+     */
+    void reset();
+
+    /*
+     * Adds a received byte to the stream.
+     */
+    void push(uint8_t b);
+
+    /*
+     * The line has gone idle: nothing else can belong to a frame that's
+     * already started, so every pending candidate is resolved now.
+     */
+    void gap();
+
+    /*
+     * Returns the byte at the given stream index; only meaningful for
+     * indices handed to the frame handler.
+     */
+    inline uint8_t byteAt(uint8_t index) const {
+        return prefixAt(index + 1) ^ prefixAt(index);
+    }
+
+    /*
+     * Copies len bytes starting at the given stream index.
+     */
+    void copyFrame(uint8_t start, uint8_t len, uint8_t *dest) const;
+};
+
+#endif /* end of include guard: IBUS_FRAMER_H */
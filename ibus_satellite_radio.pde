@@ -3,10 +3,8 @@
     "simple" mode; it should revert to this state whenever it's disconnected.
     
     Outstanding issues:
-    • need to deal with millis() rollover
     • iPod still stops responding, occasionally
     • occasionally doesn't get metadata after iPod reconnect
-    • still shows garbage at end of metadata strings after startup
     
     Current status: iPod operation appears reliable on my workbench and in the
     BMW.
@@ -15,11 +13,16 @@
 #define DEBUG_PACKET_PARSING 0
 #define WICKED_VERBOSE 0
 
+// timing probes on the hot path, dumped to the console on an ESN request
+// (hold SAT); see probe.h
+#define PROBES 0
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include <avr/wdt.h>
+#include <avr/sleep.h>
 
 #include <SoftwareSerial.h>
 
@@ -27,32 +30,76 @@
 #include <AdvancedRemote.h>
 
 #include "iPodWrapper.h"
+#include "TimerSerial.h"
+#include "ibus_serial.h"
+#include "scheduler.h"
+#include "display_cache.h"
+#include "text_scroller.h"
+#include "probe.h"
+#include "trace.h"
+#include "state_snapshot.h"
 #include "pgm_util.h"
 
-// @todo look into whether the preprocessor will magically convert 
-// strlen("foo") -> 3
-//    https://lists.linux-foundation.org/pipermail/openais/2010-March/014011.html
-// … possibly; see the comment about strlen() in the section on the 
-// "freestanding" compiler option:
-//    http://www.nongnu.org/avr-libc/user-manual/using__tools.html#gcc_minusW
-// sizeof() is compile-time?
-//    http://www.avrfreaks.net/index.php?name=PNphpBB2&file=viewtopic&t=32181&start=0
-#define IBUS_DATA_END_MARKER() "\xAA\xBB"
-#define ibus_data(_DATA) PSTR((_DATA IBUS_DATA_END_MARKER()))
+#if PROBES && ! DEBUG
+    #error "PROBES needs DEBUG for the console"
+#endif
+
+/*
+    sizeof() on a string literal is compile-time, so templates for outgoing
+    packets carry their length with them instead of needing a terminator:
+    
+        send_sdrs_packet(sdrs_data("\x3E\x02\x00..\x04", SDRS_PATCH_CHANNEL | SDRS_PATCH_PRESET),
+                         TX_STATUS, NULL);
+    
+    expands to the PROGMEM bytes, their length, and the patch flags.  '.' is
+    just a placeholder for a byte that gets patched.  Whether the scanning
+    flag applies (3E 01 and 3E 02 only) is also worked out from the literal,
+    which the compiler folds to a constant.
+*/
+#define ibus_raw_data(_DATA) PSTR(_DATA), (sizeof(_DATA) - 1)
+
+#define sdrs_data(_DATA, _PATCH) \
+    PSTR(_DATA), \
+    (sizeof(_DATA) - 1), \
+    ((_PATCH) | (sdrs_data_is_scannable(_DATA) ? SDRS_SCAN_FLAG : 0))
+
+#define sdrs_data_is_scannable(_DATA) \
+    (((_DATA)[0] == '\x3E') && (((_DATA)[1] == '\x01') || ((_DATA)[1] == '\x02')))
 
-const char *IBUS_DATA_END_MARKER = IBUS_DATA_END_MARKER();
+// patch flags for sdrs_data()
+#define SDRS_PATCH_CHANNEL 0x01 // channel goes in data[SDRS_CHANNEL_IND]
+#define SDRS_PATCH_PRESET  0x02 // bank and preset go in data[SDRS_PRESET_IND]
+#define SDRS_SCAN_FLAG     0x04 // set automatically; see above
+#define SDRS_IF_CHANGED    0x08 // not sent if the display already shows it; see display_cache.h
+
+#define SDRS_CHANNEL_IND 3
+#define SDRS_PRESET_IND  4
 
 // pin mappings
-#define INH_PIN 2
+#define INH_PIN 2 // INT0; low while the bus is asleep
 
 // RX for console is not currently supported; need special handling for
 // multiple SoftwareSerial instances
 #define CONSOLE_RX_PIN 14
 #define CONSOLE_TX_PIN 15
 
-#define IPOD_RX_PIN 8 // 14 on chip
+#define IPOD_RX_PIN 8 // 14 on chip; ICP1
 #define IPOD_TX_PIN 7 // 13 on chip
 
+#if IPOD_RX_PIN != TIMER_SERIAL_RX_PIN
+    #error "the iPod's RX pin has to be timer1's input capture pin"
+#endif
+
+/*
+ * The iPod autobauds, up to 57600.  NewSoftSerial never managed more than
+ * 19200 here; on timer1 the bits are timed by the hardware rather than by
+ * delay loops, and 38400 halves the time metadata takes to come in.  The
+ * DEBUG console's bit-banged at 115200 with interrupts off, which costs
+ * about 90µs a character; that's more than a bit here, so expect the odd
+ * garbled response with DEBUG on.
+ */
+#define IPOD_BAUD 38400
+
 /*
  * LEDs:
  *   red: missed poll from radio
@@ -65,16 +112,6 @@ const char *IBUS_DATA_END_MARKER = IBUS_DATA_END_MARKER();
 #define LED_IBUS_RX  18 // yellow
 #define LED_IBUS_TX  17 // green
 
-// addresses of IBus devices
-#define RAD_ADDR  0x68
-#define SDRS_ADDR 0x73
-
-// static offsets into the packet
-#define PKT_SRC  0
-#define PKT_LEN  1
-#define PKT_DEST 2
-#define PKT_CMD  3
-
 // SDRS commands
 #define SDRS_CMD_POWER          0x00 // power; not seen in Josh's car
 #define SDRS_CMD_MODE           0x01 // mode
@@ -91,48 +128,22 @@ const char *IBUS_DATA_END_MARKER = IBUS_DATA_END_MARKER();
 #define SDRS_CMD_ESN_REQ        0x14 // SAT press and hold; ESN request
 #define SDRS_CMD_SAT            0x15 // SAT press; preset bank change
 
-// there may well be a protocol-imposed limit to the max value of a length
-// byte in a packet, but it looks like this is the biggest we'll see in
-// practice.  Use this as a sort of heuristic to determine if the incoming
-// data is valid.
-#define MAX_EXPECTED_LEN 64
+// largest packet we can build; anything bigger wouldn't fit in the TX queue
+#define TX_BUF_LEN IBUS_TX_FRAME_LEN
 
-#if MAX_EXPECTED_LEN > RX_BUFFER_SIZE
-    #error MAX_EXPECTED_LEN bigger than RX_BUFFER_SIZE in HardwareSerial.h
-#endif
-
-#define TX_BUF_LEN 80
-#define RX_BUF_LEN (MAX_EXPECTED_LEN + 2)
-
-/*
-prescale    target timer count  rounded timer count       (D)    (E)          % diff
-       1             11110.111                11110     1440    1440.0144    -0.0010
-       8              1387.888                 1388     1440    1439.8848     0.0079
-      32               346.222                  346     1440    1440.9221    -0.0640
-      64               172.611                  173     1440    1436.7816     0.2234
-     128                85.805                   86     1440    1436.7816     0.2234
-     256                42.402                   42     1440    1453.4883    -0.9366
-    1024                 9.850                   10     1440    1420.4545     1.3573
-
-@ todo
-to detect the line being idle for 1.5 byte periods:
-    9600-8-e-1 => 11 bits/byte
-    11 * 1.5 = 16.5 bit periods
-
-target timer count=((16000000/A2)/(960*1.5))-1 [((16000000/1)/(9600*11*1.5))-1]
-rounded timer count=ROUND(target timer count '1', 0)
-(D)=(16000000/A2)/(target timer count '1'+1)
-(E)=(16000000/A2)/(rounded timer count '1'+1)
-% diff=100-(E2*100)/D2
-*/
-#define CONTENTION_TIMEOUT 173        
+// classes of outgoing frames; see IBUS_TX_URGENT in ibus_serial.h.  Poll
+// responses and ACKs are urgent, so the radio gets them within its
+// deadline even if text is waiting.  A newer announcement, status or
+// channel text replaces one that hasn't been sent yet.
+#define TX_ANNOUNCE     (IBUS_TX_URGENT | 1)
+#define TX_STATUS       (IBUS_TX_URGENT | 2)
+#define TX_ACK          (IBUS_TX_URGENT)
+#define TX_CHANNEL_TEXT 3
+#define TX_TEXT         0
 
 // buffer for building outgoing packets
 uint8_t tx_buf[TX_BUF_LEN];
 
-// buffer for processing incoming packets; same size as serial buffer
-uint8_t rx_buf[RX_BUF_LEN];
-
 typedef enum __sdrs_status_enum {
     SDRS_STATUS_UNKNOWN,
     SDRS_STATUS_INACTIVE,
@@ -150,30 +161,59 @@ typedef struct __sat_state {
 SatState satelliteState = {1, 1, 0, SDRS_STATUS_UNKNOWN, false};
 
 /*
- * time-keeping variables
+ * deferred actions; see scheduler.h
  */
-// timestamp of last poll from radio
-unsigned long lastPoll; // 20s timeout
+// re-announce ourselves if the radio hasn't polled us in this long
+#define POLL_TIMEOUT 20000L
+ScheduledAction poll_timeout_action;
 
-// trigger time to turn off LED
-unsigned long ledOffTime; // 500ms interval
+// turn off the TX LED after sending
+ScheduledAction led_off_action;
 
-// timeout duration before giving up on a read
-unsigned long readTimeout; // variable
+// the radio wants a little time between an ACK and the channel text
+ScheduledAction channel_text_action;
+
+// set when the radio's waiting for the channel text that channel_text_action
+// will send, so it goes out even if it hasn't changed
+boolean channel_text_forced;
+
+// changes to the channel text from the iPod that come within this long of
+// each other go out as one frame
+#define CHANNEL_TEXT_SETTLE 50
+
+// moves the channel text on to the next part of the track's metadata; see
+// text_scroller.h
+ScheduledAction scroll_action;
+
+// how long to put off a scroll step while a frame from the radio is waiting
+#define SCROLL_RETRY 10
+
+// gives the iPod time to be paused after the bus goes to sleep, before its
+// link is shut down and we power down; see sleep_while_inhibited()
+#define SLEEP_DELAY 1000L
+ScheduledAction sleep_timer;
+
+// the state's saved to EEPROM this long after it changes, so a burst of
+// changes is one write; see state_snapshot.h
+#define SNAPSHOT_SETTLE 500L
+ScheduledAction snapshot_action;
+
+// after a reset, the channel text restored from EEPROM is kept this long at
+// most while the iPod's found and asked what it's playing; see
+// resume_from_snapshot()
+#define RESUME_TIMEOUT 5000L
+ScheduledAction resume_timer;
+
+// the track that channel text was for; see trackChangedHandler()
+unsigned long resume_position;
 
 #if DEBUG
-    unsigned long lastFreeMemCheck; // 10s, or more frequently
+    ScheduledAction free_mem_action; // 10s
 #endif /* DEBUG */
 
 // the 47k pull-down on the RX pin allows the iPodWrapper to detect the 
-// presence of the iPod
-SoftwareSerial nssIPod(
-    IPOD_RX_PIN, // RX pin
-    IPOD_TX_PIN, // TX pin
-    false,       // inverse_logic
-    false,       // disable_rx
-    true         // disable_pullup
-);
+// presence of the iPod; the RX pin's fixed, see TimerSerial.h
+TimerSerial iPodSerialPort(IPOD_TX_PIN);
 
 #if DEBUG
     SoftwareSerial nssConsole(CONSOLE_RX_PIN, CONSOLE_TX_PIN);
@@ -181,12 +221,24 @@ SoftwareSerial nssIPod(
 
 IPodWrapper iPodWrapper;
 IPodWrapper::IPodPlayingState iPodPlayState;
+IPodWrapper::IPodMode iPodMode;
 
 // only 8 chars show on the screen for the channel display. It doesn't scroll
 // on its own.
 #define CHANNEL_TEXT_LENGTH 8
+
+#if CHANNEL_TEXT_LENGTH != SCROLL_WIDTH
+    #error "SCROLL_WIDTH has to match CHANNEL_TEXT_LENGTH"
+#endif
+
+#if CHANNEL_TEXT_LENGTH != SNAPSHOT_TEXT_LEN
+    #error "SNAPSHOT_TEXT_LEN has to match CHANNEL_TEXT_LENGTH"
+#endif
 char channel_text_data[CHANNEL_TEXT_LENGTH + 1];
 volatile boolean bus_inhibited;
+
+// set by INT0 when INH_PIN changes; handled in loop()
+volatile boolean inhibit_changed;
 boolean announcement_sent;
 
 // this'll give me flexibility to swap between soft- and hard-ware serial 
@@ -211,15 +263,60 @@ void get_mcusr_and_disable_wdt(void) {
 
 // {{{ trackChangedHandler
 void trackChangedHandler(unsigned long playlistPosition) {
-    // iPod playlist position starts at 0; for aesthetics, we should start at 1
-    satelliteState.channel = ((uint8_t) playlistPosition) + 1;
-    update_sdrs_status();
+    // iPod playlist position starts at 0; for aesthetics, we should start at 1.
+    // Channel up/down presses still to be sent to the iPod have already
+    // been counted in the channel shown.
+    satelliteState.channel = ((uint8_t) (playlistPosition + iPodWrapper.getPendingSkip())) + 1;
+    update_sdrs_status(true);
+    
+    // the text restored after a reset can stay up until the title's in,
+    // but only if it's for this track
+    if (scheduler_is_pending(&resume_timer) && (playlistPosition != resume_position)) {
+        DEBUG_PGM_PRINTLN("[state] iPod's on a different track from the restored state");
+        
+        scheduler_cancel(&resume_timer);
+        schedule_channel_text(0, false);
+    }
 }
 // }}}
 
 // {{{ metaDataChangedHandler
 void metaDataChangedHandler() {
-    update_sdrs_channel_text();
+    // metadata arrives one field at a time; only what's changed has to be
+    // reloaded.  The scroller's fields are in the same order as
+    // IPodWrapper's.
+    static uint8_t loadedGeneration[SCROLL_FIELD_COUNT];
+    
+    boolean titleChanged = false;
+    
+    for (uint8_t field = 0; field < SCROLL_FIELD_COUNT; field++) {
+        uint8_t generation = iPodWrapper.getMetaDataGeneration((IPodWrapper::MetaDataField) field);
+        
+        if (generation != loadedGeneration[field]) {
+            loadedGeneration[field] = generation;
+            scroller_load(field);
+            
+            titleChanged |= (field == SCROLL_FIELD_TITLE);
+        }
+    }
+    
+    if (titleChanged) {
+        // new track; start again from the beginning of its title
+        scroller_restart();
+        scheduler_cancel(&scroll_action);
+        
+        schedule_channel_text(CHANNEL_TEXT_SETTLE, false);
+    }
+}
+// }}}
+
+// {{{ scroll_text_source
+const char *scroll_text_source(uint8_t field) {
+    switch (field) {
+        case SCROLL_FIELD_ARTIST: return iPodWrapper.getArtist();
+        case SCROLL_FIELD_ALBUM:  return iPodWrapper.getAlbum();
+        default:                  return iPodWrapper.getTitle();
+    }
 }
 // }}}
 
@@ -232,7 +329,7 @@ void playStateChangedHandler(IPodWrapper::IPodPlayingState playState) {
     
     iPodPlayState = playState;
     
-    update_sdrs_channel_text();
+    schedule_channel_text(CHANNEL_TEXT_SETTLE, false);
 }
 // }}}
 
@@ -253,7 +350,10 @@ void iPodModeChangedHandler(IPodWrapper::IPodMode mode) {
         }
     #endif
     
-    update_sdrs_channel_text();
+    iPodMode = mode;
+    
+    schedule_channel_text(CHANNEL_TEXT_SETTLE, false);
+    note_state_changed();
 }
 // }}}
 
@@ -271,12 +371,195 @@ void iPodModeChangedHandler(IPodWrapper::IPodMode mode) {
     
         DEBUG_PGM_PRINT("free mem: ");
         DEBUG_PRINTLN(free_mem);
-        lastFreeMemCheck = millis();
+    }
+    
+    void free_mem_timeout(void *context) {
+        printFreeMemory();
+        scheduler_schedule(&free_mem_action, 10000L);
     }
 #endif /* DEBUG */
 
+// {{{ poll_timeout
+void poll_timeout(void *context) {
+    // can't do anything while the bus is asleep.
+    if (! bus_inhibited) {
+        DEBUG_PGM_PRINTLN("[IBus] haven't seen a poll in a while; we're dead to the radio");
+        trace(TRACE_POLL_TIMEOUT, 0);
+        digitalWrite(LED_ERR, HIGH);
+        
+        // the radio may have been reset, so assume it's showing nothing
+        display_cache_invalidate();
+        
+        send_sdrs_device_ready_after_reset();
+        
+        digitalWrite(LED_ERR, LOW);
+    }
+    
+    scheduler_schedule(&poll_timeout_action, POLL_TIMEOUT);
+}
+// }}}
+
+// {{{ led_off
+void led_off(void *context) {
+    digitalWrite(LED_IBUS_TX, LOW);
+}
+// }}}
+
+// {{{ deferred_channel_text
+void deferred_channel_text(void *context) {
+    boolean forced = channel_text_forced;
+    channel_text_forced = false;
+    
+    update_sdrs_channel_text(! forced);
+}
+// }}}
+
+// {{{ scroll_step
+void scroll_step(void *context) {
+    // stops here until update_sdrs_channel_text() starts it again
+    if ((satelliteState.status != SDRS_STATUS_ACTIVE) || bus_inhibited || ! showing_metadata()) {
+        return;
+    }
+    
+    // keep the bus clear for the poll response, and let a command from the
+    // radio be answered first
+    unsigned long wait = scroller_poll_wait(millis());
+    
+    if ((wait == 0) && (ibus_serial_peek_frame() != NULL)) {
+        wait = SCROLL_RETRY;
+    }
+    
+    if (wait != 0) {
+        scheduler_schedule(&scroll_action, wait);
+        return;
+    }
+    
+    scroller_advance();
+    update_sdrs_channel_text(true);
+}
+// }}}
+
+// {{{ schedule_channel_text
+/*
+ * Sends the channel text in delay_ms, picking up anything else that changes
+ * in the meantime.  Unless it's forced (the radio's waiting for it), it's
+ * only sent if the radio isn't already showing it.
+ */
+void schedule_channel_text(unsigned long delay_ms, boolean forced) {
+    if (forced) {
+        channel_text_forced = true;
+    }
+    else if (scheduler_is_pending(&channel_text_action)) {
+        // it's coming soon anyway; don't put it off
+        return;
+    }
+    
+    scheduler_schedule(&channel_text_action, delay_ms);
+}
+// }}}
+
+// {{{ note_state_changed
+/*
+ * Saves the state to EEPROM once it's settled.  Whether anything's actually
+ * changed is up to snapshot_save(); a scroll step isn't a change.  Nothing's
+ * saved while what was restored after a reset is still standing in for the
+ * iPod, since nothing better is known yet.
+ */
+void note_state_changed() {
+    if (scheduler_is_pending(&snapshot_action) || scheduler_is_pending(&resume_timer)) {
+        return;
+    }
+    
+    scheduler_schedule(&snapshot_action, SNAPSHOT_SETTLE);
+}
+// }}}
+
+// {{{ save_state_snapshot
+void save_state_snapshot(void *context) {
+    StateSnapshot snapshot;
+    
+    snapshot.channel = satelliteState.channel;
+    snapshot.preset_bank = satelliteState.presetBank;
+    snapshot.preset_num = satelliteState.presetNum;
+    snapshot.sdrs_status = satelliteState.status;
+    snapshot.ipod_mode = iPodMode;
+    snapshot.playlist_position = iPodWrapper.getPlaylistPosition();
+    
+    // the start of the title rather than wherever the scroller's got to,
+    // so a track's only saved once
+    memset(snapshot.text, 0, SNAPSHOT_TEXT_LEN);
+    strncpy(snapshot.text, showing_metadata() ? iPodWrapper.getTitle() : channel_text_data, SNAPSHOT_TEXT_LEN);
+    
+    snapshot_save(&snapshot);
+}
+// }}}
+
+// {{{ resume_from_snapshot
+/*
+ * Puts back the channel, preset, status and channel text from before a
+ * reset, if they were saved, and shows them now rather than "no iPod"
+ * until the iPod's been found again.  An iPod that was in advanced mode is
+ * attached straight to advanced mode, without the trip through simple
+ * mode, and the restored text stays up until the iPod's got something
+ * definite to show instead (see resume_superseded()) or RESUME_TIMEOUT
+ * runs out; the channel follows the iPod's playlist position as soon as
+ * that comes in, and if it's not the track that was saved, the text goes
+ * at once.
+ */
+void resume_from_snapshot() {
+    StateSnapshot snapshot;
+    
+    if (! snapshot_restore(&snapshot)) {
+        return;
+    }
+    
+    // it can go straight back to advanced mode when it's found
+    if (snapshot.ipod_mode == IPodWrapper::MODE_ADVANCED) {
+        iPodWrapper.setAdvanced(true);
+    }
+    
+    // the radio's asleep, and starts over when it wakes up
+    if (bus_inhibited || (snapshot.sdrs_status > SDRS_STATUS_ACTIVE)) {
+        return;
+    }
+    
+    DEBUG_PGM_PRINTLN("[state] resuming from EEPROM snapshot");
+    
+    satelliteState.channel = snapshot.channel;
+    satelliteState.presetBank = snapshot.preset_bank;
+    satelliteState.presetNum = snapshot.preset_num;
+    satelliteState.status = (SDRSStatusEnum) snapshot.sdrs_status;
+    
+    memcpy(channel_text_data, snapshot.text, CHANNEL_TEXT_LENGTH);
+    channel_text_data[CHANNEL_TEXT_LENGTH] = '\0';
+    
+    resume_position = snapshot.playlist_position;
+    
+    trace(TRACE_RESUMED, satelliteState.channel);
+    
+    if (snapshot.ipod_mode == IPodWrapper::MODE_ADVANCED) {
+        // anything noted since boot is only the iPod not being found yet
+        scheduler_cancel(&snapshot_action);
+        scheduler_schedule(&resume_timer, RESUME_TIMEOUT);
+    }
+    
+    send_channel_text(false);
+}
+// }}}
+
+// {{{ resume_expired
+void resume_expired(void *context) {
+    DEBUG_PGM_PRINTLN("[state] iPod didn't confirm the restored state in time");
+    
+    schedule_channel_text(0, false);
+}
+// }}}
+
 // {{{ setup
 void setup() {
+    // keeps what happened before a watchdog reset; see trace.h
+    trace_init(mcusr_mirror);
+    
     #if DEBUG
         // RX not supported; see comment near CONSOLE_RX_PIN define
         nssConsole.begin(115200);
@@ -289,6 +572,11 @@ void setup() {
         if (mcusr_mirror & _BV(EXTRF)) DEBUG_PGM_PRINTLN("==== external reset ====");
         if (mcusr_mirror & _BV(BORF))  DEBUG_PGM_PRINTLN("==== brown-out reset ====");
         if (mcusr_mirror & _BV(WDRF))  DEBUG_PGM_PRINTLN("==== watchdog reset ====");
+        
+        // decode with util/trace_decode.py; the messages above go out first
+        // so everything's in order
+        binlog_flush(console);
+        trace_dump(console);
     #endif /* DEBUG */
     
     pinMode(LED_ERR, OUTPUT);
@@ -305,14 +593,35 @@ void setup() {
     // zero-out channel text buffer, including trailing nul
     memset(channel_text_data, 0, CHANNEL_TEXT_LENGTH + 1);
     
-    // Set up timer2 at Fcpu/64 for contention detection. Must be done before 
-    // any IBus serial activity!
-    //     CS22:1, CS21:0, CS20:0
-    TCCR2B = _BV(CS22); // ~_BV(CS21) | ~_BV(CS20);
+    scheduler_init_action(&poll_timeout_action, poll_timeout, NULL);
+    scheduler_init_action(&led_off_action, led_off, NULL);
+    scheduler_init_action(&channel_text_action, deferred_channel_text, NULL);
+    scheduler_init_action(&scroll_action, scroll_step, NULL);
+    scheduler_init_action(&sleep_timer, NULL, NULL);
+    scheduler_init_action(&snapshot_action, save_state_snapshot, NULL);
+    scheduler_init_action(&resume_timer, resume_expired, NULL);
+    
+    scroller_init(scroll_text_source);
+    
+    #if DEBUG
+        scheduler_init_action(&free_mem_action, free_mem_timeout, NULL);
+        scheduler_schedule(&free_mem_action, 10000L);
+    #endif
+    
+    scheduler_schedule(&poll_timeout_action, POLL_TIMEOUT);
     
-    // set up serial for IBus; 9600,8,E,1
-    Serial.begin(9600);
-    UCSR0C |= _BV(UPM01); // even parity
+    // set up serial for IBus; 9600,8,E,1, and timer2 for idle gap
+    // detection, which also decides when we can transmit
+    ibus_serial_init();
+    
+    PROBE_INIT();
+    
+    // only the radio's broadcasts and whatever it sends to us are of
+    // interest; everything else is skipped a whole frame at a time
+    ibus_serial_clear_filter();
+    ibus_serial_accept_source(RAD_ADDR);
+    ibus_serial_accept_destination(SDRS_ADDR);
+    ibus_serial_accept_destination(BCST_ADDR);
     
     // start the watchdog timer w/ 4s timeout
     wdt_enable(WDTO_4S);
@@ -327,26 +636,15 @@ void setup() {
         DEBUG_PGM_PRINTLN("[IBus] bus is alive");
     }
     
-    // can't do anything while the bus is asleep.
-    // bus_inhibited = true;
-    // while (bus_inhibited) {
-    //     wdt_reset();
-    //     configureForBusInhibition();
-    // }
-    // 
-    // // enable INT0
-    // // @todo use this interrupt to wake the µC from sleep
-    // attachInterrupt(0, configureForBusInhibition, CHANGE);    
-    
-    // baud rate for iPodSerial
-    // not having much luck with 38,400; maybe related to my "buffer"
-    // implementation (emitter-follower)?  19,200 works in both simple and
-    // advanced modes, however, even with the iPhone, it seems!
+    // can't do anything while the bus is asleep; loop() powers down once
+    // it's been asleep for SLEEP_DELAY, and INT0 says when it changes
+    configureForBusInhibition();
+    attachInterrupt(0, inhibit_pin_changed, CHANGE);
     
-    nssIPod.begin(19200);
-    // nssIPod.begin(iPodSerial::IPOD_SERIAL_RATE);
+    iPodSerialPort.begin(IPOD_BAUD);
     
     iPodPlayState = IPodWrapper::PLAY_STATE_UNKNOWN;
+    iPodMode = IPodWrapper::MODE_UNKNOWN;
     
     // for notification when the currently-playing track changes
     iPodWrapper.setTrackChangedHandler(trackChangedHandler);
@@ -357,7 +655,7 @@ void setup() {
     // for notification when mode changes between simple and advanced
     iPodWrapper.setModeChangedHandler(iPodModeChangedHandler);
 
-    iPodWrapper.init(&nssIPod, IPOD_RX_PIN);
+    iPodWrapper.init(&iPodSerialPort, IPOD_RX_PIN);
     
     iPodWrapper.setAdvanced();
     
@@ -365,8 +663,14 @@ void setup() {
     DEBUG_PGM_PRINTLN("[IBus] sending initial announcement");
     send_sdrs_device_ready_after_reset();
     
+    // what the radio was showing before the reset, if it's known
+    resume_from_snapshot();
+    
     #if DEBUG
         printFreeMemory();
+        
+        // the LED flashing blocks anyway
+        binlog_flush(console);
     #endif /* DEBUG */
     
     for (int i = 0; i < 3; i++) {
@@ -388,52 +692,38 @@ void setup() {
 void loop() {
     wdt_reset();
     
-    if (millis() > ledOffTime) {
-        digitalWrite(LED_IBUS_TX, LOW);
+    if (inhibit_changed) {
+        inhibit_changed = false;
+        configureForBusInhibition();
     }
     
+    // nothing in here or in any deferred action blocks for more than a
+    // frame time; anything that has to wait is scheduled instead
+    scheduler_run();
+    
+    PROBE_BEGIN(PROBE_IPOD_UPDATE);
     iPodWrapper.update();
+    PROBE_END(PROBE_IPOD_UPDATE);
     
-    #if DEBUG
-        if (millis() > (lastFreeMemCheck + 10000L)) {
-            printFreeMemory();
-        }
-    #endif /* DEBUG */
+    // a byte at a time, whenever the EEPROM's free
+    snapshot_poll();
     
     // can't do anything while the bus is asleep.
     if (bus_inhibited) {
-        // @todo flash leds?
-    } else {
-        if ((lastPoll + 20000L) < millis()) {
-            DEBUG_PGM_PRINTLN("[IBus] haven't seen a poll in a while; we're dead to the radio");
-            digitalWrite(LED_ERR, HIGH);
-            
-            send_sdrs_device_ready_after_reset();
-            lastPoll = millis();
-            
-            digitalWrite(LED_ERR, LOW);
+        if (! scheduler_is_pending(&sleep_timer)) {
+            sleep_while_inhibited();
         }
-        
+    } else {
         process_incoming_data();
     }
-}
-// }}}
-
-// {{{ disableSerialReceive
-inline void disableSerialReceive() {
-    UCSR0B &= ~(_BV(RXEN0) | _BV(RXCIE0));
-}
-// }}}
-
-// {{{ enableSerialReceive
-inline void enableSerialReceive() {
-    // @todo still (usually?) getting 2 bytes in the RX buffer after 
-    //       transmitting, even with RX turned off
     
-    // wait for TX buffer to flush (while TX is not complete)
-    while (! (UCSR0A & _BV(TXC0)));
-            
-    UCSR0B |= _BV(RXEN0) | _BV(RXCIE0);
+    #if DEBUG
+        // the console's bit-banged with interrupts off, so only send
+        // queued debug output while no frame's waiting to be handled
+        if (ibus_serial_peek_frame() == NULL) {
+            binlog_drain(console);
+        }
+    #endif /* DEBUG */
 }
 // }}}
 
@@ -443,174 +733,191 @@ inline void enableSerialReceive() {
  * the RX hardware and flush the buffer.
  */
 void configureForBusInhibition() {
+    boolean was_inhibited = bus_inhibited;
+    
     // bus is uninhibited (alive) when PORTD2 is high
     bus_inhibited = (digitalRead(INH_PIN) == LOW);
+    trace(TRACE_BUS_INHIBIT, bus_inhibited);
     
     if (bus_inhibited) {
         // shutdown the receive circuitry, flush any remaining data
-        disableSerialReceive();
-        Serial.flush();
+        ibus_serial_rx_disable();
+        
+        // the radio's going to sleep, and won't remember what it showed
+        display_cache_invalidate();
+        
+        // the car's been turned off.  The radio will tell us when it wants
+        // us again.
+        iPodWrapper.pause();
+        satelliteState.status = SDRS_STATUS_INACTIVE;
+        note_state_changed();
+        
+        scheduler_schedule(&sleep_timer, SLEEP_DELAY);
     } else {
         // bus is now enabled; restart USART
-        enableSerialReceive();
+        ibus_serial_rx_enable();
+        
+        scheduler_cancel(&sleep_timer);
+        
+        if (was_inhibited) {
+            // the radio's just woken up too
+            send_sdrs_device_ready_after_reset();
+            scheduler_schedule(&poll_timeout_action, POLL_TIMEOUT);
+        }
+    }
+}
+// }}}
+
+// {{{ inhibit_pin_changed
+// INT0 handler
+void inhibit_pin_changed() {
+    inhibit_changed = true;
+}
+// }}}
+
+// {{{ sleep_while_inhibited
+/*
+ * Powers everything down until the bus wakes up again: the USART, timer2,
+ * the iPod's serial port, the ADC and the watchdog, leaving the MCU in
+ * power-down.  The bus transceiver raises INH_PIN when the car wakes up.
+ *
+ * INT0 can only wake the MCU from power-down on a low level, which is the
+ * wrong way round, and its edge detection needs the I/O clock that
+ * power-down stops.  The pin change interrupt on the same pin (PCINT18)
+ * is asynchronous, so it's what wakes us.  NewSoftSerial (for the DEBUG
+ * console) owns the PCINT2 vector; its handler only looks at the pin of
+ * the instance that's listening.  Anything the iPod had half sent when we
+ * went down is flushed after waking.
+ *
+ * millis() doesn't move while the MCU's powered down, so scheduled actions
+ * just pick up where they left off.
+ */
+void sleep_while_inhibited() {
+    DEBUG_PGM_PRINTLN("[power] bus asleep; powering down");
+    trace(TRACE_POWER_DOWN, 1);
+    
+    #if DEBUG
+        binlog_flush(console);
+    #endif /* DEBUG */
+    
+    digitalWrite(LED_ERR, LOW);
+    digitalWrite(LED_IBUS_RX, LOW);
+    digitalWrite(LED_IBUS_TX, LOW);
+    scheduler_cancel(&led_off_action);
+    
+    // the power may well go while we're down; don't leave a snapshot
+    // half written
+    if (scheduler_is_pending(&snapshot_action)) {
+        scheduler_cancel(&snapshot_action);
+        save_state_snapshot(NULL);
     }
+    
+    snapshot_flush();
+    
+    ibus_serial_shutdown();
+    iPodSerialPort.end();
+    
+    // the ADC keeps drawing current in every sleep mode if it's left on
+    uint8_t adcsra = ADCSRA;
+    ADCSRA &= ~_BV(ADEN);
+    
+    // it would only reset us
+    wdt_disable();
+    
+    PCMSK2 |= _BV(PCINT18);
+    PCIFR = _BV(PCIF2);
+    PCICR |= _BV(PCIE2);
+    
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    
+    // a glitch on INH_PIN wakes us up too; go straight back to sleep.  The
+    // pin's checked with interrupts off, and sleep_cpu() runs before any
+    // interrupt can be taken after sei(), so a change in between isn't
+    // missed.
+    for (;;) {
+        cli();
+        
+        if (digitalRead(INH_PIN) == HIGH) {
+            sei();
+            break;
+        }
+        
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    
+    PCICR &= ~_BV(PCIE2);
+    PCMSK2 &= ~_BV(PCINT18);
+    
+    wdt_enable(WDTO_4S);
+    ADCSRA = adcsra;
+    
+    iPodSerialPort.begin(IPOD_BAUD);
+    iPodSerialPort.flush();
+    
+    ibus_serial_init();
+    
+    trace(TRACE_POWER_DOWN, 0);
+    DEBUG_PGM_PRINTLN("[power] bus awake");
+    
+    // INT0 didn't see the edge while the clock was stopped
+    inhibit_changed = false;
+    configureForBusInhibition();
 }
 // }}}
 
 // {{{ process_incoming_data
 boolean process_incoming_data() {
     /*
-    The serial reading is pretty naive. If we start reading in the middle of
-    a packet transmission, the checksum validation will fail. All data
-    received up to that point will be lost. It's expected that this loop will
-    eventually synchronize with the stream during a lull in the conversation,
-    where all available and "invalid" data will have been consumed.
+    Framing, checksum validation and filtering of packets we don't care
+    about all happen in the USART RX interrupt (see ibus_serial.cpp);
+    anything in the queue is a complete, valid packet from the radio to us
+    or to everyone.
     */
     
+    PROBE_BEGIN(PROBE_PROCESS_INCOMING);
+    
     boolean found_message = false;
     
-    uint8_t bytes_availble = Serial.available();
+    const uint8_t *packet;
     
-    if (bytes_availble) {
+    while ((packet = ibus_serial_peek_frame()) != NULL) {
+        found_message = true;
+        
         digitalWrite(LED_IBUS_RX, HIGH);
-
-        #if DEBUG && DEBUG_PACKET_PARSING
-            DEBUG_PGM_PRINT("[pkt] buf contents: ");
-            for (int i = 0; i < bytes_availble; i++) {
-                DEBUG_PRINT(Serial.peek(i), HEX);
+        
+        #if DEBUG_PACKET_PARSING
+            DEBUG_PGM_PRINT("[pkt] received pkt ");
+            for (int i = 0; i < (packet[PKT_LEN] + 2); i++) {
+                DEBUG_PRINT(packet[i], HEX);
                 DEBUG_PGM_PRINT(" ");
             }
             DEBUG_PRINTLN();
         #endif
-    }
-    
-    // filter out packets from sources we don't care about
-    // I don't like this solution at all, but until I can implement a timer to 
-    // reset in the RX interrupt I think this will at least avoid getting 
-    // stuck waiting for enough data to arrive
-    if (bytes_availble && (Serial.peek(PKT_SRC) != RAD_ADDR) && (Serial.peek(PKT_SRC) != SDRS_ADDR)) {
-        DEBUG_PGM_PRINTLN("[IBus] dropping byte from unknown source");
-        Serial.remove(1);
-    }
-    // need at least two bytes to a packet, src and length
-    else if (bytes_availble > 2) {
-        // length of the data
-        uint8_t data_len = Serial.peek(PKT_LEN);
-
-        #if DEBUG && DEBUG_PACKET_PARSING
-            DEBUG_PGM_PRINT("[pkt] have ");
-            DEBUG_PRINT(bytes_availble, DEC);
-            DEBUG_PGM_PRINTLN(" bytes available");
         
-            DEBUG_PGM_PRINT("[pkt] packet length is ");
-            DEBUG_PRINTLN(data_len, DEC);
+        #if WICKED_VERBOSE
+            DEBUG_PGM_PRINT("[IBus] packet from ");
+            DEBUG_PRINTLN(packet[PKT_SRC], HEX);
         #endif
         
-        if (
-            (data_len == 0)                || // length cannot be zero
-            (data_len >= MAX_EXPECTED_LEN)    // we don't handle messages larger than this
-        ) {
-            DEBUG_PGM_PRINTLN("[IBus] invalid packet length");
-            
-            #if DEBUG && DEBUG_PACKET_PARSING
-                     if (data_len == 0) DEBUG_PGM_PRINTLN("[pkt] length cannot be zero");
-                else if (data_len >= MAX_EXPECTED_LEN) DEBUG_PGM_PRINTLN("[pkt] we don't handle messages larger than this");
-            #endif
-            
-            Serial.remove(1);
-        }
-        else {
-            // length of entire packet including source and length
-            uint8_t pkt_len = data_len + 2;
-
-            // index of the checksum byte
-            uint8_t chksum_ind = pkt_len - 1;
-            
-            #if DEBUG && DEBUG_PACKET_PARSING
-                DEBUG_PGM_PRINT("[pkt] checksum at index ");
-                DEBUG_PRINT(chksum_ind, DEC);
-                DEBUG_PGM_PRINT(": ");
-                DEBUG_PRINTLN(Serial.peek(chksum_ind), HEX);
-
-                DEBUG_PGM_PRINT("[pkt] need at least ");
-                DEBUG_PRINT(pkt_len, DEC);
-                DEBUG_PGM_PRINTLN(" bytes for complete packet");
-            #endif
-
-            // ensure we've got enough data in the buffer to comprise a
-            // complete packet
-            if (bytes_availble >= pkt_len) {
-                // yep, have enough data
-                readTimeout = 0;
-
-                // verify the checksum
-                int calculated_chksum = 0;
-                for (int i = 0; i < chksum_ind; i++) {
-                    calculated_chksum ^= Serial.peek(i);
-                }
-
-                if (calculated_chksum == Serial.peek(chksum_ind)) {
-                    found_message = true;
-                    
-                    // valid checksum
-
-                    #if DEBUG_PACKET_PARSING
-                        DEBUG_PGM_PRINT("[pkt] received pkt ");
-                    #endif
-
-                    // read packet into buffer and dispatch
-                    for (int i = 0; i < pkt_len; i++) {
-                        rx_buf[i] = Serial.read();
-
-                        #if DEBUG_PACKET_PARSING
-                            DEBUG_PRINT(rx_buf[i], HEX);
-                            DEBUG_PGM_PRINT(" ");
-                        #endif
-                    }
-
-                    #if DEBUG_PACKET_PARSING
-                        DEBUG_PRINTLN();
-                    #endif
-                    
-                    #if WICKED_VERBOSE
-                        DEBUG_PGM_PRINT("[IBus] packet from ");
-                        DEBUG_PRINTLN(rx_buf[PKT_SRC], HEX);
-                    #endif
-                    
-                    dispatch_packet(rx_buf);
-                }
-                else {
-                    // invalid checksum; drop first byte in buffer and try
-                    // again
-                    DEBUG_PGM_PRINTLN("[IBus] invalid checksum");
-                    Serial.remove(1);
-                }
-            } // if (bytes_availble …)
-            else {
-                // provide a timeout mechanism; expire if needed bytes 
-                // haven't shown up in the expected time.
-                
-                if (readTimeout == 0) {
-                    // (10 bits/byte) => 1.042ms/byte; add a 20% fudge factor
-                    readTimeout = ((125 * ((pkt_len - bytes_availble) + 1)) / 100);
-                    
-                    #if DEBUG && DEBUG_PACKET_PARSING
-                        DEBUG_PGM_PRINT("[pkt] read timeout: ");
-                        DEBUG_PRINTLN(readTimeout, DEC);
-                    #endif
-                    
-                    readTimeout += millis();
-                }
-                else if (millis() > readTimeout) {
-                    DEBUG_PGM_PRINTLN("[IBus] dropping packet due to read timeout");
-                    readTimeout = 0;
-                    Serial.remove(1);
-                }
-            }
+        if (packet[PKT_CMD] == 0x3D) {
+            trace(TRACE_RX_SDRS_CMD, packet[4]);
+        } else {
+            trace(TRACE_RX, packet[PKT_CMD]);
         }
-    } // if (bytes_availble  >= 2)
+        
+        PROBE_BEGIN(PROBE_DISPATCH);
+        dispatch_packet(packet);
+        PROBE_END(PROBE_DISPATCH);
+        
+        ibus_serial_release_frame();
+    }
     
     digitalWrite(LED_IBUS_RX, LOW);
+    
+    PROBE_END(PROBE_PROCESS_INCOMING);
 
     return found_message;
 }
@@ -622,10 +929,10 @@ void dispatch_packet(const uint8_t *packet) {
     // are any other packets we should use as a trigger.
     #if WICKED_VERBOSE
         DEBUG_PGM_PRINT("[IBus] got packet from ");
-        DEBUG_PRINTLN(rx_buf[PKT_SRC], HEX);
+        DEBUG_PRINTLN(packet[PKT_SRC], HEX);
     #endif
     
-    if ((packet[PKT_SRC] == RAD_ADDR) && (packet[PKT_DEST] == 0xFF)) {
+    if ((packet[PKT_SRC] == RAD_ADDR) && (packet[PKT_DEST] == BCST_ADDR)) {
         // broadcast from the radio
         
         if (packet[PKT_CMD] == 0x02) {
@@ -647,7 +954,8 @@ void dispatch_packet(const uint8_t *packet) {
         // check the command byte
         if (packet[PKT_CMD] == 0x01) {
             // handle poll request
-            lastPoll = millis();
+            scheduler_schedule(&poll_timeout_action, POLL_TIMEOUT);
+            scroller_note_poll(millis());
             
             DEBUG_PGM_PRINTLN("[IBus] responding to poll request");
             send_sdrs_device_ready();
@@ -707,11 +1015,9 @@ void dispatch_packet(const uint8_t *packet) {
                 handle_buttons(packet[4], packet[5]);
                 
                 // send ACK; <3D 02>
-                update_sdrs_status();
-                
-                delay(100);
+                update_sdrs_status(false);
                 
-                update_sdrs_channel_text();
+                schedule_channel_text(100, true);
             }
             else if (packet[4] == SDRS_CMD_CHAN_DOWN) {
                 // <3D 04>
@@ -720,12 +1026,10 @@ void dispatch_packet(const uint8_t *packet) {
                 handle_buttons(packet[4], packet[5]);
                 
                 // send ACK; <3E 03>
-                send_sdrs_packet(ibus_data("\x3E\x03\x00..\x04"),
-                                 NULL, true, true);
-                
-                delay(100);
+                send_sdrs_packet(sdrs_data("\x3E\x03\x00..\x04", SDRS_PATCH_CHANNEL | SDRS_PATCH_PRESET),
+                                 TX_ACK, NULL);
                 
-                update_sdrs_channel_text();
+                schedule_channel_text(100, true);
             }
             else if (packet[4] == SDRS_CMD_CHAN_UP_HOLD) {
                 // <3D 05>
@@ -746,11 +1050,9 @@ void dispatch_packet(const uint8_t *packet) {
                 handle_buttons(packet[4], packet[5]);
                 
                 // send ACK; <3E 02>
-                update_sdrs_status();
+                update_sdrs_status(false);
                 
-                delay(100);
-                
-                update_sdrs_channel_text();
+                schedule_channel_text(100, true);
             }
             else if (packet[4] == SDRS_CMD_PRESET_HOLD) {
                 // <3D 09>
@@ -760,26 +1062,24 @@ void dispatch_packet(const uint8_t *packet) {
                 
                 // send ACK; <3E 01 01 00 BP> (Band, Preset)
                 // special case of update_sdrs_status
-                send_sdrs_packet(ibus_data("\x3E\x01\x01\x00."),
-                                 NULL, false, true);
+                send_sdrs_packet(sdrs_data("\x3E\x01\x01\x00.", SDRS_PATCH_PRESET),
+                                 TX_ACK, NULL);
             }
             else if (packet[4] == SDRS_CMD_INF1) {
                 // <3D 0E>
                 DEBUG_PGM_PRINTLN("[cmd] first inf press");
                 
                 // send artist
-                send_sdrs_packet(ibus_data("\x3E\x01\x06.\x01\x01"),
-                                 iPodWrapper.getArtist(),
-                                 true, false);
+                send_sdrs_packet(sdrs_data("\x3E\x01\x06.\x01\x01", SDRS_PATCH_CHANNEL),
+                                 TX_TEXT, iPodWrapper.getArtist());
             }
             else if (packet[4] == SDRS_CMD_INF2) {
                 // <3D 0F>
                 DEBUG_PGM_PRINTLN("[cmd] second inf press");
                 
                 // send album name
-                send_sdrs_packet(ibus_data("\x3E\x01\x07.\x01\x01"),
-                                 iPodWrapper.getAlbum(),
-                                 true, false);
+                send_sdrs_packet(sdrs_data("\x3E\x01\x07.\x01\x01", SDRS_PATCH_CHANNEL),
+                                 TX_TEXT, iPodWrapper.getAlbum());
             }
             else if (packet[4] == SDRS_CMD_ESN_REQ) {
                 // <3D 14>
@@ -787,9 +1087,14 @@ void dispatch_packet(const uint8_t *packet) {
                 
                 // 9 chars displayed, max, prefixed on display with "000"
                 // @todo send ipod name?
-                send_sdrs_packet(ibus_data("\x3E\x01\x0C\x30\x30\x30"),
-                                 "forty two",
-                                 false, false);
+                send_sdrs_packet(sdrs_data("\x3E\x01\x0C\x30\x30\x30", 0),
+                                 TX_TEXT, "forty two");
+                
+                #if PROBES
+                    binlog_flush(console);
+                    probe_dump(console);
+                    probe_reset();
+                #endif
             }
             else if (packet[4] == SDRS_CMD_SAT) {
                 // <3D 15>
@@ -802,7 +1107,7 @@ void dispatch_packet(const uint8_t *packet) {
                 
                 // @todo perform some activity
                 
-                update_sdrs_status();
+                update_sdrs_status(false);
             }
             else if (packet[4] == SDRS_CMD_START_SCAN) {
                 // <3D 07>
@@ -812,11 +1117,6 @@ void dispatch_packet(const uint8_t *packet) {
             }
         }
     }
-    #if DEBUG && DEBUG_PACKET_PARSING
-        else if (packet[PKT_SRC] == SDRS_ADDR) {
-            DEBUG_PGM_PRINTLN("[pkt] ignoring packet from myself");
-        }
-    #endif
 }
 // }}}
 
@@ -867,19 +1167,21 @@ void handle_buttons(uint8_t button_id, uint8_t button_data) {
 // }}}
 
 // {{{ send_raw_ibus_packet_P
-void send_raw_ibus_packet_P(PGM_P pgm_data, size_t pgm_data_len) {
+void send_raw_ibus_packet_P(PGM_P pgm_data, size_t pgm_data_len, uint8_t tx_class) {
     for (uint8_t i = 0; i < pgm_data_len; i++) {
         tx_buf[i] = pgm_read_byte(&pgm_data[i]);
     }
     
-    send_raw_ibus_packet(tx_buf, pgm_data_len);
+    send_raw_ibus_packet(tx_buf, pgm_data_len, tx_class);
 }
 // }}}
 
-// {{{ 
-boolean send_raw_ibus_packet(uint8_t *data, size_t data_len) {
-    boolean sent_successfully = false;
-    
+// {{{ send_raw_ibus_packet
+/*
+ * Queues the packet; it goes out from the USART interrupts once the bus is
+ * free (see ibus_serial.cpp).  Returns false if it had to be dropped.
+ */
+boolean send_raw_ibus_packet(uint8_t *data, size_t data_len, uint8_t tx_class) {
     #if DEBUG && DEBUG_PACKET_PARSING
         DEBUG_PGM_PRINT("[pkt] packet to send: ");
         for (int i = 0; i < data_len; i++) {
@@ -890,277 +1192,195 @@ boolean send_raw_ibus_packet(uint8_t *data, size_t data_len) {
     #endif
     
     digitalWrite(LED_IBUS_TX, HIGH);
-    ledOffTime = millis() + 500L;
-    
-    // check for bus contention before sending
-    // 10 retries before failing (which should be *very* generous)
-    for (uint8_t retryCnt = 0; (retryCnt < 10) && (! sent_successfully); retryCnt++) {
-        // wait for line to become clear
-        boolean contention = false;
-        
-        // reset timer2 value
-        TCNT2 = 0;
-        
-        // check that the receive buffer doesn't get any data during the timer cycle
-        while ((TCNT2 < CONTENTION_TIMEOUT) && (! contention)) {
-            if (! (PIND & _BV(0))) { // pin was pulled low, so data being received
-            // if (UCSR0A & _BV(RXC0)) { // unread data in the RX buffer
-                contention = true;
-            }
-        }
-        
-        if (contention) {
-            // someone's sending data; we cannot send
-            digitalWrite(LED_IBUS_RX, HIGH);
-            DEBUG_PGM_PRINT("[IBus] CONTENTION SENDING ");
-            DEBUG_PRINTLN(retryCnt, DEC);
-
-            #if DEBUG && DEBUG_PACKET_PARSING
-                uint8_t bytes_availble = Serial.available();
-                if (bytes_availble) {
-                    DEBUG_PGM_PRINT("[pkt] buf contents: ");
-                    for (int i = 0; i < bytes_availble; i++) {
-                        DEBUG_PRINT(Serial.peek(i), HEX);
-                        DEBUG_PGM_PRINT(" ");
-                    }
-                    DEBUG_PRINTLN();
-                }
-            #endif
-            
-            delay(20 * (retryCnt + 1));
-        }
-        else {
-            digitalWrite(LED_IBUS_RX, LOW);
-        
-            // disableSerialReceive();
-            // Serial.flush();
-        
-            Serial.write(data, data_len);
-
-            // enableSerialReceive();
-
-            #if DEBUG && DEBUG_PACKET_PARSING
-                DEBUG_PGM_PRINTLN("[pkt] done sending");
-            #endif
-
-            sent_successfully = true;
-        }
-    }
+    scheduler_schedule(&led_off_action, 500);
     
-    return sent_successfully;
+    return ibus_serial_send(data, data_len, tx_class);
 }
 // }}}
 
 // {{{ send_sdrs_packet
 /*
     pgm_data is the static part of the message being sent, ie. without any
-    text that may be dynamically generated. It's just a byte (char) array, but
-    terminated with the "special" sequence \xAA\xBB, so that I don't need to
-    manually keep track of the length. This means that none of these PROGMEM
-    strings can have that sequence embedded in them!
+    text that may be dynamically generated; use sdrs_data() to build the
+    first three arguments, and one of the TX_* classes for tx_class.  The
+    packet is assembled directly in tx_buf in a single pass: header, data
+    (with channel, preset and scanning flag patched in), text, then the
+    length byte and checksum.
 */
 void send_sdrs_packet(PGM_P pgm_data,
-                      const char *text,
-                      boolean send_channel,
-                      boolean send_preset)
+                      uint8_t pgm_data_len,
+                      uint8_t flags,
+                      uint8_t tx_class,
+                      const char *text)
 {
-    uint8_t tx_ind;
-    
-    // length of pgm_data
-    size_t pgm_data_len = 0;
-    
-    // add length of text data (the display only shows 8 chars [sometimes]…)
-    size_t text_len = 0;
-
-    // length of text and pgm data
-    size_t data_len; /* = 0 */
-    
-    // determine length of pgm_data
-    while (
-        ! (
-            (pgm_read_byte(&pgm_data[pgm_data_len])     == ((uint8_t) IBUS_DATA_END_MARKER[0])) &&
-            (pgm_read_byte(&pgm_data[pgm_data_len + 1]) == ((uint8_t) IBUS_DATA_END_MARKER[1]))
-        )
-    ) {
-        pgm_data_len += 1;
-    }
-    
-    #if WICKED_VERBOSE
-        DEBUG_PGM_PRINT("pgm_data_len: ");
-        DEBUG_PRINTLN(pgm_data_len, DEC);
-    #endif
+    PROBE_BEGIN(PROBE_SEND_SDRS);
     
-    if (pgm_data_len > TX_BUF_LEN) {
-        DEBUG_PGM_PRINT("pgm_data_len > TX_BUF_LEN");
+    // src, length, dest, data and checksum must fit in tx_buf
+    if ((pgm_data_len + 4) > TX_BUF_LEN) {
+        DEBUG_PGM_PRINTLN("[IBus] pgm_data too long for TX_BUF_LEN");
+        PROBE_END(PROBE_SEND_SDRS);
         return;
     }
     
-    if (text != NULL) {
-        text_len = strlen(text);
-    }
+    tx_buf[PKT_SRC]  = SDRS_ADDR;
+    tx_buf[PKT_DEST] = RAD_ADDR;
     
-    data_len = pgm_data_len + text_len;
-    if (data_len > TX_BUF_LEN) {
-        DEBUG_PGM_PRINT("trimming text to fit with pgm data in TX_BUF_LEN bytes");
-        text_len -= (data_len - (TX_BUF_LEN + 1)); // @todo I suck at index math; do I need the +1?
-
-        data_len = pgm_data_len + text_len;
-    } 
-    
-    #if WICKED_VERBOSE
-        DEBUG_PGM_PRINT("data_len: ");
-        DEBUG_PRINTLN(data_len, DEC);
-    #endif
+    uint8_t checksum = SDRS_ADDR ^ RAD_ADDR;
+    uint8_t tx_ind = PKT_CMD;
     
-    uint8_t *data = (uint8_t *) malloc((size_t) (data_len + 2));
-    if (data == NULL) {
-        DEBUG_PGM_PRINT("[ERROR] Unable to malloc data of length ");
-        DEBUG_PRINTLN(data_len + 2, DEC);
-        return;
-    }
-    
-    #if WICKED_VERBOSE
-        DEBUG_PGM_PRINT("pgm_data: ");
-    #endif
     for (uint8_t i = 0; i < pgm_data_len; i++) {
-        data[i] = pgm_read_byte(&pgm_data[i]);
-        #if WICKED_VERBOSE
-            DEBUG_PRINT(data[i], HEX);
-            DEBUG_PGM_PRINT(" ");
-        #endif
-    }
-    #if WICKED_VERBOSE
-        DEBUG_PRINTLN();
-    #endif
-    
-    // enable scanning flag
-    if (satelliteState.scanning && (data[0] == 0x3E)) {
-        // 0x01 is channel text update, 0x02 is status update
-        // first nibble goes to 1 for these (01 -> 11, 02 -> 12)
-        if ((data[1] == 0x01) || (data[1] == 0x02)) {
-            data[1] |= (1 << 4);
+        uint8_t b = pgm_read_byte(&pgm_data[i]);
+        
+        // fill in the blanks for the channel, preset bank, and preset number
+        if ((i == SDRS_CHANNEL_IND) && (flags & SDRS_PATCH_CHANNEL)) {
+            b = satelliteState.channel;
         }
+        else if ((i == SDRS_PRESET_IND) && (flags & SDRS_PATCH_PRESET)) {
+            b = ((satelliteState.presetBank << 4) | satelliteState.presetNum);
+        }
+        else if ((i == 1) && (flags & SDRS_SCAN_FLAG) && satelliteState.scanning) {
+            // 0x01 is channel text update, 0x02 is status update
+            // first nibble goes to 1 for these (01 -> 11, 02 -> 12)
+            b |= (1 << 4);
+        }
+        
+        tx_buf[tx_ind++] = b;
+        checksum ^= b;
     }
     
-    // fill in the blanks for the channel, preset bank, and preset number
-    if (send_channel) {
-        data[3] = satelliteState.channel;
-    }
-    
-    if (send_preset) {
-        data[4] = ((satelliteState.presetBank << 4) | satelliteState.presetNum);
-    }
-    
-    // append text
+    // append text, trimming it to leave room for the checksum
     if (text != NULL) {
         #if DEBUG && DEBUG_PACKET_PARSING
             DEBUG_PGM_PRINT("text: '");
             DEBUG_PRINT(text);
-            DEBUG_PGM_PRINT("'");
+            DEBUG_PGM_PRINTLN("'");
         #endif
         
-        for (uint8_t i = 0; i < text_len; i++) {
-            data[pgm_data_len + i] = text[i];
-            
-            #if DEBUG && DEBUG_PACKET_PARSING
-                DEBUG_PGM_PRINT(" ");
-                DEBUG_PRINT(data[pgm_data_len + i], HEX);
-            #endif
+        while ((*text != '\0') && (tx_ind < (TX_BUF_LEN - 1))) {
+            tx_buf[tx_ind] = *text++;
+            checksum ^= tx_buf[tx_ind++];
         }
-        #if DEBUG && DEBUG_PACKET_PARSING
-            DEBUG_PRINTLN();
-        #endif
     }
     
-    // add space for dest and checksum bytes
-    size_t packet_len = data_len + 2;
+    // length doesn't include src or length, but does include the checksum
+    tx_buf[PKT_LEN] = tx_ind - 1;
+    checksum ^= tx_buf[PKT_LEN];
+    
+    // checksum goes immediately after the last data byte
+    tx_buf[tx_ind++] = checksum;
+    
     #if WICKED_VERBOSE
         DEBUG_PGM_PRINT("packet_len: ");
-        DEBUG_PRINTLN(packet_len, DEC);
+        DEBUG_PRINTLN(tx_ind, DEC);
     #endif
     
-    // ensure sufficient space in tx buffer
-    // add two more for src and packet_len bytes
-    if ((tx_ind + packet_len + 2) >= TX_BUF_LEN) {
-        #if DEBUG
-            DEBUG_PGM_PRINTLN("[IBus] dropping message because TX buffer is full!");
-            
-            DEBUG_PGM_PRINT("data: ");
-            for (int i = 0; i < data_len; i++) {
-                DEBUG_PRINT((uint8_t) data[i], HEX);
-                DEBUG_PGM_PRINT(" ");
-            }
-            DEBUG_PRINTLN();
-        #endif
-    }
-    else {
-        uint8_t tmp_ind = tx_ind;
-        
-        // copy all data into the tx buffer
-        tx_buf[tx_ind++] = SDRS_ADDR;
-        tx_buf[tx_ind++] = packet_len;
-        tx_buf[tx_ind++] = RAD_ADDR;
-
-        for (size_t i = 0; i < data_len; i++) {
-            tx_buf[tx_ind++] = data[i];
-        }
-
-        // calculate checksum, which goes immediately after the last data byte
-        tx_buf[tx_ind++] = calc_checksum(&tx_buf[tmp_ind], tx_ind - tmp_ind);
-        
-        if (! send_raw_ibus_packet(tx_buf, tx_ind)) {
-            DEBUG_PGM_PRINTLN("[IBus] unable to send after repeated retries");
+    uint8_t slot = display_cache_slot(tx_buf);
+    
+    if (slot != DISPLAY_SLOT_NONE) {
+        if ((flags & SDRS_IF_CHANGED) && display_cache_matches(slot, tx_buf, tx_ind)) {
+            PROBE_END(PROBE_SEND_SDRS);
+            return;
         }
     }
     
-    free(data);
-}
-// }}}
-
-// {{{ calc_checksum
-int calc_checksum(uint8_t *buf, uint8_t buf_len) {
-    int checksum = 0;
-    
-    for (size_t i = 0; i < buf_len; i++) {
-        checksum ^= buf[i];
+    if (! send_raw_ibus_packet(tx_buf, tx_ind, tx_class)) {
+        DEBUG_PGM_PRINTLN("[IBus] TX queue full; packet dropped");
+    }
+    else if (slot != DISPLAY_SLOT_NONE) {
+        display_cache_store(slot, tx_buf, tx_ind);
     }
     
-    return checksum;
+    PROBE_END(PROBE_SEND_SDRS);
 }
 // }}}
 
 // {{{ send_sdrs_device_ready_after_reset
 void send_sdrs_device_ready_after_reset() {
-    send_raw_ibus_packet_P(PSTR("\x73\x04\x68\x02\x01\x1c"), 6);
+    send_raw_ibus_packet_P(ibus_raw_data("\x73\x04\x68\x02\x01\x1c"), TX_ANNOUNCE);
 }
 // }}}
 
 // {{{ send_sdrs_device_ready
 void send_sdrs_device_ready() {
-    send_raw_ibus_packet_P(PSTR("\x73\x04\x68\x02\x00\x1d"), 6);
+    send_raw_ibus_packet_P(ibus_raw_data("\x73\x04\x68\x02\x00\x1d"), TX_ANNOUNCE);
 }
 // }}}
 
 // {{{ update_sdrs_status
-void update_sdrs_status() {
+/*
+ * With if_changed, the status is only sent if it's different from what the
+ * radio last got; otherwise it's an answer the radio's waiting for.
+ */
+void update_sdrs_status(boolean if_changed) {
     DEBUG_PGM_PRINTLN("[IBus] updating status");
     
-    send_sdrs_packet(ibus_data("\x3E\x02\x00..\x04"),
-                     NULL, true, true);
+    send_sdrs_packet(sdrs_data("\x3E\x02\x00..\x04", SDRS_PATCH_CHANNEL | SDRS_PATCH_PRESET | (if_changed ? SDRS_IF_CHANGED : 0)),
+                     TX_STATUS, NULL);
+    
+    note_state_changed();
+}
+// }}}
+
+// {{{ showing_metadata
+// whether the channel text is the track's metadata, rather than the state
+boolean showing_metadata() {
+    return (
+        iPodWrapper.isPresent() &&
+        (iPodPlayState == IPodWrapper::PLAY_STATE_PLAYING) &&
+        iPodWrapper.isAdvancedModeActive()
+    );
+}
+// }}}
+
+// {{{ resume_superseded
+// whether the iPod's got something definite to show in place of the channel
+// text restored after a reset
+boolean resume_superseded() {
+    if (! iPodWrapper.isPresent()) {
+        return true;
+    }
+    
+    if (
+        (iPodPlayState == IPodWrapper::PLAY_STATE_PAUSED) ||
+        (iPodPlayState == IPodWrapper::PLAY_STATE_STOPPED)
+    ) {
+        return true;
+    }
+    
+    return (showing_metadata() && (iPodWrapper.getTitle()[0] != '\0'));
 }
 // }}}
 
 // {{{ update_sdrs_channel_text
-void update_sdrs_channel_text() {
+// if_changed as for update_sdrs_status()
+void update_sdrs_channel_text(boolean if_changed) {
     DEBUG_PGM_PRINTLN("[IBus] updating channel text");
+    
+    if (scheduler_is_pending(&resume_timer)) {
+        if (! resume_superseded()) {
+            // "playing" or "confused" says less than what was restored
+            send_channel_text(if_changed);
+            return;
+        }
+        
+        DEBUG_PGM_PRINTLN("[state] iPod's caught up with the restored state");
+        scheduler_cancel(&resume_timer);
+    }
 
-    if (iPodWrapper.isPresent()) {
+    if (showing_metadata() && scroller_window(channel_text_data)) {
+        // scroll_step() takes it from here
+        if (
+            (satelliteState.status == SDRS_STATUS_ACTIVE) &&
+            scroller_is_scrolling() &&
+            ! scheduler_is_pending(&scroll_action)
+        ) {
+            scheduler_schedule(&scroll_action, scroller_hold_time());
+        }
+    }
+    else if (iPodWrapper.isPresent()) {
         if (iPodPlayState == IPodWrapper::PLAY_STATE_PLAYING) {
-            if (iPodWrapper.isAdvancedModeActive() && (iPodWrapper.getTitle() != NULL)) {
-                strncpy(channel_text_data, iPodWrapper.getTitle(), CHANNEL_TEXT_LENGTH);
-            } else {
-                strncpy_P(channel_text_data, PSTR("playing"), CHANNEL_TEXT_LENGTH);
-            }
+            // no metadata (yet)
+            strncpy_P(channel_text_data, PSTR("playing"), CHANNEL_TEXT_LENGTH);
         }
         else if (iPodPlayState == IPodWrapper::PLAY_STATE_STOPPED) {
             strncpy_P(channel_text_data, PSTR("stopped"), CHANNEL_TEXT_LENGTH);
@@ -1175,8 +1395,16 @@ void update_sdrs_channel_text() {
         strncpy_P(channel_text_data, PSTR("no iPod"), CHANNEL_TEXT_LENGTH);
     }
     
-    send_sdrs_packet(ibus_data("\x3E\x01\x00..\x04"),
-                     channel_text_data, true, true);
+    send_channel_text(if_changed);
+    note_state_changed();
+}
+// }}}
+
+// {{{ send_channel_text
+// sends channel_text_data as it is; if_changed as for update_sdrs_status()
+void send_channel_text(boolean if_changed) {
+    send_sdrs_packet(sdrs_data("\x3E\x01\x00..\x04", SDRS_PATCH_CHANNEL | SDRS_PATCH_PRESET | (if_changed ? SDRS_IF_CHANGED : 0)),
+                     TX_CHANNEL_TEXT, channel_text_data);
 }
 // }}}
 
@@ -1201,19 +1429,24 @@ void set_state_active() {
     // // 1.5 to 2 seconds after 3E 02
     // delay(100);
     
-    update_sdrs_channel_text();
+    // the radio wants this even if it hasn't changed
+    update_sdrs_channel_text(false);
 }
 // }}}
 
 // {{{ set_state_inactive
 void set_state_inactive() {
     DEBUG_PGM_PRINTLN("[IBus] going inactive for mode/power command");
-    send_sdrs_packet(ibus_data("\x3E\x00\x00\x1A\x11\x04"),
-                     NULL, false, false);
+    send_sdrs_packet(sdrs_data("\x3E\x00\x00\x1A\x11\x04", 0),
+                     TX_ACK, NULL);
 
     iPodWrapper.pause();
     
     satelliteState.status = SDRS_STATUS_INACTIVE;
+    note_state_changed();
+    
+    // the radio's showing something else now
+    display_cache_invalidate();
 }
 // }}}
 
@@ -0,0 +1,487 @@
+#include "ibus_serial.h"
+#include "ibus_framer.h"
+#include "trace.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define BAUD 9600
+#include <util/setbaud.h>
+
+/*
+    The IBus receiver runs entirely in the USART RX interrupt.  Each byte is
+    handed to an IBusFramer, which resynchronises in linear time after
+    garbage (see ibus_framer.h).  Valid frames are copied into a queue slot
+    and only become visible to the main loop once the checksum has been
+    verified, so loop() only ever sees finished packets.
+
+    Every byte restarts timer2; when the line goes idle for IBUS_GAP_TICKS
+    the framer is told that nothing else belongs to the current burst,
+    which resolves (and usually rejects) any frame that's been cut short.
+
+    The same idle gap is what lets us talk.  Outgoing frames wait in a
+    small queue; when the gap timer fires and the transmitter's free, the
+    next frame is started and fed to the USART from the UDRE interrupt.
+    When TX complete fires, the gap timer is restarted, so there's always
+    an idle gap between frames and whoever else is waiting gets a chance at
+    the bus.
+
+    IBus is a single wire, so everything we send comes straight back to the
+    receiver.  The RX interrupt compares each byte with what was sent; our
+    own echo is consumed there and never reaches the framer.  A byte that
+    doesn't match (or a gap before the whole echo's come back) means someone
+    else was talking at the same time: the frame's abandoned, and it's sent
+    again after backing off for a few extra idle gaps.
+*/
+
+volatile IBusRxStats ibus_rx_stats;
+volatile IBusTxStats ibus_tx_stats;
+
+static IBusFramer ibus_framer;
+
+// one more slot than can be queued; the handler always has somewhere to write
+#define RX_QUEUE_SLOTS (IBUS_RX_QUEUE_LEN + 1)
+
+static uint8_t rx_queue[RX_QUEUE_SLOTS][IBUS_RX_FRAME_LEN];
+
+// next free slot
+static volatile uint8_t rx_queue_tail;
+
+// oldest complete frame
+static volatile uint8_t rx_queue_head;
+
+// number of complete frames in the queue
+static volatile uint8_t rx_queue_count;
+
+typedef struct __tx_slot {
+    uint8_t len;       // 0 if the slot's free
+    uint8_t tx_class;
+    uint8_t seq;       // tx_seq when the frame was queued
+    uint8_t retries;   // collisions so far
+    uint8_t data[IBUS_TX_FRAME_LEN];
+} TxSlot;
+
+static TxSlot tx_queue[IBUS_TX_QUEUE_LEN];
+
+// frame being sent; NULL when the transmitter's idle
+static TxSlot * volatile tx_current;
+static volatile uint8_t tx_index;
+
+// number of bytes of tx_current that have come back intact
+static volatile uint8_t tx_echo_index;
+
+// idle gaps still to wait out before sending after a collision
+static volatile uint8_t tx_backoff;
+
+// incremented for every frame queued; orders frames of the same urgency
+static uint8_t tx_seq;
+
+// set when the gap timer fires, cleared by every byte received
+static volatile bool bus_idle;
+
+// {{{ restart_gap_timer
+static inline void restart_gap_timer() {
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+}
+// }}}
+
+// {{{ tx_start
+// picks the next frame and starts sending it; interrupts must be disabled
+static void tx_start() {
+    TxSlot *next = NULL;
+
+    for (uint8_t i = 0; i < IBUS_TX_QUEUE_LEN; i++) {
+        TxSlot *slot = &tx_queue[i];
+
+        if (slot->len == 0) {
+            continue;
+        }
+
+        // urgent first, then oldest
+        if (
+            (next == NULL) ||
+            ((slot->tx_class & IBUS_TX_URGENT) > (next->tx_class & IBUS_TX_URGENT)) ||
+            (
+                ((slot->tx_class & IBUS_TX_URGENT) == (next->tx_class & IBUS_TX_URGENT)) &&
+                (((uint8_t) (tx_seq - slot->seq)) > ((uint8_t) (tx_seq - next->seq)))
+            )
+        ) {
+            next = slot;
+        }
+    }
+
+    if (next == NULL) {
+        return;
+    }
+
+    tx_current = next;
+    tx_index = 0;
+    tx_echo_index = 0;
+    bus_idle = false;
+
+    // clear TX complete by writing a 1 to it; it's enabled after the last
+    // byte's been loaded.  FE0, DOR0 and UPE0 must be written as 0, so
+    // only U2X0 is kept.
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+    UCSR0B |= _BV(UDRIE0);
+}
+// }}}
+
+// {{{ rx_frame_handler
+// invoked from the RX (or timer2) ISR for every valid frame
+static void rx_frame_handler(IBusFramer *framer, uint8_t start, uint8_t pkt_len) {
+    if ((pkt_len > IBUS_RX_FRAME_LEN) || (rx_queue_count == IBUS_RX_QUEUE_LEN)) {
+        ibus_rx_stats.queue_overruns += 1;
+        trace(TRACE_RX_OVERRUN, pkt_len);
+        return;
+    }
+
+    framer->copyFrame(start, pkt_len, rx_queue[rx_queue_tail]);
+
+    rx_queue_tail = (rx_queue_tail + 1) % RX_QUEUE_SLOTS;
+    rx_queue_count += 1;
+}
+// }}}
+
+// {{{ tx_abort
+// called with interrupts disabled when tx_current's echo doesn't match
+static void tx_abort() {
+    TxSlot *slot = tx_current;
+
+    // stop loading bytes; whatever's already in the USART still goes out,
+    // but the frame's checksum won't hold up
+    UCSR0B &= ~(_BV(UDRIE0) | _BV(TXCIE0));
+    tx_current = NULL;
+
+    ibus_tx_stats.collisions += 1;
+    trace(TRACE_TX_COLLISION, slot->retries);
+
+    if (slot->retries >= IBUS_TX_MAX_RETRIES) {
+        slot->len = 0;
+        ibus_tx_stats.failed += 1;
+        trace(TRACE_TX_FAILED, slot->data[PKT_CMD]);
+        return;
+    }
+
+    slot->retries += 1;
+    ibus_tx_stats.retries += 1;
+
+    // back off for longer after each collision, plus a little jitter from
+    // the millis() timer so that two senders don't keep colliding
+    tx_backoff = slot->retries + (TCNT0 & 0x03);
+}
+// }}}
+
+// {{{ ibus_serial_init
+void ibus_serial_init() {
+    // timer2 in normal mode at Fcpu/256; used for idle gap detection and
+    // contention detection before sending.
+    //     CS22:1, CS21:1, CS20:0
+    TCCR2A = 0;
+    TCCR2B = _BV(CS22) | _BV(CS21);
+    OCR2A = IBUS_GAP_TICKS;
+    TIMSK2 = 0;
+
+    // 9600,8,E,1
+    UBRR0H = UBRRH_VALUE;
+    UBRR0L = UBRRL_VALUE;
+
+    // written outright: this runs again after power-down, and FE0, DOR0 and
+    // UPE0 (maybe left set by a half-received byte) must be written as 0
+    UCSR0A = USE_2X ? _BV(U2X0) : 0;
+
+    UCSR0C = _BV(UPM01) | _BV(UCSZ01) | _BV(UCSZ00);
+    UCSR0B = _BV(TXEN0);
+
+    tx_current = NULL;
+    tx_backoff = 0;
+    bus_idle = false;
+
+    ibus_framer.setFrameHandler(rx_frame_handler);
+
+    ibus_serial_rx_enable();
+}
+// }}}
+
+// {{{ ibus_serial_clear_filter
+void ibus_serial_clear_filter() {
+    ibus_framer.clearFilter();
+}
+// }}}
+
+// {{{ ibus_serial_accept_source
+void ibus_serial_accept_source(uint8_t addr) {
+    ibus_framer.acceptSource(addr);
+}
+// }}}
+
+// {{{ ibus_serial_accept_destination
+void ibus_serial_accept_destination(uint8_t addr) {
+    ibus_framer.acceptDestination(addr);
+}
+// }}}
+
+// {{{ ibus_serial_rx_disable
+void ibus_serial_rx_disable() {
+    uint8_t sreg = SREG;
+    cli();
+
+    UCSR0B &= ~(_BV(RXEN0) | _BV(RXCIE0));
+    TIMSK2 &= ~_BV(OCIE2A);
+    bus_idle = false;
+
+    // the echo can't be verified any more; whatever was being sent stays
+    // queued and starts over once the receiver's back
+    UCSR0B &= ~(_BV(UDRIE0) | _BV(TXCIE0));
+    tx_current = NULL;
+
+    SREG = sreg;
+
+    // no ISR running now, so it's safe to reset everything
+    ibus_framer.reset();
+    rx_queue_head = rx_queue_tail = rx_queue_count = 0;
+}
+// }}}
+
+// {{{ ibus_serial_rx_enable
+void ibus_serial_rx_enable() {
+    UCSR0B |= _BV(RXEN0) | _BV(RXCIE0);
+
+    // nothing's sent until the bus has been quiet for a full gap
+    uint8_t sreg = SREG;
+    cli();
+    restart_gap_timer();
+    SREG = sreg;
+}
+// }}}
+
+// {{{ ibus_serial_shutdown
+void ibus_serial_shutdown() {
+    ibus_serial_rx_disable();
+
+    // whatever was waiting is stale by the time the bus wakes up again
+    for (uint8_t i = 0; i < IBUS_TX_QUEUE_LEN; i++) {
+        tx_queue[i].len = 0;
+    }
+
+    tx_backoff = 0;
+
+    // receiver, transmitter and their interrupts off; the TX pin goes back
+    // to being an input
+    UCSR0B = 0;
+
+    // timer2 stopped, and no gap left pending
+    TCCR2B = 0;
+    TIMSK2 = 0;
+    TIFR2 = _BV(OCF2A);
+}
+// }}}
+
+// {{{ ibus_serial_peek_frame
+const uint8_t *ibus_serial_peek_frame() {
+    if (rx_queue_count == 0) {
+        return NULL;
+    }
+
+    return rx_queue[rx_queue_head];
+}
+// }}}
+
+// {{{ ibus_serial_release_frame
+void ibus_serial_release_frame() {
+    if (rx_queue_count == 0) {
+        return;
+    }
+
+    rx_queue_head = (rx_queue_head + 1) % RX_QUEUE_SLOTS;
+
+    uint8_t sreg = SREG;
+    cli();
+    rx_queue_count -= 1;
+    SREG = sreg;
+}
+// }}}
+
+// {{{ ibus_serial_send
+bool ibus_serial_send(const uint8_t *data, uint8_t data_len, uint8_t tx_class) {
+    if ((data_len == 0) || (data_len > IBUS_TX_FRAME_LEN)) {
+        ibus_tx_stats.dropped += 1;
+        return false;
+    }
+
+    TxSlot *slot = NULL;
+
+    uint8_t sreg = SREG;
+    cli();
+
+    // a waiting frame of the same kind is superseded; it keeps its place
+    if (tx_class & IBUS_TX_KIND_MASK) {
+        for (uint8_t i = 0; i < IBUS_TX_QUEUE_LEN; i++) {
+            if (
+                (tx_queue[i].len != 0) &&
+                (&tx_queue[i] != tx_current) &&
+                (tx_queue[i].tx_class == tx_class)
+            ) {
+                slot = &tx_queue[i];
+                slot->retries = 0;
+                ibus_tx_stats.coalesced += 1;
+                break;
+            }
+        }
+    }
+
+    if (slot == NULL) {
+        for (uint8_t i = 0; i < IBUS_TX_QUEUE_LEN; i++) {
+            if (tx_queue[i].len == 0) {
+                slot = &tx_queue[i];
+                break;
+            }
+        }
+
+        // an urgent frame bumps the newest non-urgent one that's waiting
+        if ((slot == NULL) && (tx_class & IBUS_TX_URGENT)) {
+            for (uint8_t i = 0; i < IBUS_TX_QUEUE_LEN; i++) {
+                TxSlot *victim = &tx_queue[i];
+
+                if (
+                    (victim != tx_current) &&
+                    (! (victim->tx_class & IBUS_TX_URGENT)) &&
+                    ((slot == NULL) || (((uint8_t) (tx_seq - victim->seq)) < ((uint8_t) (tx_seq - slot->seq))))
+                ) {
+                    slot = victim;
+                }
+            }
+
+            if (slot != NULL) {
+                ibus_tx_stats.dropped += 1;
+                trace(TRACE_TX_DROPPED, slot->data[PKT_CMD]);
+            }
+        }
+
+        if (slot == NULL) {
+            ibus_tx_stats.dropped += 1;
+            trace(TRACE_TX_DROPPED, (data_len > PKT_CMD) ? data[PKT_CMD] : 0);
+            SREG = sreg;
+            return false;
+        }
+
+        slot->seq = tx_seq++;
+        slot->retries = 0;
+    }
+
+    memcpy(slot->data, data, data_len);
+    slot->len = data_len;
+    slot->tx_class = tx_class;
+
+    if (bus_idle && (tx_current == NULL) && (tx_backoff == 0)) {
+        tx_start();
+    }
+
+    SREG = sreg;
+
+    return true;
+}
+// }}}
+
+// {{{ USART RX ISR
+ISR(USART_RX_vect) {
+    // error flags must be read before UDR0
+    uint8_t status = UCSR0A;
+    uint8_t b = UDR0;
+
+    // restart the idle gap timer
+    restart_gap_timer();
+    bus_idle = false;
+
+    TxSlot *slot = tx_current;
+
+    if (slot != NULL) {
+        if (
+            (! (status & (_BV(FE0) | _BV(DOR0) | _BV(UPE0)))) &&
+            (tx_echo_index < tx_index) &&
+            (b == slot->data[tx_echo_index])
+        ) {
+            // our own byte came back intact
+            tx_echo_index += 1;
+
+            if (tx_echo_index == slot->len) {
+                // the whole frame made it onto the bus
+                slot->len = 0;
+                tx_current = NULL;
+                ibus_tx_stats.frames += 1;
+                trace(TRACE_TX, slot->data[PKT_CMD]);
+            }
+
+            return;
+        }
+
+        // someone else is on the bus; what was received is garbage
+        // either way, so let the framer sort it out
+        tx_abort();
+    }
+
+    if (status & (_BV(FE0) | _BV(DOR0) | _BV(UPE0))) {
+        // the byte's garbage, and with an overrun there's at least one
+        // missing; nothing received so far can be combined with what
+        // comes next
+        ibus_rx_stats.line_errors += 1;
+        ibus_framer.gap();
+    } else {
+        ibus_framer.push(b);
+    }
+}
+// }}}
+
+// {{{ timer2 compare ISR
+// the line's been idle for IBUS_GAP_TICKS; the next byte starts a new frame
+ISR(TIMER2_COMPA_vect) {
+    TIMSK2 &= ~_BV(OCIE2A);
+
+    ibus_framer.gap();
+
+    if (tx_current != NULL) {
+        // the line's gone quiet before our whole frame was echoed back
+        tx_abort();
+    }
+
+    bus_idle = true;
+
+    if (tx_backoff > 0) {
+        // wait out another gap
+        tx_backoff -= 1;
+        restart_gap_timer();
+    }
+    else if (tx_current == NULL) {
+        tx_start();
+    }
+}
+// }}}
+
+// {{{ USART data register empty ISR
+ISR(USART_UDRE_vect) {
+    TxSlot *slot = tx_current;
+
+    UDR0 = slot->data[tx_index++];
+
+    if (tx_index == slot->len) {
+        // last byte's loaded; wait for it to be shifted out
+        UCSR0B &= ~_BV(UDRIE0);
+        UCSR0B |= _BV(TXCIE0);
+    }
+}
+// }}}
+
+// {{{ USART TX complete ISR
+ISR(USART_TX_vect) {
+    UCSR0B &= ~_BV(TXCIE0);
+
+    // the last byte's echo is due about now.  If it doesn't show up before
+    // the gap timer fires, the frame's treated as a collision.
+    restart_gap_timer();
+}
+// }}}
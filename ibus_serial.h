@@ -0,0 +1,137 @@
+#ifndef IBUS_SERIAL_H
+#define IBUS_SERIAL_H
+
+#include <stdint.h>
+
+// addresses of IBus devices
+#define RAD_ADDR  0x68
+#define SDRS_ADDR 0x73
+#define BCST_ADDR 0xFF
+
+// static offsets into the packet
+#define PKT_SRC  0
+#define PKT_LEN  1
+#define PKT_DEST 2
+#define PKT_CMD  3
+
+// there may well be a protocol-imposed limit to the max value of a length
+// byte in a packet, but it looks like this is the biggest we'll see in
+// practice.  Use this as a sort of heuristic to determine if the incoming
+// data is valid.
+#define MAX_EXPECTED_LEN 64
+
+// number of complete, validated frames that can be waiting for
+// dispatch_packet()
+#define IBUS_RX_QUEUE_LEN 3
+
+// largest frame (src through checksum) that will be queued.  Everything the
+// radio sends to us is much shorter than this; longer frames are still
+// tracked by length but are dropped instead of queued.
+#define IBUS_RX_FRAME_LEN 24
+
+/*
+timer2 runs at Fcpu/256 (16µs/tick) and is restarted by every received byte.
+One byte at 9600,8,E,1 is 11 bits, or 1.146ms (~72 ticks) from one RX
+complete to the next when bytes are sent back-to-back.  If timer2 gets to
+IBUS_GAP_TICKS (2 byte periods, 2.29ms) without another byte showing up, the
+line's been idle for at least a byte period and any partially-received frame
+is resolved.
+*/
+#define IBUS_GAP_TICKS 143
+
+// number of outgoing frames that can be waiting to be sent, and the largest
+// one (src through checksum)
+#define IBUS_TX_QUEUE_LEN 3
+#define IBUS_TX_FRAME_LEN 32
+
+// number of times a frame is retransmitted after collisions before it's
+// given up on
+#define IBUS_TX_MAX_RETRIES 5
+
+/*
+Outgoing frames have a class: IBUS_TX_URGENT, or'd with a kind from 1 to
+0x7F.  Urgent frames (poll responses, ACKs) go out ahead of everything else;
+otherwise frames go out in the order they were queued.  A frame that's
+still waiting is replaced by a newer one of the same kind (a newer status
+or channel text supersedes the old one), keeping its place in the queue.
+Kind 0 is never replaced.
+*/
+#define IBUS_TX_URGENT    0x80
+#define IBUS_TX_KIND_MASK 0x7F
+
+// framing statistics are kept by the IBusFramer; see ibus_framer.h
+typedef struct __ibus_rx_stats {
+    uint16_t line_errors;     // parity, framing or data overrun in the USART
+    uint16_t queue_overruns;  // valid frame dropped; queue full or too long
+} IBusRxStats;
+
+extern volatile IBusRxStats ibus_rx_stats;
+
+typedef struct __ibus_tx_stats {
+    uint16_t frames;          // frames sent and verified by their echo
+    uint16_t coalesced;       // frames replaced by a newer one of the same kind
+    uint16_t dropped;         // frames that didn't fit in the queue
+    uint16_t collisions;      // echo didn't match, or never came back
+    uint16_t retries;         // retransmissions after a collision
+    uint16_t failed;          // frames given up on after IBUS_TX_MAX_RETRIES
+} IBusTxStats;
+
+extern volatile IBusTxStats ibus_tx_stats;
+
+/*
+ * Configures the USART for 9600,8,E,1 and timer2 for idle gap detection, and
+ * enables the receiver and transmitter.  Must be done before any IBus serial
+ * activity!
+ */
+void ibus_serial_init();
+
+/*
+ * Accept filter for incoming frames; see IBusFramer.  Every valid frame is
+ * queued until the filter's cleared, after which only frames from an
+ * accepted source to an accepted destination are.
+ */
+void ibus_serial_clear_filter();
+void ibus_serial_accept_source(uint8_t addr);
+void ibus_serial_accept_destination(uint8_t addr);
+
+/*
+ * Shuts down the receive circuitry and discards any queued frames.  Nothing
+ * more is sent until the receiver's enabled again, since there's no way to
+ * tell if the bus is free.
+ */
+void ibus_serial_rx_disable();
+
+/*
+ * (Re-)enables the receiver.  Transmission resumes once the bus has been
+ * seen to be idle.
+ */
+void ibus_serial_rx_enable();
+
+/*
+ * Turns the USART and timer2 off altogether, before going to sleep, and
+ * discards everything that's queued either way.  ibus_serial_init() starts
+ * them up again.
+ */
+void ibus_serial_shutdown();
+
+/*
+ * Returns the oldest complete frame, or NULL if there isn't one.  The frame
+ * remains valid until ibus_serial_release_frame() is called.
+ */
+const uint8_t *ibus_serial_peek_frame();
+
+/*
+ * Releases the frame returned by ibus_serial_peek_frame().
+ */
+void ibus_serial_release_frame();
+
+/*
+ * Queues a complete frame (src through checksum) for sending; see
+ * IBUS_TX_URGENT for tx_class.  Never blocks: the frame is copied, and goes
+ * out from the USART interrupts the next time the bus has been idle for
+ * IBUS_GAP_TICKS.  Every byte is checked against its echo, and the frame's
+ * retransmitted if it was garbled.  Returns false if the frame was dropped.
+ */
+bool ibus_serial_send(const uint8_t *data, uint8_t data_len, uint8_t tx_class);
+
+#endif /* end of include guard: IBUS_SERIAL_H */
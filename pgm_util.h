@@ -6,14 +6,17 @@
 
 // ==== [macros] ====
 #if DEBUG
-    /** Prints a message via Serial. **/
-    #define DEBUG_PRINT(...) console->print(__VA_ARGS__)
+    // queued as binary records and sent from loop(); see binlog.h
+    #include "binlog.h"
+
+    /** Prints a message via the console. **/
+    #define DEBUG_PRINT(...) binlog_print(__VA_ARGS__)
     
-    /** Prints a message via Serial, with newline. **/
-    #define DEBUG_PRINTLN(...) console->println(__VA_ARGS__)
+    /** Prints a message via the console, with newline. **/
+    #define DEBUG_PRINTLN(...) binlog_println(__VA_ARGS__)
 
-    #define DEBUG_PGM_PRINT(_msg) pgm_print(console, PSTR(_msg))
-    #define DEBUG_PGM_PRINTLN(_msg) pgm_println(console, PSTR(_msg))
+    #define DEBUG_PGM_PRINT(_msg) binlog_message(PSTR(_msg), false)
+    #define DEBUG_PGM_PRINTLN(_msg) binlog_message(PSTR(_msg), true)
 #else
     // do nothing
     #define DEBUG_PRINT(...)       /**< No-op. **/
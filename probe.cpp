@@ -0,0 +1,98 @@
+#include "probe.h"
+
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "pgm_util.h"
+
+ProbeStats probe_stats[PROBE_COUNT];
+
+// fixed width, so a name's found without a table of PROGMEM pointers
+static const char probe_names[PROBE_COUNT][22] PROGMEM = {
+    "process_incoming_data",
+    "dispatch_packet",
+    "send_sdrs_packet",
+    "IPodWrapper::update",
+};
+
+// {{{ probe_init
+void probe_init() {
+    // normal mode, Fcpu/8; undoes the core's PWM setup
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11);
+
+    probe_reset();
+}
+// }}}
+
+// {{{ probe_reset
+// leaves start alone, so probes that are running when it's called still end
+// properly
+void probe_reset() {
+    for (uint8_t i = 0; i < PROBE_COUNT; i++) {
+        probe_stats[i].min = 0xFFFF;
+        probe_stats[i].max = 0;
+        memset(probe_stats[i].buckets, 0, PROBE_BUCKETS);
+    }
+}
+// }}}
+
+// {{{ probe_record
+void probe_record(uint8_t id, uint16_t ticks) {
+    ProbeStats *p = &probe_stats[id];
+
+    if (ticks < p->min) {
+        p->min = ticks;
+    }
+
+    if (ticks > p->max) {
+        p->max = ticks;
+    }
+
+    uint8_t bucket = 0;
+    ticks >>= PROBE_BUCKET_SHIFT;
+
+    while ((ticks != 0) && (bucket < (PROBE_BUCKETS - 1))) {
+        ticks >>= 1;
+        bucket += 1;
+    }
+
+    if (p->buckets[bucket] == 0xFF) {
+        for (uint8_t i = 0; i < PROBE_BUCKETS; i++) {
+            p->buckets[i] >>= 1;
+        }
+    }
+
+    p->buckets[bucket] += 1;
+}
+// }}}
+
+// {{{ probe_dump
+void probe_dump(Print *out) {
+    for (uint8_t i = 0; i < PROBE_COUNT; i++) {
+        const ProbeStats *p = &probe_stats[i];
+
+        pgm_print(out, PSTR("[probe] "));
+        pgm_print(out, probe_names[i]);
+
+        if (p->min > p->max) {
+            pgm_println(out, PSTR(": never ran"));
+            continue;
+        }
+
+        // ticks are 0.5µs
+        pgm_print(out, PSTR(": min "));
+        out->print(p->min >> 1, DEC);
+        pgm_print(out, PSTR("us, max "));
+        out->print(p->max >> 1, DEC);
+        pgm_print(out, PSTR("us, buckets"));
+
+        for (uint8_t b = 0; b < PROBE_BUCKETS; b++) {
+            pgm_print(out, PSTR(" "));
+            out->print(p->buckets[b], DEC);
+        }
+
+        out->println();
+    }
+}
+// }}}
@@ -0,0 +1,96 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Print.h"
+
+/*
+ * Timing probes for the hot path.  Timer1 free-runs at Fcpu/8 (0.5µs per
+ * tick, wrapping every 32.768ms); PROBE_BEGIN() notes the count and
+ * PROBE_END() adds the difference to the probe's min, max and a histogram
+ * of power-of-two buckets, so a probe costs two 16-bit timer reads and a
+ * few dozen cycles of bookkeeping.  Anything taking longer than a wrap
+ * reads short.
+ *
+ * Probes are compiled in when PROBES is non-zero before this is included
+ * (alongside DEBUG in the sketch), and are nothing at all otherwise.  Timer1
+ * is taken over, so analogWrite() on pins 9 and 10 stops working.
+ */
+
+// the stages that can be timed
+#define PROBE_PROCESS_INCOMING 0 // process_incoming_data()
+#define PROBE_DISPATCH         1 // dispatch_packet()
+#define PROBE_SEND_SDRS        2 // send_sdrs_packet()
+#define PROBE_IPOD_UPDATE      3 // IPodWrapper::update()
+#define PROBE_COUNT            4
+
+/*
+ * Bucket n counts runs shorter than 2^(n + PROBE_BUCKET_SHIFT) ticks; the
+ * last bucket takes everything longer.  With a shift of 7 the buckets are
+ * <64µs, <128µs, … <4ms, and ≥4ms.  Counts are 8 bits; when one would
+ * overflow, all of the probe's buckets are halved, keeping the shape.
+ */
+#define PROBE_BUCKETS      8
+#define PROBE_BUCKET_SHIFT 7
+
+typedef struct __probe_stats {
+    uint16_t start;
+    uint16_t min;
+    uint16_t max;
+    uint8_t buckets[PROBE_BUCKETS];
+} ProbeStats;
+
+extern ProbeStats probe_stats[PROBE_COUNT];
+
+#if PROBES
+    #define PROBE_INIT()     probe_init()
+    #define PROBE_BEGIN(_id) probe_begin(_id)
+    #define PROBE_END(_id)   probe_end(_id)
+#else
+    #define PROBE_INIT()     /**< No-op. **/
+    #define PROBE_BEGIN(_id) /**< No-op. **/
+    #define PROBE_END(_id)   /**< No-op. **/
+#endif
+
+/*
+ * Starts timer1 free-running and clears the statistics.
+ */
+void probe_init();
+
+/*
+ * Clears the statistics.
+ */
+void probe_reset();
+
+/*
+ * Prints min, max and the histogram for each probe, in µs.
+ */
+void probe_dump(Print *out);
+
+void probe_record(uint8_t id, uint16_t ticks);
+
+// {{{ probe_timer
+// TCNT1's read through the shared TEMP register; an interrupt that touches
+// another 16-bit timer1 register mid-read would spoil it
+static inline uint16_t probe_timer() {
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t t = TCNT1;
+
+    SREG = sreg;
+    return t;
+}
+// }}}
+
+static inline void probe_begin(uint8_t id) {
+    probe_stats[id].start = probe_timer();
+}
+
+static inline void probe_end(uint8_t id) {
+    probe_record(id, probe_timer() - probe_stats[id].start);
+}
+
+#endif /* end of include guard: PROBE_H */
@@ -0,0 +1,100 @@
+#include "scheduler.h"
+
+#include <stddef.h>
+#include "WProgram.h"
+
+// earliest deadline first
+static ScheduledAction *queue_head;
+
+// rollover-safe "a is earlier than b"
+#define DEADLINE_BEFORE(_a, _b) (((long) ((_a) - (_b))) < 0)
+
+// {{{ scheduler_init_action
+void scheduler_init_action(ScheduledAction *action, ScheduledCallback_t *callback, void *context) {
+    action->callback = callback;
+    action->context = context;
+    action->next = NULL;
+    action->pending = false;
+}
+// }}}
+
+// {{{ scheduler_schedule
+void scheduler_schedule(ScheduledAction *action, unsigned long delay_ms) {
+    scheduler_cancel(action);
+
+    action->deadline = millis() + delay_ms;
+    action->pending = true;
+
+    // insert after every action due at or before this one, so actions with
+    // the same deadline run in the order they were scheduled
+    ScheduledAction **link = &queue_head;
+
+    while ((*link != NULL) && (! DEADLINE_BEFORE(action->deadline, (*link)->deadline))) {
+        link = &(*link)->next;
+    }
+
+    action->next = *link;
+    *link = action;
+}
+// }}}
+
+// {{{ scheduler_cancel
+void scheduler_cancel(ScheduledAction *action) {
+    if (! action->pending) {
+        return;
+    }
+
+    for (ScheduledAction **link = &queue_head; *link != NULL; link = &(*link)->next) {
+        if (*link == action) {
+            *link = action->next;
+            break;
+        }
+    }
+
+    action->next = NULL;
+    action->pending = false;
+}
+// }}}
+
+// {{{ scheduler_is_pending
+bool scheduler_is_pending(const ScheduledAction *action) {
+    return action->pending;
+}
+// }}}
+
+// {{{ scheduler_time_remaining
+unsigned long scheduler_time_remaining(const ScheduledAction *action) {
+    if (! action->pending) {
+        return 0;
+    }
+
+    unsigned long now = millis();
+
+    if (! DEADLINE_BEFORE(now, action->deadline)) {
+        return 0;
+    }
+
+    return action->deadline - now;
+}
+// }}}
+
+// {{{ scheduler_run
+void scheduler_run() {
+    // an action is due once millis() has moved past its deadline.  Anything
+    // (re-)scheduled by a callback gets a deadline of at least now, so it
+    // can't be picked up again by this loop.
+    unsigned long now = millis();
+
+    while ((queue_head != NULL) && DEADLINE_BEFORE(queue_head->deadline, now)) {
+        ScheduledAction *action = queue_head;
+
+        queue_head = action->next;
+        action->next = NULL;
+        action->pending = false;
+
+        if (action->callback != NULL) {
+            action->callback(action->context);
+        }
+    }
+}
+// }}}
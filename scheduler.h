@@ -0,0 +1,64 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+/*
+ * A deadline queue of deferred actions, run from loop() via scheduler_run().
+ *
+ * Actions are owned by the caller (usually statically allocated) and linked
+ * into the queue in deadline order, so nothing's allocated and scheduling
+ * an action costs one walk of a very short list.  Deadlines are compared by
+ * the signed difference from millis(), so they keep working across the
+ * ~49.7 day rollover as long as no action is scheduled more than ~24 days
+ * out.
+ *
+ * An action with no callback is just a timer: schedule it, and check
+ * scheduler_is_pending() to find out if it's gone off.
+ */
+
+typedef void ScheduledCallback_t(void *context);
+
+typedef struct __scheduled_action {
+    unsigned long deadline;
+    ScheduledCallback_t *callback;
+    void *context;
+    struct __scheduled_action *next;
+    bool pending;
+} ScheduledAction;
+
+/*
+ * Prepares an action for use; callback may be NULL.
+ */
+void scheduler_init_action(ScheduledAction *action, ScheduledCallback_t *callback, void *context);
+
+/*
+ * Runs the action once millis() has passed delay_ms from now.  An action
+ * that's already pending is moved to the new deadline.
+ */
+void scheduler_schedule(ScheduledAction *action, unsigned long delay_ms);
+
+/*
+ * Removes the action from the queue, if it's in it.
+ */
+void scheduler_cancel(ScheduledAction *action);
+
+/*
+ * Returns true if the action's waiting for its deadline.
+ */
+bool scheduler_is_pending(const ScheduledAction *action);
+
+/*
+ * Returns the number of milliseconds until the action's deadline, or 0 if
+ * it isn't pending.
+ */
+unsigned long scheduler_time_remaining(const ScheduledAction *action);
+
+/*
+ * Runs every action whose deadline has passed, earliest first.  Callbacks
+ * may schedule or cancel any action, including their own; anything
+ * scheduled from a callback runs on a later call, never this one.
+ */
+void scheduler_run();
+
+#endif /* end of include guard: SCHEDULER_H */
@@ -0,0 +1,164 @@
+#include "state_snapshot.h"
+
+#include <string.h>
+#include <avr/eeprom.h>
+
+// a slot: sequence number, snapshot, CRC
+#define SLOT_SEQ_IND  0
+#define SLOT_DATA_IND 1
+#define SLOT_CRC_IND  (SLOT_DATA_IND + sizeof(StateSnapshot))
+#define SLOT_USED_LEN (SLOT_CRC_IND + 1)
+
+// fails to compile if a snapshot's outgrown its slot
+typedef char snapshot_fits_slot[(SLOT_USED_LEN <= SNAPSHOT_SLOT_LEN) ? 1 : -1];
+
+// the last snapshot saved, and the slot it's in or going to
+static StateSnapshot saved;
+static bool have_saved;
+static uint8_t saved_seq;
+static uint8_t saved_crc;
+static uint8_t saved_slot;
+
+// how many of the slot's bytes have been written; SLOT_USED_LEN when
+// there's nothing left to do
+static uint8_t write_step = SLOT_USED_LEN;
+
+// {{{ slot_crc
+// CRC-8 (x^8 + x^2 + x + 1) over the sequence number and snapshot, started
+// from the version so an erased slot (all 0xFF) doesn't pass
+static uint8_t slot_crc(uint8_t seq, const StateSnapshot *snapshot) {
+    const uint8_t *p = (const uint8_t *) snapshot;
+    uint8_t crc = SNAPSHOT_VERSION;
+
+    for (uint8_t i = 0; i < (sizeof(StateSnapshot) + 1); i++) {
+        crc ^= (i == 0) ? seq : p[i - 1];
+
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+// }}}
+
+// {{{ slot_addr
+static uint8_t *slot_addr(uint8_t slot) {
+    return (uint8_t *) (uintptr_t) (SNAPSHOT_EEPROM_ADDR + (slot * SNAPSHOT_SLOT_LEN));
+}
+// }}}
+
+// {{{ snapshot_restore
+bool snapshot_restore(StateSnapshot *snapshot) {
+    have_saved = false;
+    write_step = SLOT_USED_LEN;
+
+    // the first save goes in slot 0 if nothing's found
+    saved_slot = SNAPSHOT_SLOTS - 1;
+    saved_seq = 0xFF;
+
+    for (uint8_t slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        uint8_t buf[SLOT_USED_LEN];
+
+        eeprom_read_block(buf, slot_addr(slot), sizeof(buf));
+
+        StateSnapshot candidate;
+        memcpy(&candidate, &buf[SLOT_DATA_IND], sizeof(candidate));
+
+        uint8_t seq = buf[SLOT_SEQ_IND];
+
+        if (buf[SLOT_CRC_IND] != slot_crc(seq, &candidate)) {
+            continue;
+        }
+
+        // the good slots are never more than SNAPSHOT_SLOTS apart, so the
+        // sequence number can wrap
+        if (have_saved && ((int8_t) (seq - saved_seq) <= 0)) {
+            continue;
+        }
+
+        memcpy(&saved, &candidate, sizeof(saved));
+        have_saved = true;
+        saved_seq = seq;
+        saved_crc = buf[SLOT_CRC_IND];
+        saved_slot = slot;
+    }
+
+    if (have_saved) {
+        memcpy(snapshot, &saved, sizeof(saved));
+    }
+
+    return have_saved;
+}
+// }}}
+
+// {{{ snapshot_save
+void snapshot_save(const StateSnapshot *snapshot) {
+    if (have_saved && (memcmp(snapshot, &saved, sizeof(saved)) == 0)) {
+        return;
+    }
+
+    // a slot that's still being written hasn't got its sequence number
+    // yet, so it's no loss; start it again with this one
+    if (write_step == SLOT_USED_LEN) {
+        saved_slot = (saved_slot + 1) % SNAPSHOT_SLOTS;
+        saved_seq += 1;
+    }
+
+    memcpy(&saved, snapshot, sizeof(saved));
+    have_saved = true;
+    saved_crc = slot_crc(saved_seq, &saved);
+
+    write_step = 0;
+}
+// }}}
+
+// {{{ write_next
+// writes the next byte that isn't already right; the sequence number goes
+// last
+static void write_next() {
+    while (write_step < SLOT_USED_LEN) {
+        uint8_t ind = (write_step < (SLOT_USED_LEN - 1)) ? (write_step + 1) : SLOT_SEQ_IND;
+        uint8_t value;
+
+        if (ind == SLOT_SEQ_IND) {
+            value = saved_seq;
+        } else if (ind == SLOT_CRC_IND) {
+            value = saved_crc;
+        } else {
+            value = ((const uint8_t *) &saved)[ind - SLOT_DATA_IND];
+        }
+
+        uint8_t *addr = slot_addr(saved_slot) + ind;
+        write_step += 1;
+
+        if (eeprom_read_byte(addr) != value) {
+            eeprom_write_byte(addr, value);
+            return;
+        }
+    }
+}
+// }}}
+
+// {{{ snapshot_poll
+bool snapshot_poll() {
+    if (write_step == SLOT_USED_LEN) {
+        return false;
+    }
+
+    if (eeprom_is_ready()) {
+        write_next();
+    }
+
+    return (write_step < SLOT_USED_LEN);
+}
+// }}}
+
+// {{{ snapshot_flush
+void snapshot_flush() {
+    // eeprom_write_byte() waits for the one before
+    while (write_step < SLOT_USED_LEN) {
+        write_next();
+    }
+}
+// }}}
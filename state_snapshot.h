@@ -0,0 +1,72 @@
+#ifndef STATE_SNAPSHOT_H
+#define STATE_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "trace.h"
+
+/*
+ * What the radio was last shown, kept in EEPROM so that after a reset
+ * (watchdog, brown-out, or the power going away) it can be shown again
+ * straight away, instead of "no iPod" until the iPod's been found, switched
+ * to advanced mode and asked for everything again.
+ *
+ * Snapshots go round a ring of SNAPSHOT_SLOTS slots, so each one is worn
+ * 1/SNAPSHOT_SLOTS as fast.  A slot is a sequence number, the snapshot and
+ * a CRC over both; the good slot with the latest sequence number is the
+ * one that counts.  The sequence number's written last, so a slot that was
+ * only partly written when the power went fails its CRC and the one before
+ * it's used.
+ *
+ * A byte takes ~3.4ms to write, so a snapshot isn't written all at once:
+ * snapshot_poll() writes the next byte whenever the EEPROM's finished with
+ * the last, and bytes that already hold the right value are skipped.
+ */
+
+#define SNAPSHOT_EEPROM_ADDR 0x000
+#define SNAPSHOT_SLOTS       16
+#define SNAPSHOT_SLOT_LEN    20
+
+// change when StateSnapshot does, so old slots are ignored
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_TEXT_LEN 8
+
+#if (SNAPSHOT_EEPROM_ADDR + (SNAPSHOT_SLOTS * SNAPSHOT_SLOT_LEN)) > TRACE_EEPROM_ADDR
+    #error "snapshot slots overlap the trace snapshot"
+#endif
+
+// packed, so it's laid out in EEPROM the same on the host
+typedef struct __attribute__((packed)) __state_snapshot {
+    uint8_t channel;
+    uint8_t preset_bank;
+    uint8_t preset_num;
+    uint8_t sdrs_status;       // SDRSStatusEnum
+    uint8_t ipod_mode;         // IPodWrapper::IPodMode
+    uint32_t playlist_position;
+    char text[SNAPSHOT_TEXT_LEN]; // not terminated if it's the full length
+} StateSnapshot;
+
+/*
+ * Call once from setup(), before anything's saved.  Fills in snapshot and
+ * returns true if there's a good one in EEPROM.
+ */
+bool snapshot_restore(StateSnapshot *snapshot);
+
+/*
+ * Starts writing the snapshot to the next slot, unless it's the same as
+ * the last one saved.  A snapshot that's still being written is abandoned
+ * for the new one.
+ */
+void snapshot_save(const StateSnapshot *snapshot);
+
+/*
+ * Call on every pass through loop(); writes a byte if one's waiting and
+ * the EEPROM's ready for it.  Returns true while there's more to write.
+ */
+bool snapshot_poll();
+
+// finishes writing, waiting for the EEPROM as long as it takes
+void snapshot_flush();
+
+#endif /* end of include guard: STATE_SNAPSHOT_H */
@@ -0,0 +1,231 @@
+#include "text_scroller.h"
+
+#include <string.h>
+
+#include "utf8_util.h"
+
+// continuation bytes look like 10xxxxxx
+#define IS_UTF8_CONTINUATION(_c) ((((unsigned char) (_c)) & 0xC0) == 0x80)
+
+static ScrollTextSource_t *text_source;
+
+// where each field's windows start; window_count is 0 for an empty field
+static uint8_t window_starts[SCROLL_FIELD_COUNT][SCROLL_MAX_WINDOWS];
+static uint8_t window_count[SCROLL_FIELD_COUNT];
+
+// what's showing now
+static uint8_t current_field;
+static uint8_t current_window;
+
+// when the radio last polled, and how often it does; 0 until it's been
+// seen twice
+static unsigned long last_poll;
+static unsigned long poll_period;
+
+// {{{ scroller_init
+void scroller_init(ScrollTextSource_t *source) {
+    text_source = source;
+
+    memset(window_count, 0, sizeof(window_count));
+    current_field = 0;
+    current_window = 0;
+
+    last_poll = 0;
+    poll_period = 0;
+}
+// }}}
+
+// {{{ next_window_start
+/*
+ * Returns where the window after the one starting at start should begin:
+ * at the first word that isn't entirely in this one, or right after it if
+ * that word's too long to show whole.
+ */
+static uint8_t next_window_start(const char *text, uint8_t start) {
+    uint8_t next = start + SCROLL_WIDTH;
+
+    // a word that ends right at the edge has been shown whole; otherwise
+    // back up to the start of the one that's cut off
+    if ((text[next] != ' ') && (text[next] != '\0')) {
+        while ((next > start) && (text[next - 1] != ' ')) {
+            next -= 1;
+        }
+
+        if (next == start) {
+            // one long word; cut it, but not in the middle of a character
+            next = start + SCROLL_WIDTH;
+
+            while ((next > (start + 1)) && IS_UTF8_CONTINUATION(text[next])) {
+                next -= 1;
+            }
+        }
+    }
+
+    while (text[next] == ' ') {
+        next += 1;
+    }
+
+    return next;
+}
+// }}}
+
+// {{{ scroller_load
+void scroller_load(uint8_t field) {
+    const char *text = text_source(field);
+    size_t len = strlen(text);
+    uint8_t *starts = window_starts[field];
+    uint8_t count = 0;
+
+    if (len > 0xFF) {
+        len = 0xFF;
+    }
+
+    uint8_t start = 0;
+
+    while ((start < len) && (count < SCROLL_MAX_WINDOWS)) {
+        starts[count++] = start;
+
+        if ((len - start) <= SCROLL_WIDTH) {
+            break;
+        }
+
+        if (count == (SCROLL_MAX_WINDOWS - 1)) {
+            // out of windows; the last one shows the end
+            start = len - SCROLL_WIDTH;
+
+            while (IS_UTF8_CONTINUATION(text[start])) {
+                start += 1;
+            }
+        } else {
+            start = next_window_start(text, start);
+        }
+    }
+
+    window_count[field] = count;
+
+    if (current_field == field) {
+        current_window = 0;
+    }
+}
+// }}}
+
+// {{{ scroller_restart
+void scroller_restart() {
+    current_field = SCROLL_FIELD_TITLE;
+    current_window = 0;
+
+    #if SCROLL_ALL_FIELDS
+        while ((current_field < (SCROLL_FIELD_COUNT - 1)) && (window_count[current_field] == 0)) {
+            current_field += 1;
+        }
+    #endif
+}
+// }}}
+
+// {{{ scroller_is_scrolling
+bool scroller_is_scrolling() {
+    #if SCROLL_ALL_FIELDS
+        uint8_t total = 0;
+
+        for (uint8_t i = 0; i < SCROLL_FIELD_COUNT; i++) {
+            total += window_count[i];
+        }
+
+        return (total > 1);
+    #else
+        return (window_count[SCROLL_FIELD_TITLE] > 1);
+    #endif
+}
+// }}}
+
+// {{{ scroller_window
+bool scroller_window(char *dest) {
+    dest[0] = '\0';
+
+    if (current_window >= window_count[current_field]) {
+        return false;
+    }
+
+    const char *text = text_source(current_field);
+    uint8_t start = window_starts[current_field][current_window];
+
+    // the text changed without being reloaded; don't run off its end
+    if (start >= strlen(text)) {
+        return false;
+    }
+
+    utf8_strlcpy(dest, &text[start], SCROLL_WIDTH + 1);
+    return true;
+}
+// }}}
+
+// {{{ scroller_advance
+void scroller_advance() {
+    current_window += 1;
+
+    if (current_window < window_count[current_field]) {
+        return;
+    }
+
+    current_window = 0;
+
+    #if SCROLL_ALL_FIELDS
+        // on to the next field with any text, maybe this one again
+        for (uint8_t i = 0; i < SCROLL_FIELD_COUNT; i++) {
+            current_field = (current_field + 1) % SCROLL_FIELD_COUNT;
+
+            if (window_count[current_field] != 0) {
+                break;
+            }
+        }
+    #endif
+}
+// }}}
+
+// {{{ scroller_hold_time
+unsigned long scroller_hold_time() {
+    unsigned long hold = SCROLL_STEP_MS;
+
+    if (current_window == 0) {
+        hold += SCROLL_PAUSE_MS;
+    }
+
+    if ((current_window + 1) >= window_count[current_field]) {
+        hold += SCROLL_PAUSE_MS;
+    }
+
+    return (hold > SCROLL_MIN_INTERVAL) ? hold : SCROLL_MIN_INTERVAL;
+}
+// }}}
+
+// {{{ scroller_note_poll
+void scroller_note_poll(unsigned long now) {
+    if (last_poll != 0) {
+        unsigned long period = now - last_poll;
+
+        if ((period >= SCROLL_POLL_PERIOD_MIN) && (period <= SCROLL_POLL_PERIOD_MAX)) {
+            poll_period = period;
+        }
+    }
+
+    last_poll = now;
+}
+// }}}
+
+// {{{ scroller_poll_wait
+unsigned long scroller_poll_wait(unsigned long now) {
+    if (poll_period == 0) {
+        return 0;
+    }
+
+    unsigned long since = now - last_poll;
+
+    // from just before the poll's due until just after; once it's come,
+    // last_poll moves on.  If it doesn't come at all, give up waiting.
+    if (((since + SCROLL_POLL_GUARD) >= poll_period) && (since < (poll_period + SCROLL_POLL_GUARD))) {
+        return (poll_period + SCROLL_POLL_GUARD) - since;
+    }
+
+    return 0;
+}
+// }}}
@@ -0,0 +1,108 @@
+#ifndef TEXT_SCROLLER_H
+#define TEXT_SCROLLER_H
+
+#include <stdint.h>
+
+/*
+ * Scrolls the title through the radio's 8-character channel text; with
+ * SCROLL_ALL_FIELDS, the artist and album are shown after it, one after
+ * the other.
+ *
+ * When a field changes, the windows it'll be shown in are worked out once
+ * and kept as a list of start offsets: each window starts at a word where
+ * possible, so words aren't chopped in half unless they're longer than the
+ * display.  Each step after that is a copy of at most SCROLL_WIDTH bytes,
+ * and nothing's allocated.  The text itself isn't copied; it's fetched from
+ * the ScrollTextSource_t each time, so a field must be reloaded whenever its
+ * text changes.
+ *
+ * Steps are spaced so scrolling never uses more than SCROLL_BUS_BUDGET of
+ * the bus, and are held off around the time the radio's next poll is due so
+ * a scroll frame's never on the wire when the poll response needs to go
+ * out.  Scroll frames should be sent with a non-urgent class, so poll
+ * responses and ACKs go ahead of them in the TX queue.
+ */
+
+#define SCROLL_WIDTH 8
+
+// fields, in the order they're shown
+#define SCROLL_FIELD_TITLE  0
+#define SCROLL_FIELD_ARTIST 1
+#define SCROLL_FIELD_ALBUM  2
+#define SCROLL_FIELD_COUNT  3
+
+// 1 to show the artist and album after the title, over and over even
+// when the title fits; with 0 only the title's shown, and a title that
+// fits stays put.  INF shows the artist and album either way.
+#define SCROLL_ALL_FIELDS 0
+
+// windows per field; a field that needs more jumps straight to its end
+#define SCROLL_MAX_WINDOWS 8
+
+// time each window's shown, and the extra time at the start and end of
+// each field (0 for none)
+#define SCROLL_STEP_MS  1000L
+#define SCROLL_PAUSE_MS 1500L
+
+// bytes per second of bus time scrolling can use; a channel text frame is
+// SCROLL_WIDTH + 10 bytes (~1.15ms each at 9600 8E1)
+#define SCROLL_BUS_BUDGET 24
+#define SCROLL_MIN_INTERVAL (((SCROLL_WIDTH + 10) * 1000L) / SCROLL_BUS_BUDGET)
+
+// no scroll frames this long either side of when the next poll's due
+#define SCROLL_POLL_GUARD 50L
+
+// the radio polls every 10s; anything far from that isn't a poll period
+#define SCROLL_POLL_PERIOD_MIN 2000L
+#define SCROLL_POLL_PERIOD_MAX 30000L
+
+typedef const char *ScrollTextSource_t(uint8_t field);
+
+void scroller_init(ScrollTextSource_t *source);
+
+/*
+ * Works out the windows for a field's current text.
+ */
+void scroller_load(uint8_t field);
+
+/*
+ * Goes back to the first window of the title, or with SCROLL_ALL_FIELDS of
+ * the first field that has any text.
+ */
+void scroller_restart();
+
+/*
+ * Returns true if there's more than one window to show.
+ */
+bool scroller_is_scrolling();
+
+/*
+ * Copies the current window into dest, which must hold SCROLL_WIDTH + 1
+ * bytes.  Returns false (and leaves dest empty) if there's no text at all.
+ */
+bool scroller_window(char *dest);
+
+/*
+ * Moves on to the next window, wrapping around to the title's first (or
+ * with SCROLL_ALL_FIELDS, the next field's) after its last.
+ */
+void scroller_advance();
+
+/*
+ * Returns how long the current window should be shown, including any pause
+ * and the bus budget.
+ */
+unsigned long scroller_hold_time();
+
+/*
+ * Call with millis() whenever the radio polls us.
+ */
+void scroller_note_poll(unsigned long now);
+
+/*
+ * Returns how long to wait before sending a scroll frame because a poll's
+ * due, or 0 if it can go now.
+ */
+unsigned long scroller_poll_wait(unsigned long now);
+
+#endif /* end of include guard: TEXT_SCROLLER_H */
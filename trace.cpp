@@ -0,0 +1,71 @@
+#include "trace.h"
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "WProgram.h"
+#include "pgm_util.h"
+
+// not touched by the C runtime's startup code, so it survives a reset
+TraceBuffer trace_buffer __attribute__((section(".noinit")));
+
+// {{{ trace_init
+void trace_init(uint8_t mcusr) {
+    if (
+        (mcusr & _BV(PORF)) ||
+        (trace_buffer.magic != TRACE_MAGIC) ||
+        (trace_buffer.head >= TRACE_LEN)
+    ) {
+        // RAM's garbage after power-on
+        memset(&trace_buffer, 0, sizeof(trace_buffer));
+        trace_buffer.magic = TRACE_MAGIC;
+    }
+    #if TRACE_EEPROM_SNAPSHOT
+        else if (mcusr & _BV(WDRF)) {
+            eeprom_write_block(&trace_buffer, (void *) TRACE_EEPROM_ADDR, sizeof(trace_buffer));
+        }
+    #endif
+
+    trace(TRACE_BOOT, mcusr);
+}
+// }}}
+
+// {{{ trace
+void trace(uint8_t type, uint8_t detail) {
+    uint16_t ms = (uint16_t) millis();
+
+    // claim a slot; an interrupt handler tracing in the meantime gets the
+    // next one
+    uint8_t sreg = SREG;
+    cli();
+
+    TraceEvent *event = &trace_buffer.events[trace_buffer.head];
+    trace_buffer.head = (trace_buffer.head + 1) & (TRACE_LEN - 1);
+
+    SREG = sreg;
+
+    event->ms = ms;
+    event->type = type;
+    event->detail = detail;
+}
+// }}}
+
+// {{{ trace_dump
+void trace_dump(Print *out) {
+    const uint8_t *p = (const uint8_t *) &trace_buffer;
+
+    pgm_print(out, PSTR("[trace] "));
+
+    for (uint8_t i = 0; i < sizeof(trace_buffer); i++) {
+        if (p[i] < 0x10) {
+            out->print('0');
+        }
+
+        out->print(p[i], HEX);
+    }
+
+    out->println();
+}
+// }}}
@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "Print.h"
+
+/*
+ * A post-mortem event trace: the last TRACE_LEN events, in a ring that
+ * lives in .noinit RAM so it's still there after a watchdog (or external)
+ * reset.  trace_init() works out whether the previous run's events are
+ * intact and marks the new boot; util/trace_decode.py turns a dump of the
+ * buffer into a timeline.
+ *
+ * An event is 4 bytes: the low 16 bits of millis(), a type and one byte of
+ * detail.  Recording one is safe from interrupt handlers and costs a call
+ * to millis() and a few stores.
+ *
+ * After a watchdog reset the buffer's also copied to EEPROM at
+ * TRACE_EEPROM_ADDR, where it survives a power cycle too; read it back
+ * with avrdude and hand the image to the decoder.
+ */
+
+// must be a power of 2
+#define TRACE_LEN 16
+
+#define TRACE_MAGIC 0xA5
+
+// snapshot of the buffer after a watchdog reset; 0 to turn it off
+#define TRACE_EEPROM_SNAPSHOT 1
+#define TRACE_EEPROM_ADDR     0x180
+
+/*
+ * Event types.  util/trace_decode.py reads these definitions, comments and
+ * all, so keep them one to a line.
+ */
+#define TRACE_BOOT          0x01 // reset; detail is MCUSR
+#define TRACE_RX            0x02 // frame from the radio; detail is its command
+#define TRACE_RX_SDRS_CMD   0x03 // SDRS command (3D) from the radio; detail is the command
+#define TRACE_RX_OVERRUN    0x04 // valid frame dropped; detail is its length
+#define TRACE_TX            0x05 // frame sent and verified; detail is its command
+#define TRACE_TX_COLLISION  0x06 // echo didn't match; detail is retries so far
+#define TRACE_TX_FAILED     0x07 // frame given up on; detail is its command
+#define TRACE_TX_DROPPED    0x08 // frame didn't fit in the TX queue; detail is its command
+#define TRACE_BUS_INHIBIT   0x09 // bus went to sleep (1) or woke up (0)
+#define TRACE_POLL_TIMEOUT  0x0A // radio hasn't polled us in POLL_TIMEOUT
+#define TRACE_IPOD_MODE     0x0B // iPod mode changed; detail is the IPodMode
+#define TRACE_IPOD_EXPIRED  0x0C // advanced mode keep-alive missed; detail is 1 when given up on
+#define TRACE_META_TIMEOUT  0x0D // metadata responses didn't come; detail is requests outstanding
+#define TRACE_POWER_DOWN    0x0E // MCU powered down (1) or woke up (0)
+#define TRACE_RESUMED       0x0F // state restored from the EEPROM snapshot; detail is the channel
+#define TRACE_IPOD_ATTACH   0x10 // direct attach to advanced mode gave up; detail is probes sent
+#define TRACE_IPOD_GONE     0x11 // RX line went low; detail is ms it was low for (max 255)
+
+typedef struct __trace_event {
+    uint16_t ms;
+    uint8_t type;
+    uint8_t detail;
+} TraceEvent;
+
+typedef struct __trace_buffer {
+    uint8_t magic;                 // TRACE_MAGIC if the contents are good
+    uint8_t head;                  // next slot to be written
+    TraceEvent events[TRACE_LEN];
+} TraceBuffer;
+
+extern TraceBuffer trace_buffer;
+
+/*
+ * Call once from setup() with the reset cause (MCUSR, as saved in .init3).
+ * Events from before the reset are kept unless it was a power-on reset or
+ * the buffer's damaged, a snapshot is saved to EEPROM after a watchdog
+ * reset, and a TRACE_BOOT event is recorded.
+ */
+void trace_init(uint8_t mcusr);
+
+void trace(uint8_t type, uint8_t detail);
+
+/*
+ * Prints the whole buffer, as hex, on a line starting with "[trace] ".
+ */
+void trace_dump(Print *out);
+
+#endif /* end of include guard: TRACE_H */
@@ -0,0 +1,265 @@
+#include "translit.h"
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// table entries that aren't a character
+#define DROP   0x00 // nothing shown; combining accents, soft hyphens
+#define EXPAND 0x01 // more than one character; see expansions
+
+// returned by next_codepoint() for malformed UTF-8 and anything past the
+// Basic Multilingual Plane
+#define BAD_CODEPOINT 0xFFFF
+
+// {{{ latin
+// U+00A0 to U+017F: Latin-1 Supplement and Latin Extended-A
+#define LATIN_FIRST 0x00A0
+#define LATIN_LAST  0x017F
+
+static const char latin[] PROGMEM = {
+    // U+00A0   ¡    ¢    £    ¤    ¥    ¦    §    ¨    ©    ª    «    ¬   shy   ®    ¯
+        ' ', '!', 'c', 'L', '?', 'Y', '|', 'S', '"', 'c', 'a', '"', '-', DROP,'R', '-',
+    // U+00B0 °    ±    ²    ³    ´    µ    ¶    ·    ¸    ¹    º    »    ¼    ½    ¾    ¿
+        'o', '+', '2', '3', '\'','u', 'P', '.', ',', '1', 'o', '"', EXPAND, EXPAND, EXPAND, '?',
+    // U+00C0 À    Á    Â    Ã    Ä    Å    Æ    Ç    È    É    Ê    Ë    Ì    Í    Î    Ï
+        'A', 'A', 'A', 'A', 'A', 'A', EXPAND, 'C', 'E', 'E', 'E', 'E', 'I', 'I', 'I', 'I',
+    // U+00D0 Ð    Ñ    Ò    Ó    Ô    Õ    Ö    ×    Ø    Ù    Ú    Û    Ü    Ý    Þ    ß
+        'D', 'N', 'O', 'O', 'O', 'O', 'O', 'x', 'O', 'U', 'U', 'U', 'U', 'Y', EXPAND, EXPAND,
+    // U+00E0 à    á    â    ã    ä    å    æ    ç    è    é    ê    ë    ì    í    î    ï
+        'a', 'a', 'a', 'a', 'a', 'a', EXPAND, 'c', 'e', 'e', 'e', 'e', 'i', 'i', 'i', 'i',
+    // U+00F0 ð    ñ    ò    ó    ô    õ    ö    ÷    ø    ù    ú    û    ü    ý    þ    ÿ
+        'd', 'n', 'o', 'o', 'o', 'o', 'o', '/', 'o', 'u', 'u', 'u', 'u', 'y', EXPAND, 'y',
+    // U+0100 Ā    ā    Ă    ă    Ą    ą    Ć    ć    Ĉ    ĉ    Ċ    ċ    Č    č    Ď    ď
+        'A', 'a', 'A', 'a', 'A', 'a', 'C', 'c', 'C', 'c', 'C', 'c', 'C', 'c', 'D', 'd',
+    // U+0110 Đ    đ    Ē    ē    Ĕ    ĕ    Ė    ė    Ę    ę    Ě    ě    Ĝ    ĝ    Ğ    ğ
+        'D', 'd', 'E', 'e', 'E', 'e', 'E', 'e', 'E', 'e', 'E', 'e', 'G', 'g', 'G', 'g',
+    // U+0120 Ġ    ġ    Ģ    ģ    Ĥ    ĥ    Ħ    ħ    Ĩ    ĩ    Ī    ī    Ĭ    ĭ    Į    į
+        'G', 'g', 'G', 'g', 'H', 'h', 'H', 'h', 'I', 'i', 'I', 'i', 'I', 'i', 'I', 'i',
+    // U+0130 İ    ı    Ĳ    ĳ    Ĵ    ĵ    Ķ    ķ    ĸ    Ĺ    ĺ    Ļ    ļ    Ľ    ľ    Ŀ
+        'I', 'i', EXPAND, EXPAND, 'J', 'j', 'K', 'k', 'k', 'L', 'l', 'L', 'l', 'L', 'l', 'L',
+    // U+0140 ŀ    Ł    ł    Ń    ń    Ņ    ņ    Ň    ň    ŉ    Ŋ    ŋ    Ō    ō    Ŏ    ŏ
+        'l', 'L', 'l', 'N', 'n', 'N', 'n', 'N', 'n', 'n', 'N', 'n', 'O', 'o', 'O', 'o',
+    // U+0150 Ő    ő    Œ    œ    Ŕ    ŕ    Ŗ    ŗ    Ř    ř    Ś    ś    Ŝ    ŝ    Ş    ş
+        'O', 'o', EXPAND, EXPAND, 'R', 'r', 'R', 'r', 'R', 'r', 'S', 's', 'S', 's', 'S', 's',
+    // U+0160 Š    š    Ţ    ţ    Ť    ť    Ŧ    ŧ    Ũ    ũ    Ū    ū    Ŭ    ŭ    Ů    ů
+        'S', 's', 'T', 't', 'T', 't', 'T', 't', 'U', 'u', 'U', 'u', 'U', 'u', 'U', 'u',
+    // U+0170 Ű    ű    Ų    ų    Ŵ    ŵ    Ŷ    ŷ    Ÿ    Ź    ź    Ż    ż    Ž    ž    ſ
+        'U', 'u', 'U', 'u', 'W', 'w', 'Y', 'y', 'Y', 'Z', 'z', 'Z', 'z', 'Z', 'z', 's',
+};
+// }}}
+
+// {{{ punctuation
+// anything outside the latin table that has a stand-in, in order
+typedef struct __translit_char {
+    uint16_t codepoint;
+    char c;
+} TranslitChar;
+
+static const TranslitChar punctuation[] PROGMEM = {
+    {0x200B, DROP},   // zero width space
+    {0x200C, DROP},   // zero width non-joiner
+    {0x200D, DROP},   // zero width joiner
+    {0x200E, DROP},   // left-to-right mark
+    {0x200F, DROP},   // right-to-left mark
+    {0x2010, '-'},    // hyphen
+    {0x2011, '-'},    // non-breaking hyphen
+    {0x2012, '-'},    // figure dash
+    {0x2013, '-'},    // en dash
+    {0x2014, '-'},    // em dash
+    {0x2015, '-'},    // horizontal bar
+    {0x2018, '\''},   // left single quote
+    {0x2019, '\''},   // right single quote
+    {0x201A, ','},    // low single quote
+    {0x201B, '\''},   // reversed single quote
+    {0x201C, '"'},    // left double quote
+    {0x201D, '"'},    // right double quote
+    {0x201E, '"'},    // low double quote
+    {0x201F, '"'},    // reversed double quote
+    {0x2020, '+'},    // dagger
+    {0x2022, '*'},    // bullet
+    {0x2026, EXPAND}, // ellipsis
+    {0x2030, '%'},    // per mille
+    {0x2032, '\''},   // prime
+    {0x2033, '"'},    // double prime
+    {0x2039, '<'},    // single left angle quote
+    {0x203A, '>'},    // single right angle quote
+    {0x20AC, EXPAND}, // euro
+    {0x2122, EXPAND}, // trade mark
+    {0x2212, '-'},    // minus
+    {0xFEFF, DROP},   // byte order mark
+};
+// }}}
+
+// {{{ expansions
+typedef struct __translit_expansion {
+    uint16_t codepoint;
+    char text[4];
+} TranslitExpansion;
+
+static const TranslitExpansion expansions[] PROGMEM = {
+    {0x00BC, "1/4"},
+    {0x00BD, "1/2"},
+    {0x00BE, "3/4"},
+    {0x00C6, "AE"},
+    {0x00DE, "TH"},
+    {0x00DF, "ss"},
+    {0x00E6, "ae"},
+    {0x00FE, "th"},
+    {0x0132, "IJ"},
+    {0x0133, "ij"},
+    {0x0152, "OE"},
+    {0x0153, "oe"},
+    {0x2026, "..."},
+    {0x20AC, "EUR"},
+    {0x2122, "TM"},
+};
+// }}}
+
+#define COUNT_OF(_a) (sizeof(_a) / sizeof((_a)[0]))
+
+// continuation bytes look like 10xxxxxx
+#define IS_UTF8_CONTINUATION(_c) (((_c) & 0xC0) == 0x80)
+
+// {{{ next_codepoint
+/*
+ * Decodes the character at *p and moves *p past it.  A malformed sequence
+ * only costs its first byte, so what follows is still decoded properly.
+ */
+static uint16_t next_codepoint(const uint8_t **p) {
+    const uint8_t *s = *p;
+    uint8_t lead = *s++;
+    uint8_t extra;
+    uint32_t cp;
+
+    if (lead < 0x80) {
+        *p = s;
+        return lead;
+    }
+    else if ((lead & 0xE0) == 0xC0) {
+        extra = 1;
+        cp = lead & 0x1F;
+    }
+    else if ((lead & 0xF0) == 0xE0) {
+        extra = 2;
+        cp = lead & 0x0F;
+    }
+    else if ((lead & 0xF8) == 0xF0) {
+        extra = 3;
+        cp = lead & 0x07;
+    }
+    else {
+        // a stray continuation byte, or not UTF-8 at all
+        *p = s;
+        return BAD_CODEPOINT;
+    }
+
+    for (uint8_t i = 0; i < extra; i++) {
+        // the nul at the end isn't a continuation byte either
+        if (! IS_UTF8_CONTINUATION(s[i])) {
+            *p += 1;
+            return BAD_CODEPOINT;
+        }
+
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+
+    *p = s + extra;
+
+    // overlong encodings are as bad as anything else
+    if ((cp < 0x80) || ((extra > 1) && (cp < 0x800)) || (cp >= BAD_CODEPOINT)) {
+        return BAD_CODEPOINT;
+    }
+
+    return (uint16_t) cp;
+}
+// }}}
+
+// {{{ stand_in
+// the character to show for cp, DROP or EXPAND
+static char stand_in(uint16_t cp) {
+    if (cp < 0x20) {
+        return ' ';
+    }
+
+    if (cp < 0x7F) {
+        return (char) cp;
+    }
+
+    if ((cp >= LATIN_FIRST) && (cp <= LATIN_LAST)) {
+        return pgm_read_byte(&latin[cp - LATIN_FIRST]);
+    }
+
+    // combining diacritical marks; the letter they go with is already out
+    if ((cp >= 0x0300) && (cp <= 0x036F)) {
+        return DROP;
+    }
+
+    for (uint8_t i = 0; i < COUNT_OF(punctuation); i++) {
+        uint16_t entry = pgm_read_word(&punctuation[i].codepoint);
+
+        if (entry == cp) {
+            return pgm_read_byte(&punctuation[i].c);
+        }
+
+        if (entry > cp) {
+            break;
+        }
+    }
+
+    return TRANSLIT_UNKNOWN;
+}
+// }}}
+
+// {{{ expansion
+static PGM_P expansion(uint16_t cp) {
+    for (uint8_t i = 0; i < COUNT_OF(expansions); i++) {
+        if (pgm_read_word(&expansions[i].codepoint) == cp) {
+            return expansions[i].text;
+        }
+    }
+
+    // can't happen if the tables agree
+    return PSTR("?");
+}
+// }}}
+
+// {{{ translit_utf8
+size_t translit_utf8(char *dest, const char *src, size_t dest_size) {
+    if (dest_size == 0) {
+        return 0;
+    }
+
+    const uint8_t *p = (const uint8_t *) src;
+    size_t len = 0;
+
+    while (*p != '\0') {
+        uint16_t cp = next_codepoint(&p);
+        char c = (cp == BAD_CODEPOINT) ? TRANSLIT_UNKNOWN : stand_in(cp);
+
+        if (c == DROP) {
+            continue;
+        }
+
+        if (c == EXPAND) {
+            PGM_P text = expansion(cp);
+            size_t n = strlen_P(text);
+
+            if ((len + n) >= dest_size) {
+                break;
+            }
+
+            memcpy_P(&dest[len], text, n);
+            len += n;
+        } else {
+            if ((len + 1) >= dest_size) {
+                break;
+            }
+
+            dest[len++] = c;
+        }
+    }
+
+    dest[len] = '\0';
+    return len;
+}
+// }}}
@@ -0,0 +1,31 @@
+#ifndef TRANSLIT_H
+#define TRANSLIT_H
+
+#include <stddef.h>
+
+/*
+ * UTF-8 to the radio's character set, which as far as the captures show is
+ * plain ASCII.
+ *
+ * Latin-1 and Latin Extended-A (U+00A0-U+017F) are looked up directly in a
+ * PROGMEM table of ASCII stand-ins: é is e, ø is o, Ł is L.  A handful of
+ * characters become two or three (ß is ss, Æ is AE, … is ...), and common
+ * punctuation (curly quotes, dashes, bullets) gets its ASCII equivalent.
+ * Combining accents are dropped, so decomposed text comes out the same as
+ * precomposed.  Anything else, and any malformed UTF-8, is '?'.
+ *
+ * Meant to be run once, as metadata arrives, so that what's stored is
+ * ready to be copied straight into frames.
+ */
+
+// what's shown for a character there's nothing better for
+#define TRANSLIT_UNKNOWN '?'
+
+/*
+ * Transliterates src into dest, which holds dest_size bytes including the
+ * nul.  A character that doesn't fit whole is left out, and so is
+ * everything after it.  Returns the length of dest.
+ */
+size_t translit_utf8(char *dest, const char *src, size_t dest_size);
+
+#endif /* end of include guard: TRANSLIT_H */
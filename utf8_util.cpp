@@ -0,0 +1,45 @@
+#include "utf8_util.h"
+
+#include <string.h>
+
+// continuation bytes look like 10xxxxxx
+#define IS_UTF8_CONTINUATION(_c) ((((unsigned char) (_c)) & 0xC0) == 0x80)
+
+// {{{ utf8_fit_len
+size_t utf8_fit_len(const char *src, size_t dest_size) {
+    if (dest_size == 0) {
+        return 0;
+    }
+
+    size_t len = 0;
+
+    while ((src[len] != '\0') && (len < (dest_size - 1))) {
+        len += 1;
+    }
+
+    // src[len] is the first byte that didn't fit; if it's in the middle of
+    // a sequence, so is the cut, so back up to that sequence's lead byte
+    if ((src[len] != '\0') && IS_UTF8_CONTINUATION(src[len])) {
+        while ((len > 0) && IS_UTF8_CONTINUATION(src[len])) {
+            len -= 1;
+        }
+    }
+
+    return len;
+}
+// }}}
+
+// {{{ utf8_strlcpy
+size_t utf8_strlcpy(char *dest, const char *src, size_t dest_size) {
+    if (dest_size == 0) {
+        return 0;
+    }
+
+    size_t len = utf8_fit_len(src, dest_size);
+
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+
+    return len;
+}
+// }}}
@@ -0,0 +1,21 @@
+#ifndef UTF8_UTIL_H
+#define UTF8_UTIL_H
+
+#include <stddef.h>
+
+/*
+ * Returns the number of leading bytes of src that fit in a buffer of
+ * dest_size bytes (leaving room for the nul) without splitting a UTF-8
+ * multi-byte character.
+ */
+size_t utf8_fit_len(const char *src, size_t dest_size);
+
+/*
+ * Copies at most dest_size - 1 bytes of src into dest and nul-terminates
+ * it.  If src has to be truncated, the cut is moved back to the start of
+ * the last whole UTF-8 sequence, so dest never ends with a partial
+ * multi-byte character.  Returns the number of bytes copied.
+ */
+size_t utf8_strlcpy(char *dest, const char *src, size_t dest_size);
+
+#endif /* end of include guard: UTF8_UTIL_H */
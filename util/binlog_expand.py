@@ -0,0 +1,207 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""
+binlog_expand.py
+
+Turns the firmware's binary debug output (see binlog.h) back into text.
+
+    binlog_expand.py ibus_satellite_radio.hex console.log
+    cat /dev/ttyUSB0 | binlog_expand.py ibus_satellite_radio.hex
+
+Messages are sent as the flash address of their string, so the .hex has to
+be the one that's running; anything else gives garbage.  Record types and
+bases are read from binlog.h.  Text the firmware prints straight to the
+console (the trace and probe dumps) is passed through as-is, and the output
+is what the old SoftwareSerial prints would have shown.
+"""
+
+import sys
+import os
+import re
+
+SRC_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# payload sizes and whether they're signed
+VALUE_TYPES = {
+    "U8":  (1, False),
+    "S16": (2, True),
+    "U16": (2, False),
+    "S32": (4, True),
+    "U32": (4, False),
+}
+
+DIGITS = "0123456789ABCDEF"
+
+
+def load_definitions():
+    header = open(os.path.join(SRC_DIR, "binlog.h")).read()
+
+    defs = {}
+
+    for m in re.finditer(r'^#define (BINLOG_\w+)\s+(0x[0-9A-Fa-f]+|\d+)', header, re.M):
+        defs[m.group(1)[len("BINLOG_"):]] = int(m.group(2), 0)
+
+    return defs
+
+
+def load_hex(path):
+    """Returns the flash image in an Intel HEX file as a dict of address to byte."""
+    flash = {}
+    base = 0
+
+    for line in open(path):
+        line = line.strip()
+
+        if not line.startswith(":"):
+            continue
+
+        rec = bytearray.fromhex(line[1:])
+        (count, addr, kind) = (rec[0], (rec[1] << 8) | rec[2], rec[3])
+
+        if kind == 0x00:
+            for i in range(count):
+                flash[base + addr + i] = rec[4 + i]
+        elif kind == 0x02:
+            base = ((rec[4] << 8) | rec[5]) << 4
+        elif kind == 0x04:
+            base = ((rec[4] << 8) | rec[5]) << 16
+        elif kind == 0x01:
+            break
+
+    return flash
+
+
+def flash_string(flash, addr):
+    chars = bytearray()
+
+    while flash.get(addr, 0) != 0:
+        chars.append(flash[addr])
+        addr += 1
+
+    return bytes(chars)
+
+
+def format_number(value, base):
+    """Like Print::printNumber()."""
+    if value == 0:
+        return "0"
+
+    digits = []
+
+    while value > 0:
+        digits.append(DIGITS[value % base])
+        value //= base
+
+    return "".join(reversed(digits))
+
+
+def format_value(value, size, signed, base):
+    if base == 0:
+        # BYTE; just the character
+        return chr(value & 0xFF)
+
+    if signed and (value & (1 << ((size * 8) - 1))):
+        value -= 1 << (size * 8)
+
+    if value < 0:
+        if base == 10:
+            return "-" + format_number(-value, base)
+
+        # Print promotes to unsigned long for the other bases
+        value &= 0xFFFFFFFF
+
+    return format_number(value, base)
+
+
+def read_bytes(f):
+    fd = f.fileno()
+
+    while True:
+        chunk = os.read(fd, 4096)
+
+        if not chunk:
+            return
+
+        for b in bytearray(chunk):
+            yield b
+
+
+def expand(stream, flash, defs, out):
+    types = dict((defs[name], name) for name in
+                 ("NONE", "MESSAGE", "STRING", "DROPPED") + tuple(VALUE_TYPES))
+
+    bases = {
+        defs["BASE_BYTE"]: 0,
+        defs["BASE_DEC"]: 10,
+        defs["BASE_HEX"]: 16,
+        defs["BASE_OCT"]: 8,
+        defs["BASE_BIN"]: 2,
+    }
+
+    def take(n):
+        return bytearray(next(stream) for i in range(n))
+
+    def little_endian(data):
+        return sum(b << (8 * i) for (i, b) in enumerate(data))
+
+    while True:
+        try:
+            b = next(stream)
+        except StopIteration:
+            return
+
+        if b != defs["SYNC"]:
+            out.write(bytearray([b]))
+            continue
+
+        try:
+            tag = next(stream)
+            name = types.get(tag & defs["TYPE_MASK"])
+            text = b""
+
+            if name == "MESSAGE":
+                text = flash_string(flash, little_endian(take(2)))
+            elif name == "STRING":
+                text = bytes(take(next(stream)))
+            elif name == "DROPPED":
+                text = ("[binlog: %d records dropped]\r\n" % next(stream)).encode("latin-1")
+            elif name in VALUE_TYPES:
+                (size, signed) = VALUE_TYPES[name]
+                base = bases.get(tag & defs["BASE_MASK"], 10)
+                text = format_value(little_endian(take(size)), size, signed, base).encode("latin-1")
+            elif name != "NONE":
+                text = ("[binlog: bad tag %02X]" % tag).encode("latin-1")
+        except (StopIteration, RuntimeError):
+            # a record cut off at the end of the capture
+            return
+
+        if tag & defs["NEWLINE"]:
+            text += b"\r\n"
+
+        out.write(text)
+        out.flush()
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write("usage: %s firmware.hex [console.log]\n" % sys.argv[0])
+        return 2
+
+    defs = load_definitions()
+    flash = load_hex(sys.argv[1])
+
+    if len(sys.argv) == 3:
+        f = open(sys.argv[2], "rb")
+    else:
+        f = sys.stdin
+
+    out = getattr(sys.stdout, "buffer", sys.stdout)
+
+    expand(read_bytes(f), flash, defs, out)
+    out.flush()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,115 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""
+navcoder_capture.py
+
+Converts a NavCoder log (doc/logs/NavCoder_Log_*.log) into a compact binary
+capture of the bus traffic, for host/bus_replay.
+
+    navcoder_capture.py NavCoder_Log_20101014_202503.log out.ibc
+
+The capture is the 4-byte magic "IBC1" followed by one record per frame, in
+the order they were logged:
+
+    varint   (ms since the previous record << 1) | garbage
+    uint8    n
+    n bytes  the frame, src through checksum
+
+The varint is little-endian base 128.  garbage is set for bytes NavCoder
+discarded as unparseable ("WARNING: Discarded ..."); they were on the wire
+too.  Timestamps are when NavCoder logged the frame, i.e. shortly after its
+last byte.  Frames with a bad length or checksum are left out.
+"""
+
+import sys
+import re
+import struct
+from datetime import datetime
+
+MAGIC = b"IBC1"
+
+LINE_RE = re.compile(r'^(\d{4}-\d\d-\d\d \d\d:\d\d:\d\d\.\d{3}):  (.*)$')
+HEX_RE = re.compile(r'^[0-9A-F]{2}( [0-9A-F]{2})+$')
+DISCARD_RE = re.compile(r'^WARNING: Discarded \d+ bytes: \[([0-9A-F ]+)\]')
+
+
+def varint(value):
+    out = bytearray()
+
+    while True:
+        b = value & 0x7F
+        value >>= 7
+
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def valid_frame(frame):
+    if (len(frame) < 4) or (frame[1] != len(frame) - 2):
+        return False
+
+    check = 0
+
+    for b in frame[:-1]:
+        check ^= b
+
+    return check == frame[-1]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s navcoder.log out.ibc\n" % sys.argv[0])
+        return 2
+
+    records = []
+    bad = 0
+
+    # NavCoder writes Windows-1252; only the ASCII parts matter
+    for line in open(sys.argv[1], "rb"):
+        m = LINE_RE.match(line.decode("latin-1").rstrip("\r\n"))
+
+        if not m:
+            continue
+
+        when = datetime.strptime(m.group(1), "%Y-%m-%d %H:%M:%S.%f")
+        text = m.group(2).strip()
+
+        if HEX_RE.match(text):
+            frame = bytearray(int(x, 16) for x in text.split())
+
+            if valid_frame(frame):
+                records.append((when, False, frame))
+            else:
+                bad += 1
+
+            continue
+
+        m = DISCARD_RE.match(text)
+
+        if m:
+            records.append((when, True, bytearray(int(x, 16) for x in m.group(1).split())))
+
+    out = open(sys.argv[2], "wb")
+    out.write(MAGIC)
+
+    last = records[0][0] if records else None
+
+    for (when, garbage, data) in records:
+        delta_ms = int(round((when - last).total_seconds() * 1000))
+        last = when
+
+        out.write(varint((delta_ms << 1) | int(garbage)))
+        out.write(struct.pack("B", len(data)))
+        out.write(bytes(data))
+
+    out.close()
+
+    sys.stderr.write("%s: %d records, %d bad frames skipped\n" % (sys.argv[2], len(records), bad))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
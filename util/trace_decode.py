@@ -0,0 +1,138 @@
+#!/usr/bin/env python
+# encoding: utf-8
+"""
+trace_decode.py
+
+Turns the firmware's post-mortem event trace (see trace.h) into a timeline.
+
+    trace_decode.py console.log     # the "[trace] ..." line printed at boot
+    trace_decode.py eeprom.bin      # avrdude -U eeprom:r:eeprom.bin:r
+
+With a console log, the last trace line in it is decoded.  Event types,
+buffer layout and the EEPROM address are read from trace.h, and command and
+mode names from the sketch and iPodWrapper.h, so they can't go stale.
+
+Events are shown oldest first, split into runs at each boot.  Times are
+seconds since that boot (or since the oldest event, if the boot's been
+overwritten), reconstructed from the 16 bits of millis() that are kept; a
+gap of more than 65s between events can't be told from a short one.
+"""
+
+import sys
+import os
+import re
+import struct
+
+SRC_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+MCUSR_BITS = ((0, "power-on"), (1, "external"), (2, "brown-out"), (3, "watchdog"))
+
+RADIO_CMDS = {0x01: "poll", 0x02: "device status ready"}
+
+
+def read_source(name):
+    return open(os.path.join(SRC_DIR, name)).read()
+
+
+def load_definitions():
+    header = read_source("trace.h")
+
+    defs = {}
+    events = {}
+
+    for m in re.finditer(r'^#define (TRACE_\w+)\s+(0x[0-9A-Fa-f]+|\d+)\s*(?://\s*(.*))?$', header, re.M):
+        value = int(m.group(2), 0)
+        defs[m.group(1)] = value
+
+        if m.group(3) is not None:
+            events[value] = (m.group(1)[len("TRACE_"):], m.group(3))
+
+    sdrs_cmds = {}
+
+    for m in re.finditer(r'^#define SDRS_CMD_(\w+)\s+(0x[0-9A-Fa-f]+)', read_source("ibus_satellite_radio.pde"), re.M):
+        sdrs_cmds[int(m.group(2), 16)] = m.group(1)
+
+    m = re.search(r'enum IPodMode \{([^}]*)\}', read_source("iPodWrapper.h"))
+    modes = [x.strip() for x in m.group(1).split(",") if x.strip()]
+
+    return (defs, events, sdrs_cmds, modes)
+
+
+def load_buffer(path, defs):
+    size = 2 + (4 * defs["TRACE_LEN"])
+    data = open(path, "rb").read()
+
+    lines = [l for l in data.decode("latin-1").splitlines() if "[trace] " in l]
+
+    if lines:
+        hex_bytes = lines[-1].split("[trace] ", 1)[1].strip()
+        return bytearray.fromhex(hex_bytes)[:size]
+
+    # an EEPROM image
+    addr = defs["TRACE_EEPROM_ADDR"]
+    return bytearray(data[addr:addr + size])
+
+
+def describe(name, detail, sdrs_cmds, modes):
+    if name == "BOOT":
+        causes = [c for (bit, c) in MCUSR_BITS if detail & (1 << bit)]
+        return "MCUSR %02X (%s)" % (detail, ", ".join(causes) or "no cause")
+
+    if name == "RX":
+        return "%02X %s" % (detail, RADIO_CMDS.get(detail, ""))
+
+    if name == "RX_SDRS_CMD":
+        return "3D %02X %s" % (detail, sdrs_cmds.get(detail, ""))
+
+    if name == "IPOD_MODE":
+        return modes[detail] if detail < len(modes) else "%d" % detail
+
+    return "%02X" % detail
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("usage: %s console.log|eeprom.bin\n" % sys.argv[0])
+        return 2
+
+    (defs, events, sdrs_cmds, modes) = load_definitions()
+    buf = load_buffer(sys.argv[1], defs)
+    trace_len = defs["TRACE_LEN"]
+
+    if (len(buf) < 2 + (4 * trace_len)) or (buf[0] != defs["TRACE_MAGIC"]):
+        sys.stderr.write("%s: no valid trace found\n" % sys.argv[1])
+        return 1
+
+    head = buf[1]
+
+    # oldest first; slots never written are all zeros
+    records = []
+
+    for i in range(trace_len):
+        slot = (head + i) % trace_len
+        (ms, kind, detail) = struct.unpack_from("<HBB", bytes(buf), 2 + (4 * slot))
+
+        if kind != 0:
+            records.append((ms, kind, detail))
+
+    last_ms = None
+    elapsed = 0
+
+    for (ms, kind, detail) in records:
+        (name, comment) = events.get(kind, ("%02X?" % kind, "unknown event"))
+
+        if name == "BOOT":
+            print("---- boot ----")
+            elapsed = ms
+        elif last_ms is not None:
+            elapsed += (ms - last_ms) & 0xFFFF
+
+        last_ms = ms
+
+        print("%10.3f s  %-14s %s" % (elapsed / 1000.0, name, describe(name, detail, sdrs_cmds, modes)))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())